@@ -18,6 +18,8 @@ struct CameraInfo {
     CameraFrustum Frustum;
     float4x4 ViewProj;
     float4 HZBSizeScale;
+    uint NumClusters;
+    uint3 Padding;
 };
 
 struct AABBData {
@@ -110,9 +112,9 @@ uint FrustumTestAABB(CameraFrustum frustum, float3 aabbMin, float3 aabbMax) {
 #include "Common.hlsli"
 
 // return ndc position, xyz in [0, 1]
-float4 TransformToNDC(float4 pos)
+float4 TransformToNDC(float4 clipPos)
 {
-    float4 ndcPos = mul(uParams.ViewProj, pos);
+    float4 ndcPos = clipPos;
     ndcPos.xyz /= ndcPos.w;
     ndcPos.xy = ndcPos.xy * 0.5f + 0.5f;
     return ndcPos;
@@ -136,39 +138,44 @@ bool OcclusionTestAABB(float3 aabbMin, float3 aabbMax) {
 
     [unroll]
     for (uint i = 0; i < 8; ++i) {
-        const float4 cornerNdc = TransformToNDC(corners[i]);
+        const float4 cornerClip = mul(uParams.ViewProj, corners[i]);
+        // crossing the near plane
+        if (cornerClip.z < 0.0f) {
+            return true;
+        }
+        const float4 cornerNdc = TransformToNDC(cornerClip);
         cornerNdcMin = min(cornerNdcMin, cornerNdc.xyz);
         cornerNdcMax = max(cornerNdcMax, cornerNdc.xyz);
     }
 
-    // y-down in texture
-    cornerNdcMin.y = 1.0f - cornerNdcMin.y;
-    cornerNdcMax.y = 1.0f - cornerNdcMax.y;
+    // y-down in texture, the max y of ndc is the min y of texture
+    float2 rectMin = float2(cornerNdcMin.x, 1.0f - cornerNdcMax.y);
+    float2 rectMax = float2(cornerNdcMax.x, 1.0f - cornerNdcMin.y);
     // scale to actual size
-    cornerNdcMin.xy *= uParams.HZBSizeScale.xy;
-    cornerNdcMax.xy *= uParams.HZBSizeScale.xy;
+    rectMin *= uParams.HZBSizeScale.xy;
+    rectMax *= uParams.HZBSizeScale.xy;
 
-    float2 rectSize = cornerNdcMax - cornerNdcMin;
+    float2 rectSize = rectMax - rectMin;
     uint2 hzbSize;
     uint hzbMipSize;
     uHZB.GetDimensions(0, hzbSize.x, hzbSize.y, hzbMipSize);
-    hzbSize.xy *= uParams.HZBSizeScale.xy;
 
     // too big to cull
     if (max(rectSize.x, rectSize.y) > 1.0f){
 	    return true;
     }
     
-    // select mip level
-    float2 numRectPixelsXY = hzbSize.xy * rectSize.xy;
+    // select the mip where the rect covers 2x2 texels at most
+    float2 numRectPixelsXY = (float2)hzbSize.xy * rectSize.xy;
     float numRectPixels = max(numRectPixelsXY.x, numRectPixelsXY.y);
-    float mipLevel = ceil(log2(numRectPixels));
-    mipLevel = min(mipLevel, float(hzbMipSize));
+    float mipLevel = ceil(log2(max(numRectPixels, 1.0f)));
+    mipLevel = min(mipLevel, float(hzbMipSize - 1));
 
-    // depth of center are compared with hzb
+    // closest depth of the aabb is compared with the furthest depth of the 2x2 texels
     float closerDepth = CloserDepth(cornerNdcMin.z, cornerNdcMax.z);
-    float2 texCoord = 0.5f * (cornerNdcMin.xy + cornerNdcMax.xy);
-    float hzbDepth = uHZB.SampleLevel(uSampler, texCoord, mipLevel);
+    float hzbDepth = FurtherDepth(
+        FurtherDepth(uHZB.SampleLevel(uSampler, rectMin, mipLevel), uHZB.SampleLevel(uSampler, float2(rectMax.x, rectMin.y), mipLevel)),
+        FurtherDepth(uHZB.SampleLevel(uSampler, float2(rectMin.x, rectMax.y), mipLevel), uHZB.SampleLevel(uSampler, rectMax, mipLevel)));
     return IsDepthCloserOrEqual(closerDepth, hzbDepth);
 }
 #endif
@@ -190,6 +197,9 @@ uint VisibleTestAABB(float3 aabbMin, float3 aabbMax){
 [numthreads(NUM_THREAD_PER_GROUP, 1, 1)]
 void MainCS(uint3 tid : SV_DispatchThreadID){
     uint tIndex = tid.x;
+    if (tIndex >= uParams.NumClusters) {
+        return;
+    }
     ClusterData cluster = uClusterData[tIndex];
 
     AABBData clusterRange = uClusterAABBs[cluster.ClusterIndex];
@@ -208,12 +218,14 @@ void MainCS(uint3 tid : SV_DispatchThreadID){
         // cluster in frustum, write all instances in the cluster to result
         if(TEST_RESULT_INNER == testResult) {
             const uint instanceCount = instanceEnd - instanceStart;
+            // write index is decided by the first primitive, the others only count
             uint instanceWriteIndex = 0;
+            InterlockedAdd(uIndirectDrawCmds[cluster.PrimitiveStart].InstanceCount, instanceCount, instanceWriteIndex);
 
         	[loop]
-            for (uint i = 0; i < cluster.PrimitiveCount; ++i) {
+            for (uint i = 1; i < cluster.PrimitiveCount; ++i) {
                 const uint primitiveIndex = cluster.PrimitiveStart + i;
-                InterlockedAdd(uIndirectDrawCmds[primitiveIndex].InstanceCount, instanceCount, instanceWriteIndex);
+                InterlockedAdd(uIndirectDrawCmds[primitiveIndex].InstanceCount, instanceCount);
             }
 
             [loop]
@@ -229,7 +241,7 @@ void MainCS(uint3 tid : SV_DispatchThreadID){
 	[unroll]
     for (uint i = 0; i < NUM_INSTANCE_PER_CLUSTER; ++i){
         const uint instanceIndex = instanceStart + i;
-        if (instanceIndex > instanceEnd){
+        if (instanceIndex >= instanceEnd){
             return;
         }
         const uint globalInstanceIndex = instanceIndex + cluster.SrcInstanceOffset;
@@ -238,10 +250,11 @@ void MainCS(uint3 tid : SV_DispatchThreadID){
 
         if (TEST_RESULT_OUTER != testResult) {
             uint instanceWriteIndex = 0;
+            InterlockedAdd(uIndirectDrawCmds[cluster.PrimitiveStart].InstanceCount, 1, instanceWriteIndex);
 			[loop]
-            for (uint j = 0; j < cluster.PrimitiveCount; ++j){
+            for (uint j = 1; j < cluster.PrimitiveCount; ++j){
                 const uint primitiveIndex = cluster.PrimitiveStart + j;
-                InterlockedAdd(uIndirectDrawCmds[primitiveIndex].InstanceCount, 1, instanceWriteIndex);
+                InterlockedAdd(uIndirectDrawCmds[primitiveIndex].InstanceCount, 1);
             }
             uInstanceIDs[cluster.DstInstanceOffset + instanceWriteIndex] = instanceIndex;
             //uInstanceIDs.Store(cache.InstanceStart + instanceWriteIndex, instanceIndex);
@@ -0,0 +1,40 @@
+#include "Core/Public/FrameAllocator.h"
+#include "Core/Public/LinearAllocator.h"
+#include <atomic>
+
+namespace {
+	std::atomic<uint64> s_FrameIndex{ 0 };
+
+	struct ThreadFrameAllocators {
+		LinearAllocator Allocators[2];
+		uint64 FrameIndex{ 0 };
+		LinearAllocator& Get() {
+			const uint64 CurrentFrame = s_FrameIndex.load(std::memory_order_relaxed);
+			LinearAllocator& Allocator = Allocators[CurrentFrame & 1];
+			if(FrameIndex != CurrentFrame) {
+				// The allocator was used 2 or more frames ago, rewind it lazily on the owner thread.
+				Allocator.Reset();
+				FrameIndex = CurrentFrame;
+			}
+			return Allocator;
+		}
+	};
+
+	thread_local ThreadFrameAllocators t_FrameAllocators;
+}
+
+void FrameAllocator::BeginFrame() {
+	s_FrameIndex.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64 FrameAllocator::GetFrameIndex() {
+	return s_FrameIndex.load(std::memory_order_relaxed);
+}
+
+void* FrameAllocator::Allocate(uint64 Size, uint64 Alignment) {
+	return t_FrameAllocators.Get().Allocate(Size, Alignment);
+}
+
+uint64 FrameAllocator::GetUsedSize() {
+	return t_FrameAllocators.Get().GetUsedSize();
+}
@@ -0,0 +1,82 @@
+#include "Core/Public/LinearAllocator.h"
+
+inline uint64 AlignUp(uint64 Value, uint64 Alignment) {
+	return (Value + Alignment - 1) & ~(Alignment - 1);
+}
+
+LinearAllocator::LinearAllocator(uint64 BlockSize) : m_BlockSize(BlockSize), m_CurrentBlock(0), m_Offset(0), m_UsedSize(0) {
+}
+
+LinearAllocator::LinearAllocator(LinearAllocator&& rhs) noexcept : m_Blocks(MoveTemp(rhs.m_Blocks)), m_BlockSize(rhs.m_BlockSize),
+m_CurrentBlock(rhs.m_CurrentBlock), m_Offset(rhs.m_Offset), m_UsedSize(rhs.m_UsedSize) {
+	rhs.m_Blocks.Reset();
+	rhs.m_CurrentBlock = 0;
+	rhs.m_Offset = 0;
+	rhs.m_UsedSize = 0;
+}
+
+LinearAllocator& LinearAllocator::operator=(LinearAllocator&& rhs) noexcept {
+	if(this != &rhs) {
+		Release();
+		m_Blocks = MoveTemp(rhs.m_Blocks);
+		m_BlockSize = rhs.m_BlockSize;
+		m_CurrentBlock = rhs.m_CurrentBlock;
+		m_Offset = rhs.m_Offset;
+		m_UsedSize = rhs.m_UsedSize;
+		rhs.m_Blocks.Reset();
+		rhs.m_CurrentBlock = 0;
+		rhs.m_Offset = 0;
+		rhs.m_UsedSize = 0;
+	}
+	return *this;
+}
+
+LinearAllocator::~LinearAllocator() {
+	Release();
+}
+
+void* LinearAllocator::Allocate(uint64 Size, uint64 Alignment) {
+	// Try current block, then the following blocks kept by previous Reset.
+	while(m_CurrentBlock < m_Blocks.Size()) {
+		Block& CurBlock = m_Blocks[m_CurrentBlock];
+		const uint64 Start = AlignUp((uint64)CurBlock.Data + m_Offset, Alignment) - (uint64)CurBlock.Data;
+		if(Start + Size <= CurBlock.Size) {
+			m_UsedSize += Start + Size - m_Offset;
+			m_Offset = Start + Size;
+			return CurBlock.Data + Start;
+		}
+		++m_CurrentBlock;
+		m_Offset = 0;
+	}
+	// Allocate a new block, large allocation gets a dedicated one.
+	const uint64 NewBlockSize = NUM_MAX(m_BlockSize, Size + Alignment);
+	Block NewBlock{ new uint8[NewBlockSize], NewBlockSize };
+	m_Blocks.PushBack(NewBlock);
+	m_CurrentBlock = m_Blocks.Size() - 1;
+	const uint64 Start = AlignUp((uint64)NewBlock.Data, Alignment) - (uint64)NewBlock.Data;
+	m_Offset = Start + Size;
+	m_UsedSize += m_Offset;
+	return NewBlock.Data + Start;
+}
+
+void LinearAllocator::Reset() {
+	m_CurrentBlock = 0;
+	m_Offset = 0;
+	m_UsedSize = 0;
+}
+
+void LinearAllocator::Release() {
+	for(Block& B: m_Blocks) {
+		delete[] B.Data;
+	}
+	m_Blocks.Reset();
+	Reset();
+}
+
+uint64 LinearAllocator::GetReservedSize() const {
+	uint64 Size = 0;
+	for(const Block& B: m_Blocks) {
+		Size += B.Size;
+	}
+	return Size;
+}
@@ -49,7 +49,7 @@ struct TEnumFlag {
 	void RemoveFlag(Enum e) {
 		Value = Value & ~(1 << (UnderlyingType)e);
 	}
-	bool HasFlag(Enum e) {
+	bool HasFlag(Enum e) const {
 		return (Value & (1 << (UnderlyingType)e)) != 0;
 	}
 
@@ -0,0 +1,36 @@
+#pragma once
+#include "Core/Public/Defines.h"
+#include "Core/Public/TArray.h"
+#include <cstddef>
+
+// Per-thread bump allocator for frame-temporary data.
+// Every thread owns two LinearAllocators used in alternate frames, so memory allocated in a frame keeps valid during the next frame.
+class FrameAllocator {
+public:
+	// Advance the frame, called by game thread at the beginning of each frame.
+	static void BeginFrame();
+	static uint64 GetFrameIndex();
+	// Allocate from the calling thread's allocator, the memory is reclaimed 2 frames later.
+	static void* Allocate(uint64 Size, uint64 Alignment = alignof(std::max_align_t));
+	// Bytes allocated by the calling thread in current frame.
+	static uint64 GetUsedSize();
+};
+
+// STL allocator adaptor of FrameAllocator, deallocation is a no-op.
+template<class T>
+class TFrameAllocator {
+public:
+	typedef T value_type;
+	TFrameAllocator() noexcept = default;
+	template<class U> TFrameAllocator(const TFrameAllocator<U>&) noexcept {}
+	T* allocate(size_t Num) {
+		return (T*)FrameAllocator::Allocate(Num * sizeof(T), alignof(T));
+	}
+	void deallocate(T*, size_t) noexcept {}
+	template<class U> bool operator==(const TFrameAllocator<U>&) const noexcept { return true; }
+	template<class U> bool operator!=(const TFrameAllocator<U>&) const noexcept { return false; }
+};
+
+// Array for frame-temporary data, do not keep it across frames.
+template<class T>
+using TFrameArray = TArray<T, TFrameAllocator<T>>;
@@ -0,0 +1,54 @@
+#pragma once
+#include "Core/Public/Defines.h"
+#include "Core/Public/TArray.h"
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// A bump allocator over a chain of memory blocks.
+// Memory is not freed one by one, call Reset to rewind and reuse all blocks, destructors are not called.
+class LinearAllocator {
+public:
+	static constexpr uint64 DEFAULT_BLOCK_SIZE = 64 * 1024;
+	NON_COPYABLE(LinearAllocator);
+	explicit LinearAllocator(uint64 BlockSize = DEFAULT_BLOCK_SIZE);
+	LinearAllocator(LinearAllocator&& rhs) noexcept;
+	LinearAllocator& operator=(LinearAllocator&& rhs) noexcept;
+	~LinearAllocator();
+
+	void* Allocate(uint64 Size, uint64 Alignment = alignof(std::max_align_t));
+
+	template<class T, class ...Args>
+	T* New(Args&&... InArgs) {
+		return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(InArgs)...);
+	}
+
+	template<class T>
+	T* NewArray(uint64 Num) {
+		T* Data = (T*)Allocate(sizeof(T) * Num, alignof(T));
+		for(uint64 i = 0; i < Num; ++i) {
+			new (Data + i) T();
+		}
+		return Data;
+	}
+
+	// Rewind to the beginning, blocks are kept for reusing.
+	void Reset();
+	// Free all blocks.
+	void Release();
+	// Bytes allocated since last Reset, including alignment padding.
+	uint64 GetUsedSize() const { return m_UsedSize; }
+	// Bytes of all blocks.
+	uint64 GetReservedSize() const;
+
+private:
+	struct Block {
+		uint8* Data;
+		uint64 Size;
+	};
+	TArray<Block> m_Blocks;
+	uint64 m_BlockSize;
+	uint32 m_CurrentBlock;
+	uint64 m_Offset;
+	uint64 m_UsedSize;
+};
@@ -447,10 +447,10 @@ private:
 template<uint32 L> using TStaticBitArray = TStaticArray<bool, L>;
 
 // A dynamic array derived from std::vector.
-template <class T>
-class TArray : private std::vector<T> {
+template <class T, class Allocator = std::allocator<T>>
+class TArray : private std::vector<T, Allocator> {
 private:
-	typedef std::vector<T> Base;
+	typedef std::vector<T, Allocator> Base;
 public:
 	TArray() : Base() {}
 
@@ -0,0 +1,241 @@
+#include "Math/Public/FrustumCulling.h"
+#include "Math/Public/MathBase.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CULLING_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define CULLING_X86 0
+#endif
+
+// gcc and clang need the target attribute to emit instructions beyond the compile flags, msvc emits intrinsics directly.
+#if CULLING_X86 && !defined(_MSC_VER)
+#define CULLING_TARGET(x) __attribute__((target(x)))
+#else
+#define CULLING_TARGET(x)
+#endif
+
+namespace {
+	// Plane in the form of dot(n, c) - d >= -dot(|n|, e), parameters are loaded once per batch.
+	struct CullingPlane {
+		float NX, NY, NZ, D;
+		float AbsNX, AbsNY, AbsNZ;
+	};
+
+	struct CullingPlanes {
+		CullingPlane Planes[6];
+		CullingPlanes() = default;
+		explicit CullingPlanes(const Math::Frustum& frustum) {
+			const Math::Plane* srcPlanes[6] = { &frustum.Near, &frustum.Far, &frustum.Left, &frustum.Right, &frustum.Bottom, &frustum.Top };
+			for(int i = 0; i < 6; ++i) {
+				const Math::Plane& src = *srcPlanes[i];
+				Planes[i] = { src.Normal.X, src.Normal.Y, src.Normal.Z, src.Distance, Math::FAbs(src.Normal.X), Math::FAbs(src.Normal.Y), Math::FAbs(src.Normal.Z) };
+			}
+		}
+	};
+
+	inline bool TestAABBScalar(const CullingPlanes& planes, const Math::AABB3Streams& aabbs, unsigned int i) {
+		for(const CullingPlane& p: planes.Planes) {
+			const float distance = p.NX * aabbs.CenterX[i] + p.NY * aabbs.CenterY[i] + p.NZ * aabbs.CenterZ[i] - p.D;
+			const float radius = p.AbsNX * aabbs.ExtentX[i] + p.AbsNY * aabbs.ExtentY[i] + p.AbsNZ * aabbs.ExtentZ[i];
+			if(distance < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Write every lane and advance by its visibility, no branch per box.
+	inline unsigned int CompactIndices(unsigned int visibleMask, unsigned int numLanes, unsigned int base, unsigned int* outIndices, unsigned int count) {
+		for(unsigned int lane = 0; lane < numLanes; ++lane) {
+			outIndices[count] = base + lane;
+			count += (visibleMask >> lane) & 1u;
+		}
+		return count;
+	}
+
+	unsigned int CullScalar(const CullingPlanes& planes, const Math::AABB3Streams& aabbs, unsigned int start, unsigned int* outIndices, unsigned int count) {
+		for(unsigned int i = start; i < aabbs.Num; ++i) {
+			outIndices[count] = i;
+			count += TestAABBScalar(planes, aabbs, i) ? 1u : 0u;
+		}
+		return count;
+	}
+
+	void CullMultiViewScalar(const CullingPlanes* viewPlanes, unsigned int numViews, const Math::AABB3Streams& aabbs, unsigned int start, unsigned int* outViewMasks) {
+		for(unsigned int i = start; i < aabbs.Num; ++i) {
+			unsigned int viewMask = 0;
+			for(unsigned int v = 0; v < numViews; ++v) {
+				viewMask |= (TestAABBScalar(viewPlanes[v], aabbs, i) ? 1u : 0u) << v;
+			}
+			outViewMasks[i] = viewMask;
+		}
+	}
+
+	// Scatter a lane mask of a view into the view masks of the lanes.
+	inline void AddViewBits(unsigned int laneMask, unsigned int numLanes, unsigned int view, unsigned int* outViewMasks) {
+		for(unsigned int lane = 0; lane < numLanes; ++lane) {
+			outViewMasks[lane] |= ((laneMask >> lane) & 1u) << view;
+		}
+	}
+
+#if CULLING_X86
+	struct SSEBoxes {
+		__m128 CX, CY, CZ, EX, EY, EZ;
+		SSEBoxes(const Math::AABB3Streams& aabbs, unsigned int i) :
+			CX(_mm_loadu_ps(aabbs.CenterX + i)), CY(_mm_loadu_ps(aabbs.CenterY + i)), CZ(_mm_loadu_ps(aabbs.CenterZ + i)),
+			EX(_mm_loadu_ps(aabbs.ExtentX + i)), EY(_mm_loadu_ps(aabbs.ExtentY + i)), EZ(_mm_loadu_ps(aabbs.ExtentZ + i)) {}
+	};
+
+	inline unsigned int TestPlanesSSE(const CullingPlanes& planes, const SSEBoxes& boxes) {
+		__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for(const CullingPlane& p: planes.Planes) {
+			const __m128 distance = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.NX), boxes.CX), _mm_mul_ps(_mm_set1_ps(p.NY), boxes.CY)), _mm_mul_ps(_mm_set1_ps(p.NZ), boxes.CZ)), _mm_set1_ps(p.D));
+			const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.AbsNX), boxes.EX), _mm_mul_ps(_mm_set1_ps(p.AbsNY), boxes.EY)), _mm_mul_ps(_mm_set1_ps(p.AbsNZ), boxes.EZ));
+			visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		return (unsigned int)_mm_movemask_ps(visible);
+	}
+
+	unsigned int CullSSE(const CullingPlanes& planes, const Math::AABB3Streams& aabbs, unsigned int* outIndices) {
+		unsigned int count = 0;
+		unsigned int i = 0;
+		for(; i + 4 <= aabbs.Num; i += 4) {
+			count = CompactIndices(TestPlanesSSE(planes, SSEBoxes(aabbs, i)), 4, i, outIndices, count);
+		}
+		return CullScalar(planes, aabbs, i, outIndices, count);
+	}
+
+	void CullMultiViewSSE(const CullingPlanes* viewPlanes, unsigned int numViews, const Math::AABB3Streams& aabbs, unsigned int* outViewMasks) {
+		unsigned int i = 0;
+		for(; i + 4 <= aabbs.Num; i += 4) {
+			const SSEBoxes boxes(aabbs, i);
+			unsigned int* laneMasks = outViewMasks + i;
+			laneMasks[0] = laneMasks[1] = laneMasks[2] = laneMasks[3] = 0;
+			for(unsigned int v = 0; v < numViews; ++v) {
+				AddViewBits(TestPlanesSSE(viewPlanes[v], boxes), 4, v, laneMasks);
+			}
+		}
+		CullMultiViewScalar(viewPlanes, numViews, aabbs, i, outViewMasks);
+	}
+
+	struct AVXBoxes {
+		__m256 CX, CY, CZ, EX, EY, EZ;
+		CULLING_TARGET("avx") AVXBoxes(const Math::AABB3Streams& aabbs, unsigned int i) :
+			CX(_mm256_loadu_ps(aabbs.CenterX + i)), CY(_mm256_loadu_ps(aabbs.CenterY + i)), CZ(_mm256_loadu_ps(aabbs.CenterZ + i)),
+			EX(_mm256_loadu_ps(aabbs.ExtentX + i)), EY(_mm256_loadu_ps(aabbs.ExtentY + i)), EZ(_mm256_loadu_ps(aabbs.ExtentZ + i)) {}
+	};
+
+	CULLING_TARGET("avx")
+	inline unsigned int TestPlanesAVX(const CullingPlanes& planes, const AVXBoxes& boxes) {
+		__m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for(const CullingPlane& p: planes.Planes) {
+			const __m256 distance = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.NX), boxes.CX), _mm256_mul_ps(_mm256_set1_ps(p.NY), boxes.CY)), _mm256_mul_ps(_mm256_set1_ps(p.NZ), boxes.CZ)), _mm256_set1_ps(p.D));
+			const __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.AbsNX), boxes.EX), _mm256_mul_ps(_mm256_set1_ps(p.AbsNY), boxes.EY)), _mm256_mul_ps(_mm256_set1_ps(p.AbsNZ), boxes.EZ));
+			visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		return (unsigned int)_mm256_movemask_ps(visible);
+	}
+
+	CULLING_TARGET("avx")
+	unsigned int CullAVX(const CullingPlanes& planes, const Math::AABB3Streams& aabbs, unsigned int* outIndices) {
+		unsigned int count = 0;
+		unsigned int i = 0;
+		for(; i + 8 <= aabbs.Num; i += 8) {
+			count = CompactIndices(TestPlanesAVX(planes, AVXBoxes(aabbs, i)), 8, i, outIndices, count);
+		}
+		return CullScalar(planes, aabbs, i, outIndices, count);
+	}
+
+	CULLING_TARGET("avx")
+	void CullMultiViewAVX(const CullingPlanes* viewPlanes, unsigned int numViews, const Math::AABB3Streams& aabbs, unsigned int* outViewMasks) {
+		unsigned int i = 0;
+		for(; i + 8 <= aabbs.Num; i += 8) {
+			const AVXBoxes boxes(aabbs, i);
+			unsigned int* laneMasks = outViewMasks + i;
+			for(unsigned int lane = 0; lane < 8; ++lane) {
+				laneMasks[lane] = 0;
+			}
+			for(unsigned int v = 0; v < numViews; ++v) {
+				AddViewBits(TestPlanesAVX(viewPlanes[v], boxes), 8, v, laneMasks);
+			}
+		}
+		CullMultiViewScalar(viewPlanes, numViews, aabbs, i, outViewMasks);
+	}
+
+	bool IsAVXSupported() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		const bool bOSXSave = info[2] & (1 << 27);
+		const bool bAVX = info[2] & (1 << 28);
+		// the os must save ymm registers on context switch
+		return bOSXSave && bAVX && (_xgetbv(0) & 6) == 6;
+#else
+		return __builtin_cpu_supports("avx");
+#endif
+	}
+#endif
+
+	Math::ECullingKernel DetectCullingKernel() {
+#if CULLING_X86
+		return IsAVXSupported() ? Math::ECullingKernel::AVX : Math::ECullingKernel::SSE;
+#else
+		return Math::ECullingKernel::Scalar;
+#endif
+	}
+}
+
+namespace Math {
+	AABB3Streams AABB3Streams::Offset(unsigned int start, unsigned int num) const {
+		return { CenterX + start, CenterY + start, CenterZ + start, ExtentX + start, ExtentY + start, ExtentZ + start, num };
+	}
+
+	ECullingKernel GetSupportedCullingKernel() {
+		static const ECullingKernel s_Kernel = DetectCullingKernel();
+		return s_Kernel;
+	}
+
+	unsigned int CullAABBs(const Frustum& frustum, const AABB3Streams& aabbs, unsigned int* outIndices, ECullingKernel kernel) {
+		const CullingPlanes planes(frustum);
+		if(ECullingKernel::Auto == kernel) {
+			kernel = GetSupportedCullingKernel();
+		}
+		switch(kernel) {
+#if CULLING_X86
+		case ECullingKernel::AVX:
+			return CullAVX(planes, aabbs, outIndices);
+		case ECullingKernel::SSE:
+			return CullSSE(planes, aabbs, outIndices);
+#endif
+		default:
+			return CullScalar(planes, aabbs, 0, outIndices, 0);
+		}
+	}
+
+	void CullAABBsMultiView(const Frustum* frustums, unsigned int numFrustums, const AABB3Streams& aabbs, unsigned int* outViewMasks, ECullingKernel kernel) {
+		CullingPlanes viewPlanes[MAX_CULLING_VIEWS];
+		numFrustums = Min(numFrustums, MAX_CULLING_VIEWS);
+		for(unsigned int v = 0; v < numFrustums; ++v) {
+			viewPlanes[v] = CullingPlanes(frustums[v]);
+		}
+		if(ECullingKernel::Auto == kernel) {
+			kernel = GetSupportedCullingKernel();
+		}
+		switch(kernel) {
+#if CULLING_X86
+		case ECullingKernel::AVX:
+			CullMultiViewAVX(viewPlanes, numFrustums, aabbs, outViewMasks);
+			break;
+		case ECullingKernel::SSE:
+			CullMultiViewSSE(viewPlanes, numFrustums, aabbs, outViewMasks);
+			break;
+#endif
+		default:
+			CullMultiViewScalar(viewPlanes, numFrustums, aabbs, 0, outViewMasks);
+			break;
+		}
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "Geometry.h"
+
+namespace Math {
+	// Center and extent streams of AABBs (SoA), each stream has Num floats.
+	struct AABB3Streams {
+		const float* CenterX;
+		const float* CenterY;
+		const float* CenterZ;
+		const float* ExtentX;
+		const float* ExtentY;
+		const float* ExtentZ;
+		unsigned int Num;
+		AABB3Streams Offset(unsigned int start, unsigned int num) const;
+	};
+
+	// Owning SoA storage, Container is a float array with PushBack/Reserve/Reset/Size/Data, such as TArray<float>.
+	template<class Container> struct TAABB3SoA {
+		Container CenterX, CenterY, CenterZ, ExtentX, ExtentY, ExtentZ;
+		unsigned int Size() const { return (unsigned int)CenterX.Size(); }
+		void Reserve(unsigned int num) {
+			CenterX.Reserve(num); CenterY.Reserve(num); CenterZ.Reserve(num);
+			ExtentX.Reserve(num); ExtentY.Reserve(num); ExtentZ.Reserve(num);
+		}
+		void Reset() {
+			CenterX.Reset(); CenterY.Reset(); CenterZ.Reset();
+			ExtentX.Reset(); ExtentY.Reset(); ExtentZ.Reset();
+		}
+		void PushBack(const AABB3& aabb) {
+			const FVector3 center = aabb.Center();
+			const FVector3 extent = aabb.Extent();
+			CenterX.PushBack(center.X); CenterY.PushBack(center.Y); CenterZ.PushBack(center.Z);
+			ExtentX.PushBack(extent.X); ExtentY.PushBack(extent.Y); ExtentZ.PushBack(extent.Z);
+		}
+		void Set(unsigned int index, const AABB3& aabb) {
+			const FVector3 center = aabb.Center();
+			const FVector3 extent = aabb.Extent();
+			CenterX[index] = center.X; CenterY[index] = center.Y; CenterZ[index] = center.Z;
+			ExtentX[index] = extent.X; ExtentY[index] = extent.Y; ExtentZ[index] = extent.Z;
+		}
+		AABB3Streams GetStreams() const {
+			return { CenterX.Data(), CenterY.Data(), CenterZ.Data(), ExtentX.Data(), ExtentY.Data(), ExtentZ.Data(), Size() };
+		}
+	};
+
+	enum class ECullingKernel : unsigned char {
+		Scalar = 0,
+		SSE,  // 4 boxes per iteration
+		AVX,  // 8 boxes per iteration
+		Auto  // the widest kernel supported by the cpu, detected once
+	};
+
+	ECullingKernel GetSupportedCullingKernel();
+
+	// Batch version of Frustum::TestAABBSimple, writes the indices of visible AABBs in ascending order and returns the count.
+	// outIndices must have room for aabbs.Num indices, the entries after the count may be overwritten.
+	// An explicit kernel must be supported by the cpu, it is for comparing kernels.
+	unsigned int CullAABBs(const Frustum& frustum, const AABB3Streams& aabbs, unsigned int* outIndices, ECullingKernel kernel = ECullingKernel::Auto);
+
+	constexpr unsigned int MAX_CULLING_VIEWS = 32;
+
+	// Test each AABB against all frustums while it is loaded, bit v of outViewMasks[i] is set if AABB i is visible in frustums[v].
+	// outViewMasks must have room for aabbs.Num masks, frustums over MAX_CULLING_VIEWS are ignored.
+	void CullAABBsMultiView(const Frustum* frustums, unsigned int numFrustums, const AABB3Streams& aabbs, unsigned int* outViewMasks, ECullingKernel kernel = ECullingKernel::Auto);
+}
@@ -28,6 +28,10 @@ namespace Editor {
 		if (ImGui::Checkbox("Cast Shadow", &castShadow)) {
 			com->SetCastShadow(castShadow);
 		}
+		bool occluder = com->GetOccluder();
+		if (ImGui::Checkbox("Occluder", &occluder)) {
+			com->SetOccluder(occluder);
+		}
 	}
 	REGISTER_LEVEL_EDIT_OnGUI(Object::MeshComponent, MeshGUI);
 
@@ -163,11 +163,21 @@ namespace Editor {
 		if(!nodes.Size()) {
 			return;
 		}
+		constexpr double toMB = 1.0 / (1024.0 * 1024.0);
+		ImGui::Text("Transient textures: allocated %.2f MB, peak %.2f MB, naive %.2f MB",
+			rgView.TransientAllocatedSize * toMB, rgView.TransientPeakSize * toMB, rgView.TransientNaiveSize * toMB);
+		ImGui::Text("Queue plan (simulated, all passes run on graphics): %u batches, %u sync points, time %llu of serial %llu",
+			rgView.NumQueueBatches, rgView.NumSyncPoints, (unsigned long long)rgView.ScheduledTime, (unsigned long long)rgView.SerialTime);
+		ImGui::Text("Barriers: %u transitions, %u split", rgView.NumTransitions, rgView.NumSplitTransitions);
 		// check and rebuild data
 		const bool needRebuild = UINT32_MAX == m_UpdateFrame || m_UpdateFrame < rgView.UpdateFrame;
 		if (needRebuild) {
 			m_NodePins.Reset(); m_NodePins.Resize(nodes.Size(), { -1, -1 });
 			m_NodeLines.Reset();
+			m_NodeSteps.Reset(); m_NodeSteps.Resize(nodes.Size(), INVALID_INDEX);
+			for (uint32 i = 0; i < rgView.ExecuteOrder.Size(); ++i) {
+				m_NodeSteps[rgView.ExecuteOrder[i]] = i;
+			}
 			if (nodes.Size()) {
 				TArray<bool> visited(nodes.Size(), false);
 				int uniqueID = 0;
@@ -196,6 +206,9 @@ namespace Editor {
 				cornerBounding = 0.0f;
 				bgColor = { 4,4,32,255 };
 			}
+			if (node.IsCulled) {
+				bgColor = { 24,24,24,255 };
+			}
 			if (ImNodes::IsNodeSelected(nodeID)) {
 				borderThickness = 4.0f;
 				outlineColor = { 128, 72, 0, 255 };
@@ -213,6 +226,20 @@ namespace Editor {
 
 			ImNodes::BeginNode(nodeID);
 			ImGui::TextUnformatted(node.Name.c_str());
+			if (node.IsCulled) {
+				ImGui::TextUnformatted("Culled");
+			}
+			else if (node.Type == Render::ERGNodeType::Resource) {
+				ImGui::Text("Step %u - %u", node.Lifetime.FirstUse, node.Lifetime.LastUse);
+			}
+			else if (node.Type == Render::ERGNodeType::Pass) {
+				static const char* s_QueueNames[] = { "Graphics", "Compute", "Transfer" };
+				ImGui::Text("Step %u", m_NodeSteps[i]);
+				ImGui::Text("Planned %s batch %u", s_QueueNames[EnumCast(node.Queue)], node.Batch);
+			}
+			else {
+				ImGui::Text("Step %u", m_NodeSteps[i]);
+			}
 			//  draw input pin
 			const auto& nodePin = m_NodePins[i];
 			if (-1 != nodePin.first) {
@@ -17,6 +17,7 @@ namespace Editor {
 		uint32 m_UpdateFrame;
 		TArray<TPair<int, int>> m_NodePins; // pin id, {inPin, outPin}
 		TArray<TPair<int, int>> m_NodeLines; // index of pin
+		TArray<uint32> m_NodeSteps; // index in the execute order, INVALID_INDEX for resources and culled passes
 		void WndContent() override;
 		void OnOpen() override;
 	};
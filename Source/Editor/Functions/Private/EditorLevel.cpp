@@ -42,6 +42,7 @@ namespace Editor {
 		const XString& meshFile = component->GetMeshFile();
 		val.AddString("MeshFile", meshFile);
 		val.AddMember("CastShadow", component->GetCastShadow());
+		val.AddMember("Occluder", component->GetOccluder());
 	}
 	REGISTER_LEVEL_EDIT_OnSave(Object::MeshComponent, MeshSave);
 
@@ -8,6 +8,7 @@
 #include "Render/Public/Renderer.h"
 #include "Render/Public/GlobalShader.h"
 #include "System/Public/Timer.h"
+#include "Core/Public/FrameAllocator.h"
 #include "Objects/Public/RenderResource.h"
 #include "Objects/Public/RenderScene.h"
 #include "Objects/Public/Material.h"
@@ -47,6 +48,7 @@ namespace Engine {
 	}
 
 	void XXEngine::Update() {
+		FrameAllocator::BeginFrame();
 		EngineWindow::Instance()->Update();
 		RHI::Instance()->BeginFrame();// RHI Update must run at the beginning.
 		Object::RenderScene::Tick();
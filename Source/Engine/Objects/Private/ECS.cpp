@@ -1,10 +1,546 @@
 #include "Objects/Public/ECS.h"
+#include "Core/Public/Log.h"
+#include "Core/Public/FrameAllocator.h"
+#include "System/Public/ThreadPool.h"
+
+namespace {
+	inline uint32 AlignUp(uint32 value, uint32 alignment) {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	TArray<Object::ECSComponentTypeInfo>& GetComponentTypeInfos() {
+		static TArray<Object::ECSComponentTypeInfo> s_TypeInfos;
+		return s_TypeInfos;
+	}
+}
 
 namespace Object {
 
-	ComponentID RegisterComponent() {
-		static ComponentID s_ComponentMax{ 0 };
-		ASSERT(s_ComponentMax < NUM_COMPONENT_MAX, "Component id out of range!");
-		return s_ComponentMax++;
+	ComponentID RegisterComponent(const ECSComponentTypeInfo& typeInfo) {
+		auto& typeInfos = GetComponentTypeInfos();
+		ASSERT(typeInfos.Size() < NUM_COMPONENT_MAX, "Component id out of range!");
+		ASSERT(typeInfo.Alignment <= ECSArchetype::CHUNK_ALIGNMENT, "Component alignment is too large!");
+		const ComponentID componentID = (ComponentID)typeInfos.Size();
+		typeInfos.PushBack(typeInfo);
+		return componentID;
+	}
+
+	const ECSComponentTypeInfo& GetComponentTypeInfo(ComponentID componentID) {
+		return GetComponentTypeInfos()[componentID];
+	}
+
+	ECSArchetype::ECSArchetype(ComponentMask mask) : m_Mask(mask), m_NumEntities(0), m_ColumnOffsets(0), m_AddEdges(INVALID_INDEX), m_RemoveEdges(INVALID_INDEX) {
+		// capacity of a chunk, reserve the worst alignment padding of each column
+		uint32 entityByteSize = sizeof(EntityID);
+		uint32 paddingSize = 0;
+		for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+			if(m_Mask & (1u << componentID)) {
+				const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(componentID);
+				entityByteSize += typeInfo.Size;
+				paddingSize += typeInfo.Alignment;
+			}
+		}
+		m_ChunkCapacity = CHUNK_SIZE > paddingSize ? (CHUNK_SIZE - paddingSize) / entityByteSize : 0;
+		m_ChunkCapacity = NUM_MAX(m_ChunkCapacity, 1u);
+		// column layout
+		uint32 offset = m_ChunkCapacity * sizeof(EntityID);
+		for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+			if(m_Mask & (1u << componentID)) {
+				const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(componentID);
+				offset = AlignUp(offset, typeInfo.Alignment);
+				m_ColumnOffsets[componentID] = offset;
+				offset += m_ChunkCapacity * typeInfo.Size;
+			}
+		}
+		m_ChunkByteSize = NUM_MAX(offset, CHUNK_SIZE);
+	}
+
+	ECSArchetype::~ECSArchetype() {
+		for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+			if(m_Mask & (1u << componentID)) {
+				const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(componentID);
+				for(uint32 slot = 0; slot < m_NumEntities; ++slot) {
+					typeInfo.Destruct(GetComponent(slot, componentID));
+				}
+			}
+		}
+		for(uint8* chunk: m_Chunks) {
+			::operator delete(chunk, std::align_val_t{ CHUNK_ALIGNMENT });
+		}
+	}
+
+	uint32 ECSArchetype::GetChunkNumEntities(uint32 chunkIndex) const {
+		const uint32 chunkStart = chunkIndex * m_ChunkCapacity;
+		return NUM_MIN(m_NumEntities - chunkStart, m_ChunkCapacity);
+	}
+
+	EntityID ECSArchetype::GetEntity(uint32 slot) const {
+		return GetEntityColumn(slot / m_ChunkCapacity)[slot % m_ChunkCapacity];
+	}
+
+	void* ECSArchetype::GetComponent(uint32 slot, ComponentID componentID) {
+		const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(componentID);
+		return (uint8*)GetColumn(slot / m_ChunkCapacity, componentID) + (slot % m_ChunkCapacity) * typeInfo.Size;
+	}
+
+	uint32 ECSArchetype::AllocateSlot(EntityID entityID) {
+		const uint32 slot = m_NumEntities++;
+		const uint32 chunkIndex = slot / m_ChunkCapacity;
+		if(chunkIndex >= m_Chunks.Size()) {
+			m_Chunks.PushBack((uint8*)::operator new(m_ChunkByteSize, std::align_val_t{ CHUNK_ALIGNMENT }));
+			m_ChunkVersions.PushBack(TStaticArray<uint32, NUM_COMPONENT_MAX>(0u));
+		}
+		((EntityID*)m_Chunks[chunkIndex])[slot % m_ChunkCapacity] = entityID;
+		return slot;
+	}
+
+	EntityID ECSArchetype::FreeSlot(uint32 slot) {
+		CHECK(slot < m_NumEntities);
+		const uint32 lastSlot = m_NumEntities - 1;
+		EntityID movedEntity = INVALID_ENTITY;
+		if(slot != lastSlot) {
+			for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+				if(m_Mask & (1u << componentID)) {
+					const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(componentID);
+					void* lastComponent = GetComponent(lastSlot, componentID);
+					typeInfo.MoveConstruct(GetComponent(slot, componentID), lastComponent);
+					typeInfo.Destruct(lastComponent);
+				}
+			}
+			movedEntity = GetEntity(lastSlot);
+			((EntityID*)m_Chunks[slot / m_ChunkCapacity])[slot % m_ChunkCapacity] = movedEntity;
+		}
+		--m_NumEntities;
+		return movedEntity;
+	}
+
+	bool ECSArchetype::IsChunkChanged(uint32 chunkIndex, ComponentMask mask, uint32 version) const {
+		const auto& versions = m_ChunkVersions[chunkIndex];
+		for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+			if((mask & (1u << componentID)) && versions[componentID] >= version) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void ECSArchetype::MarkChunkChanged(uint32 chunkIndex, ComponentMask mask, uint32 version) {
+		auto& versions = m_ChunkVersions[chunkIndex];
+		mask &= m_Mask;
+		for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+			if(mask & (1u << componentID)) {
+				versions[componentID] = version;
+			}
+		}
+	}
+
+	bool ECSSystemBase::MatchArchetype(ComponentMask archetypeMask) const {
+		const ComponentMask requiredMask = m_ReadMask | m_WriteMask;
+		return (archetypeMask & requiredMask) == requiredMask && !(archetypeMask & m_ExcludeMask);
+	}
+
+	bool ECSSystemBase::ConflictsWith(const ECSSystemBase* rhs) const {
+		return (m_WriteMask & (rhs->m_ReadMask | rhs->m_WriteMask)) || (rhs->m_WriteMask & m_ReadMask);
+	}
+
+	void ECSSystemBase::UpdateEntry(ECSScene* ecsScene) {
+		const uint32 version = ecsScene->GetVersion();
+		auto updateChunk = [this, ecsScene, version](ECSArchetype* archetype, uint32 chunkIndex) {
+			if(m_ChangeFilterMask && !archetype->IsChunkChanged(chunkIndex, m_ChangeFilterMask, m_LastVersion)) {
+				return;
+			}
+			const uint32 numEntities = chunkIndex < archetype->GetNumChunks() ? archetype->GetChunkNumEntities(chunkIndex) : 0;
+			const ECSChunkView chunk{ archetype, chunkIndex, numEntities, m_LastVersion };
+			UpdateChunk(ecsScene, chunk);
+			if(chunk.WrittenMask) {
+				CHECK(!(chunk.WrittenMask & ~m_WriteMask));
+				archetype->MarkChunkChanged(chunkIndex, chunk.WrittenMask, version);
+			}
+		};
+		// chunks emptied since the last update are visited once more with no entity, so systems see the entities leaving
+		m_NumUpdatedChunks.Resize(m_Archetypes.Size(), 0);
+		auto getNumChunks = [this](uint32 archetypeIndex) {
+			const uint32 numChunks = m_Archetypes[archetypeIndex]->GetNumChunks();
+			const uint32 numVisitedChunks = NUM_MAX(numChunks, m_NumUpdatedChunks[archetypeIndex]);
+			m_NumUpdatedChunks[archetypeIndex] = numChunks;
+			return numVisitedChunks;
+		};
+		if(!m_ParallelChunks) {
+			for(uint32 archetypeIndex = 0; archetypeIndex < m_Archetypes.Size(); ++archetypeIndex) {
+				const uint32 numChunks = getNumChunks(archetypeIndex);
+				for(uint32 chunkIndex = 0; chunkIndex < numChunks; ++chunkIndex) {
+					updateChunk(m_Archetypes[archetypeIndex], chunkIndex);
+				}
+			}
+		}
+		else {
+			// flatten chunks of all archetypes, a chunk is the smallest parallel unit
+			TFrameArray<TPair<ECSArchetype*, uint32>> chunks;
+			for(uint32 archetypeIndex = 0; archetypeIndex < m_Archetypes.Size(); ++archetypeIndex) {
+				const uint32 numChunks = getNumChunks(archetypeIndex);
+				for(uint32 chunkIndex = 0; chunkIndex < numChunks; ++chunkIndex) {
+					chunks.PushBack({ m_Archetypes[archetypeIndex], chunkIndex });
+				}
+			}
+			Engine::ParallelFor(0u, chunks.Size(), 1u, [&updateChunk, &chunks](uint32 rangeBegin, uint32 rangeEnd) {
+				for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+					updateChunk(chunks[i].first, chunks[i].second);
+				}
+			});
+		}
+		m_LastVersion = version;
+	}
+
+	ECSCommandBuffer::ECSCommandBuffer(ECSScene* scene): m_Scene(scene) {
+	}
+
+	ECSCommandBuffer::~ECSCommandBuffer() {
+		Reset();
+	}
+
+	EntityID ECSCommandBuffer::CreateEntity() {
+		const EntityID entityID = m_Scene->ReserveEntity();
+		MutexLock lock(m_Mutex);
+		PushCommand(entityID, ECommandType::CreateEntity, 0, nullptr);
+		return entityID;
+	}
+
+	void ECSCommandBuffer::DestroyEntity(EntityID entityID) {
+		MutexLock lock(m_Mutex);
+		PushCommand(entityID, ECommandType::DestroyEntity, 0, nullptr);
+	}
+
+	void ECSCommandBuffer::PushCommand(EntityID entityID, ECommandType type, ComponentID componentID, void* data) {
+		m_Commands.PushBack({ entityID, m_Commands.Size(), type, componentID, data });
+		const uint64 entityKey = (uint64)entityID << 8;
+		switch(type) {
+		case ECommandType::AddComponent:
+			m_RecordedComponents[entityKey | componentID] = data;
+			break;
+		case ECommandType::RemoveComponent:
+			m_RecordedComponents.erase(entityKey | componentID);
+			break;
+		case ECommandType::DestroyEntity:
+			for(ComponentID i = 0; i < NUM_COMPONENT_MAX; ++i) {
+				m_RecordedComponents.erase(entityKey | i);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	void* ECSCommandBuffer::FindRecordedComponent(EntityID entityID, ComponentID componentID) const {
+		auto iter = m_RecordedComponents.find(((uint64)entityID << 8) | componentID);
+		return iter != m_RecordedComponents.end() ? iter->second : nullptr;
+	}
+
+	void ECSCommandBuffer::Reset() {
+		for(Command& command: m_Commands) {
+			if(command.Data) {
+				GetComponentTypeInfo(command.Component).Destruct(command.Data);
+			}
+		}
+		m_Commands.Reset();
+		m_RecordedComponents.clear();
+		m_Data.Reset();
+	}
+
+	ECSScene::ECSScene(): m_CommandBuffer(this) {
+	}
+
+	EntityID ECSScene::NewEntity() {
+		const EntityID entityID = ReserveEntity();
+		CreateReservedEntity(entityID);
+		return entityID;
+	}
+
+	EntityID ECSScene::ReserveEntity() {
+		MutexLock lock(m_ReserveMutex);
+		if(INVALID_INDEX != m_FreeHead) {
+			const uint32 index = m_FreeHead;
+			m_FreeHead = m_EntityRecords[index].Slot;
+			if(INVALID_INDEX == m_FreeHead) {
+				m_FreeTail = INVALID_INDEX;
+			}
+			return MakeEntityID(index, m_EntityRecords[index].Generation);
+		}
+		const uint32 index = m_EntityRecords.Size() + m_NumReservedRecords++;
+		// the max index is excluded, otherwise it makes INVALID_ENTITY with the max generation
+		ASSERT(index < ENTITY_INDEX_MASK, "Entity index out of range!");
+		return MakeEntityID(index, 0);
+	}
+
+	void ECSScene::CreateReservedEntity(EntityID entityID) {
+		{
+			MutexLock lock(m_ReserveMutex);
+			if(m_NumReservedRecords) {
+				m_EntityRecords.Resize(m_EntityRecords.Size() + m_NumReservedRecords);
+				m_NumReservedRecords = 0;
+			}
+		}
+		EntityRecord& record = m_EntityRecords[GetEntityIndex(entityID)];
+		CHECK(!record.Valid && record.Generation == GetEntityGeneration(entityID));
+		record.Mask = 0;
+		record.ArchetypeIndex = INVALID_INDEX;
+		record.Slot = INVALID_INDEX;
+		record.Valid = true;
+	}
+
+	bool ECSScene::IsValid(EntityID entityID) const {
+		const uint32 index = GetEntityIndex(entityID);
+		return index < m_EntityRecords.Size() && m_EntityRecords[index].Valid && m_EntityRecords[index].Generation == GetEntityGeneration(entityID);
+	}
+
+	void ECSScene::RemoveEntity(EntityID entityID) {
+		if(EntityRecord* record = FindRecord(entityID)) {
+			MoveEntity(entityID, INVALID_INDEX);
+			record->Valid = false;
+			record->Generation = (record->Generation + 1) & ENTITY_GENERATION_MASK;
+			// push to free list
+			const uint32 index = GetEntityIndex(entityID);
+			MutexLock lock(m_ReserveMutex);
+			record->Slot = INVALID_INDEX;
+			if(INVALID_INDEX == m_FreeTail) {
+				m_FreeHead = index;
+			}
+			else {
+				m_EntityRecords[m_FreeTail].Slot = index;
+			}
+			m_FreeTail = index;
+		}
+	}
+
+	ECSScene::EntityRecord* ECSScene::FindRecord(EntityID entityID) {
+		return IsValid(entityID) ? &m_EntityRecords[GetEntityIndex(entityID)] : nullptr;
+	}
+
+	void ECSScene::PlaybackCommands(ECSCommandBuffer& cmdBuffer) {
+		using ECommandType = ECSCommandBuffer::ECommandType;
+		MutexLock lock(cmdBuffer.m_Mutex);
+		auto& commands = cmdBuffer.m_Commands;
+		// group the commands of an entity, keep the recording order inside the group
+		commands.Sort([](const ECSCommandBuffer::Command& lhs, const ECSCommandBuffer::Command& rhs) {
+			const uint32 lhsIndex = GetEntityIndex(lhs.Entity), rhsIndex = GetEntityIndex(rhs.Entity);
+			return lhsIndex != rhsIndex ? lhsIndex < rhsIndex : lhs.Sequence < rhs.Sequence;
+		});
+		TStaticArray<void*, NUM_COMPONENT_MAX> addedData(nullptr);
+		for(uint32 groupBegin = 0, groupEnd; groupBegin < commands.Size(); groupBegin = groupEnd) {
+			const EntityID entityID = commands[groupBegin].Entity;
+			groupEnd = groupBegin + 1;
+			while(groupEnd < commands.Size() && commands[groupEnd].Entity == entityID) {
+				++groupEnd;
+			}
+			if(ECommandType::CreateEntity == commands[groupBegin].Type) {
+				CreateReservedEntity(entityID);
+			}
+			const EntityRecord* record = FindRecord(entityID);
+			if(!record) {
+				LOG_WARNING("[ECSScene::PlaybackCommands] Invalid entity ID! %u", entityID);
+				continue;
+			}
+			// fold the commands into the final mask, the last added component wins
+			ComponentMask mask = record->Mask;
+			bool bDestroy = false;
+			for(uint32 i = groupBegin; i < groupEnd && !bDestroy; ++i) {
+				const ECSCommandBuffer::Command& command = commands[i];
+				const ComponentMask bit = 1u << command.Component;
+				switch(command.Type) {
+				case ECommandType::DestroyEntity:
+					bDestroy = true;
+					break;
+				case ECommandType::AddComponent:
+					mask |= bit;
+					addedData[command.Component] = command.Data;
+					break;
+				case ECommandType::RemoveComponent:
+					mask &= ~bit;
+					addedData[command.Component] = nullptr;
+					break;
+				default:
+					break;
+				}
+			}
+			if(bDestroy) {
+				RemoveEntity(entityID);
+			}
+			else {
+				MoveEntity(entityID, mask ? GetOrCreateArchetype(mask) : INVALID_INDEX);
+				for(uint32 i = groupBegin; i < groupEnd; ++i) {
+					ECSCommandBuffer::Command& command = commands[i];
+					if(command.Data && addedData[command.Component] == command.Data) {
+						const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(command.Component);
+						void* component = GetComponent(entityID, command.Component, true);
+						typeInfo.Destruct(component);
+						typeInfo.MoveConstruct(component, command.Data);
+						typeInfo.Destruct(command.Data);
+						command.Data = nullptr;
+					}
+				}
+			}
+			addedData.Reset(nullptr);
+		}
+		cmdBuffer.Reset();
+	}
+
+	void ECSScene::SystemUpdate() {
+		++m_Version;
+		if(m_SystemGraphDirty) {
+			BuildSystemGraph();
+		}
+		m_SystemGraph.Dispatch();
+		m_SystemGraph.WaitUntilComplete();
+	}
+
+	void ECSScene::BuildSystemGraph() {
+		m_SystemGraph.Reset();
+		TArray<Engine::TaskNode*> nodes; nodes.Reserve(m_SystemOrder.Size());
+		for(uint32 i = 0; i < m_SystemOrder.Size(); ++i) {
+			ECSSystemBase* system = m_SystemOrder[i];
+			Engine::TaskNode* node = m_SystemGraph.CreateNodeLambda("ECSSystem", [this, system]() {
+				system->UpdateEntry(this);
+			});
+			for(uint32 j = 0; j < i; ++j) {
+				if(system->ConflictsWith(m_SystemOrder[j])) {
+					m_SystemGraph.Connect(nodes[j], node);
+				}
+			}
+			nodes.PushBack(node);
+		}
+		m_SystemGraph.Compile();
+		m_SystemGraphDirty = false;
+	}
+
+	void ECSScene::RegisterSystem(ComponentMask mask, ECSSystemBase* system) {
+		TUniquePtr<ECSSystemBase>& sysPtr = m_Systems[mask];
+		if(sysPtr) {
+			m_SystemOrder.Replace(sysPtr.Get(), system);
+		}
+		else {
+			m_SystemOrder.PushBack(system);
+		}
+		sysPtr.Reset(system);
+		m_SystemGraphDirty = true;
+		for(TUniquePtr<ECSArchetype>& archetype: m_Archetypes) {
+			if(system->MatchArchetype(archetype->GetMask())) {
+				system->m_Archetypes.PushBack(archetype.Get());
+			}
+		}
+	}
+
+	void* ECSScene::AddComponent(EntityID entityID, ComponentID componentID) {
+		if(const EntityRecord* record = FindRecord(entityID)) {
+			if(!(record->Mask & (1u << componentID))) {
+				MoveEntity(entityID, GetArchetypeAfterChange(record->ArchetypeIndex, componentID, true));
+			}
+			return GetComponent(entityID, componentID, true);
+		}
+		LOG_FATAL("[ECSScene::AddComponent] Invalid entity ID! %u", entityID);
+		return nullptr;
+	}
+
+	void* ECSScene::GetComponent(EntityID entityID, ComponentID componentID, bool bWrite) {
+		const EntityRecord* record = FindRecord(entityID);
+		if(record && (record->Mask & (1u << componentID))) {
+			ECSArchetype* archetype = m_Archetypes[record->ArchetypeIndex].Get();
+			if(bWrite) {
+				archetype->MarkChunkChanged(record->Slot / archetype->GetChunkCapacity(), 1u << componentID, m_Version);
+			}
+			return archetype->GetComponent(record->Slot, componentID);
+		}
+		return nullptr;
+	}
+
+	void ECSScene::RemoveComponent(EntityID entityID, ComponentID componentID) {
+		if(const EntityRecord* record = FindRecord(entityID)) {
+			if(record->Mask & (1u << componentID)) {
+				MoveEntity(entityID, GetArchetypeAfterChange(record->ArchetypeIndex, componentID, false));
+			}
+		}
+		else {
+			LOG_FATAL("[ECSScene::RemoveComponent] Invalid entity ID! %u", entityID);
+		}
+	}
+
+	uint32 ECSScene::GetOrCreateArchetype(ComponentMask mask) {
+		if(auto iter = m_ArchetypeIndices.find(mask); iter != m_ArchetypeIndices.end()) {
+			return iter->second;
+		}
+		const uint32 archetypeIndex = m_Archetypes.Size();
+		ECSArchetype* archetype = new ECSArchetype(mask);
+		m_Archetypes.EmplaceBack(archetype);
+		m_ArchetypeIndices[mask] = archetypeIndex;
+		// matching systems are resolved once per archetype
+		for(ECSSystemBase* system: m_SystemOrder) {
+			if(system->MatchArchetype(mask)) {
+				system->m_Archetypes.PushBack(archetype);
+			}
+		}
+		return archetypeIndex;
+	}
+
+	uint32 ECSScene::GetArchetypeAfterChange(uint32 archetypeIndex, ComponentID componentID, bool bAdd) {
+		const ComponentMask bit = 1u << componentID;
+		if(INVALID_INDEX == archetypeIndex) {
+			return bAdd ? GetOrCreateArchetype(bit) : INVALID_INDEX;
+		}
+		ECSArchetype* archetype = m_Archetypes[archetypeIndex].Get();
+		uint32& edge = bAdd ? archetype->m_AddEdges[componentID] : archetype->m_RemoveEdges[componentID];
+		if(INVALID_INDEX == edge) {
+			const ComponentMask newMask = bAdd ? (archetype->GetMask() | bit) : (archetype->GetMask() & ~bit);
+			edge = newMask ? GetOrCreateArchetype(newMask) : INVALID_INDEX;
+		}
+		return edge;
+	}
+
+	void ECSScene::MoveEntity(EntityID entityID, uint32 dstArchetypeIndex) {
+		EntityRecord& record = m_EntityRecords[GetEntityIndex(entityID)];
+		if(record.ArchetypeIndex == dstArchetypeIndex) {
+			return;
+		}
+		ECSArchetype* srcArchetype = INVALID_INDEX == record.ArchetypeIndex ? nullptr : m_Archetypes[record.ArchetypeIndex].Get();
+		ECSArchetype* dstArchetype = nullptr;
+		ComponentMask newMask = 0;
+		uint32 dstSlot = INVALID_INDEX;
+		if(INVALID_INDEX != dstArchetypeIndex) {
+			dstArchetype = m_Archetypes[dstArchetypeIndex].Get();
+			newMask = dstArchetype->GetMask();
+			dstSlot = dstArchetype->AllocateSlot(entityID);
+			dstArchetype->MarkChunkChanged(dstSlot / dstArchetype->GetChunkCapacity(), newMask, m_Version);
+		}
+		// move the shared components, construct the added ones and destruct the removed ones
+		for(ComponentID componentID = 0; componentID < NUM_COMPONENT_MAX; ++componentID) {
+			const ComponentMask bit = 1u << componentID;
+			const bool bInSrc = record.Mask & bit;
+			const bool bInDst = newMask & bit;
+			if(!bInSrc && !bInDst) {
+				continue;
+			}
+			const ECSComponentTypeInfo& typeInfo = GetComponentTypeInfo(componentID);
+			if(bInSrc && bInDst) {
+				void* srcComponent = srcArchetype->GetComponent(record.Slot, componentID);
+				typeInfo.MoveConstruct(dstArchetype->GetComponent(dstSlot, componentID), srcComponent);
+				typeInfo.Destruct(srcComponent);
+			}
+			else if(bInDst) {
+				typeInfo.Construct(dstArchetype->GetComponent(dstSlot, componentID));
+			}
+			else {
+				typeInfo.Destruct(srcArchetype->GetComponent(record.Slot, componentID));
+			}
+		}
+		if(srcArchetype) {
+			// the entity leaves its chunk, and the last entity leaves the last chunk to fill the slot
+			const uint32 lastSlot = srcArchetype->GetNumEntities() - 1;
+			srcArchetype->MarkChunkChanged(record.Slot / srcArchetype->GetChunkCapacity(), record.Mask, m_Version);
+			srcArchetype->MarkChunkChanged(lastSlot / srcArchetype->GetChunkCapacity(), record.Mask, m_Version);
+			const EntityID movedEntity = srcArchetype->FreeSlot(record.Slot);
+			if(INVALID_ENTITY != movedEntity) {
+				m_EntityRecords[GetEntityIndex(movedEntity)].Slot = record.Slot;
+			}
+		}
+		record.Mask = newMask;
+		record.ArchetypeIndex = dstArchetypeIndex;
+		record.Slot = dstSlot;
 	}
 }
@@ -1,5 +1,9 @@
 #include "Objects/Public/InstanceDataMgr.h"
 #include "Math/Public/Math.h"
+#include "System/Public/ConfigManager.h"
+#include "System/Public/ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
 
 namespace Object {
 
@@ -7,29 +11,127 @@ namespace Object {
 		return vec.X < vec.Y ? (vec.Y < vec.Z ? 2 : 1) : (vec.X < vec.Z ? 2 : 0);
 	}
 
-	static constexpr uint32 NUM_LEAF_INSTANCE_MAX = 16;
+	inline float GetSurfaceArea(const Math::AABB3& aabb) {
+		const Math::FVector3 size = aabb.Max - aabb.Min;
+		return 2.0f * (size.X * size.Y + size.Y * size.Z + size.Z * size.X);
+	}
+
+	static constexpr uint32 NUM_LEAF_INSTANCE_MAX = 16; // also the slot capacity of a leaf
+	static constexpr uint32 NUM_LEAF_SLOT_SLACK = 4;    // free slots reserved after the instances of a built leaf
 	static constexpr uint32 NUM_CHILD_NODE_MAX = 8;
 	static constexpr uint32 INVALID_INDEX = UINT32_MAX;
+	static constexpr uint32 NUM_SAH_BINS = 16;
+	static constexpr uint32 NUM_PARALLEL_INSTANCES_MIN = 4096; // ranges smaller than this are separated serially
+	// FlushUpdates rebuilds the tree if the leaf area grew over this ratio since the build, ...
+	static constexpr double REBUILD_LEAF_AREA_RATIO = 1.5;
+	// ... or overflow leaves exceed 1/N of the built leaves, or less than 1/N of the built instances remain
+	static constexpr uint32 REBUILD_OVERFLOW_LEAF_RATIO = 8;
+	static constexpr uint32 REBUILD_REMAINING_INSTANCE_RATIO = 2;
+
+	// Reorder elements[0, num) into two sides and return the size of the left side, getAABB and getCenter read an element.
+	template<class T, class AABBFunc, class CenterFunc>
+	uint32 PartitionElements(T* elements, uint32 num, const Math::AABB3& entireAABB, Engine::EClusterTreeBuild method, const AABBFunc& getAABB, const CenterFunc& getCenter) {
+		if(Engine::EClusterTreeBuild::BinnedSAH == method) {
+			Math::AABB3 centerBounds = Math::AABB3::MinMax(getCenter(elements[0]), getCenter(elements[0]));
+			for(uint32 i = 1; i < num; ++i) {
+				centerBounds.Include(getCenter(elements[i]));
+			}
+			const Math::FVector3 centerExtent = centerBounds.Max - centerBounds.Min;
+			const uint32 axis = GetVector3MaxAxis(centerExtent);
+			if(centerExtent[axis] > 0.0f) {
+				// bin the centers on the max axis, then split at the bin boundary with the lowest cost
+				const float binScale = (float)NUM_SAH_BINS / centerExtent[axis];
+				const float axisMin = centerBounds.Min[axis];
+				auto getBin = [&getCenter, binScale, axisMin, axis](const T& element) {
+					return Math::Min<uint32>(NUM_SAH_BINS - 1, (uint32)((getCenter(element)[axis] - axisMin) * binScale));
+				};
+				TStaticArray<Math::AABB3, NUM_SAH_BINS> binAABBs;
+				TStaticArray<uint32, NUM_SAH_BINS> binSizes;
+				binSizes.Reset(0u);
+				for(uint32 i = 0; i < num; ++i) {
+					const uint32 bin = getBin(elements[i]);
+					const Math::AABB3& aabb = getAABB(elements[i]);
+					binAABBs[bin] = binSizes[bin] ? binAABBs[bin] : aabb;
+					binAABBs[bin].Union(aabb);
+					++binSizes[bin];
+				}
+				// split s puts bins [0, s] to the left
+				TStaticArray<float, NUM_SAH_BINS> rightCosts;
+				Math::AABB3 accumulated;
+				uint32 accumulatedSize = 0;
+				for(uint32 bin = NUM_SAH_BINS - 1; bin > 0; --bin) {
+					if(binSizes[bin]) {
+						accumulated = accumulatedSize ? accumulated : binAABBs[bin];
+						accumulated.Union(binAABBs[bin]);
+						accumulatedSize += binSizes[bin];
+					}
+					rightCosts[bin - 1] = GetSurfaceArea(accumulated) * (float)accumulatedSize;
+				}
+				uint32 bestSplit = 0;
+				float bestCost = FLT_MAX;
+				accumulatedSize = 0;
+				for(uint32 bin = 0; bin + 1 < NUM_SAH_BINS; ++bin) {
+					if(binSizes[bin]) {
+						accumulated = accumulatedSize ? accumulated : binAABBs[bin];
+						accumulated.Union(binAABBs[bin]);
+						accumulatedSize += binSizes[bin];
+					}
+					const float cost = GetSurfaceArea(accumulated) * (float)accumulatedSize + rightCosts[bin];
+					if(accumulatedSize && accumulatedSize < num && cost < bestCost) {
+						bestCost = cost;
+						bestSplit = bin;
+					}
+				}
+				T* middle = std::partition(elements, elements + num, [&getBin, bestSplit](const T& element) {
+					return getBin(element) <= bestSplit;
+				});
+				return (uint32)(middle - elements);
+			}
+		}
+		// separate elements on max axis at the median
+		const uint32 axis = GetVector3MaxAxis(entireAABB.Extent());
+		const uint32 middle = num / 2;
+		std::nth_element(elements, elements + middle, elements + num, [&getCenter, axis](const T& l, const T& r) {
+			return getCenter(l)[axis] < getCenter(r)[axis];
+		});
+		return middle;
+	}
 
 	class ClusterTreeBuilder {
 		using ClusterNode = InstanceDataMgr::ClusterNode;
 	public:
 		TArray<ClusterNode> ClusterNodes;
 		uint32 ClusterSize;
-		ClusterTreeBuilder(TArray<InstanceData>& transforms, TArray<Math::AABB3>& aabbs): m_RefInstances(transforms), m_RefAABBs(aabbs) {
+		TArray<uint32> Order; // source index of each reordered instance
+		ClusterTreeBuilder(TArray<InstanceData>& transforms, TArray<Math::AABB3>& aabbs, Engine::EClusterTreeBuild method): m_RefInstances(transforms), m_RefAABBs(aabbs), m_Method(method) {
 			ASSERT(m_RefInstances.Size() == m_RefAABBs.Size(), "transforms is not matches aabbs!");
 			if(transforms.IsEmpty()) {
 				return;
 			}
-			TArray<uint32> indirectIndices(m_RefAABBs.Size());
-			for(uint32 i=0; i<indirectIndices.Size(); ++i) {
-				indirectIndices[i] = i;
-			}
+			const uint32 numInstances = m_RefAABBs.Size();
+			// instances are partitioned in a contiguous array with centers computed once
+			m_BuildInstances.Resize(numInstances);
+			Engine::ParallelFor(0u, numInstances, NUM_PARALLEL_INSTANCES_MIN, [this](uint32 rangeBegin, uint32 rangeEnd) {
+				for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+					m_BuildInstances[i] = { m_RefAABBs[i], m_RefAABBs[i].Center(), i };
+				}
+			});
 
-			// 1. build leaf nodes
+			// 1. build leaf nodes, top levels are split serially then the ranges are separated on workers
 			TArray<TArray<ClusterNode>> treeLayers;
 			auto& leafNodes = treeLayers.EmplaceBack();
-			RecursivelySeparateClusters(indirectIndices, 0, indirectIndices.Size(), leafNodes);
+			TArray<TPair<uint32, uint32>> ranges;
+			const uint32 parallelRangeSize = Math::Max(NUM_PARALLEL_INSTANCES_MIN, numInstances / 64);
+			RecursivelySplitRanges(0, numInstances, parallelRangeSize, ranges);
+			TArray<TArray<ClusterNode>> rangeNodes(ranges.Size());
+			Engine::ParallelFor(0u, ranges.Size(), 1u, [this, &ranges, &rangeNodes](uint32 rangeBegin, uint32 rangeEnd) {
+				for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+					RecursivelySeparateClusters(ranges[i].first, ranges[i].second, rangeNodes[i]);
+				}
+			});
+			for(const TArray<ClusterNode>& nodes : rangeNodes) {
+				leafNodes.PushBack(nodes);
+			}
 
 			// 2. build other layers of tree
 			uint32 layerNodeSize = leafNodes.Size();
@@ -49,25 +151,19 @@ namespace Object {
 				layerIndexEnds[i] = nodeSize;
 			}
 
-			// 3. reorder instances
-			TArray<uint32> orderMap(indirectIndices.Size());
-			uint32 instanceIndex = 0;
-			for(auto& node : treeLayers[0]) {
-				const uint32 newInstanceStart = instanceIndex;
-				for(uint32 i=node.InstanceStart; i<node.InstanceEnd; ++i) {
-					orderMap[indirectIndices[i]] = instanceIndex++;
-				}
-				node.InstanceStart = newInstanceStart;
-				node.InstanceEnd = instanceIndex;
-			}
-			for(uint32 i=0; i<orderMap.Size(); ++i) {
-				while(orderMap[i] != i) {
-					const uint32 targetIdx = orderMap[i];
-					m_RefAABBs.SwapEle(i, targetIdx);
-					m_RefInstances.SwapEle(i, targetIdx);
-					orderMap.SwapEle(i, targetIdx);
+			// 3. reorder instances, leaves cover m_BuildInstances in order
+			TArray<InstanceData> orderedInstances(numInstances);
+			TArray<Math::AABB3> orderedAABBs(numInstances);
+			Order.Resize(numInstances);
+			Engine::ParallelFor(0u, numInstances, NUM_PARALLEL_INSTANCES_MIN, [&](uint32 rangeBegin, uint32 rangeEnd) {
+				for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+					orderedInstances[i] = m_RefInstances[m_BuildInstances[i].Index];
+					orderedAABBs[i] = m_BuildInstances[i].AABB;
+					Order[i] = m_BuildInstances[i].Index;
 				}
-			}
+			});
+			m_RefInstances.Swap(orderedInstances);
+			m_RefAABBs.Swap(orderedAABBs);
 
 			// 4. reorder tree nodes
 			uint32 nodeIndex = 0;
@@ -113,25 +209,48 @@ namespace Object {
 	private:
 		TArray<InstanceData>& m_RefInstances;
 		TArray<Math::AABB3>& m_RefAABBs;
-		void RecursivelySeparateClusters(TArray<uint32>& indirectIndices, uint32 start, uint32 end, TArray<ClusterNode>& outNodes) {
-			// calc entire AABB
-			uint32 i = start;
-			Math::AABB3 entireAABB = m_RefAABBs[indirectIndices[i++]];
-			for (; i < end; ++i) {
-				auto& instanceAABB = m_RefAABBs[indirectIndices[i]];
-				entireAABB.Union(instanceAABB);
+		struct BuildInstance {
+			Math::AABB3 AABB;
+			Math::FVector3 Center;
+			uint32 Index;
+		};
+		TArray<BuildInstance> m_BuildInstances;
+		Engine::EClusterTreeBuild m_Method;
+
+		Math::AABB3 GetEntireAABB(uint32 start, uint32 end) const {
+			Math::AABB3 entireAABB = m_BuildInstances[start].AABB;
+			for (uint32 i = start + 1; i < end; ++i) {
+				entireAABB.Union(m_BuildInstances[i].AABB);
 			}
+			return entireAABB;
+		}
 
+		uint32 PartitionInstances(uint32 start, uint32 end, const Math::AABB3& entireAABB) {
+			const uint32 numLeft = PartitionElements(m_BuildInstances.Data() + start, end - start, entireAABB, m_Method,
+				[](const BuildInstance& instance)->const Math::AABB3& { return instance.AABB; },
+				[](const BuildInstance& instance)->const Math::FVector3& { return instance.Center; });
+			return start + numLeft;
+		}
+
+		// Split the same way as RecursivelySeparateClusters until ranges are small enough to be separated on workers.
+		void RecursivelySplitRanges(uint32 start, uint32 end, uint32 rangeSize, TArray<TPair<uint32, uint32>>& outRanges) {
+			if(end - start > rangeSize) {
+				const uint32 middle = PartitionInstances(start, end, GetEntireAABB(start, end));
+				RecursivelySplitRanges(start, middle, rangeSize, outRanges);
+				RecursivelySplitRanges(middle, end, rangeSize, outRanges);
+			}
+			else {
+				outRanges.PushBack({ start, end });
+			}
+		}
+
+		// Ranges of m_BuildInstances are disjoint, so they can be separated concurrently.
+		void RecursivelySeparateClusters(uint32 start, uint32 end, TArray<ClusterNode>& outNodes) {
+			const Math::AABB3 entireAABB = GetEntireAABB(start, end);
 			if(end - start > NUM_LEAF_INSTANCE_MAX) {
-				// separate elements on max axis
-				const auto extent = entireAABB.Extent();
-				const uint32 axis = GetVector3MaxAxis(extent);
-				indirectIndices.Sort(start, end, [this, axis](uint32 l, uint32 r) {
-					return m_RefAABBs[l].Center()[axis] < m_RefAABBs[r].Center()[axis];
-				});
-				const uint32 middle = (start + end) / 2;
-				RecursivelySeparateClusters(indirectIndices, start, middle, outNodes);
-				RecursivelySeparateClusters(indirectIndices, middle, end, outNodes);
+				const uint32 middle = PartitionInstances(start, end, entireAABB);
+				RecursivelySeparateClusters(start, middle, outNodes);
+				RecursivelySeparateClusters(middle, end, outNodes);
 			}
 			else {
 				// push leaf cluster node
@@ -143,7 +262,8 @@ namespace Object {
 			}
 		}
 
-		void RecursivelyBuildClusterTreeLayer(TArray<ClusterNode>& clusters, uint32 start, uint32 end, TArray<ClusterNode>& outNodes) {
+		// Group clusters into parents without reordering them, so the instances of each parent stay contiguous.
+		void RecursivelyBuildClusterTreeLayer(const TArray<ClusterNode>& clusters, uint32 start, uint32 end, TArray<ClusterNode>& outNodes) {
 			// calc entire AABB
 			uint32 i = start;
 			Math::AABB3 entireAABB = clusters[i++].AABB;
@@ -152,13 +272,7 @@ namespace Object {
 			}
 
 			if(end - start > NUM_CHILD_NODE_MAX) {
-				// separate elements on max axis
-				const auto extent = entireAABB.Extent();
-				const uint32 axis = GetVector3MaxAxis(extent);
-				clusters.Sort(start, end, [axis](const ClusterNode& l, const ClusterNode& r) {
-					return l.AABB.Center()[axis] < r.AABB.Center()[axis];
-				});
-				const uint32 middle = (start + end) / 2;
+				const uint32 middle = Engine::EClusterTreeBuild::BinnedSAH == m_Method ? FindSAHSplit(clusters, start, end) : (start + end) / 2;
 				RecursivelyBuildClusterTreeLayer(clusters, start, middle, outNodes);
 				RecursivelyBuildClusterTreeLayer(clusters, middle, end, outNodes);
 			}
@@ -171,6 +285,28 @@ namespace Object {
 				node.AABB = entireAABB;
 			}
 		}
+
+		// Find the split position of clusters in order with the lowest surface area heuristic cost.
+		static uint32 FindSAHSplit(const TArray<ClusterNode>& clusters, uint32 start, uint32 end) {
+			TArray<float> rightCosts(end - start);
+			Math::AABB3 accumulated = clusters[end - 1].AABB;
+			for(uint32 i = end - 1; i > start; --i) {
+				accumulated.Union(clusters[i].AABB);
+				rightCosts[i - start] = GetSurfaceArea(accumulated) * (float)(end - i);
+			}
+			uint32 bestSplit = (start + end) / 2;
+			float bestCost = FLT_MAX;
+			accumulated = clusters[start].AABB;
+			for(uint32 i = start + 1; i < end; ++i) {
+				const float cost = GetSurfaceArea(accumulated) * (float)(i - start) + rightCosts[i - start];
+				if(cost < bestCost) {
+					bestCost = cost;
+					bestSplit = i;
+				}
+				accumulated.Union(clusters[i].AABB);
+			}
+			return bestSplit;
+		}
 	};
 
 	HalfMatrix4x4& HalfMatrix4x4::operator=(const Math::FMatrix4x4& fMatrix) {
@@ -194,55 +330,195 @@ namespace Object {
 		return INVALID_INDEX != ChildStart && INVALID_INDEX != ChildEnd;
 	}
 
-	InstanceDataMgr::InstanceDataMgr() : m_ClusterSize(0) {
+	bool InstanceDataMgr::ClusterNode::IsEmpty() const {
+		return InstanceStart >= InstanceEnd;
+	}
+
+	InstanceDataMgr::InstanceDataMgr() : m_ClusterSize(0), m_NumTreeNodes(0), m_NumInstances(0), m_Version(0), m_BufferSlots(0),
+		m_LeafArea(0.0), m_BuiltLeafArea(0.0), m_BuiltClusterSize(0), m_BuiltNumInstances(0), m_BufferRetired(false),
+		m_ClusterTreeBuild(Engine::ConfigMgr::Instance().GetProjectConfig().ClusterTreeBuild) {
 	}
 
 	InstanceDataMgr::InstanceDataMgr(InstanceDataMgr&& rhs) noexcept:
 		m_InstanceBuffer(MoveTemp(rhs.m_InstanceBuffer)),
 		m_Instances(MoveTemp(rhs.m_Instances)),
 		m_AABBs(MoveTemp(rhs.m_AABBs)),
+		m_AABBStreams(MoveTemp(rhs.m_AABBStreams)),
 		m_ClusterNodes(MoveTemp(rhs.m_ClusterNodes)),
-		m_ClusterSize(rhs.m_ClusterSize){}
+		m_ClusterSize(rhs.m_ClusterSize),
+		m_NumTreeNodes(rhs.m_NumTreeNodes),
+		m_ResAABB(rhs.m_ResAABB),
+		m_SlotHandles(MoveTemp(rhs.m_SlotHandles)),
+		m_HandleSlots(MoveTemp(rhs.m_HandleSlots)),
+		m_FreeHandles(MoveTemp(rhs.m_FreeHandles)),
+		m_DirtySlots(MoveTemp(rhs.m_DirtySlots)),
+		m_NumInstances(rhs.m_NumInstances),
+		m_Version(rhs.m_Version),
+		m_BufferSlots(rhs.m_BufferSlots),
+		m_LeafArea(rhs.m_LeafArea),
+		m_BuiltLeafArea(rhs.m_BuiltLeafArea),
+		m_BuiltClusterSize(rhs.m_BuiltClusterSize),
+		m_BuiltNumInstances(rhs.m_BuiltNumInstances),
+		m_BufferRetired(rhs.m_BufferRetired),
+		m_ClusterTreeBuild(rhs.m_ClusterTreeBuild){}
 
 	InstanceDataMgr& InstanceDataMgr::operator=(InstanceDataMgr&& rhs) noexcept {
 		m_InstanceBuffer = MoveTemp(rhs.m_InstanceBuffer);
 		m_Instances = MoveTemp(rhs.m_Instances);
 		m_AABBs = MoveTemp(rhs.m_AABBs);
+		m_AABBStreams = MoveTemp(rhs.m_AABBStreams);
 		m_ClusterNodes = MoveTemp(rhs.m_ClusterNodes);
 		m_ClusterSize = rhs.m_ClusterSize;
+		m_NumTreeNodes = rhs.m_NumTreeNodes;
+		m_ResAABB = rhs.m_ResAABB;
+		m_SlotHandles = MoveTemp(rhs.m_SlotHandles);
+		m_HandleSlots = MoveTemp(rhs.m_HandleSlots);
+		m_FreeHandles = MoveTemp(rhs.m_FreeHandles);
+		m_DirtySlots = MoveTemp(rhs.m_DirtySlots);
+		m_NumInstances = rhs.m_NumInstances;
+		m_Version = rhs.m_Version;
+		m_BufferSlots = rhs.m_BufferSlots;
+		m_LeafArea = rhs.m_LeafArea;
+		m_BuiltLeafArea = rhs.m_BuiltLeafArea;
+		m_BuiltClusterSize = rhs.m_BuiltClusterSize;
+		m_BuiltNumInstances = rhs.m_BuiltNumInstances;
+		m_BufferRetired = rhs.m_BufferRetired;
+		m_ClusterTreeBuild = rhs.m_ClusterTreeBuild;
 		return *this;
 	}
 
 	void InstanceDataMgr::Reset() {
 		m_Instances.Reset();
 		m_AABBs.Reset();
+		m_AABBStreams.Reset();
 		m_ClusterNodes.Reset();
 		m_InstanceBuffer.Reset();
 		m_ClusterSize = 0;
+		m_NumTreeNodes = 0;
+		m_SlotHandles.Reset();
+		m_HandleSlots.Reset();
+		m_FreeHandles.Reset();
+		m_DirtySlots.Reset();
+		m_NumInstances = 0;
+		m_BufferSlots = 0;
+		m_LeafArea = m_BuiltLeafArea = 0.0;
+		m_BuiltClusterSize = m_BuiltNumInstances = 0;
+		m_BufferRetired = false;
+		++m_Version;
+	}
+
+	void InstanceDataMgr::SetClusterTreeBuild(Engine::EClusterTreeBuild buildMethod) {
+		m_ClusterTreeBuild = buildMethod;
 	}
 
 	void InstanceDataMgr::Build(const Math::AABB3& resAABB, const TArray<Math::FTransform>& transforms) {
 		Reset();
+		m_ResAABB = resAABB;
 		if(!transforms.Size()) {
 			return;
 		}
-		m_AABBs.Reserve(transforms.Size());
-		m_Instances.Reserve(transforms.Size());
-		for(auto& transform: transforms) {
-			const Math::FMatrix4x4& mat = transform.ToMatrix();
-			m_AABBs.PushBack(resAABB.Transform(transform.ToMatrix()));
-#ifdef INSTANCE_HALF_FLOAT
-			m_Instances.EmplaceBack().TransformMatrix = mat;
-#else
-			m_Instances.EmplaceBack().TransformMatrix = mat;
-#endif
+		const uint32 numInstances = transforms.Size();
+		TArray<InstanceData> instances(numInstances);
+		TArray<Math::AABB3> aabbs(numInstances);
+		TArray<uint32> handles(numInstances);
+		Engine::ParallelFor(0u, numInstances, NUM_PARALLEL_INSTANCES_MIN, [&](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+				const Math::FMatrix4x4 mat = transforms[i].ToMatrix();
+				aabbs[i] = resAABB.Transform(mat);
+				instances[i].TransformMatrix = mat;
+				handles[i] = i;
+			}
+		});
+		m_HandleSlots.Resize(numInstances);
+		BuildClusters(instances, aabbs, handles);
+	}
+
+	uint32 InstanceDataMgr::AddInstance(const Math::FTransform& transform) {
+		uint32 handle;
+		if(m_FreeHandles.Size()) {
+			handle = m_FreeHandles.Back();
+			m_FreeHandles.PopBack();
 		}
-		ClusterTreeBuilder clusterTreeBuilder(m_Instances, m_AABBs);
-		m_ClusterNodes.Swap(clusterTreeBuilder.ClusterNodes);
-		m_ClusterSize = clusterTreeBuilder.ClusterSize;
-		RHIBufferDesc desc{ EBufferFlags::SRV | EBufferFlags::CopyDst, m_Instances.ByteSize(), sizeof(InstanceData) };
-		m_InstanceBuffer = RHI::Instance()->CreateBuffer(desc);
-		m_InstanceBuffer->UpdateData(m_Instances.Data(), m_Instances.ByteSize(), 0);
+		else {
+			handle = m_HandleSlots.Size();
+			m_HandleSlots.PushBack(INVALID_INDEX);
+		}
+		InstanceData instance;
+		const Math::FMatrix4x4 mat = transform.ToMatrix();
+		instance.TransformMatrix = mat;
+		InsertSlot(handle, instance, m_ResAABB.Transform(mat));
+		++m_NumInstances;
+		return handle;
+	}
+
+	void InstanceDataMgr::RemoveInstance(uint32 handle) {
+		ASSERT(handle < m_HandleSlots.Size() && INVALID_INDEX != m_HandleSlots[handle], "Invalid instance handle!");
+		RemoveSlot(m_HandleSlots[handle]);
+		m_HandleSlots[handle] = INVALID_INDEX;
+		m_FreeHandles.PushBack(handle);
+		--m_NumInstances;
+	}
+
+	void InstanceDataMgr::UpdateInstance(uint32 handle, const Math::FTransform& transform) {
+		ASSERT(handle < m_HandleSlots.Size() && INVALID_INDEX != m_HandleSlots[handle], "Invalid instance handle!");
+		const uint32 slot = m_HandleSlots[handle];
+		InstanceData instance;
+		const Math::FMatrix4x4 mat = transform.ToMatrix();
+		instance.TransformMatrix = mat;
+		const Math::AABB3 aabb = m_ResAABB.Transform(mat);
+		const uint32 leafIndex = FindLeaf(slot);
+		if(m_ClusterNodes[leafIndex].AABB.Contains(aabb)) {
+			SetSlot(slot, instance, aabb, handle);
+			RefitLeaf(leafIndex);
+		}
+		else {
+			// moved out of its leaf, reinsert it instead of growing the leaf
+			RemoveSlot(slot);
+			InsertSlot(handle, instance, aabb);
+		}
+	}
+
+	void InstanceDataMgr::FlushUpdates() {
+		const bool bTreeDegraded = m_LeafArea > m_BuiltLeafArea * REBUILD_LEAF_AREA_RATIO ||
+			(m_ClusterSize - m_BuiltClusterSize) * REBUILD_OVERFLOW_LEAF_RATIO > m_BuiltClusterSize ||
+			m_NumInstances * REBUILD_REMAINING_INSTANCE_RATIO < m_BuiltNumInstances;
+		if(bTreeDegraded) {
+			Rebuild();
+		}
+	}
+
+	void InstanceDataMgr::UploadUpdates() {
+		if(m_BufferRetired || m_Instances.Size() > m_BufferSlots) {
+			UploadInstanceBuffer();
+			return;
+		}
+		if(m_DirtySlots.IsEmpty()) {
+			return;
+		}
+		// upload contiguous runs of dirty slots
+		m_DirtySlots.Sort(0, m_DirtySlots.Size(), [](uint32 l, uint32 r) { return l < r; });
+		uint32 runStart = m_DirtySlots[0];
+		uint32 runEnd = runStart + 1;
+		for(uint32 i = 1; i <= m_DirtySlots.Size(); ++i) {
+			if(i < m_DirtySlots.Size() && m_DirtySlots[i] <= runEnd) {
+				runEnd = m_DirtySlots[i] + 1;
+				continue;
+			}
+			m_InstanceBuffer->UpdateData(&m_Instances[runStart], (runEnd - runStart) * sizeof(InstanceData), runStart * sizeof(InstanceData));
+			if(i < m_DirtySlots.Size()) {
+				runStart = m_DirtySlots[i];
+				runEnd = runStart + 1;
+			}
+		}
+		m_DirtySlots.Reset();
+	}
+
+	uint32 InstanceDataMgr::GetVersion() const {
+		return m_Version;
+	}
+
+	uint32 InstanceDataMgr::GetNumInstances() const {
+		return m_NumInstances;
 	}
 
 	RHIBuffer* InstanceDataMgr::GetInstanceBuffer() {
@@ -266,33 +542,316 @@ namespace Object {
 	}
 
 	bool InstanceDataMgr::IsEmpty() const {
-		return m_Instances.IsEmpty();
+		return !m_NumInstances;
 	}
 
-	void InstanceDataMgr::GenerateInstanceID(const Math::Frustum& frustum, TArray<uint32>& outInstanceIDs) {
-		outInstanceIDs.Reserve(m_Instances.Size());
-		RecursivelyGenerateInstanceID(0, frustum, outInstanceIDs);
+	void InstanceDataMgr::GenerateInstanceID(const Math::Frustum& frustum, TFrameArray<uint32>& outInstanceIDs, const Render::SoftwareOcclusion* occlusion) {
+		outInstanceIDs.Reserve(m_NumInstances);
+		if(occlusion && !occlusion->HasDepth()) {
+			occlusion = nullptr;
+		}
+		if(m_NumTreeNodes) {
+			RecursivelyGenerateInstanceID(0, frustum, occlusion, outInstanceIDs);
+		}
+		for(uint32 i = m_NumTreeNodes; i < m_ClusterNodes.Size(); ++i) {
+			RecursivelyGenerateInstanceID(i, frustum, occlusion, outInstanceIDs);
+		}
 	}
 
 	void InstanceDataMgr::GenerateDrawRanges(const Math::Frustum& frustum, TArray<InstanceDrawRange>& ranges) {
-		RecursivelyGenerateDrawRanges(0, frustum, ranges);
+		if(m_NumTreeNodes) {
+			RecursivelyGenerateDrawRanges(0, frustum, ranges);
+		}
+		for(uint32 i = m_NumTreeNodes; i < m_ClusterNodes.Size(); ++i) {
+			RecursivelyGenerateDrawRanges(i, frustum, ranges);
+		}
 	}
 
-	void InstanceDataMgr::RecursivelyGenerateInstanceID(uint32 nodeIndex, const Math::Frustum& frustum, TArray<uint32>& outInstanceIDs) {
+	void InstanceDataMgr::BuildClusters(TArray<InstanceData>& instances, TArray<Math::AABB3>& aabbs, TArray<uint32>& handles) {
+		m_ClusterNodes.Reset();
+		m_ClusterSize = m_NumTreeNodes = 0;
+		m_DirtySlots.Reset();
+		m_NumInstances = handles.Size();
+		m_LeafArea = 0.0;
+		++m_Version;
+		if(instances.IsEmpty()) {
+			m_Instances.Reset();
+			m_AABBs.Reset();
+			m_AABBStreams.Reset();
+			m_SlotHandles.Reset();
+			m_BuiltLeafArea = 0.0;
+			m_BuiltClusterSize = m_BuiltNumInstances = 0;
+			m_BufferRetired = true;
+			return;
+		}
+		ClusterTreeBuilder clusterTreeBuilder(instances, aabbs, m_ClusterTreeBuild);
+		m_ClusterNodes.Swap(clusterTreeBuilder.ClusterNodes);
+		m_ClusterSize = clusterTreeBuilder.ClusterSize;
+		m_NumTreeNodes = m_ClusterNodes.Size();
+
+		// lay out leaves in slots with free slots after their instances
+		const uint32 leafStart = m_NumTreeNodes - m_ClusterSize;
+		TArray<uint32> srcStarts(m_ClusterSize);
+		uint32 numSlots = 0;
+		for(uint32 i = 0; i < m_ClusterSize; ++i) {
+			ClusterNode& leaf = m_ClusterNodes[leafStart + i];
+			const uint32 numLeafInstances = leaf.InstanceEnd - leaf.InstanceStart;
+			srcStarts[i] = leaf.InstanceStart;
+			leaf.InstanceStart = numSlots;
+			leaf.InstanceEnd = numSlots + numLeafInstances;
+			numSlots += Math::Min(numLeafInstances + NUM_LEAF_SLOT_SLACK, NUM_LEAF_INSTANCE_MAX);
+			leaf.SlotEnd = numSlots;
+			m_LeafArea += GetSurfaceArea(leaf.AABB);
+		}
+		m_Instances.Resize(numSlots);
+		m_AABBs.Resize(numSlots);
+		m_SlotHandles.Resize(numSlots);
+		Engine::ParallelFor(0u, m_ClusterSize, NUM_PARALLEL_INSTANCES_MIN / NUM_LEAF_INSTANCE_MAX, [&](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+				const ClusterNode& leaf = m_ClusterNodes[leafStart + i];
+				uint32 src = srcStarts[i];
+				for(uint32 slot = leaf.InstanceStart; slot < leaf.InstanceEnd; ++slot, ++src) {
+					const uint32 handle = handles[clusterTreeBuilder.Order[src]];
+					m_Instances[slot] = instances[src];
+					m_AABBs[slot] = aabbs[src];
+					m_SlotHandles[slot] = handle;
+					m_HandleSlots[handle] = slot;
+				}
+				for(uint32 slot = leaf.InstanceEnd; slot < leaf.SlotEnd; ++slot) {
+					m_SlotHandles[slot] = INVALID_INDEX;
+				}
+			}
+		});
+		// children are after their parents, recompute instance ranges of inner nodes in slots
+		m_ClusterNodes[0].Parent = INVALID_INDEX;
+		for(uint32 i = leafStart; i-- > 0;) {
+			ClusterNode& node = m_ClusterNodes[i];
+			node.InstanceStart = UINT32_MAX;
+			node.InstanceEnd = 0;
+			node.SlotEnd = 0;
+			for(uint32 j = node.ChildStart; j < node.ChildEnd; ++j) {
+				ClusterNode& child = m_ClusterNodes[j];
+				child.Parent = i;
+				node.InstanceStart = Math::Min(node.InstanceStart, child.InstanceStart);
+				node.InstanceEnd = Math::Max(node.InstanceEnd, child.InstanceEnd);
+			}
+		}
+		m_AABBStreams.Reset();
+		m_AABBStreams.Reserve(numSlots);
+		for(const Math::AABB3& aabb: m_AABBs) {
+			m_AABBStreams.PushBack(aabb);
+		}
+		m_BuiltLeafArea = m_LeafArea;
+		m_BuiltClusterSize = m_ClusterSize;
+		m_BuiltNumInstances = m_NumInstances;
+		m_BufferRetired = true;
+	}
+
+	void InstanceDataMgr::Rebuild() {
+		TArray<InstanceData> instances;
+		TArray<Math::AABB3> aabbs;
+		TArray<uint32> handles;
+		instances.Reserve(m_NumInstances);
+		aabbs.Reserve(m_NumInstances);
+		handles.Reserve(m_NumInstances);
+		for(const ClusterNode& leaf: GetClusters()) {
+			for(uint32 slot = leaf.InstanceStart; slot < leaf.InstanceEnd; ++slot) {
+				instances.PushBack(m_Instances[slot]);
+				aabbs.PushBack(m_AABBs[slot]);
+				handles.PushBack(m_SlotHandles[slot]);
+			}
+		}
+		BuildClusters(instances, aabbs, handles);
+	}
+
+	void InstanceDataMgr::UploadInstanceBuffer() {
+		m_DirtySlots.Reset();
+		m_BufferRetired = false;
+		if(m_Instances.IsEmpty()) {
+			m_InstanceBuffer.Reset();
+			m_BufferSlots = 0;
+			return;
+		}
+		// overflow leaves grow the buffer with room for more of them
+		m_BufferSlots = m_BufferSlots < m_Instances.Size() && m_BufferSlots ? Math::Max(m_Instances.Size(), m_BufferSlots * 3 / 2) : m_Instances.Size();
+		RHIBufferDesc desc{ EBufferFlags::SRV | EBufferFlags::CopyDst, m_BufferSlots * (uint32)sizeof(InstanceData), sizeof(InstanceData) };
+		m_InstanceBuffer = RHI::Instance()->CreateBuffer(desc);
+		m_InstanceBuffer->UpdateData(m_Instances.Data(), m_Instances.ByteSize(), 0);
+		++m_Version;
+	}
+
+	uint32 InstanceDataMgr::FindLeaf(uint32 slot) const {
+		// slots of leaves are in the order of leaves
+		const TConstArrayView<ClusterNode> leaves = GetClusters();
+		uint32 low = 0, high = leaves.Size();
+		while(high - low > 1) {
+			const uint32 middle = (low + high) / 2;
+			if(leaves[middle].InstanceStart <= slot) {
+				low = middle;
+			}
+			else {
+				high = middle;
+			}
+		}
+		return m_ClusterNodes.Size() - m_ClusterSize + low;
+	}
+
+	uint32 InstanceDataMgr::FindInsertLeaf(const Math::AABB3& aabb) {
+		// descend into the child with the least area growth, skipping full leaves
+		if(m_NumTreeNodes) {
+			uint32 nodeIndex = 0;
+			while(m_ClusterNodes[nodeIndex].HasChild()) {
+				const ClusterNode& node = m_ClusterNodes[nodeIndex];
+				uint32 bestChild = INVALID_INDEX;
+				float bestCost = FLT_MAX;
+				for(uint32 i = node.ChildStart; i < node.ChildEnd; ++i) {
+					const ClusterNode& child = m_ClusterNodes[i];
+					if(!child.HasChild() && child.InstanceEnd == child.SlotEnd) {
+						continue;
+					}
+					float cost = GetSurfaceArea(aabb);
+					if(!child.IsEmpty()) {
+						Math::AABB3 unionAABB = child.AABB;
+						unionAABB.Union(aabb);
+						cost = GetSurfaceArea(unionAABB) - GetSurfaceArea(child.AABB);
+					}
+					if(cost < bestCost) {
+						bestCost = cost;
+						bestChild = i;
+					}
+				}
+				if(INVALID_INDEX == bestChild) {
+					break;
+				}
+				nodeIndex = bestChild;
+			}
+			if(!m_ClusterNodes[nodeIndex].HasChild()) {
+				return nodeIndex;
+			}
+		}
+		// no free slot on the path, append to the last overflow leaf
+		if(m_ClusterNodes.Size() > m_NumTreeNodes && m_ClusterNodes.Back().InstanceEnd < m_ClusterNodes.Back().SlotEnd) {
+			return m_ClusterNodes.Size() - 1;
+		}
+		return AddOverflowLeaf();
+	}
+
+	uint32 InstanceDataMgr::AddOverflowLeaf() {
+		const uint32 slotStart = m_Instances.Size();
+		const uint32 numSlots = slotStart + NUM_LEAF_INSTANCE_MAX;
+		m_Instances.Resize(numSlots);
+		m_AABBs.Resize(numSlots);
+		m_SlotHandles.Resize(numSlots, INVALID_INDEX);
+		for(uint32 slot = slotStart; slot < numSlots; ++slot) {
+			m_AABBStreams.PushBack(m_AABBs[slot]);
+		}
+		ClusterNode& leaf = m_ClusterNodes.EmplaceBack();
+		leaf.InstanceStart = leaf.InstanceEnd = slotStart;
+		leaf.SlotEnd = numSlots;
+		leaf.ChildStart = leaf.ChildEnd = INVALID_INDEX;
+		leaf.Parent = INVALID_INDEX;
+		++m_ClusterSize;
+		return m_ClusterNodes.Size() - 1;
+	}
+
+	void InstanceDataMgr::InsertSlot(uint32 handle, const InstanceData& instance, const Math::AABB3& aabb) {
+		const uint32 leafIndex = FindInsertLeaf(aabb);
+		const uint32 slot = m_ClusterNodes[leafIndex].InstanceEnd++;
+		SetSlot(slot, instance, aabb, handle);
+		RefitLeaf(leafIndex);
+	}
+
+	void InstanceDataMgr::RemoveSlot(uint32 slot) {
+		// move the last instance of the leaf into the slot
+		const uint32 leafIndex = FindLeaf(slot);
+		const uint32 lastSlot = --m_ClusterNodes[leafIndex].InstanceEnd;
+		if(slot != lastSlot) {
+			SetSlot(slot, m_Instances[lastSlot], m_AABBs[lastSlot], m_SlotHandles[lastSlot]);
+		}
+		m_SlotHandles[lastSlot] = INVALID_INDEX;
+		++m_Version;
+		RefitLeaf(leafIndex);
+	}
+
+	void InstanceDataMgr::SetSlot(uint32 slot, const InstanceData& instance, const Math::AABB3& aabb, uint32 handle) {
+		m_Instances[slot] = instance;
+		m_AABBs[slot] = aabb;
+		m_AABBStreams.Set(slot, aabb);
+		m_SlotHandles[slot] = handle;
+		m_HandleSlots[handle] = slot;
+		m_DirtySlots.PushBack(slot);
+		++m_Version;
+	}
+
+	void InstanceDataMgr::RefitLeaf(uint32 leafIndex) {
+		ClusterNode& leaf = m_ClusterNodes[leafIndex];
+		m_LeafArea -= leaf.IsEmpty() ? 0.0f : GetSurfaceArea(leaf.AABB);
+		if(!leaf.IsEmpty()) {
+			leaf.AABB = m_AABBs[leaf.InstanceStart];
+			for(uint32 slot = leaf.InstanceStart + 1; slot < leaf.InstanceEnd; ++slot) {
+				leaf.AABB.Union(m_AABBs[slot]);
+			}
+			m_LeafArea += GetSurfaceArea(leaf.AABB);
+		}
+		// refit ancestors until one is unchanged, empty children are skipped
+		for(uint32 nodeIndex = leaf.Parent; INVALID_INDEX != nodeIndex; nodeIndex = m_ClusterNodes[nodeIndex].Parent) {
+			ClusterNode& node = m_ClusterNodes[nodeIndex];
+			Math::AABB3 aabb = node.AABB;
+			uint32 instanceStart = UINT32_MAX;
+			uint32 instanceEnd = 0;
+			for(uint32 i = node.ChildStart; i < node.ChildEnd; ++i) {
+				const ClusterNode& child = m_ClusterNodes[i];
+				if(!child.IsEmpty()) {
+					aabb = instanceStart < instanceEnd ? aabb : child.AABB;
+					aabb.Union(child.AABB);
+					instanceStart = Math::Min(instanceStart, child.InstanceStart);
+					instanceEnd = Math::Max(instanceEnd, child.InstanceEnd);
+				}
+			}
+			if(instanceStart >= instanceEnd) {
+				instanceStart = instanceEnd = 0;
+			}
+			if(aabb.Min == node.AABB.Min && aabb.Max == node.AABB.Max && instanceStart == node.InstanceStart && instanceEnd == node.InstanceEnd) {
+				break;
+			}
+			node.AABB = aabb;
+			node.InstanceStart = instanceStart;
+			node.InstanceEnd = instanceEnd;
+		}
+	}
+
+	void InstanceDataMgr::RecursivelyGenerateInstanceID(uint32 nodeIndex, const Math::Frustum& frustum, const Render::SoftwareOcclusion* occlusion, TFrameArray<uint32>& outInstanceIDs) {
 		if(nodeIndex < m_ClusterNodes.Size()) {
 			auto& node = m_ClusterNodes[nodeIndex];
+			if(node.IsEmpty()) {
+				return;
+			}
 			const Math::EGeometryTest testResult = frustum.TestAABB(node.AABB);
 			if(Math::EGeometryTest::Outer == testResult) {
 				return;
 			}
-			if(Math::EGeometryTest::Inner == testResult || !node.HasChild()) {
-				for(uint32 i=node.InstanceStart; i<node.InstanceEnd; ++i) {
-					outInstanceIDs.PushBack(i);
+			if(occlusion && !occlusion->TestAABB(node.AABB)) {
+				return;
+			}
+			// children of an inner node are still tested against the occlusion
+			if(Math::EGeometryTest::Inner == testResult && (!occlusion || !node.HasChild())) {
+				RecursivelyPushLeafInstances(nodeIndex, outInstanceIDs);
+			}
+			else if(!node.HasChild()) {
+				// intersected leaf, cull its instances in a batch
+				const uint32 numInstances = node.InstanceEnd - node.InstanceStart;
+				const uint32 outStart = outInstanceIDs.Size();
+				outInstanceIDs.Resize(outStart + numInstances);
+				uint32* outIDs = outInstanceIDs.Data() + outStart;
+				const uint32 numVisible = Math::CullAABBs(frustum, m_AABBStreams.GetStreams().Offset(node.InstanceStart, numInstances), outIDs);
+				for(uint32 i=0; i<numVisible; ++i) {
+					outIDs[i] += node.InstanceStart;
 				}
+				outInstanceIDs.Resize(outStart + numVisible);
 			}
 			else {
 				for(uint32 i=node.ChildStart; i<node.ChildEnd; ++i) {
-					RecursivelyGenerateInstanceID(i, frustum, outInstanceIDs);
+					RecursivelyGenerateInstanceID(i, frustum, occlusion, outInstanceIDs);
 				}
 			}
 		}
@@ -301,12 +860,15 @@ namespace Object {
 	void InstanceDataMgr::RecursivelyGenerateDrawRanges(uint32 nodeIndex, const Math::Frustum& frustum, TArray<InstanceDrawRange>& ranges) {
 		if (nodeIndex < m_ClusterNodes.Size()) {
 			auto& node = m_ClusterNodes[nodeIndex];
+			if(node.IsEmpty()) {
+				return;
+			}
 			const Math::EGeometryTest testResult = frustum.TestAABB(node.AABB);
 			if(Math::EGeometryTest::Outer == testResult) {
 				return;
 			}
 			if(Math::EGeometryTest::Inner == testResult || !node.HasChild()) {
-				ranges.PushBack({ node.InstanceStart, node.InstanceEnd });
+				RecursivelyPushLeafRanges(nodeIndex, ranges);
 			}
 			else {
 				for(uint32 i=node.ChildStart; i<node.ChildEnd; ++i) {
@@ -315,4 +877,40 @@ namespace Object {
 			}
 		}
 	}
+
+	void InstanceDataMgr::RecursivelyPushLeafInstances(uint32 nodeIndex, TFrameArray<uint32>& outInstanceIDs) {
+		// free slots between leaves are skipped
+		const ClusterNode& node = m_ClusterNodes[nodeIndex];
+		if(!node.HasChild()) {
+			for(uint32 i=node.InstanceStart; i<node.InstanceEnd; ++i) {
+				outInstanceIDs.PushBack(i);
+			}
+		}
+		else if(!node.IsEmpty()) {
+			for(uint32 i=node.ChildStart; i<node.ChildEnd; ++i) {
+				RecursivelyPushLeafInstances(i, outInstanceIDs);
+			}
+		}
+	}
+
+	void InstanceDataMgr::RecursivelyPushLeafRanges(uint32 nodeIndex, TArray<InstanceDrawRange>& ranges) {
+		const ClusterNode& node = m_ClusterNodes[nodeIndex];
+		if(!node.HasChild()) {
+			if(node.IsEmpty()) {
+				return;
+			}
+			// merge with the previous range if no free slot is between them
+			if(ranges.Size() && ranges.Back().InstanceEnd == node.InstanceStart) {
+				ranges.Back().InstanceEnd = node.InstanceEnd;
+			}
+			else {
+				ranges.PushBack({ node.InstanceStart, node.InstanceEnd });
+			}
+		}
+		else if(!node.IsEmpty()) {
+			for(uint32 i=node.ChildStart; i<node.ChildEnd; ++i) {
+				RecursivelyPushLeafRanges(i, ranges);
+			}
+		}
+	}
 }
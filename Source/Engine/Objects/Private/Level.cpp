@@ -44,7 +44,8 @@ namespace Object {
 
 	LevelActor::~LevelActor() {
 		if(INVALID_ENTITY != m_EntityID) {
-			GetScene()->RemoveEntity(m_EntityID);
+			// the index is not reused until playback, so the actors loaded in the same frame get new ids
+			GetScene()->GetCommandBuffer().DestroyEntity(m_EntityID);
 		}
 	}
 
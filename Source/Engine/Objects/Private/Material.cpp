@@ -222,10 +222,15 @@ namespace Object {
 		}
 		// textures
 		TSet<uint32> samplersCode;
+		TArray<Engine::TFuture<RHITexture*>> textureFutures;
+		textureFutures.Reserve(layout.NumTextures);
+		for (uint32 i=0; i<layout.NumTextures; ++i) {
+			textureFutures.PushBack(StaticResourceMgr::Instance()->LoadTextureAsync(asset.Textures[i].Texture));
+		}
 		for (uint32 i=0; i<layout.NumTextures; ++i) {
 			const Asset::MaterialTemplateAsset::TextureParameter& srcTex = asset.Textures[i];
 			BindingData& data = m_BindingDatas.EmplaceBack();
-			data.Texture = StaticResourceMgr::Instance()->GetTexture(srcTex.Texture);
+			data.Texture = textureFutures[i].Get();
 			data.TexSampleCode = srcTex.SamplerCode;
 			samplersCode.insert(srcTex.SamplerCode);
 		}
@@ -448,9 +453,16 @@ namespace Object {
 			data.BufferSize = bufferSize;
 		}
 		// textures
+		TArray<Engine::TFuture<RHITexture*>> textureFutures;
+		textureFutures.Reserve(layout.NumTextures);
+		for(uint32 i=0; i<layout.NumTextures; ++i) {
+			if(i<asset.TextureOverrides.Size()) {
+				textureFutures.PushBack(StaticResourceMgr::Instance()->LoadTextureAsync(asset.TextureOverrides[i]));
+			}
+		}
 		for(uint32 i=0; i<layout.NumTextures; ++i) {
 			OverrideData& data = m_Overrides.EmplaceBack();
-			data.Texture = i<asset.TextureOverrides.Size() ? StaticResourceMgr::Instance()->GetTexture(asset.TextureOverrides[i]) : nullptr;
+			data.Texture = i<textureFutures.Size() ? textureFutures[i].Get() : nullptr;
 		}
 		m_CacheLayout = layout;
 	}
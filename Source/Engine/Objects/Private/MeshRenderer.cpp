@@ -5,6 +5,8 @@
 #include "Render/public/DefaultResource.h"
 #include "Render/Public/GlobalShader.h"
 #include "System/Public/ConfigManager.h"
+#include "System/Public/ThreadPool.h"
+#include "System/Public/Timer.h"
 
 namespace {
 	inline void FillScenePSORenderTargets(RHIGraphicsPipelineStateDesc& desc) {
@@ -18,6 +20,20 @@ namespace {
 		desc.NumSamples = 1;
 	}
 
+	void BindBasePassMaterial(RHICommandBuffer* cmd, void* material) {
+		static_cast<Object::MaterialInterface*>(material)->BindBasePassShaderPrams(cmd, false);
+	}
+
+	void BindBasePassMaterialInstanced(RHICommandBuffer* cmd, void* material) {
+		static_cast<Object::MaterialInterface*>(material)->BindBasePassShaderPrams(cmd, true);
+	}
+
+	// Normalized depth of the aabb center, for sorting draws from near to far.
+	inline float GetSortDepth(const Math::FMatrix4x4& viewProjectMatrix, const Math::AABB3& aabb) {
+		const Math::FVector4 clip = viewProjectMatrix * Math::FVector4(aabb.Center(), 1.0f);
+		return clip.W > 0.0f ? clip.Z / clip.W : 0.0f;
+	}
+
 	class InstanceCullingCS: public Render::GlobalShader {
 		BEGIN_SHADER_PERMUTATION
 		SHADER_PERMUTATION_SWITCH(OCCLUSION_TEST, false)
@@ -38,7 +54,9 @@ namespace {
 		GLOBAL_SHADER_IMPLEMENT(InstanceCullingCS, "InstanceCulling.hlsl", "MainCS", EShaderStageFlags::Compute);
 	};
 
-	inline bool CheckMeshComponentValid(Object::MeshECSComponent* com) {
+	static constexpr uint32 NUM_OCCLUSION_TEST_PRIMITIVES_MIN = 256; // primitives tested per worker task at least
+
+	inline bool CheckMeshComponentValid(const Object::MeshECSComponent* com) {
 		return com->Primitives.Size();
 	}
 }
@@ -54,20 +72,52 @@ namespace Object {
 		TransformData.SetTransform(transform);
 	}
 
-	void MeshRenderSystem::Update(ECSScene* ecsScene, TransformECSComponent* transform, MeshECSComponent* meshCom) {
-		if(CheckMeshComponentValid(meshCom)) {
-			PrimitiveMgr* primitiveMgr = ((RenderScene*)ecsScene)->GetPrimitiveMgr();
-			primitiveMgr->AddPrimitive(meshCom, transform);
+	MeshRenderSystem::MeshRenderSystem() {
+		// instanced meshes are rendered by InstancedMeshRenderSystem
+		m_ExcludeMask = InstancedDataECSComponent::GetComponentMask();
+		// entities moving in or out also stamp the columns, so unchanged chunks have the same entities as last time
+		m_ChangeFilterMask = TransformECSComponent::GetComponentMask() | MeshECSComponent::GetComponentMask();
+	}
+
+	void MeshRenderSystem::UpdateEntities(ECSScene* ecsScene, const ECSChunkView& chunk, const TransformECSComponent* transforms, const MeshECSComponent* meshComs) {
+		PrimitiveMgr* primitiveMgr = ((RenderScene*)ecsScene)->GetPrimitiveMgr();
+		TArray<TArray<EntityID>>& chunkEntities = m_ChunkEntities[chunk.Archetype];
+		if(chunk.ChunkIndex >= chunkEntities.Size()) {
+			chunkEntities.Resize(chunk.ChunkIndex + 1);
 		}
+		// add the entities before releasing the last registrations, the ones staying in the chunk are never freed
+		const bool bTransformChanged = chunk.IsChanged<TransformECSComponent>();
+		const bool bMeshChanged = chunk.IsChanged<MeshECSComponent>();
+		const EntityID* entities = chunk.Archetype->GetEntityColumn(chunk.ChunkIndex);
+		TArray<EntityID> registered;
+		registered.Reserve(chunk.NumEntities);
+		for(uint32 i = 0; i < chunk.NumEntities; ++i) {
+			if(CheckMeshComponentValid(meshComs + i)) {
+				primitiveMgr->AddPrimitive(entities[i], meshComs + i, transforms + i, bTransformChanged, bMeshChanged);
+				registered.PushBack(entities[i]);
+			}
+		}
+		for(const EntityID entity: chunkEntities[chunk.ChunkIndex]) {
+			primitiveMgr->RemovePrimitive(entity);
+		}
+		chunkEntities[chunk.ChunkIndex].Swap(registered);
 	}
 
-	void InstancedMeshRenderSystem::Update(ECSScene* ecsScene, MeshECSComponent* meshCom, InstancedDataECSComponent* instanceCom) {
+	void InstancedMeshRenderSystem::Update(ECSScene* ecsScene, const MeshECSComponent* meshCom, InstancedDataECSComponent* instanceCom) {
 		if(CheckMeshComponentValid(meshCom)) {
 			PrimitiveMgr* primitiveMgr = ((RenderScene*)ecsScene)->GetPrimitiveMgr();
 			primitiveMgr->AddInstancedPrimitive(meshCom, instanceCom);
 		}
 	}
 
+	void OccluderRenderSystem::Update(ECSScene* ecsScene, const TransformECSComponent* transform, const OccluderECSComponent* occluder) {
+		if(Render::SoftwareOcclusion* occlusion = ((RenderScene*)ecsScene)->GetSoftwareOcclusion()) {
+			for(const Render::OccluderMesh* mesh : occluder->Meshes) {
+				occlusion->AddOccluder(mesh, transform->TransformData.ObjectMatrix);
+			}
+		}
+	}
+
 	RHIGraphicsPipelineState* PrimitiveMaterialPSOCache::GetPSO(MaterialChild* handle, bool bInstanced) {
 		// find or add
 		const uint32 idx = FixMaterialIndex(handle);
@@ -75,16 +125,23 @@ namespace Object {
 		return FindOrAddPSO(idx, bInstanced);
 	}
 
+	uint32 PrimitiveMaterialPSOCache::GetPSOIndex(const MaterialChild* handle, bool bInstanced) const {
+		CHECK(handle->MaterialIndex < m_MaterialCaches.Size());
+		return m_MaterialCaches[handle->MaterialIndex].PSOIndex[bInstanced];
+	}
+
 	void PrimitiveMaterialPSOCache::AddMaterialRef(MaterialChild* handle) {
+		MutexLock lock(m_RefMutex);
 		const uint32 idx = FixMaterialIndex(handle);
 		++m_MaterialCaches[idx].RefCounter;
 		handle->MaterialIndex = idx;
 	}
 
 	void PrimitiveMaterialPSOCache::RemoveMaterialRef(MaterialChild* handle) {
+		MutexLock lock(m_RefMutex);
 		const uint32 idx = FixMaterialIndex(handle);
 		if(m_MaterialCaches[idx].RefCounter) {
-			++m_MaterialCaches[idx].RefCounter;
+			--m_MaterialCaches[idx].RefCounter;
 		}
 		handle->MaterialIndex = INVALID_INDEX;
 	}
@@ -178,19 +235,37 @@ namespace Object {
 		}
 	}
 
-	void PrimitiveMgr::AddPrimitive(MeshECSComponent* mesh, TransformECSComponent* transform) {
-		m_PrimitiveRenderer->Add(mesh, transform);
+	void PrimitiveMgr::AddPrimitive(EntityID entity, const MeshECSComponent* mesh, const TransformECSComponent* transform, bool bTransformChanged, bool bMeshChanged) {
+		m_PrimitiveRenderer->Add(entity, mesh, transform, bTransformChanged, bMeshChanged);
+	}
+
+	void PrimitiveMgr::RemovePrimitive(EntityID entity) {
+		m_PrimitiveRenderer->Remove(entity);
 	}
 
-	void PrimitiveMgr::AddInstancedPrimitive(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) {
+	void PrimitiveMgr::AddInstancedPrimitive(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) {
+		instanceData->InstanceData.FlushUpdates();
+		{
+			MutexLock lock(m_InstanceUploadMutex);
+			m_InstanceUploads.PushBack(&instanceData->InstanceData);
+		}
 		m_PrimitiveInstancedRenderer->Add(mesh, instanceData);
 	}
 
 	void PrimitiveMgr::PreDrawCall() {
+		for(InstanceDataMgr* instanceData: m_InstanceUploads) {
+			instanceData->UploadUpdates();
+		}
+		m_InstanceUploads.Reset();
 		m_PrimitiveRenderer->PreDrawCall();
 		m_PrimitiveInstancedRenderer->PreDrawCall();
 	}
 
+	void PrimitiveMgr::CullViews(TConstArrayView<RenderCameraBase*> views) {
+		m_PrimitiveRenderer->CullViews(views);
+		m_PrimitiveInstancedRenderer->CullViews(views);
+	}
+
 	void PrimitiveMgr::GenerateBasePassDrawCall(Object::RenderCamera* camera) {
 		m_PrimitiveRenderer->GenerateBasePassDrawCall(camera);
 		m_PrimitiveInstancedRenderer->GenerateBasePassDrawCall(camera);
@@ -202,110 +277,195 @@ namespace Object {
 	}
 
 	void PrimitiveMgr::Clean() {
+		m_InstanceUploads.Reset();
 		m_PrimitiveRenderer->Reset();
 		m_PrimitiveInstancedRenderer->Reset();
 		m_MaterialPSOCache->Clean();
 	}
 
-	void PrimitiveRendererCPUDriven::Add(MeshECSComponent* mesh, TransformECSComponent* transform) {
-		uint32& indexRef = transform->CacheIndex;
-		if(indexRef == INVALID_INDEX) {
-			indexRef = m_PrimitiveStorage.Allocate();
-			PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(indexRef);
-			cacheGroup.PrimitiveCaches.Reserve(mesh->Primitives.Size());
-			for(PrimitiveRenderData& primitiveData: mesh->Primitives) {
-				PrimitiveCache& cache = cacheGroup.PrimitiveCaches.EmplaceBack();
-				cache.Material = primitiveData.Material;
-				cache.MaterialIndex = INVALID_INDEX;
-				cache.Primitive = primitiveData.Primitive;
-				m_MaterialPSOCache->AddMaterialRef(&cache);
-			}
+	void PrimitiveRendererCPUDriven::Add(EntityID entity, const MeshECSComponent* mesh, const TransformECSComponent* transform, bool bTransformChanged, bool bMeshChanged) {
+		auto [iter, bNew] = m_EntityGroups.try_emplace(entity, INVALID_INDEX);
+		if(bNew) {
+			iter->second = m_PrimitiveStorage.Allocate();
+			m_PrimitiveStorage.Get(iter->second).Entity = entity;
+			bMeshChanged = true;
 		}
-		PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(indexRef);
-		// check transform and update AABB
-		if(cacheGroup.Transform.ObjectMatrix != transform->TransformData.ObjectMatrix) {
+		const uint32 groupIndex = iter->second;
+		PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(groupIndex);
+		if(bMeshChanged) {
+			ReleasePrimitiveCaches(cacheGroup);
+			BuildPrimitiveCaches(cacheGroup, mesh);
+			bTransformChanged = true;
+		}
+		cacheGroup.RenderFlags = mesh->RenderFlags;
+		// update transform and AABB
+		if(bTransformChanged) {
 			cacheGroup.Transform = transform->TransformData;
-			for(auto& cache: cacheGroup.PrimitiveCaches) {
+			for(uint32 i = 0; i < cacheGroup.PrimitiveCaches.Size(); ++i) {
+				PrimitiveCache& cache = cacheGroup.PrimitiveCaches[i];
 				cache.AABB = cache.Primitive->AABB.Transform(transform->TransformData.ObjectMatrix);
+				if(INVALID_INDEX == cache.ProxyIndex) {
+					cache.ProxyIndex = m_SceneBVH.Insert(cache.AABB);
+					if(cache.ProxyIndex >= m_ProxyPrimitives.Size()) {
+						m_ProxyPrimitives.Resize(cache.ProxyIndex + 1);
+					}
+					m_ProxyPrimitives[cache.ProxyIndex] = { groupIndex, i };
+				}
+				else {
+					m_SceneBVH.Update(cache.ProxyIndex, cache.AABB);
+				}
 			}
 		}
 		++cacheGroup.RefCount;
-		for(uint32 i=0; i<EnumCast(ERenderPassType::MaxNum); ++i) {
-			if(mesh->RenderFlags.HasFlag((ERenderPassType)i)) {
-				m_RenderingCacheArray[i].PushBack(indexRef);
-			}
-		}
+	}
+
+	void PrimitiveRendererCPUDriven::Remove(EntityID entity) {
+		auto iter = m_EntityGroups.find(entity);
+		CHECK(iter != m_EntityGroups.end());
+		PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(iter->second);
+		CHECK(cacheGroup.RefCount);
+		--cacheGroup.RefCount;
 	}
 
 	void PrimitiveRendererCPUDriven::Reset() {
-		for(auto& renderingCache: m_RenderingCacheArray) {
-			renderingCache.Reset();
-		}
-		// Clear primitives with no ref
+		// Clear primitives with no registration
 		for(uint32 i=0; i<m_PrimitiveStorage.Size(); ++i) {
 			PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(i);
 			if(cacheGroup.IsValid()) {
 				cacheGroup.BufferIndex = INVALID_INDEX;
 				if(0 == cacheGroup.RefCount) {
-					for(PrimitiveCache& cache: cacheGroup.PrimitiveCaches) {
-						m_MaterialPSOCache->RemoveMaterialRef(&cache);
-					}
+					m_EntityGroups.erase(cacheGroup.Entity);
+					ReleasePrimitiveCaches(cacheGroup);
 					m_PrimitiveStorage.Free(i);
 				}
-				cacheGroup.RefCount = 0;
 			}
 		}
 		m_TransformBuffers.Reset();
 		m_TransformBuffers.Reserve(m_PrimitiveStorage.Size());
+		m_CulledViews.Reset();
 	}
 
-	void PrimitiveRendererCPUDriven::GenerateBasePassDrawCall(Object::RenderCamera* camera) {
-		Render::DrawCallQueue& queue = camera->GetRenderContext().RenderingQueue;
-		const Math::Frustum& frustum = camera->GetFrustum();
-		const auto& renderingIndices = m_RenderingCacheArray[EnumCast(ERenderPassType::BasePass)];
-		for(uint32 i : renderingIndices) {
-			PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(i);
-			for(auto& cache: cacheGroup.PrimitiveCaches) {
-				if(frustum.TestAABBSimple(cache.AABB)) {
-					const RHIDynamicBuffer& transformBuffer = GetTransformBuffer(i);
-					CHECK(transformBuffer.IsValid());
-					MaterialInterface* material = cache.Material;
-					RHIGraphicsPipelineState* pso = m_MaterialPSOCache->GetPSO(&cache, false);
-					CHECK(pso);
-					queue.PushDrawCall([pso, transformBuffer, material, primitive = cache.Primitive, cameraBuffer = camera->GetBuffer()](RHICommandBuffer* cmd) {
-						cmd->BindGraphicsPipeline(pso);
-						cmd->SetShaderParam(MaterialShader::uCamera, RHIShaderParam::UniformBuffer(cameraBuffer));
-						cmd->SetShaderParam(MaterialShader::uModel, RHIShaderParam::UniformBuffer(transformBuffer));
-						material->BindBasePassShaderPrams(cmd, false);
-						cmd->BindVertexBuffer(primitive->VertexBuffer.Get(), 0, 0);
-						cmd->BindIndexBuffer(primitive->IndexBuffer.Get(), 0);
-						cmd->DrawIndexed(primitive->IndexCount, 1, 0, 0, 0);
-					});
+	void PrimitiveRendererCPUDriven::BuildPrimitiveCaches(PrimitiveCacheGroup& cacheGroup, const MeshECSComponent* mesh) {
+		cacheGroup.PrimitiveCaches.Reserve(mesh->Primitives.Size());
+		for(const PrimitiveRenderData& primitiveData: mesh->Primitives) {
+			PrimitiveCache& cache = cacheGroup.PrimitiveCaches.EmplaceBack();
+			cache.Material = primitiveData.Material;
+			cache.MaterialIndex = INVALID_INDEX;
+			cache.Primitive = primitiveData.Primitive;
+			m_MaterialPSOCache->AddMaterialRef(&cache);
+		}
+	}
+
+	void PrimitiveRendererCPUDriven::ReleasePrimitiveCaches(PrimitiveCacheGroup& cacheGroup) {
+		for(PrimitiveCache& cache: cacheGroup.PrimitiveCaches) {
+			m_MaterialPSOCache->RemoveMaterialRef(&cache);
+			if(INVALID_INDEX != cache.ProxyIndex) {
+				m_SceneBVH.Remove(cache.ProxyIndex);
+			}
+		}
+		cacheGroup.PrimitiveCaches.Reset();
+	}
+
+	void PrimitiveRendererCPUDriven::PreDrawCall() {
+		// swap in the background rebuilt tree, or start rebuilding if refitting degraded it
+		m_SceneBVH.Tick();
+	}
+
+	void PrimitiveRendererCPUDriven::CullViews(TConstArrayView<RenderCameraBase*> views) {
+		m_CulledViews.Reset();
+		TFrameArray<Math::Frustum> frustums;
+		for(uint32 i = 0; i < views.Size() && i < Math::MAX_CULLING_VIEWS; ++i) {
+			m_CulledViews.PushBack(views[i]);
+			frustums.PushBack(views[i]->GetFrustum());
+		}
+		// subtrees out of all views are rejected once for all views
+		TFrameArray<TPair<uint32, uint32>> primitives;
+		TFrameArray<uint32> viewMasks;
+		CullPrimitives(frustums.Data(), frustums.Size(), primitives, viewMasks);
+		// the views having software occlusion drop the primitives hidden behind the occluders
+		for(uint32 viewIndex = 0; viewIndex < m_CulledViews.Size(); ++viewIndex) {
+			const Render::SoftwareOcclusion* occlusion = views[viewIndex]->GetRenderContext().Occlusion;
+			if(!occlusion || !occlusion->HasDepth()) {
+				continue;
+			}
+			const uint32 viewBit = 1u << viewIndex;
+			Engine::ParallelFor(0u, primitives.Size(), NUM_OCCLUSION_TEST_PRIMITIVES_MIN, [&](uint32 rangeBegin, uint32 rangeEnd) {
+				for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+					if(viewMasks[i] & viewBit) {
+						const PrimitiveCache& cache = m_PrimitiveStorage.Get(primitives[i].first).PrimitiveCaches[primitives[i].second];
+						if(!occlusion->TestAABB(cache.AABB)) {
+							viewMasks[i] &= ~viewBit;
+						}
+					}
 				}
+			});
+		}
+		m_CulledPrimitives.Reset();
+		m_CulledPrimitives.PushBack(primitives.Size(), primitives.Data());
+		m_CulledViewMasks.Reset();
+		m_CulledViewMasks.PushBack(viewMasks.Size(), viewMasks.Data());
+	}
+
+	void PrimitiveRendererCPUDriven::GenerateBasePassDrawCall(Object::RenderCamera* camera) {
+		Render::DrawCommandQueue& queue = camera->GetRenderContext().RenderingQueue;
+		const Math::FMatrix4x4& viewProjectMatrix = camera->GetViewProjectMatrix();
+		const RHIDynamicBuffer& cameraBuffer = camera->GetBuffer();
+		TFrameArray<TPair<uint32, uint32>> visiblePrimitives;
+		GetVisiblePrimitives(camera, ERenderPassType::BasePass, visiblePrimitives);
+		const uint32 viewParams = queue.AddParamBlock();
+		queue.AddParam(MaterialShader::uCamera, RHIShaderParam::UniformBuffer(cameraBuffer));
+		// primitives of a group are culled together, they share the block of the group transform
+		uint32 objectParams = INVALID_INDEX, objectGroupIndex = INVALID_INDEX;
+		for(const auto& [groupIndex, cacheIndex] : visiblePrimitives) {
+			PrimitiveCache& cache = m_PrimitiveStorage.Get(groupIndex).PrimitiveCaches[cacheIndex];
+			if(groupIndex != objectGroupIndex) {
+				const RHIDynamicBuffer& transformBuffer = GetTransformBuffer(groupIndex);
+				CHECK(transformBuffer.IsValid());
+				objectParams = queue.AddParamBlock();
+				queue.AddParam(MaterialShader::uModel, RHIShaderParam::UniformBuffer(transformBuffer));
+				objectGroupIndex = groupIndex;
 			}
+			RHIGraphicsPipelineState* pso = m_MaterialPSOCache->GetPSO(&cache, false);
+			CHECK(pso);
+			const uint64 sortKey = Render::DrawCommandQueue::MakeSortKey(0, m_MaterialPSOCache->GetPSOIndex(&cache, false),
+				cache.MaterialIndex, GetSortDepth(viewProjectMatrix, cache.AABB));
+			Render::DrawCommand& command = queue.AddCommand(sortKey);
+			command.PSO = pso;
+			command.BindMaterial = BindBasePassMaterial;
+			command.Material = cache.Material;
+			command.VertexBuffer = cache.Primitive->VertexBuffer.Get();
+			command.IndexBuffer = cache.Primitive->IndexBuffer.Get();
+			command.IndexCount = cache.Primitive->IndexCount;
+			command.ViewParams = viewParams;
+			command.ObjectParams = objectParams;
 		}
 	}
 
 	void PrimitiveRendererCPUDriven::GenerateDirectionalShadowDrawCall(Object::ShadowCamera* camera, RHIGraphicsPipelineState* pso) {
-		Render::DrawCallQueue& queue = camera->GetRenderContext().RenderingQueue;
-		const Math::Frustum& frustum = camera->GetFrustum();
-		const auto& renderingIndices = m_RenderingCacheArray[EnumCast(ERenderPassType::DirectionalShadow)];
-		for(uint32 i : renderingIndices) {
-			PrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(i);
-			for(auto& cache: cacheGroup.PrimitiveCaches) {
-				if(frustum.TestAABBSimple(cache.AABB)) {
-					const RHIDynamicBuffer& transformBuffer = GetTransformBuffer(i);
-					CHECK(transformBuffer.IsValid());
-					queue.PushDrawCall([pso, transformBuffer, primitive = cache.Primitive, cameraBuffer = camera->GetBuffer()](RHICommandBuffer* cmd) {
-						cmd->BindGraphicsPipeline(pso);
-						cmd->SetShaderParam(0, 0, RHIShaderParam::UniformBuffer(cameraBuffer));
-						cmd->SetShaderParam(1, 0, RHIShaderParam::UniformBuffer(transformBuffer));
-						cmd->BindVertexBuffer(primitive->VertexBuffer.Get(), 0, 0);
-						cmd->BindIndexBuffer(primitive->IndexBuffer.Get(), 0);
-						cmd->DrawIndexed(primitive->IndexCount, 1, 0, 0, 0);
-					});
-				}
+		Render::DrawCommandQueue& queue = camera->GetRenderContext().RenderingQueue;
+		const Math::FMatrix4x4& viewProjectMatrix = camera->GetViewProjectMatrix();
+		const RHIDynamicBuffer& cameraBuffer = camera->GetBuffer();
+		TFrameArray<TPair<uint32, uint32>> visiblePrimitives;
+		GetVisiblePrimitives(camera, ERenderPassType::DirectionalShadow, visiblePrimitives);
+		const uint32 viewParams = queue.AddParamBlock();
+		queue.AddParam(0, 0, RHIShaderParam::UniformBuffer(cameraBuffer));
+		uint32 objectParams = INVALID_INDEX, objectGroupIndex = INVALID_INDEX;
+		for(const auto& [groupIndex, cacheIndex] : visiblePrimitives) {
+			const PrimitiveCache& cache = m_PrimitiveStorage.Get(groupIndex).PrimitiveCaches[cacheIndex];
+			if(groupIndex != objectGroupIndex) {
+				const RHIDynamicBuffer& transformBuffer = GetTransformBuffer(groupIndex);
+				CHECK(transformBuffer.IsValid());
+				objectParams = queue.AddParamBlock();
+				queue.AddParam(1, 0, RHIShaderParam::UniformBuffer(transformBuffer));
+				objectGroupIndex = groupIndex;
 			}
+			Render::DrawCommand& command = queue.AddCommand(Render::DrawCommandQueue::MakeSortKey(0, 0, 0, GetSortDepth(viewProjectMatrix, cache.AABB)));
+			command.PSO = pso;
+			command.VertexBuffer = cache.Primitive->VertexBuffer.Get();
+			command.IndexBuffer = cache.Primitive->IndexBuffer.Get();
+			command.IndexCount = cache.Primitive->IndexCount;
+			command.ViewParams = viewParams;
+			command.ObjectParams = objectParams;
 		}
 	}
 
@@ -319,14 +479,58 @@ namespace Object {
 		return m_TransformBuffers[group.BufferIndex];
 	}
 
-	void PrimitiveInstancedRendererCPUDriven::Add(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) {
+	void PrimitiveRendererCPUDriven::CullPrimitives(const Math::Frustum* frustums, uint32 numFrustums, TFrameArray<TPair<uint32, uint32>>& outPrimitives, TFrameArray<uint32>& outViewMasks) {
+		TFrameArray<uint32> proxies;
+		m_SceneBVH.CullViews(frustums, numFrustums, proxies, outViewMasks);
+		// the tree keeps primitives until Reset, skip the ones no chunk registers any more
+		outPrimitives.Reserve(proxies.Size());
+		uint32 numVisible = 0;
+		for(uint32 i = 0; i < proxies.Size(); ++i) {
+			const TPair<uint32, uint32>& primitive = m_ProxyPrimitives[proxies[i]];
+			if(m_PrimitiveStorage.Get(primitive.first).RefCount) {
+				outPrimitives.PushBack(primitive);
+				outViewMasks[numVisible++] = outViewMasks[i];
+			}
+		}
+		outViewMasks.Resize(numVisible);
+	}
+
+	void PrimitiveRendererCPUDriven::GetVisiblePrimitives(const RenderCameraBase* camera, ERenderPassType pass, TFrameArray<TPair<uint32, uint32>>& outVisible) {
+		uint32 viewIndex = 0;
+		while(viewIndex < m_CulledViews.Size() && m_CulledViews[viewIndex] != camera) {
+			++viewIndex;
+		}
+		if(viewIndex == m_CulledViews.Size()) {
+			const Math::Frustum& frustum = camera->GetFrustum();
+			TFrameArray<TPair<uint32, uint32>> primitives;
+			TFrameArray<uint32> viewMasks;
+			CullPrimitives(&frustum, 1, primitives, viewMasks);
+			for(const TPair<uint32, uint32>& primitive : primitives) {
+				if(m_PrimitiveStorage.Get(primitive.first).RenderFlags.HasFlag(pass)) {
+					outVisible.PushBack(primitive);
+				}
+			}
+			return;
+		}
+		const uint32 viewBit = 1u << viewIndex;
+		for(uint32 i = 0; i < m_CulledPrimitives.Size(); ++i) {
+			if(m_CulledViewMasks[i] & viewBit) {
+				const TPair<uint32, uint32>& primitive = m_CulledPrimitives[i];
+				if(m_PrimitiveStorage.Get(primitive.first).RenderFlags.HasFlag(pass)) {
+					outVisible.PushBack(primitive);
+				}
+			}
+		}
+	}
+
+	void PrimitiveInstancedRendererCPUDriven::Add(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) {
 		uint32& indexRef = instanceData->CacheIndex;
 		if (indexRef == INVALID_INDEX) {
 			indexRef = m_PrimitiveStorage.Allocate();
 			InstancedPrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(indexRef);
 			cacheGroup.DataMgr = &instanceData->InstanceData;
 			cacheGroup.PrimitiveCaches.Reserve(mesh->Primitives.Size());
-			for (PrimitiveRenderData& primitiveData : mesh->Primitives) {
+			for (const PrimitiveRenderData& primitiveData : mesh->Primitives) {
 				InstancedPrimitiveCache& cache = cacheGroup.PrimitiveCaches.EmplaceBack();
 				cache.Material = primitiveData.Material;
 				cache.MaterialIndex = INVALID_INDEX;
@@ -361,62 +565,70 @@ namespace Object {
 	}
 
 	void PrimitiveInstancedRendererCPUDriven::GenerateBasePassDrawCall(Object::RenderCamera* camera) {
-		Render::DrawCallQueue& queue = camera->GetRenderContext().RenderingQueue;
+		Render::DrawCommandQueue& queue = camera->GetRenderContext().RenderingQueue;
 		const Math::Frustum& frustum = camera->GetFrustum();
+		const Render::SoftwareOcclusion* occlusion = camera->GetRenderContext().Occlusion;
 		const auto& renderingIndices = m_RenderingCacheArray[EnumCast(ERenderPassType::BasePass)];
+		const uint32 viewParams = queue.AddParamBlock();
+		queue.AddParam(MaterialShader::uCamera, RHIShaderParam::UniformBuffer(camera->GetBuffer()));
 		for(uint32 i : renderingIndices) {
 			InstancedPrimitiveCacheGroup& group = m_PrimitiveStorage.Get(i);
-			TArray<uint32> instanceIDs;
-			group.DataMgr->GenerateInstanceID(frustum, instanceIDs);
+			TFrameArray<uint32> instanceIDs;
+			group.DataMgr->GenerateInstanceID(frustum, instanceIDs, occlusion);
 			if(instanceIDs.IsEmpty()) {
 				continue;
 			}
 			RHIDynamicBuffer instanceIDBuffer = RHI::Instance()->AllocateDynamicBuffer(EBufferFlags::SRV,
 				instanceIDs.ByteSize(), instanceIDs.Data(), sizeof(uint32));
-			RHIBuffer* instanceBuffer = group.DataMgr->GetInstanceBuffer();
+			const uint32 objectParams = queue.AddParamBlock();
+			queue.AddParam(MaterialShader::uInstanceData, RHIShaderParam::StructuredBuffer(group.DataMgr->GetInstanceBuffer()));
+			queue.AddParam(MaterialShader::uInstanceID, RHIShaderParam::StructuredBuffer(instanceIDBuffer));
 			uint32 instanceCount = instanceIDs.Size();
 			for(auto& cache: group.PrimitiveCaches) {
-				MaterialInterface* material = cache.Material;
 				RHIGraphicsPipelineState* pso = m_MaterialPSOCache->GetPSO(&cache, true);
-				queue.PushDrawCall([pso, instanceBuffer, instanceIDBuffer, material, instanceCount, primitive=cache.Primitive, cameraBuffer=camera->GetBuffer()](RHICommandBuffer* cmd) {
-					cmd->BindGraphicsPipeline(pso);
-					cmd->SetShaderParam(MaterialShader::uCamera, RHIShaderParam::UniformBuffer(cameraBuffer));
-					cmd->SetShaderParam(MaterialShader::uInstanceData, RHIShaderParam::StructuredBuffer(instanceBuffer));
-					cmd->SetShaderParam(MaterialShader::uInstanceID, RHIShaderParam::StructuredBuffer(instanceIDBuffer));
-					material->BindBasePassShaderPrams(cmd, true);
-					cmd->BindVertexBuffer(primitive->VertexBuffer, 0, 0);
-					cmd->BindIndexBuffer(primitive->IndexBuffer, 0);
-					cmd->DrawIndexed(primitive->IndexCount, instanceCount, 0, 0, 0);
-				});
+				const uint64 sortKey = Render::DrawCommandQueue::MakeSortKey(0, m_MaterialPSOCache->GetPSOIndex(&cache, true), cache.MaterialIndex, 0.0f);
+				Render::DrawCommand& command = queue.AddCommand(sortKey);
+				command.PSO = pso;
+				command.BindMaterial = BindBasePassMaterialInstanced;
+				command.Material = cache.Material;
+				command.VertexBuffer = cache.Primitive->VertexBuffer.Get();
+				command.IndexBuffer = cache.Primitive->IndexBuffer.Get();
+				command.IndexCount = cache.Primitive->IndexCount;
+				command.InstanceCount = instanceCount;
+				command.ViewParams = viewParams;
+				command.ObjectParams = objectParams;
 			}
 		}
 	}
 
 	void PrimitiveInstancedRendererCPUDriven::GenerateDirectionalShadowDrawCall(Object::ShadowCamera* camera, RHIGraphicsPipelineState* pso) {
-		Render::DrawCallQueue& queue = camera->GetRenderContext().RenderingQueue;
+		Render::DrawCommandQueue& queue = camera->GetRenderContext().RenderingQueue;
 		const Math::Frustum& frustum = camera->GetFrustum();
 		const auto& renderingIndices = m_RenderingCacheArray[EnumCast(ERenderPassType::DirectionalShadow)];
+		const uint32 viewParams = queue.AddParamBlock();
+		queue.AddParam(0, 0, RHIShaderParam::UniformBuffer(camera->GetBuffer()));
 		for(uint32 i : renderingIndices) {
 			InstancedPrimitiveCacheGroup& group = m_PrimitiveStorage.Get(i);
-			TArray<uint32> instanceIDs;
+			TFrameArray<uint32> instanceIDs;
 			group.DataMgr->GenerateInstanceID(frustum, instanceIDs);
 			if(instanceIDs.IsEmpty()) {
 				continue;
 			}
 			RHIDynamicBuffer instanceIDBuffer = RHI::Instance()->AllocateDynamicBuffer(EBufferFlags::SRV,
 				instanceIDs.ByteSize(), instanceIDs.Data(), sizeof(uint32));
-			RHIBuffer* instanceBuffer = group.DataMgr->GetInstanceBuffer();
+			const uint32 objectParams = queue.AddParamBlock();
+			queue.AddParam(1, 0, RHIShaderParam::StructuredBuffer(group.DataMgr->GetInstanceBuffer()));
+			queue.AddParam(1, 1, RHIShaderParam::StructuredBuffer(instanceIDBuffer));
 			uint32 instanceCount = instanceIDs.Size();
 			for(auto& cache: group.PrimitiveCaches) {
-				queue.PushDrawCall([pso, instanceBuffer, instanceIDBuffer, instanceCount, primitive=cache.Primitive, cameraBuffer=camera->GetBuffer()](RHICommandBuffer* cmd) {
-					cmd->BindGraphicsPipeline(pso);
-					cmd->SetShaderParam(0, 0, RHIShaderParam::UniformBuffer(cameraBuffer));
-					cmd->SetShaderParam(1, 0, RHIShaderParam::StructuredBuffer(instanceBuffer));
-					cmd->SetShaderParam(1, 1, RHIShaderParam::StructuredBuffer(instanceIDBuffer));
-					cmd->BindVertexBuffer(primitive->VertexBuffer, 0, 0);
-					cmd->BindIndexBuffer(primitive->IndexBuffer, 0);
-					cmd->DrawIndexed(primitive->IndexCount, instanceCount, 0, 0, 0);
-				});
+				Render::DrawCommand& command = queue.AddCommand(Render::DrawCommandQueue::MakeSortKey(0, 0, 0, 0.0f));
+				command.PSO = pso;
+				command.VertexBuffer = cache.Primitive->VertexBuffer.Get();
+				command.IndexBuffer = cache.Primitive->IndexBuffer.Get();
+				command.IndexCount = cache.Primitive->IndexCount;
+				command.InstanceCount = instanceCount;
+				command.ViewParams = viewParams;
+				command.ObjectParams = objectParams;
 			}
 		}
 	}
@@ -425,33 +637,12 @@ namespace Object {
 
 	static constexpr uint32 NUM_THREAD_PER_GROUP = 256;
 
-	struct CullingParams {
-		Math::Frustum Frustum;
-		Math::FMatrix4x4 ViewProjectMatrix;
-		Math::FVector4 HZBSizeScale; // (width scale, height scale, unused, unused)
-	};
-
-	struct GPUAABBData {
-		Math::FVector4 AABBMin; // (AABBMin.xyz, instance start)
-		Math::FVector4 AABBMax; // (AABBMax.xyz, instanec end);
-	};
-
-	struct ClusterData {
-		uint32 ClusterIndex;
-		uint32 SrcInstanceOffset;
-		uint32 DstInstanceOffset;
-		uint32 PrimitiveStart;
-		uint32 PrimitiveCount;
-	};
-
-	struct InstanceDrawData {
-		DrawIndexedIndirectCommand Command;
-	};
-
 	PrimitiveInstancedRendererGPUDriven::PrimitiveInstancedRendererGPUDriven(PrimitiveMaterialPSOCache* cache):
 	PrimitiveInstancedRendererBase(cache),
 	m_IsBufferDirty(false),
-	m_EnableOcclusionTest(true){
+	m_EnableOcclusionTest(true),
+	m_EnableCPUCulling(Engine::ConfigMgr::Instance().GetProjectConfig().GPUDrivenCullingOnCPU),
+	m_CaptureIndex(0){
 		{
 			InstanceCullingCS::ShaderPermutation cp;
 			cp.OCCLUSION_TEST = true;
@@ -468,14 +659,14 @@ namespace Object {
 		m_SRVAlignment = RHI::Instance()->GetBufferAlignment(EBufferFlags::SRV);
 	}
 
-	void PrimitiveInstancedRendererGPUDriven::Add(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) {
+	void PrimitiveInstancedRendererGPUDriven::Add(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) {
 		uint32& indexRef = instanceData->CacheIndex;
 		if (indexRef == INVALID_INDEX) {
 			indexRef = m_PrimitiveStorage.Allocate();
 			InstancedPrimitiveCacheGroup& cacheGroup = m_PrimitiveStorage.Get(indexRef);
 			cacheGroup.DataMgr = &instanceData->InstanceData;
 			cacheGroup.PrimitiveCaches.Reserve(mesh->Primitives.Size());
-			for (PrimitiveRenderData& primitiveData : mesh->Primitives) {
+			for (const PrimitiveRenderData& primitiveData : mesh->Primitives) {
 				InstancedPrimitiveCache& cache = cacheGroup.PrimitiveCaches.EmplaceBack();
 				cache.Material = primitiveData.Material;
 				cache.MaterialIndex = INVALID_INDEX;
@@ -529,25 +720,29 @@ namespace Object {
 
 		uint32 primitiveIndex = 0;
 		uint32 alignedInstanceOffset = 0;
+		const uint32 viewParams = context.RenderingQueue.AddParamBlock();
+		context.RenderingQueue.AddParam(MaterialShader::uCamera, RHIShaderParam::UniformBuffer(cameraBuffer));
 		for(uint32 groupIndex: m_RenderingCacheArray[EnumCast(ERenderPassType::BasePass)]) {
 			InstancedPrimitiveCacheGroup& group = m_PrimitiveStorage.Get(groupIndex);
 			CHECK(group.IsValid());
-			RHIBuffer* instanceBuffer = group.DataMgr->GetInstanceBuffer();
 			const uint32 alignedInstanceSize = AlignInstanceSize(group.DataMgr->GetInstances().Size());
+			const uint32 objectParams = context.RenderingQueue.AddParamBlock();
+			context.RenderingQueue.AddParam(MaterialShader::uInstanceData, RHIShaderParam::StructuredBuffer(group.DataMgr->GetInstanceBuffer()));
+			context.RenderingQueue.AddParam(MaterialShader::uInstanceID, RHIShaderParam::StructuredBuffer(instanceIDBuffer,
+				alignedInstanceOffset * sizeof(uint32), alignedInstanceSize * sizeof(uint32)));
 			for(InstancedPrimitiveCache& cache: group.PrimitiveCaches) {
-				MaterialInterface* material = cache.Material;
 				RHIGraphicsPipelineState* pso = m_MaterialPSOCache->GetPSO(&cache, true);
-				context.RenderingQueue.PushDrawCall([cameraBuffer, indirectCmdBuffer, primitiveIndex, instanceIDBuffer, instanceBuffer, pso, material, alignedInstanceOffset, alignedInstanceSize, primitive=cache.Primitive](RHICommandBuffer* cmd) {
-					cmd->BindGraphicsPipeline(pso);
-					cmd->SetShaderParam(MaterialShader::uCamera, RHIShaderParam::UniformBuffer(cameraBuffer));
-					cmd->SetShaderParam(MaterialShader::uInstanceData, RHIShaderParam::StructuredBuffer(instanceBuffer));
-					cmd->SetShaderParam(MaterialShader::uInstanceID, RHIShaderParam::StructuredBuffer(instanceIDBuffer,
-						alignedInstanceOffset * sizeof(uint32), alignedInstanceSize * sizeof(uint32)));
-					material->BindBasePassShaderPrams(cmd, true);
-					cmd->BindVertexBuffer(primitive->VertexBuffer, 0, 0);
-					cmd->BindIndexBuffer(primitive->IndexBuffer, 0);
-					cmd->DrawIndexedIndirect(indirectCmdBuffer, primitiveIndex * sizeof(InstanceDrawData), 1);
-				});
+				const uint64 sortKey = Render::DrawCommandQueue::MakeSortKey(0, m_MaterialPSOCache->GetPSOIndex(&cache, true), cache.MaterialIndex, 0.0f);
+				Render::DrawCommand& command = context.RenderingQueue.AddCommand(sortKey);
+				command.PSO = pso;
+				command.BindMaterial = BindBasePassMaterialInstanced;
+				command.Material = cache.Material;
+				command.VertexBuffer = cache.Primitive->VertexBuffer.Get();
+				command.IndexBuffer = cache.Primitive->IndexBuffer.Get();
+				command.IndirectBuffer = indirectCmdBuffer;
+				command.IndirectOffset = primitiveIndex * sizeof(DrawIndexedIndirectCommand);
+				command.ViewParams = viewParams;
+				command.ObjectParams = objectParams;
 				++primitiveIndex;
 			}
 			alignedInstanceOffset += alignedInstanceSize;
@@ -567,22 +762,25 @@ namespace Object {
 
 		uint32 primitiveIndex = 0;
 		uint32 alignedInstanceOffset = 0;
+		const uint32 viewParams = context.RenderingQueue.AddParamBlock();
+		context.RenderingQueue.AddParam(0, 0, RHIShaderParam::UniformBuffer(cameraBuffer));
 		for (uint32 groupIndex : m_RenderingCacheArray[EnumCast(ERenderPassType::DirectionalShadow)]) {
 			InstancedPrimitiveCacheGroup& group = m_PrimitiveStorage.Get(groupIndex);
 			CHECK(group.IsValid());
-			RHIBuffer* instanceBuffer = group.DataMgr->GetInstanceBuffer();
 			const uint32 alignedInstanceSize = AlignInstanceSize(group.DataMgr->GetInstances().Size());
+			const uint32 objectParams = context.RenderingQueue.AddParamBlock();
+			context.RenderingQueue.AddParam(1, 0, RHIShaderParam::StructuredBuffer(group.DataMgr->GetInstanceBuffer()));
+			context.RenderingQueue.AddParam(1, 1, RHIShaderParam::StructuredBuffer(instanceIDBuffer,
+				alignedInstanceOffset * sizeof(uint32), alignedInstanceSize * sizeof(uint32)));
 			for (InstancedPrimitiveCache& cache : group.PrimitiveCaches) {
-				context.RenderingQueue.PushDrawCall([cameraBuffer, indirectCmdBuffer, primitiveIndex, instanceIDBuffer, instanceBuffer, pso, alignedInstanceOffset, alignedInstanceSize, primitive=cache.Primitive](RHICommandBuffer* cmd) {
-					cmd->BindGraphicsPipeline(pso);
-					cmd->SetShaderParam(0, 0, RHIShaderParam::UniformBuffer(cameraBuffer));
-					cmd->SetShaderParam(1, 0, RHIShaderParam::StructuredBuffer(instanceBuffer));
-					cmd->SetShaderParam(1, 1, RHIShaderParam::StructuredBuffer(instanceIDBuffer,
-						alignedInstanceOffset * sizeof(uint32), alignedInstanceSize * sizeof(uint32)));
-					cmd->BindVertexBuffer(primitive->VertexBuffer, 0, 0);
-					cmd->BindIndexBuffer(primitive->IndexBuffer, 0);
-					cmd->DrawIndexedIndirect(indirectCmdBuffer, primitiveIndex * sizeof(InstanceDrawData), 1);
-				});
+				Render::DrawCommand& command = context.RenderingQueue.AddCommand(Render::DrawCommandQueue::MakeSortKey(0, 0, 0, 0.0f));
+				command.PSO = pso;
+				command.VertexBuffer = cache.Primitive->VertexBuffer.Get();
+				command.IndexBuffer = cache.Primitive->IndexBuffer.Get();
+				command.IndirectBuffer = indirectCmdBuffer;
+				command.IndirectOffset = primitiveIndex * sizeof(DrawIndexedIndirectCommand);
+				command.ViewParams = viewParams;
+				command.ObjectParams = objectParams;
 				++primitiveIndex;
 			}
 			alignedInstanceOffset += alignedInstanceSize;
@@ -597,8 +795,8 @@ namespace Object {
 				if (!group.RefCount) {
 					return true;
 				}
-				// buffer updated
-				if (group.DataMgr->GetInstanceBuffer() != group.CacheInstanceBuffer) {
+				// instances or clusters updated
+				if (group.DataMgr->GetVersion() != group.CacheVersion) {
 					return true;
 				}
 			}
@@ -610,14 +808,17 @@ namespace Object {
 		// combine all instance buffer
 		constexpr auto passCount = EnumCast(ERenderPassType::MaxNum);
 
-		TArray<GPUAABBData> instanceAABBs;
-		TArray<GPUAABBData> clusterAABBs;
-		TStaticArray<TArray<ClusterData>, passCount> clusterDatasArray;
-		TStaticArray<TArray<InstanceDrawData>, passCount> indirectCmdsArray;
+		TArray<Render::InstanceCullingAABB>& instanceAABBs = m_InstanceAABBs;
+		TArray<Render::InstanceCullingAABB>& clusterAABBs = m_ClusterAABBs;
+		instanceAABBs.Reset();
+		clusterAABBs.Reset();
+		for(PassBuffers& buffers: m_PassBuffersArray) {
+			buffers.IndirectCmds.Reset();
+			buffers.Clusters.Reset();
+		}
 		TStaticArray<uint32, passCount> alignedInstanceCountArray(0);
 		TStaticArray<uint32, passCount> primitiveCountArray(0);
 		TStaticArray<uint32, passCount> groupCountArray(0);
-		TStaticArray<uint32, passCount> clusterCountArray(0);
 
 		for(auto& indices: m_RenderingCacheArray) {
 			indices.Reset();
@@ -629,22 +830,21 @@ namespace Object {
 			if(!group.IsValid()) {
 				continue;
 			}
+			group.CacheVersion = group.DataMgr->GetVersion();
 			if(group.DataMgr->IsEmpty()) {
-				group.CacheInstanceBuffer = nullptr;
 				continue;
 			}
-			group.CacheInstanceBuffer = group.DataMgr->GetInstanceBuffer();
 
 			// collect global data
 			const uint32 clusterOffset = clusterAABBs.Size();
 			const uint32 instanceOffset = instanceAABBs.Size();
 			for (auto& aabb : group.DataMgr->GetInstanceAABBs()) {
-				GPUAABBData& aabbData = instanceAABBs.EmplaceBack();
+				Render::InstanceCullingAABB& aabbData = instanceAABBs.EmplaceBack();
 				aabbData.AABBMin = Math::FVector4(aabb.Min, 1.0f);
 				aabbData.AABBMax = Math::FVector4(aabb.Max, 1.0f);
 			}
 			for (auto& cluster : group.DataMgr->GetClusters()) {
-				GPUAABBData& clusterData = clusterAABBs.EmplaceBack();
+				Render::InstanceCullingAABB& clusterData = clusterAABBs.EmplaceBack();
 				clusterData.AABBMin = Math::FVector4(cluster.AABB.Min, (float)cluster.InstanceStart);
 				clusterData.AABBMax = Math::FVector4(cluster.AABB.Max, (float)cluster.InstanceEnd);
 			}
@@ -653,27 +853,31 @@ namespace Object {
 			const uint32 instanceCount = group.DataMgr->GetInstances().Size();
 			// offset must be aligned by srv buffer requirement
 			const uint32 alignedInstanceCount = Math::AlignUp(instanceCount, m_SRVAlignment);
-			const uint32 clusterCount = group.DataMgr->GetClusters().Size();
+			// only leaves are dispatched, inner nodes share the instances of their leaves
+			const TConstArrayView<InstanceDataMgr::ClusterNode> clusters = group.DataMgr->GetClusters();
 			for(uint32 pass=0; pass< passCount; ++pass) {
 				if(group.RenderFlag.HasFlag((ERenderPassType)pass)) {
+					PassBuffers& buffers = m_PassBuffersArray[pass];
 					m_RenderingCacheArray[pass].PushBack(groupIndex);
 					for (auto& cache : group.PrimitiveCaches) {
-						auto& cmd = indirectCmdsArray[pass].EmplaceBack().Command;
+						auto& cmd = buffers.IndirectCmds.EmplaceBack();
 						cmd.IndexCount = cache.Primitive->IndexCount;
 						cmd.InstanceCount = 0;
 						cmd.FirstIndex = 0;
 						cmd.FirstVertex = 0;
 						cmd.FirstInstance = 0;
 					}
-					for(uint32 i=0; i<clusterCount; ++i) {
-						auto& clusterData = clusterDatasArray[pass].EmplaceBack();
+					for(uint32 i=0; i<clusters.Size(); ++i) {
+						if(clusters[i].HasChild() || clusters[i].IsEmpty()) {
+							continue;
+						}
+						auto& clusterData = buffers.Clusters.EmplaceBack();
 						clusterData.ClusterIndex = clusterOffset + i;
 						clusterData.SrcInstanceOffset = instanceOffset;
 						clusterData.DstInstanceOffset = alignedInstanceCountArray[pass];
 						clusterData.PrimitiveStart = primitiveCountArray[pass];
 						clusterData.PrimitiveCount = primitiveCount;
 					}
-					clusterCountArray[pass] += clusterCount;
 					alignedInstanceCountArray[pass] += alignedInstanceCount;
 					primitiveCountArray[pass] += primitiveCount;
 					++groupCountArray[pass];
@@ -687,7 +891,7 @@ namespace Object {
 			if (instanceAABBs.Size()) {
 				if (!m_InstanceAABBBuffer || m_InstanceAABBBuffer->GetDesc().ByteSize < instanceAABBs.ByteSize()) {
 					m_InstanceAABBBuffer = RHI::Instance()->CreateBuffer({ EBufferFlags::SRV | EBufferFlags::CopyDst,
-						instanceAABBs.ByteSize(), sizeof(GPUAABBData) });
+						instanceAABBs.ByteSize(), sizeof(Render::InstanceCullingAABB) });
 					m_InstanceAABBBuffer->SetName("InstanceAABB");
 				}
 				m_InstanceAABBBuffer->UpdateData(instanceAABBs.Data(), instanceAABBs.ByteSize(), 0);
@@ -700,7 +904,7 @@ namespace Object {
 			if (clusterAABBs.Size()) {
 				if (!m_ClusterAABBBuffer || m_ClusterAABBBuffer->GetDesc().ByteSize < clusterAABBs.ByteSize()) {
 					m_ClusterAABBBuffer = RHI::Instance()->CreateBuffer({ EBufferFlags::SRV | EBufferFlags::CopyDst,
-						clusterAABBs.ByteSize(), sizeof(GPUAABBData) });
+						clusterAABBs.ByteSize(), sizeof(Render::InstanceCullingAABB) });
 					m_ClusterAABBBuffer->SetName("ClusterAABB");
 				}
 				m_ClusterAABBBuffer->UpdateData(clusterAABBs.Data(), clusterAABBs.ByteSize(), 0);
@@ -714,11 +918,11 @@ namespace Object {
 		for(uint32 pass=0; pass<passCount; ++pass) {
 			PassBuffers& buffers = m_PassBuffersArray[pass];
 			// cluster data
-			auto& clusterDatas = clusterDatasArray[pass];
+			auto& clusterDatas = buffers.Clusters;
 			if(clusterDatas.Size()) {
 				if(!buffers.Cluster || buffers.Cluster->GetDesc().ByteSize < clusterDatas.ByteSize()) {
 					buffers.Cluster = RHI::Instance()->CreateBuffer({ EBufferFlags::SRV | EBufferFlags::CopyDst,
-						clusterDatas.ByteSize(), sizeof(ClusterData) });
+						clusterDatas.ByteSize(), sizeof(Render::InstanceCullingCluster) });
 					buffers.Cluster->SetName("Cluster");
 				}
 				buffers.Cluster->UpdateData(clusterDatas.Data(), clusterDatas.ByteSize(), 0);
@@ -728,17 +932,17 @@ namespace Object {
 			}
 
 			// indirect draw cmd
-			auto& indirectCmds = indirectCmdsArray[pass];
+			auto& indirectCmds = buffers.IndirectCmds;
 			if(indirectCmds.Size()) {
 				if (!buffers.IndirectCmd || buffers.IndirectCmd->GetDesc().ByteSize < indirectCmds.ByteSize()) {
 					buffers.IndirectCmd = RHI::Instance()->CreateBuffer({ EBufferFlags::CopySrc,
-						indirectCmds.ByteSize(), sizeof(InstanceDrawData) });
+						indirectCmds.ByteSize(), sizeof(DrawIndexedIndirectCommand) });
 					buffers.IndirectCmd->SetName("IndirectCmd");
 				}
 				buffers.IndirectCmd->UpdateData(indirectCmds.Data(), indirectCmds.ByteSize(), 0);
 			}
 
-			buffers.ClusterSize = clusterCountArray[pass];
+			buffers.ClusterSize = clusterDatas.Size();
 			buffers.AlignedInstanceSize = alignedInstanceCountArray[pass];
 			buffers.PrimitiveSize = primitiveCountArray[pass];
 		}
@@ -751,22 +955,33 @@ namespace Object {
 		//  check instance id buffer
 		const uint32 instanceIDByteSize = buffer.AlignedInstanceSize * sizeof(uint32);
 		if(!context.CullResultBuffer || context.CullResultBuffer->GetDesc().ByteSize < instanceIDByteSize) {
-			context.CullResultBuffer = RHI::Instance()->CreateBuffer({ EBufferFlags::SRV | EBufferFlags::UAV,
+			context.CullResultBuffer = RHI::Instance()->CreateBuffer({ EBufferFlags::SRV | EBufferFlags::UAV | EBufferFlags::CopyDst,
 				instanceIDByteSize, sizeof(uint32) });
 			context.CullResultBuffer->SetName("CullingResult");
 		}
 
 		// check indirect cmd buffer
-		const uint32 indirectCmdByteSize = buffer.PrimitiveSize * sizeof(InstanceDrawData);
+		const uint32 indirectCmdByteSize = buffer.PrimitiveSize * sizeof(DrawIndexedIndirectCommand);
 		if(!context.IndirectCmdBuffer || context.IndirectCmdBuffer->GetDesc().ByteSize < indirectCmdByteSize) {
 			context.IndirectCmdBuffer = RHI::Instance()->CreateBuffer({ EBufferFlags::UAV | EBufferFlags::CopyDst | EBufferFlags::IndirectDraw,
-				indirectCmdByteSize, sizeof(InstanceDrawData) });
+				indirectCmdByteSize, sizeof(DrawIndexedIndirectCommand) });
 			context.IndirectCmdBuffer->SetName("IndirectCmd");
 		}
 
+		const uint32 captureFrame = Engine::ConfigMgr::Instance().GetProjectConfig().InstanceCullingCaptureFrame;
+		if(captureFrame && captureFrame == Engine::Timer::GetFrame()) {
+			CaptureCulling(camera, context, pass);
+		}
+
+		if(m_EnableCPUCulling) {
+			CPUCulling(camera, context, pass);
+			return;
+		}
+
 		// culling param data
-		CullingParams params;
+		Render::InstanceCullingParams params{};
 		params.Frustum = camera->GetFrustum();
+		params.NumClusters = buffer.ClusterSize;
 		if (hzb) {
 			params.ViewProjectMatrix = context.HZB->GetViewProjectMatrix();
 			auto actualSize = context.HZB->GetActualSize();
@@ -776,6 +991,7 @@ namespace Object {
 		RHIDynamicBuffer paramBuffer = RHI::Instance()->AllocateDynamicBuffer(EBufferFlags::Uniform, sizeof(params), &params, 0);
 
 		uint32 numThreadGroup = (buffer.ClusterSize + NUM_THREAD_PER_GROUP - 1) / NUM_THREAD_PER_GROUP;
+		context.NumCulledClusters += buffer.ClusterSize;
 		RHIBuffer* srcIndirectCmdBuffer = buffer.IndirectCmd.Get();
 		RHIBuffer* indirectCmdBuffer = context.IndirectCmdBuffer.Get();
 		RHIBuffer* cullResultBuffer = context.CullResultBuffer.Get();
@@ -803,6 +1019,68 @@ namespace Object {
 		});
 	}
 
+	Render::InstanceCullingParams PrimitiveInstancedRendererGPUDriven::GetCPUCullingParams(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass, Render::HZBCPU& hzb) const {
+		Render::InstanceCullingParams params{};
+		params.Frustum = camera->GetFrustum();
+		params.NumClusters = m_PassBuffersArray[EnumCast(pass)].ClusterSize;
+		// the HZB texture can not be read back, the software occlusion depth is used instead
+		const Render::SoftwareOcclusion* occlusion = context.Occlusion;
+		if(m_EnableOcclusionTest && occlusion && occlusion->HasDepth()) {
+			hzb.Build(occlusion->GetDepth(), occlusion->GetWidth(), occlusion->GetHeight());
+			params.ViewProjectMatrix = occlusion->GetViewProjectMatrix();
+			const USize2D actualSize = hzb.GetActualSize();
+			params.HZBSizeScale.X = (float)actualSize.w / (float)hzb.GetSize();
+			params.HZBSizeScale.Y = (float)actualSize.h / (float)hzb.GetSize();
+		}
+		return params;
+	}
+
+	void PrimitiveInstancedRendererGPUDriven::CaptureCulling(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass) {
+		const PassBuffers& buffer = m_PassBuffersArray[EnumCast(pass)];
+		Render::InstanceCullingCapture capture;
+		Render::HZBCPU hzb;
+		capture.Params = GetCPUCullingParams(camera, context, pass, hzb);
+		capture.InstanceAABBs = m_InstanceAABBs;
+		capture.ClusterAABBs = m_ClusterAABBs;
+		capture.Clusters = buffer.Clusters;
+		capture.IndirectCmds = buffer.IndirectCmds;
+		capture.NumInstanceIDs = buffer.AlignedInstanceSize;
+		if(hzb.GetMipSize()) {
+			const Render::SoftwareOcclusion* occlusion = context.Occlusion;
+			capture.DepthWidth = occlusion->GetWidth();
+			capture.DepthHeight = occlusion->GetHeight();
+			capture.Depth.Resize(capture.DepthWidth * capture.DepthHeight);
+			memcpy(capture.Depth.Data(), occlusion->GetDepth(), capture.Depth.ByteSize());
+		}
+		const XString captureDir = File::CombinePathStr(Engine::ConfigMgr::Instance().GetExecutableDir(), "InstanceCullingCaptures");
+		File::MakeDirRecursively(captureDir);
+		XString fileName = "Frame" + ToString(Engine::Timer::GetFrame()) + "_" + ToString(m_CaptureIndex++) + ".iccap";
+		if(!capture.Save(File::CombinePathStr(captureDir, fileName).c_str())) {
+			LOG_WARNING("Failed to save instance culling capture %s", fileName.c_str());
+		}
+	}
+
+	void PrimitiveInstancedRendererGPUDriven::CPUCulling(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass) {
+		const PassBuffers& buffer = m_PassBuffersArray[EnumCast(pass)];
+		Render::HZBCPU hzb;
+		const Render::InstanceCullingParams params = GetCPUCullingParams(camera, context, pass, hzb);
+		TArray<DrawIndexedIndirectCommand> indirectCmds = buffer.IndirectCmds;
+		TArray<uint32> instanceIDs(buffer.AlignedInstanceSize);
+		Render::InstanceCullingCPU culling;
+		culling.Cull(params, hzb.GetMipSize() ? &hzb : nullptr, m_InstanceAABBs, m_ClusterAABBs, buffer.Clusters, indirectCmds, instanceIDs);
+
+		RHIBuffer* indirectCmdBuffer = context.IndirectCmdBuffer.Get();
+		RHIBuffer* cullResultBuffer = context.CullResultBuffer.Get();
+		indirectCmdBuffer->UpdateData(indirectCmds.Data(), indirectCmds.ByteSize(), 0);
+		if(instanceIDs.Size()) {
+			cullResultBuffer->UpdateData(instanceIDs.Data(), instanceIDs.ByteSize(), 0);
+		}
+		context.CullingQueue.PushDrawCall([indirectCmdBuffer, cullResultBuffer](RHICommandBuffer* cmd) {
+			cmd->TransitionBufferState(indirectCmdBuffer, EResourceState::Unknown, EResourceState::IndirectDrawBuffer);
+			cmd->TransitionBufferState(cullResultBuffer, EResourceState::Unknown, EResourceState::ShaderResourceView);
+		});
+	}
+
 	uint32 PrimitiveInstancedRendererGPUDriven::AlignInstanceSize(uint32 size) const {
 		return Math::AlignUp(size, m_SRVAlignment);
 	}
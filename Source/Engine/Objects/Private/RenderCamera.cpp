@@ -13,8 +13,10 @@ namespace Object {
 
 	void RenderContext::Reset(Render::HZBBuilder* hzb) {
 		CullingQueue.Reset();
+		NumCulledClusters = 0;
 		RenderingQueue.Reset();
 		HZB = hzb;
+		Occlusion = nullptr;
 	}
 
 	const Camera& RenderCameraBase::GetCamera() const {
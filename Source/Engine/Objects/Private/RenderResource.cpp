@@ -1,6 +1,7 @@
 #include "Objects/Public/RenderResource.h"
 #include "Asset/Public/AssetLoader.h"
 #include "Render/Public/DefaultResource.h"
+#include "Core/Public/TSharedPtr.h"
 
 namespace {
 	static constexpr ETextureFlags TEXTURE_RESOURCE_FLAGS = ETextureFlags::SRV | ETextureFlags::CopyDst;
@@ -23,6 +24,20 @@ namespace {
 		}
 	}
 
+	void CreatePrimitiveResource(const Asset::PrimitiveAsset& asset, Object::PrimitiveResource& outPrimitive) {
+		const RHIBufferDesc vbDesc{ EBufferFlags::Vertex | EBufferFlags::CopyDst, asset.Vertices.ByteSize(), sizeof(Asset::AssetVertex) };
+		outPrimitive.VertexBuffer = RHI::Instance()->CreateBuffer(vbDesc);
+		outPrimitive.VertexBuffer->UpdateData(asset.Vertices.Data(), asset.Vertices.ByteSize(), 0);
+		if(asset.Indices.Size()) {
+			const RHIBufferDesc ivDesc{ EBufferFlags::Index | EBufferFlags::CopyDst, asset.Indices.ByteSize(), sizeof(Asset::IndexType) };
+			outPrimitive.IndexBuffer = RHI::Instance()->CreateBuffer(ivDesc);
+			outPrimitive.IndexBuffer->UpdateData(asset.Indices.Data(), asset.Indices.ByteSize(), 0);
+		}
+		outPrimitive.VertexCount = asset.Vertices.Size();
+		outPrimitive.IndexCount = asset.Indices.Size();
+		CalcAABB(asset.Vertices, outPrimitive.AABB.Min, outPrimitive.AABB.Max);
+	}
+
 	inline RHITextureDesc ConvertAssetTypeToDesc(Asset::ETextureAssetType type) {
 		switch (type) {
 		case Asset::ETextureAssetType::R8_2D: {
@@ -62,44 +77,106 @@ namespace Object {
 	}
 
 	RHITexture* StaticResourceMgr::GetTexture(const XString& fileName) {
-		if (!fileName.empty()) {
-			if (auto iter = m_Textures.find(fileName); iter != m_Textures.end()) {
-				return iter->second.Get();
+		return LoadTextureAsync(fileName).Get();
+	}
+
+	Engine::TFuture<RHITexture*> StaticResourceMgr::LoadTextureAsync(const XString& fileName) {
+		if(fileName.empty()) {
+			return Engine::LaunchTask(Engine::INLINE_TASK_LANE, []()->RHITexture* { return nullptr; });
+		}
+		if(auto iter = m_Textures.find(fileName); iter != m_Textures.end()) {
+			m_PendingTextures.erase(fileName);
+			RHITexture* texture = iter->second.Get();
+			return Engine::LaunchTask(Engine::INLINE_TASK_LANE, [texture]() { return texture; });
+		}
+		// a file is loaded once, later requests share the load in flight
+		if(auto iter = m_PendingTextures.find(fileName); iter != m_PendingTextures.end()) {
+			return iter->second;
+		}
+		typedef TSharedPtr<Asset::TextureAsset, true> AssetPtr;
+		// file IO on background thread
+		Engine::TFuture<RHITexture*> future = Engine::EnqueueBackgroundTask([fileName]() {
+			AssetPtr asset{ new Asset::TextureAsset };
+			if(!Asset::AssetLoader::LoadProjectAsset(asset.Get(), fileName.c_str())) {
+				LOG_ERROR("Failed to load texture file: %s", fileName.c_str());
+				return AssetPtr{ nullptr };
 			}
-			Asset::TextureAsset imageAsset;
-			if (Asset::AssetLoader::LoadProjectAsset(&imageAsset, fileName.c_str())) {
-				RHITexturePtr texturePtr = CreateTextureFromAsset(imageAsset);
-				auto* texRHI = texturePtr.Get();
-				texRHI->SetName(fileName.c_str());
-				m_Textures.emplace(fileName, MoveTemp(texturePtr));
-				return texRHI;
+			return asset;
+		})
+		// uploads are recorded into the shared RHI command buffer without locking, create the texture on game thread
+		// m_Textures is only accessed on game thread
+		.Then(Engine::ETaskType::GameThread, [this, fileName](const AssetPtr& asset)->RHITexture* {
+			if(!asset) {
+				return nullptr;
 			}
-			LOG_ERROR("Failed to load texture file: %s", fileName.c_str());
-		}
-		return nullptr;
+			RHITexturePtr texture = CreateTextureFromAsset(*asset);
+			texture->SetName(fileName.c_str());
+			return m_Textures.emplace(fileName, MoveTemp(texture)).first->second.Get();
+		});
+		m_PendingTextures.emplace(fileName, future);
+		return future;
 	}
 
 	PrimitiveResource* StaticResourceMgr::GetPrimitive(const XString& fileName) {
+		return LoadPrimitiveAsync(fileName).Get();
+	}
+
+	Engine::TFuture<PrimitiveResource*> StaticResourceMgr::LoadPrimitiveAsync(const XString& fileName) {
+		if(fileName.empty()) {
+			return Engine::LaunchTask(Engine::INLINE_TASK_LANE, []()->PrimitiveResource* { return nullptr; });
+		}
+		if(auto iter = m_Primitives.find(fileName); iter != m_Primitives.end()) {
+			m_PendingPrimitives.erase(fileName);
+			PrimitiveResource* primitive = &iter->second;
+			return Engine::LaunchTask(Engine::INLINE_TASK_LANE, [primitive]() { return primitive; });
+		}
+		if(auto iter = m_PendingPrimitives.find(fileName); iter != m_PendingPrimitives.end()) {
+			return iter->second;
+		}
+		typedef TSharedPtr<Asset::PrimitiveAsset, true> AssetPtr;
+		// file IO on background thread
+		Engine::TFuture<PrimitiveResource*> future = Engine::EnqueueBackgroundTask([fileName]() {
+			AssetPtr asset{ new Asset::PrimitiveAsset };
+			if(!Asset::AssetLoader::LoadProjectAsset(asset.Get(), fileName.c_str())) {
+				LOG_ERROR("Failed to load primitive file: %s", fileName.c_str());
+				return AssetPtr{ nullptr };
+			}
+			return asset;
+		})
+		// buffers are created on game thread as textures, m_Primitives is only accessed on game thread
+		.Then(Engine::ETaskType::GameThread, [this, fileName](const AssetPtr& asset)->PrimitiveResource* {
+			if(!asset) {
+				return nullptr;
+			}
+			PrimitiveResource& primitive = m_Primitives.emplace(fileName, PrimitiveResource{}).first->second;
+			CreatePrimitiveResource(*asset, primitive);
+			return &primitive;
+		});
+		m_PendingPrimitives.emplace(fileName, future);
+		return future;
+	}
+
+	const Render::OccluderMesh* StaticResourceMgr::GetOccluderMesh(const XString& fileName) {
 		if(!fileName.empty()) {
-			if(auto iter = m_Primitives.find(fileName); iter != m_Primitives.end()) {
+			if(auto iter = m_OccluderMeshes.find(fileName); iter != m_OccluderMeshes.end()) {
 				return &iter->second;
 			}
-			// create new resource
 			Asset::PrimitiveAsset asset;
 			if(Asset::AssetLoader::LoadProjectAsset(&asset, fileName.c_str())) {
-				auto& newPrimitive = m_Primitives.emplace(fileName, PrimitiveResource{}).first->second;
-				const RHIBufferDesc vbDesc{ EBufferFlags::Vertex | EBufferFlags::CopyDst, asset.Vertices.ByteSize(), sizeof(Asset::AssetVertex) };
-				newPrimitive.VertexBuffer = RHI::Instance()->CreateBuffer(vbDesc);
-				newPrimitive.VertexBuffer->UpdateData(asset.Vertices.Data(), asset.Vertices.ByteSize(), 0);
+				auto& newMesh = m_OccluderMeshes.emplace(fileName, Render::OccluderMesh{}).first->second;
+				newMesh.Vertices.Reserve(asset.Vertices.Size());
+				for(const Asset::AssetVertex& vertex : asset.Vertices) {
+					newMesh.Vertices.PushBack(vertex.Position);
+				}
 				if(asset.Indices.Size()) {
-					const RHIBufferDesc ivDesc{ EBufferFlags::Index | EBufferFlags::CopyDst, asset.Indices.ByteSize(), sizeof(Asset::IndexType) };
-					newPrimitive.IndexBuffer = RHI::Instance()->CreateBuffer(ivDesc);
-					newPrimitive.IndexBuffer->UpdateData(asset.Indices.Data(), asset.Indices.ByteSize(), 0);
+					newMesh.Indices = MoveTemp(asset.Indices);
+				}
+				else {
+					for(uint32 i = 0; i < asset.Vertices.Size(); ++i) {
+						newMesh.Indices.PushBack(i);
+					}
 				}
-				newPrimitive.VertexCount = asset.Vertices.Size();
-				newPrimitive.IndexCount = asset.Indices.Size();
-				CalcAABB(asset.Vertices, newPrimitive.AABB.Min, newPrimitive.AABB.Max);
-				return &newPrimitive;
+				return &newMesh;
 			}
 			LOG_ERROR("Failed to load primitive file: %s", fileName.c_str());
 		}
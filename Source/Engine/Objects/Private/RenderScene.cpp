@@ -7,6 +7,7 @@
 #include "Render/public/DefaultResource.h"
 #include "Objects/Public/MeshRenderer.h"
 #include "Render/Public/GlobalShader.h"
+#include "System/Public/ConfigManager.h"
 
 namespace {
     class DeferredLightingVS : public Render::GlobalShader {
@@ -74,6 +75,11 @@ namespace Object {
         m_Camera->SetView({ { 0, 4, -4 }, { 0, 2, 0 }, { 0, 1, 0 } });
         // primitive renderer
         m_PrimitiveMgr.Reset(new PrimitiveMgr());
+        // occlusion of the GPU driven renderer is tested with the HZB, unless its culling runs on CPU
+        const Engine::XXProjectConfig& config = Engine::ConfigMgr::Instance().GetProjectConfig();
+        if (config.EnableSoftwareOcclusion && (!config.EnableGPUDriven || config.GPUDrivenCullingOnCPU)) {
+            m_SoftwareOcclusion.Reset(new Render::SoftwareOcclusion(config.SoftwareOcclusionWidth, config.SoftwareOcclusionHeight));
+        }
     }
 
     RenderScene::~RenderScene() {
@@ -87,16 +93,38 @@ namespace Object {
         // create deferred lighting draw call firstly
         CreateDeferredLightingDrawCall();
 
+        // apply structural changes recorded since last frame, systems see a stable layout
+        PlaybackCommands();
+
+        // occluders are collected by the systems
+        if (m_SoftwareOcclusion) {
+            m_SoftwareOcclusion->Reset();
+        }
+
         // update ecs systems for collecting primitives
         SystemUpdate();
 
         // camera and light
         m_Camera->GetRenderContext().Reset(&m_HzbBuilder);
         m_Camera->UpdateBuffer();
+        if (m_SoftwareOcclusion) {
+            m_SoftwareOcclusion->Rasterize(m_Camera->GetViewProjectMatrix());
+            m_Camera->GetRenderContext().Occlusion = m_SoftwareOcclusion.Get();
+        }
         m_DirectionalLight->Update(m_Camera);
 
         m_PrimitiveMgr->PreDrawCall();
 
+        // cull the camera and all cascades in one pass
+        TFrameArray<RenderCameraBase*> views;
+        views.PushBack(m_Camera.Get());
+        if (m_DirectionalLight->GetEnableShadow()) {
+            for (uint32 i = 0; i < m_DirectionalLight->GetCascadeNum(); ++i) {
+                views.PushBack(m_DirectionalLight->GetShadowCamera(i));
+            }
+        }
+        m_PrimitiveMgr->CullViews(views);
+
         // create draw call for base pass and shadow pass
         m_PrimitiveMgr->GenerateBasePassDrawCall(m_Camera.Get());
         for (uint32 i = 0; i < m_DirectionalLight->GetCascadeNum(); ++i) {
@@ -123,9 +151,9 @@ namespace Object {
         }
 
         // ========= create resource nodes ==========
-        Render::RGTextureNode* normalNode = rg.CreateTextureNode(m_GBufferNormal, "GBufferNormal");
-        Render::RGTextureNode* albedoNode = rg.CreateTextureNode(m_GBufferAlbedo, "GBufferAlbedo");
-        Render::RGTextureNode* depthNode = rg.CreateTextureNode(m_Depth, "DepthBuffer");
+        Render::RGTextureNode* normalNode = rg.CreateTransientTextureNode(GetGBufferDesc(GetGBufferNormalFormat()), "GBufferNormal");
+        Render::RGTextureNode* albedoNode = rg.CreateTransientTextureNode(GetGBufferDesc(GetGBufferAlbedoFormat()), "GBufferAlbedo");
+        Render::RGTextureNode* depthNode = rg.CreateTransientTextureNode(GetDepthDesc(), "DepthBuffer");
         Render::RGTextureNode* depthSRVNode = rg.CreateTextureNode(m_DepthSRV, "DepthSRV");
 
         // ========= create pass nodes ==============
@@ -142,6 +170,8 @@ namespace Object {
         if(!renderContext.CullingQueue.IsEmpty()) {
             Render::RGBufferNode* cullingResultBuffer = rg.CreateBufferNode(renderContext.CullResultBuffer, "CullResult");
             Render::RGComputeNode* cullingNode = rg.CreateComputeNode("BasePassCulling");
+            cullingNode->SetPreferredQueue(EQueueType::Compute);
+            cullingNode->SetEstimatedCost(renderContext.NumCulledClusters);
             cullingNode->WriteUAV(cullingResultBuffer);
             basePassNode->ReadSRV(cullingResultBuffer);
             RHITexture* hzb = renderContext.HZB ? renderContext.HZB->GetTexture() : nullptr;
@@ -159,6 +189,7 @@ namespace Object {
 
         // copy depth texture
         Render::RGTransferNode* depthCpyNode = rg.CreateTransferNode("CopyDepthToSRV");
+        depthCpyNode->SetPreferredQueue(EQueueType::Transfer);
         depthCpyNode->CopyTexture(depthNode, depthSRVNode);
 
         // build hzb
@@ -178,6 +209,8 @@ namespace Object {
             if (!shadowRenderContext.CullingQueue.IsEmpty()) {
                 Render::RGBufferNode* cullingResultBuffer = rg.CreateBufferNode(shadowRenderContext.CullResultBuffer, StringFormat("CullResultCSM%u", i));
                 Render::RGComputeNode* cullingNode = rg.CreateComputeNode(StringFormat("CSM%uCulling", i));
+                cullingNode->SetPreferredQueue(EQueueType::Compute);
+                cullingNode->SetEstimatedCost(shadowRenderContext.NumCulledClusters);
                 cullingNode->WriteUAV(cullingResultBuffer);
                 csmNode->ReadSRV(cullingResultBuffer);
                 RHITexture* hzb = shadowRenderContext.HZB ? shadowRenderContext.HZB->GetTexture() : nullptr;
@@ -205,7 +238,9 @@ namespace Object {
         deferredLightingNode->WriteColorTarget(targetNode, 0);
         deferredLightingNode->ReadDepthTarget(depthNode);
         deferredLightingNode->SetRenderArea(renderArea);
-        deferredLightingNode->SetTask([this](RHICommandBuffer* cmd) {
+        deferredLightingNode->SetTask([this, normalNode, albedoNode](RHICommandBuffer* cmd) {
+            m_GBufferNormal = normalNode->GetRHI();
+            m_GBufferAlbedo = albedoNode->GetRHI();
             GetLightingPassDrawCallQueue().Execute(cmd);
         });
     }
@@ -236,7 +271,7 @@ namespace Object {
             cmd->SetShaderParam(DeferredLightingPS::inShadowMap, RHIShaderParam::Texture(directionalShadowMap, directionalShadowMapSubRes));
             cmd->SetShaderParam(DeferredLightingPS::inGBuffer0, RHIShaderParam::Texture(m_GBufferNormal));
             cmd->SetShaderParam(DeferredLightingPS::inGBuffer1, RHIShaderParam::Texture(m_GBufferAlbedo));
-            const RHITextureSubRes depthSrvSubRes = m_Depth->GetDesc().GetSubRes2D(0, ETextureViewFlags::Depth);
+            const RHITextureSubRes depthSrvSubRes = m_DepthSRV->GetDesc().GetSubRes2D(0, ETextureViewFlags::Depth);
             cmd->SetShaderParam(DeferredLightingPS::inDepth, RHIShaderParam::Texture(m_DepthSRV, depthSrvSubRes));
             cmd->SetShaderParam(DeferredLightingPS::inPointSampler, RHIShaderParam::Sampler(Render::DefaultResources::Instance()->GetDefaultSampler(ESamplerFilter::Point, ESamplerAddressMode::Clamp)));
             cmd->SetShaderParam(DeferredLightingPS::inLinearSampler, RHIShaderParam::Sampler(Render::DefaultResources::Instance()->GetDefaultSampler(ESamplerFilter::Bilinear, ESamplerAddressMode::Clamp)));
@@ -245,23 +280,28 @@ namespace Object {
     }
 
     void RenderScene::CreateTextureResources() {
-        RHI* r = RHI::Instance();
+        // depth srv is kept for hzb, the gBuffer and depth targets are transient
+        RHITextureDesc desc = GetDepthDesc();
+        desc.Flags = ETextureFlags::DepthStencilTarget | ETextureFlags::SRV | ETextureFlags::CopyDst;
+        m_DepthSRV = RHI::Instance()->CreateTexture(desc);
+    }
+
+    RHITextureDesc RenderScene::GetGBufferDesc(ERHIFormat format) const {
         RHITextureDesc desc = RHITextureDesc::Texture2D();
         desc.Flags = ETextureFlags::ColorTarget | ETextureFlags::SRV;
         desc.Width = m_TargetSize.w;
         desc.Height = m_TargetSize.h;
-        desc.Format = GetGBufferNormalFormat();
-        m_GBufferNormal = r->CreateTexture(desc);
-
-        desc.Format = GetGBufferAlbedoFormat();
-        m_GBufferAlbedo = r->CreateTexture(desc);
+        desc.Format = format;
+        return desc;
+    }
 
-        desc.Format = r->GetDepthFormat();
+    RHITextureDesc RenderScene::GetDepthDesc() const {
+        RHITextureDesc desc = RHITextureDesc::Texture2D();
         desc.Flags = ETextureFlags::DepthStencilTarget | ETextureFlags::CopySrc;
+        desc.Width = m_TargetSize.w;
+        desc.Height = m_TargetSize.h;
+        desc.Format = RHI::Instance()->GetDepthFormat();
         desc.ClearValue.DepthStencil = { 1.0f, 0u };
-        m_Depth = r->CreateTexture(desc);
-        desc.Flags = ETextureFlags::DepthStencilTarget | ETextureFlags::SRV | ETextureFlags::CopyDst;
-        desc.ClearValue.DepthStencil = { 1.0f, 0u };
-        m_DepthSRV = r->CreateTexture(desc);
+        return desc;
     }
 }
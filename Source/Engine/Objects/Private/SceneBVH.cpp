@@ -0,0 +1,459 @@
+#include "Objects/Public/SceneBVH.h"
+#include "Math/Public/FrustumCulling.h"
+#include "Math/Public/Math.h"
+#include "System/Public/ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace Object {
+
+	namespace {
+		constexpr uint32 NUM_SAH_BINS = 16;
+		constexpr uint32 NUM_REBUILD_PROXIES_MIN = 64;
+		constexpr float REBUILD_COST_RATIO = 1.5f;
+		constexpr uint32 NUM_PARALLEL_SUBTREES = 64;
+
+		inline float SurfaceArea(const Math::AABB3& aabb) {
+			const Math::FVector3 size = aabb.Max - aabb.Min;
+			return 2.0f * (size.X * size.Y + size.Y * size.Z + size.Z * size.X);
+		}
+
+		inline uint32 GetMaxAxis(const Math::FVector3& vec) {
+			return vec.X < vec.Y ? (vec.Y < vec.Z ? 2 : 1) : (vec.X < vec.Z ? 2 : 0);
+		}
+
+		// Test the node against the views intersected by its parent, returns false if it is outside of all views.
+		inline bool TestViews(const Math::AABB3& aabb, const Math::Frustum* frustums, uint32& testMask, uint32& innerMask) {
+			for(uint32 v = 0, bits = testMask; bits; ++v, bits >>= 1) {
+				if(bits & 1u) {
+					const Math::EGeometryTest result = frustums[v].TestAABB(aabb);
+					if(Math::EGeometryTest::Intersected != result) {
+						testMask &= ~(1u << v);
+						if(Math::EGeometryTest::Inner == result) {
+							innerMask |= 1u << v;
+						}
+					}
+				}
+			}
+			return 0 != (testMask | innerMask);
+		}
+	}
+
+	SceneBVH::SceneBVH() : m_Root(INVALID_INDEX), m_NumProxies(0), m_InternalArea(0.0), m_BuiltCost(0.0f) {
+		m_RebuildResult.Root = INVALID_INDEX;
+		m_RebuildResult.InternalArea = 0.0;
+	}
+
+	SceneBVH::~SceneBVH() {
+		m_RebuildTask.Wait();
+	}
+
+	uint32 SceneBVH::Insert(const Math::AABB3& aabb) {
+		uint32 proxyIndex;
+		if(m_FreeProxies.Size()) {
+			proxyIndex = m_FreeProxies.Back();
+			m_FreeProxies.PopBack();
+		}
+		else {
+			proxyIndex = m_Proxies.Size();
+			m_Proxies.EmplaceBack();
+		}
+		const uint32 leaf = AllocateNode();
+		m_Nodes[leaf] = { aabb, INVALID_INDEX, INVALID_INDEX, proxyIndex };
+		m_Proxies[proxyIndex] = { aabb, leaf };
+		InsertLeaf(leaf);
+		++m_NumProxies;
+		if(m_RebuildTask.IsValid()) {
+			m_RebuildPendingOps.PushBack({ EProxyOp::Insert, proxyIndex });
+		}
+		return proxyIndex;
+	}
+
+	void SceneBVH::Remove(uint32 proxyIndex) {
+		Proxy& proxy = m_Proxies[proxyIndex];
+		CHECK(INVALID_INDEX != proxy.Leaf);
+		RemoveLeaf(proxy.Leaf);
+		FreeNode(proxy.Leaf);
+		proxy.Leaf = INVALID_INDEX;
+		m_FreeProxies.PushBack(proxyIndex);
+		--m_NumProxies;
+		if(m_RebuildTask.IsValid()) {
+			m_RebuildPendingOps.PushBack({ EProxyOp::Remove, proxyIndex });
+		}
+	}
+
+	void SceneBVH::Update(uint32 proxyIndex, const Math::AABB3& aabb) {
+		Proxy& proxy = m_Proxies[proxyIndex];
+		CHECK(INVALID_INDEX != proxy.Leaf);
+		if(proxy.AABB.Min == aabb.Min && proxy.AABB.Max == aabb.Max) {
+			return;
+		}
+		proxy.AABB = aabb;
+		m_Nodes[proxy.Leaf].AABB = aabb;
+		RefitAncestors(m_Nodes[proxy.Leaf].Parent);
+		if(m_RebuildTask.IsValid()) {
+			m_RebuildPendingOps.PushBack({ EProxyOp::Update, proxyIndex });
+		}
+	}
+
+	const Math::AABB3& SceneBVH::GetAABB(uint32 proxyIndex) const {
+		return m_Proxies[proxyIndex].AABB;
+	}
+
+	uint32 SceneBVH::GetNumProxies() const {
+		return m_NumProxies;
+	}
+
+	void SceneBVH::Tick() {
+		if(m_RebuildTask.IsValid()) {
+			if(!m_RebuildTask.IsReady()) {
+				return;
+			}
+			ApplyRebuild();
+		}
+		if(m_NumProxies >= NUM_REBUILD_PROXIES_MIN && GetCost() > m_BuiltCost * REBUILD_COST_RATIO) {
+			LaunchRebuild();
+		}
+	}
+
+	void SceneBVH::FlushRebuild() {
+		if(m_RebuildTask.IsValid()) {
+			m_RebuildTask.Wait();
+			ApplyRebuild();
+		}
+	}
+
+	float SceneBVH::GetCost() const {
+		if(INVALID_INDEX == m_Root || m_Nodes[m_Root].IsLeaf()) {
+			return 0.0f;
+		}
+		const float rootArea = SurfaceArea(m_Nodes[m_Root].AABB);
+		return rootArea > 0.0f ? (float)(m_InternalArea / rootArea) : 0.0f;
+	}
+
+	void SceneBVH::CullViews(const Math::Frustum* frustums, uint32 numFrustums, TFrameArray<uint32>& outProxies, TFrameArray<uint32>& outViewMasks) const {
+		numFrustums = Math::Min(numFrustums, Math::MAX_CULLING_VIEWS);
+		if(INVALID_INDEX == m_Root || 0 == numFrustums) {
+			return;
+		}
+		const uint32 allViews = numFrustums == 32 ? UINT32_MAX : (1u << numFrustums) - 1u;
+		// expand the top of the tree breadth first until there are enough subtrees for workers
+		TFrameArray<CullEntry> subtrees;
+		TFrameArray<CullEntry> queue;
+		queue.PushBack({ m_Root, allViews, 0 });
+		uint32 head = 0;
+		while(head < queue.Size() && subtrees.Size() + queue.Size() - head < NUM_PARALLEL_SUBTREES) {
+			CullEntry entry = queue[head++];
+			const Node& node = m_Nodes[entry.Node];
+			if(node.IsLeaf() || 0 == entry.TestMask) {
+				subtrees.PushBack(entry);
+			}
+			else if(TestViews(node.AABB, frustums, entry.TestMask, entry.InnerMask)) {
+				queue.PushBack({ node.Child0, entry.TestMask, entry.InnerMask });
+				queue.PushBack({ node.Child1, entry.TestMask, entry.InnerMask });
+			}
+		}
+		for(; head < queue.Size(); ++head) {
+			subtrees.PushBack(queue[head]);
+		}
+		const uint32 numSubtrees = subtrees.Size();
+		if(numSubtrees < 2) {
+			for(const CullEntry& entry : subtrees) {
+				CullSubtree(frustums, numFrustums, entry, outProxies, outViewMasks);
+			}
+			return;
+		}
+		struct SubtreeResult {
+			TFrameArray<uint32> Proxies;
+			TFrameArray<uint32> ViewMasks;
+		};
+		TFrameArray<SubtreeResult> results;
+		results.Resize(numSubtrees);
+		Engine::ParallelFor(0u, numSubtrees, 1u, [&](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+				CullSubtree(frustums, numFrustums, subtrees[i], results[i].Proxies, results[i].ViewMasks);
+			}
+		});
+		uint32 numVisible = outProxies.Size();
+		for(const SubtreeResult& result : results) {
+			numVisible += result.Proxies.Size();
+		}
+		outProxies.Reserve(numVisible);
+		outViewMasks.Reserve(numVisible);
+		for(const SubtreeResult& result : results) {
+			outProxies.PushBack(result.Proxies);
+			outViewMasks.PushBack(result.ViewMasks);
+		}
+	}
+
+	uint32 SceneBVH::AllocateNode() {
+		if(m_FreeNodes.Size()) {
+			const uint32 index = m_FreeNodes.Back();
+			m_FreeNodes.PopBack();
+			return index;
+		}
+		m_Nodes.EmplaceBack();
+		return m_Nodes.Size() - 1;
+	}
+
+	void SceneBVH::FreeNode(uint32 index) {
+		if(!m_Nodes[index].IsLeaf()) {
+			m_InternalArea -= SurfaceArea(m_Nodes[index].AABB);
+		}
+		m_FreeNodes.PushBack(index);
+	}
+
+	void SceneBVH::SetInternalAABB(uint32 index, const Math::AABB3& aabb) {
+		Node& node = m_Nodes[index];
+		m_InternalArea += SurfaceArea(aabb) - SurfaceArea(node.AABB);
+		node.AABB = aabb;
+	}
+
+	void SceneBVH::InsertLeaf(uint32 leaf) {
+		if(INVALID_INDEX == m_Root) {
+			m_Root = leaf;
+			m_Nodes[leaf].Parent = INVALID_INDEX;
+			return;
+		}
+		// descend to the sibling with the lowest cost increase, see b2DynamicTree::InsertLeaf
+		const Math::AABB3 leafAABB = m_Nodes[leaf].AABB;
+		uint32 index = m_Root;
+		while(!m_Nodes[index].IsLeaf()) {
+			const Node& node = m_Nodes[index];
+			Math::AABB3 combined = node.AABB;
+			combined.Union(leafAABB);
+			const float combinedArea = SurfaceArea(combined);
+			// cost of creating a new parent for this node and the leaf
+			const float cost = 2.0f * combinedArea;
+			// minimum cost of pushing the leaf further down the tree
+			const float inheritanceCost = 2.0f * (combinedArea - SurfaceArea(node.AABB));
+			auto getChildCost = [&](uint32 childIndex) {
+				const Node& child = m_Nodes[childIndex];
+				Math::AABB3 childCombined = child.AABB;
+				childCombined.Union(leafAABB);
+				const float childCost = SurfaceArea(childCombined) + inheritanceCost;
+				return child.IsLeaf() ? childCost : childCost - SurfaceArea(child.AABB);
+			};
+			const float cost0 = getChildCost(node.Child0);
+			const float cost1 = getChildCost(node.Child1);
+			if(cost < cost0 && cost < cost1) {
+				break;
+			}
+			index = cost0 < cost1 ? node.Child0 : node.Child1;
+		}
+
+		// create a new parent of the sibling and the leaf
+		const uint32 sibling = index;
+		const uint32 oldParent = m_Nodes[sibling].Parent;
+		const uint32 newParent = AllocateNode();
+		m_Nodes[newParent] = { Math::AABB3{}, oldParent, sibling, leaf };
+		Math::AABB3 parentAABB = leafAABB;
+		parentAABB.Union(m_Nodes[sibling].AABB);
+		SetInternalAABB(newParent, parentAABB);
+		m_Nodes[sibling].Parent = newParent;
+		m_Nodes[leaf].Parent = newParent;
+		if(INVALID_INDEX == oldParent) {
+			m_Root = newParent;
+		}
+		else {
+			Node& parent = m_Nodes[oldParent];
+			(parent.Child0 == sibling ? parent.Child0 : parent.Child1) = newParent;
+		}
+		RefitAncestors(oldParent);
+	}
+
+	void SceneBVH::RemoveLeaf(uint32 leaf) {
+		if(leaf == m_Root) {
+			m_Root = INVALID_INDEX;
+			return;
+		}
+		const uint32 parent = m_Nodes[leaf].Parent;
+		const uint32 grandParent = m_Nodes[parent].Parent;
+		const uint32 sibling = m_Nodes[parent].Child0 == leaf ? m_Nodes[parent].Child1 : m_Nodes[parent].Child0;
+		// replace the parent with the sibling
+		m_Nodes[sibling].Parent = grandParent;
+		if(INVALID_INDEX == grandParent) {
+			m_Root = sibling;
+		}
+		else {
+			Node& node = m_Nodes[grandParent];
+			(node.Child0 == parent ? node.Child0 : node.Child1) = sibling;
+		}
+		FreeNode(parent);
+		RefitAncestors(grandParent);
+	}
+
+	void SceneBVH::RefitAncestors(uint32 index) {
+		while(INVALID_INDEX != index) {
+			const Node& node = m_Nodes[index];
+			Math::AABB3 aabb = m_Nodes[node.Child0].AABB;
+			aabb.Union(m_Nodes[node.Child1].AABB);
+			// ancestors are unions of their children, so they are unchanged either
+			if(aabb.Min == node.AABB.Min && aabb.Max == node.AABB.Max) {
+				break;
+			}
+			SetInternalAABB(index, aabb);
+			index = node.Parent;
+		}
+	}
+
+	void SceneBVH::LaunchRebuild() {
+		m_RebuildSnapshot.Reset();
+		m_RebuildSnapshot.Reserve(m_NumProxies);
+		for(uint32 i = 0; i < m_Proxies.Size(); ++i) {
+			const Proxy& proxy = m_Proxies[i];
+			if(INVALID_INDEX != proxy.Leaf) {
+				m_RebuildSnapshot.PushBack({ proxy.AABB, proxy.AABB.Center(), i });
+			}
+		}
+		m_RebuildTask = Engine::LaunchTask(Engine::ETaskType::Worker, [this]() {
+			m_RebuildResult.Nodes.Reset();
+			m_RebuildResult.Nodes.Reserve(m_RebuildSnapshot.Size() * 2 - 1);
+			m_RebuildResult.InternalArea = 0.0;
+			m_RebuildResult.Root = BuildRecursive(m_RebuildSnapshot, 0, m_RebuildSnapshot.Size(), INVALID_INDEX, m_RebuildResult);
+		}, Engine::ETaskPriority::Background);
+	}
+
+	void SceneBVH::ApplyRebuild() {
+		m_RebuildTask.Reset();
+		m_Nodes.Swap(m_RebuildResult.Nodes);
+		m_RebuildResult.Nodes.Reset();
+		m_FreeNodes.Reset();
+		m_Root = m_RebuildResult.Root;
+		m_InternalArea = m_RebuildResult.InternalArea;
+		// compare with the cost of the built tree, changes replayed below would raise the threshold otherwise
+		m_BuiltCost = GetCost();
+		for(Proxy& proxy : m_Proxies) {
+			proxy.Leaf = INVALID_INDEX;
+		}
+		for(uint32 i = 0; i < m_Nodes.Size(); ++i) {
+			if(m_Nodes[i].IsLeaf()) {
+				m_Proxies[m_Nodes[i].Child1].Leaf = i;
+			}
+		}
+		// the tree is built from the snapshot, replay changes made after it
+		for(const auto& [op, proxyIndex] : m_RebuildPendingOps) {
+			Proxy& proxy = m_Proxies[proxyIndex];
+			if(EProxyOp::Insert == op) {
+				proxy.Leaf = AllocateNode();
+				m_Nodes[proxy.Leaf] = { proxy.AABB, INVALID_INDEX, INVALID_INDEX, proxyIndex };
+				InsertLeaf(proxy.Leaf);
+			}
+			else if(INVALID_INDEX != proxy.Leaf) {
+				if(EProxyOp::Remove == op) {
+					RemoveLeaf(proxy.Leaf);
+					FreeNode(proxy.Leaf);
+					proxy.Leaf = INVALID_INDEX;
+				}
+				else {
+					m_Nodes[proxy.Leaf].AABB = proxy.AABB;
+					RefitAncestors(m_Nodes[proxy.Leaf].Parent);
+				}
+			}
+		}
+		m_RebuildPendingOps.Reset();
+	}
+
+	void SceneBVH::CullSubtree(const Math::Frustum* frustums, uint32 numFrustums, CullEntry root, TFrameArray<uint32>& outProxies, TFrameArray<uint32>& outViewMasks) const {
+		TFrameArray<CullEntry> stack;
+		stack.PushBack(root);
+		while(stack.Size()) {
+			CullEntry entry = stack.Back();
+			stack.PopBack();
+			const Node& node = m_Nodes[entry.Node];
+			// views containing the parent contain the node too
+			if(entry.TestMask && !TestViews(node.AABB, frustums, entry.TestMask, entry.InnerMask)) {
+				continue;
+			}
+			if(node.IsLeaf()) {
+				outProxies.PushBack(node.Child1);
+				outViewMasks.PushBack(entry.TestMask | entry.InnerMask);
+			}
+			else {
+				stack.PushBack({ node.Child1, entry.TestMask, entry.InnerMask });
+				stack.PushBack({ node.Child0, entry.TestMask, entry.InnerMask });
+			}
+		}
+	}
+
+	uint32 SceneBVH::BuildRecursive(TArray<BuildPrimitive>& primitives, uint32 start, uint32 end, uint32 parent, BuildResult& result) {
+		const uint32 index = result.Nodes.Size();
+		result.Nodes.EmplaceBack();
+		if(end - start == 1) {
+			result.Nodes[index] = { primitives[start].AABB, parent, INVALID_INDEX, primitives[start].Proxy };
+			return index;
+		}
+		Math::AABB3 aabb = primitives[start].AABB;
+		Math::AABB3 centerBounds = Math::AABB3::MinMax(primitives[start].Center, primitives[start].Center);
+		for(uint32 i = start + 1; i < end; ++i) {
+			aabb.Union(primitives[i].AABB);
+			centerBounds.Include(primitives[i].Center);
+		}
+		result.InternalArea += SurfaceArea(aabb);
+		const uint32 middle = PartitionSAH(primitives, start, end, centerBounds);
+		const uint32 child0 = BuildRecursive(primitives, start, middle, index, result);
+		const uint32 child1 = BuildRecursive(primitives, middle, end, index, result);
+		result.Nodes[index] = { aabb, parent, child0, child1 };
+		return index;
+	}
+
+	uint32 SceneBVH::PartitionSAH(TArray<BuildPrimitive>& primitives, uint32 start, uint32 end, const Math::AABB3& centerBounds) {
+		const Math::FVector3 centerExtent = centerBounds.Max - centerBounds.Min;
+		const uint32 axis = GetMaxAxis(centerExtent);
+		if(centerExtent[axis] <= 0.0f) {
+			// all centers are at the same point
+			return (start + end) / 2;
+		}
+		// bin the centers on the max axis, then split at the bin boundary with the lowest surface area heuristic cost
+		const float binScale = (float)NUM_SAH_BINS / centerExtent[axis];
+		const float axisMin = centerBounds.Min[axis];
+		auto getBin = [binScale, axisMin, axis](const BuildPrimitive& primitive) {
+			return Math::Min<uint32>(NUM_SAH_BINS - 1, (uint32)((primitive.Center[axis] - axisMin) * binScale));
+		};
+		TStaticArray<Math::AABB3, NUM_SAH_BINS> binAABBs;
+		TStaticArray<uint32, NUM_SAH_BINS> binSizes;
+		binSizes.Reset(0u);
+		for(uint32 i = start; i < end; ++i) {
+			const uint32 bin = getBin(primitives[i]);
+			binAABBs[bin] = binSizes[bin] ? binAABBs[bin] : primitives[i].AABB;
+			binAABBs[bin].Union(primitives[i].AABB);
+			++binSizes[bin];
+		}
+		// costs of the right sides, split s puts bins [0, s] to the left
+		TStaticArray<float, NUM_SAH_BINS> rightCosts;
+		Math::AABB3 accumulated;
+		uint32 accumulatedSize = 0;
+		for(uint32 bin = NUM_SAH_BINS - 1; bin > 0; --bin) {
+			if(binSizes[bin]) {
+				accumulated = accumulatedSize ? accumulated : binAABBs[bin];
+				accumulated.Union(binAABBs[bin]);
+				accumulatedSize += binSizes[bin];
+			}
+			rightCosts[bin - 1] = accumulatedSize ? SurfaceArea(accumulated) * (float)accumulatedSize : 0.0f;
+		}
+		uint32 bestSplit = INVALID_INDEX;
+		float bestCost = FLT_MAX;
+		uint32 leftSize = 0;
+		for(uint32 bin = 0; bin + 1 < NUM_SAH_BINS; ++bin) {
+			if(binSizes[bin]) {
+				accumulated = leftSize ? accumulated : binAABBs[bin];
+				accumulated.Union(binAABBs[bin]);
+				leftSize += binSizes[bin];
+			}
+			const uint32 rightSize = end - start - leftSize;
+			if(leftSize && rightSize) {
+				const float cost = SurfaceArea(accumulated) * (float)leftSize + rightCosts[bin];
+				if(cost < bestCost) {
+					bestCost = cost;
+					bestSplit = bin;
+				}
+			}
+		}
+		CHECK(INVALID_INDEX != bestSplit);
+		BuildPrimitive* first = primitives.Data() + start;
+		BuildPrimitive* middle = std::partition(first, primitives.Data() + end, [&getBin, bestSplit](const BuildPrimitive& primitive) {
+			return getBin(primitive) <= bestSplit;
+		});
+		return start + (uint32)(middle - first);
+	}
+}
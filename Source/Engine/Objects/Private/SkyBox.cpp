@@ -83,20 +83,20 @@ namespace Object {
 	}
 
 	void SkyBoxComponent::OnAdd() {
-		GetScene()->AddComponent<SkyBoxECSComp>(GetEntityID());
+		GetScene()->GetCommandBuffer().AddComponent<SkyBoxECSComp>(GetEntityID());
 	}
 
 	void SkyBoxComponent::OnRemove() {
-		GetScene()->RemoveComponent<SkyBoxECSComp>(GetEntityID());
+		GetScene()->GetCommandBuffer().RemoveComponent<SkyBoxECSComp>(GetEntityID());
 	}
 
 	void SkyBoxComponent::SetCubeMapFile(const XString& file) {
 		m_CubeMapFile = file;
-		auto* com = GetScene()->GetComponent<SkyBoxECSComp>(GetEntityID());
+		auto* com = GetECSComponent<SkyBoxECSComp>();
 		com->LoadCubeMap(file);
 	}
 
-	void SkyBoxSystem::Update(ECSScene* scene, SkyBoxECSComp* component) {
+	void SkyBoxSystem::Update(ECSScene* scene, const SkyBoxECSComp* component) {
 		if(nullptr == component->CubeMap) {
 			return;
 		}
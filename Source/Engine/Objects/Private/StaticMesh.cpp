@@ -17,11 +17,11 @@ namespace Object {
 		Position = { 0,0,0 };
 		Scale = { 1,1,1 };
 		Euler = { 0,0,0 };
-		GetScene()->AddComponent<TransformECSComponent>(GetEntityID());
+		GetScene()->GetCommandBuffer().AddComponent<TransformECSComponent>(GetEntityID());
 	}
 
 	void TransformComponent::OnRemove() {
-		GetScene()->RemoveComponent<TransformECSComponent>(GetEntityID());
+		GetScene()->GetCommandBuffer().RemoveComponent<TransformECSComponent>(GetEntityID());
 	}
 
 	void TransformComponent::TransformUpdated() {
@@ -29,7 +29,7 @@ namespace Object {
 		transform.Position = Position;
 		transform.Rotation = Math::FQuaternion::Euler(Euler);
 		transform.Scale = Scale;
-		TransformECSComponent* component = GetScene()->GetComponent<TransformECSComponent>(GetEntityID());
+		TransformECSComponent* component = GetECSComponent<TransformECSComponent>();
 		component->SetTransform(transform);
 	}
 
@@ -45,30 +45,43 @@ namespace Object {
 			else {
 				SetCastShadow(true);
 			}
+
+			if(val.HasMember("Occluder")) {
+				SetOccluder(val["Occluder"].GetBool());
+			}
 		}
 	}
 
 	void MeshComponent::OnAdd() {
-		MeshECSComponent* ecsCom = GetScene()->AddComponent<MeshECSComponent>(GetEntityID());
+		MeshECSComponent* ecsCom = GetScene()->GetCommandBuffer().AddComponent<MeshECSComponent>(GetEntityID());
 		ecsCom->RenderFlags.AddFlag(ERenderPassType::BasePass);
 	}
 
 	void MeshComponent::OnRemove() {
-		GetScene()->RemoveComponent<MeshECSComponent>(GetEntityID());
+		GetScene()->GetCommandBuffer().RemoveComponent<MeshECSComponent>(GetEntityID());
+		if(m_Occluder) {
+			GetScene()->GetCommandBuffer().RemoveComponent<OccluderECSComponent>(GetEntityID());
+		}
 	}
 
 	void MeshComponent::SetMeshFile(const XString& meshFile) {
 		m_MeshFile = meshFile;
 		Asset::MeshAsset asset;
 		if(Asset::AssetLoader::LoadProjectAsset(&asset, m_MeshFile.c_str())) {
-			MeshECSComponent* component = GetScene()->GetComponent<MeshECSComponent>(GetEntityID());
+			MeshECSComponent* component = GetECSComponent<MeshECSComponent>();
 			auto& Primitives = component->Primitives;
 			Primitives.Reset();
 			Primitives.Reserve(asset.Primitives.Size());
+			// load all primitive files concurrently
+			TArray<Engine::TFuture<PrimitiveResource*>> primitiveFutures;
+			primitiveFutures.Reserve(asset.Primitives.Size());
 			for (auto& srcPrimitive : asset.Primitives) {
+				primitiveFutures.PushBack(Object::StaticResourceMgr::Instance()->LoadPrimitiveAsync(srcPrimitive.BinaryFile));
+			}
+			for (uint32 i = 0; i < asset.Primitives.Size(); ++i) {
 				auto& primitive = Primitives.EmplaceBack();
-				primitive.Primitive = Object::StaticResourceMgr::Instance()->GetPrimitive(srcPrimitive.BinaryFile);
-				primitive.Material = Object::MaterialMgr::Instance()->GetMaterialInterface(srcPrimitive.MaterialFile);
+				primitive.Primitive = primitiveFutures[i].Get();
+				primitive.Material = Object::MaterialMgr::Instance()->GetMaterialInterface(asset.Primitives[i].MaterialFile);
 			}
 			// calc aabb
 			if (Primitives.Size()) {
@@ -85,12 +98,15 @@ namespace Object {
 			if(m_CastShadow) {
 				component->RenderFlags.AddFlag(ERenderPassType::DirectionalShadow);
 			}
+			if(m_Occluder) {
+				UpdateOccluderMeshes();
+			}
 		}
 	}
 
 	void MeshComponent::SetCastShadow(bool bCastShadow) {
 		m_CastShadow = bCastShadow;
-		MeshECSComponent* component = GetScene()->GetComponent<MeshECSComponent>(GetEntityID());
+		MeshECSComponent* component = GetECSComponent<MeshECSComponent>();
 		auto& renderFlags = component->RenderFlags;
 		if(bCastShadow) {
 			renderFlags.AddFlag(ERenderPassType::DirectionalShadow);
@@ -100,6 +116,33 @@ namespace Object {
 		}
 	}
 
+	void MeshComponent::SetOccluder(bool bOccluder) {
+		if(m_Occluder == bOccluder) {
+			return;
+		}
+		m_Occluder = bOccluder;
+		if(bOccluder) {
+			GetScene()->GetCommandBuffer().AddComponent<OccluderECSComponent>(GetEntityID());
+			UpdateOccluderMeshes();
+		}
+		else {
+			GetScene()->GetCommandBuffer().RemoveComponent<OccluderECSComponent>(GetEntityID());
+		}
+	}
+
+	void MeshComponent::UpdateOccluderMeshes() {
+		Asset::MeshAsset asset;
+		OccluderECSComponent* component = GetECSComponent<OccluderECSComponent>();
+		component->Meshes.Reset();
+		if(!m_MeshFile.empty() && Asset::AssetLoader::LoadProjectAsset(&asset, m_MeshFile.c_str())) {
+			for(auto& srcPrimitive : asset.Primitives) {
+				if(const Render::OccluderMesh* mesh = Object::StaticResourceMgr::Instance()->GetOccluderMesh(srcPrimitive.BinaryFile)) {
+					component->Meshes.PushBack(mesh);
+				}
+			}
+		}
+	}
+
 	void InstanceDataComponent::OnLoad(const Json::Value& val) {
 		if(val.HasMember("InstanceFile")) {
 			SetInstanceFile(val["InstanceFile"].GetString());
@@ -107,23 +150,23 @@ namespace Object {
 	}
 
 	void InstanceDataComponent::OnAdd() {
-		GetScene()->AddComponent<InstancedDataECSComponent>(GetEntityID());
+		GetScene()->GetCommandBuffer().AddComponent<InstancedDataECSComponent>(GetEntityID());
 	}
 
 	void InstanceDataComponent::OnRemove() {
-		GetScene()->RemoveComponent<InstancedDataECSComponent>(GetEntityID());
+		GetScene()->GetCommandBuffer().RemoveComponent<InstancedDataECSComponent>(GetEntityID());
 	}
 
 	void InstanceDataComponent::SetInstanceFile(const XString& file) {
 		m_InstanceFile = file;
-		const auto* meshCom = GetScene()->GetComponent<MeshECSComponent>(GetEntityID());
+		const auto* meshCom = GetECSComponent<const MeshECSComponent>();
 		if(!meshCom) {
 			LOG_WARNING("[InstanceDataComponent::SetInstanceFile] Mesh not found!");
 			return;
 		}
 		Asset::InstanceDataAsset instanceAsset;
 		Asset::AssetLoader::LoadProjectAsset(&instanceAsset, m_InstanceFile.c_str());
-		auto* dataCom = GetScene()->GetComponent<InstancedDataECSComponent>(GetEntityID());
+		auto* dataCom = GetECSComponent<InstancedDataECSComponent>();
 		dataCom->InstanceData.Build(meshCom->AABB, instanceAsset.Instances);
 	}
 }
@@ -3,209 +3,318 @@
 #include "Core/Public/Container.h"
 #include "Core/Public/TUniquePtr.h"
 #include "Core/Public/Defines.h"
+#include "Core/Public/Concurrency.h"
+#include "Core/Public/LinearAllocator.h"
+#include "System/Public/TaskGraph.h"
+#include <new>
+#include <type_traits>
 
 namespace Object {
 	//  A simple ECS framework, reference: https://austinmorlan.com/posts/entity_component_system/
 
+	// Entity handle, low bits are the index of entity record, high bits are the generation of the index.
+	// Indices are recycled, the generation detects stale handles of destroyed entities.
 	typedef uint32 EntityID;
 	typedef uint8 ComponentID;
 	typedef uint32 ComponentMask;
 	constexpr uint32 INVALID_ENTITY = UINT32_MAX;
+	constexpr uint32 ENTITY_INDEX_BITS = 20;
+	constexpr uint32 ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+	constexpr uint32 ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+	inline uint32 GetEntityIndex(EntityID entityID) { return entityID & ENTITY_INDEX_MASK; }
+	inline uint32 GetEntityGeneration(EntityID entityID) { return entityID >> ENTITY_INDEX_BITS; }
+	inline EntityID MakeEntityID(uint32 index, uint32 generation) { return (generation << ENTITY_INDEX_BITS) | index; }
 
 
 	//  ================ component ====================
 	constexpr ComponentID NUM_COMPONENT_MAX = 32;
-	ComponentID RegisterComponent();
+
+	// Type-erased operations of a component type, used by archetype columns.
+	struct ECSComponentTypeInfo {
+		uint32 Size;
+		uint32 Alignment;
+		void(*Construct)(void* dst);
+		void(*MoveConstruct)(void* dst, void* src);
+		void(*Destruct)(void* ptr);
+	};
+	ComponentID RegisterComponent(const ECSComponentTypeInfo& typeInfo);
+	const ECSComponentTypeInfo& GetComponentTypeInfo(ComponentID componentID);
+
+	template<class T> ComponentID RegisterComponent() {
+		ECSComponentTypeInfo typeInfo;
+		typeInfo.Size = sizeof(T);
+		typeInfo.Alignment = alignof(T);
+		typeInfo.Construct = [](void* dst) { new (dst) T(); };
+		typeInfo.MoveConstruct = [](void* dst, void* src) { new (dst) T(MoveTemp(*(T*)src)); };
+		typeInfo.Destruct = [](void* ptr) { ((T*)ptr)->~T(); };
+		return RegisterComponent(typeInfo);
+	}
+
 #define REGISTER_ECS_COMPONENT(cls)\
 	public:\
 	static Object::ComponentID cls::GetComponentID(){ return s_ComponentID;	}\
 	static Object::ComponentMask cls::GetComponentMask(){return 1 << s_ComponentID;}\
 	private:\
-		inline static Object::ComponentID s_ComponentID{Object::RegisterComponent()}
+		inline static Object::ComponentID s_ComponentID{Object::RegisterComponent<cls>()}
 
 	class ECSScene;
 
-	class ECSComponentContainerBase {
+	// Entities with the same component mask, stored in fixed size chunks.
+	// A chunk holds an entity column and a column per component (SoA), all chunks are full except the last one.
+	// Each column of a chunk has a change version, the scene version of the last write or structural change.
+	class ECSArchetype {
 	public:
-		virtual ~ECSComponentContainerBase() = default;
-		virtual void Remove(EntityID entityID) = 0;
-	};
-
-	// Component container contains same types.
-	template<class T>
-	class ECSComponentContainer : public ECSComponentContainerBase{
-	public:
-		ECSComponentContainer() = default;
-		~ECSComponentContainer() override = default;
-		template<class ...Args>
-		T* Add(EntityID entityID, Args&&...args) {
-			EntityID idx = m_Components.Size();
-			m_Entity2Indices[entityID] = idx;
-			m_Components.EmplaceBack(MoveTemp(args)...);
-			m_Entities.PushBack(entityID);
-			return &m_Components.Back();
-		}
-
-		T* Get(EntityID entityID) {
-			if(auto iter = m_Entity2Indices.find(entityID); iter != m_Entity2Indices.end()) {
-				return &m_Components[iter->second];
-			}
-			return nullptr;
-		}
-		void Remove(EntityID entityID) override {
-			if (auto iter = m_Entity2Indices.find(entityID); iter != m_Entity2Indices.end()) {
-				const EntityID removedIdx = iter->second;
-				const EntityID backEntityID = m_Entities.Back();
-				m_Components.SwapRemoveAt(removedIdx);
-				m_Entities.SwapRemoveAt(removedIdx);
-				m_Entity2Indices[backEntityID] = removedIdx;
-				m_Entity2Indices.erase(entityID);
-			}
-		}
+		static constexpr uint32 CHUNK_SIZE = 16 * 1024;
+		static constexpr uint32 CHUNK_ALIGNMENT = 64;
+		NON_COPYABLE(ECSArchetype);
+		NON_MOVEABLE(ECSArchetype);
+		explicit ECSArchetype(ComponentMask mask);
+		~ECSArchetype();
+		ComponentMask GetMask() const { return m_Mask; }
+		uint32 GetNumEntities() const { return m_NumEntities; }
+		uint32 GetChunkCapacity() const { return m_ChunkCapacity; }
+		uint32 GetNumChunks() const { return (m_NumEntities + m_ChunkCapacity - 1) / m_ChunkCapacity; }
+		uint32 GetChunkNumEntities(uint32 chunkIndex) const;
+		const EntityID* GetEntityColumn(uint32 chunkIndex) const { return (const EntityID*)m_Chunks[chunkIndex]; }
+		void* GetColumn(uint32 chunkIndex, ComponentID componentID) { return m_Chunks[chunkIndex] + m_ColumnOffsets[componentID]; }
+		template<class T> T* GetColumn(uint32 chunkIndex) { return (T*)GetColumn(chunkIndex, T::GetComponentID()); }
+		EntityID GetEntity(uint32 slot) const;
+		void* GetComponent(uint32 slot, ComponentID componentID);
+		// Append an entity, the components are not constructed.
+		uint32 AllocateSlot(EntityID entityID);
+		// Components in the slot must be destructed already, the last entity is moved to fill the slot.
+		// Return the moved entity, or INVALID_ENTITY if no entity is moved.
+		EntityID FreeSlot(uint32 slot);
+		uint32 GetChunkVersion(uint32 chunkIndex, ComponentID componentID) const { return m_ChunkVersions[chunkIndex][componentID]; }
+		// Return true if any column in the mask is changed at or after the version.
+		bool IsChunkChanged(uint32 chunkIndex, ComponentMask mask, uint32 version) const;
+		void MarkChunkChanged(uint32 chunkIndex, ComponentMask mask, uint32 version);
 	private:
-		TArray<T> m_Components;
-		TArray<EntityID> m_Entities;
-		TUnorderedMap<EntityID, uint32> m_Entity2Indices;
+		friend ECSScene;
+		ComponentMask m_Mask;
+		uint32 m_ChunkCapacity;
+		uint32 m_ChunkByteSize;
+		uint32 m_NumEntities;
+		TStaticArray<uint32, NUM_COMPONENT_MAX> m_ColumnOffsets;
+		TArray<uint8*> m_Chunks; // Chunks are kept when entities removed
+		TArray<TStaticArray<uint32, NUM_COMPONENT_MAX>> m_ChunkVersions;
+		// Cached archetype index after adding or removing a component, filled by ECSScene
+		TStaticArray<uint32, NUM_COMPONENT_MAX> m_AddEdges;
+		TStaticArray<uint32, NUM_COMPONENT_MAX> m_RemoveEdges;
 	};
 
-	class ECSComponentContainerMgr {
-	public:
-		template<class T> T* AddComponent(EntityID entityID) {
-			return TryGetComponentContainer<T>()->Add(entityID);
-		}
-		template<class T> T* GetComponent(EntityID entityID) {
-			return TryGetComponentContainer<T>()->Get(entityID);
-		}
-		template<class T> void RemoveComponent(EntityID entityID) {
-			TryGetComponentContainer<T>()->Remove(entityID);
-		}
-		void RemoveEntity(EntityID entityID) {
-			for(auto& container: m_Containers) {
-				if(container) {
-					container->Remove(entityID);
-				}
-			}
-		}
-	private:
-		TArray<TUniquePtr<ECSComponentContainerBase>> m_Containers;
-		template<class T> ECSComponentContainer<T>* TryGetComponentContainer() {
-			const ComponentID componentID = T::GetComponentID();
-			if(componentID >= m_Containers.Size()) {
-				m_Containers.Resize(componentID + 1);
-			}
-			if(!m_Containers[componentID]) {
-				m_Containers[componentID].Reset(new ECSComponentContainer<T>());
-			}
-			return (ECSComponentContainer<T>*)m_Containers[componentID].Get();
-		}
+	//  ================ system ====================
+	// A chunk being updated by a system.
+	struct ECSChunkView {
+		ECSArchetype* Archetype;
+		uint32 ChunkIndex;
+		uint32 NumEntities;
+		uint32 LastVersion; // Scene version of the last update of the system
+		mutable ComponentMask WrittenMask{ 0 }; // Columns stamped with the scene version after the update
+		// Return true if the component column is written since the last update of the system, including entities moved in or out.
+		template<class T> bool IsChanged() const { return Archetype->IsChunkChanged(ChunkIndex, T::GetComponentMask(), LastVersion); }
+		// Must be called by UpdateEntities writing the column, columns not marked keep their change versions.
+		template<class T> void MarkWritten() const { WrittenMask |= T::GetComponentMask(); }
 	};
 
-	//  ================ system ====================
 	class ECSSystemBase {
 	public:
 		virtual ~ECSSystemBase() = default;
-		void AddEntity(EntityID entityID) {
-			m_Entity2Indices[entityID] = m_Entities.Size();
-			m_Entities.PushBack(entityID);
-		}
-		void RemoveEntity(EntityID entityID) {
-			if(auto iter = m_Entity2Indices.find(entityID); iter != m_Entity2Indices.end()) {
-				const uint32 idx = iter->second;
-				const EntityID lastEntity = m_Entities.Back();
-				m_Entities.SwapRemoveAt(idx);
-				m_Entity2Indices.erase(entityID);
-				m_Entity2Indices[lastEntity] = idx;
-			}
-		}
+		ComponentMask GetReadMask() const { return m_ReadMask; }
+		ComponentMask GetWriteMask() const { return m_WriteMask; }
+		// An archetype is updated if it has all accessed components and none of the excluded ones.
+		bool MatchArchetype(ComponentMask archetypeMask) const;
+		// Systems conflict if one writes a component accessed by the other, conflicting systems run in registration order.
+		bool ConflictsWith(const ECSSystemBase* rhs) const;
 	protected:
 		friend ECSScene;
-		TArray<EntityID> m_Entities;
-		TMap<EntityID, uint32> m_Entity2Indices;
-		virtual void UpdateEntry(ECSScene* ecsScene, ECSComponentContainerMgr& mgr) = 0;
+		ComponentMask m_ReadMask{ 0 };
+		ComponentMask m_WriteMask{ 0 };
+		ComponentMask m_ExcludeMask{ 0 };
+		// Chunks with none of these components changed since the last update are skipped.
+		ComponentMask m_ChangeFilterMask{ 0 };
+		uint32 m_LastVersion{ 0 };
+		// Update chunks on worker threads, enable it only if Update touches nothing shared except the components.
+		bool m_ParallelChunks{ false };
+		TArray<ECSArchetype*> m_Archetypes;
+		TArray<uint32> m_NumUpdatedChunks; // Num of chunks of each archetype at the last update
+		void UpdateEntry(ECSScene* ecsScene);
+		virtual void UpdateChunk(ECSScene* ecsScene, const ECSChunkView& chunk) = 0;
 	};
 
+	// Components declared as const T are read only, the others are writable.
+	// Override Update for per entity work, it may write any writable component so all of them are marked written.
+	// Or override UpdateEntities for per chunk work such as checking change versions, it marks the columns it writes by ECSChunkView::MarkWritten.
 	template<class ...T>
 	class ECSSystem: public ECSSystemBase {
 	public:
+		ECSSystem() {
+			m_ReadMask = (0 | ... | (std::is_const_v<T> ? T::GetComponentMask() : 0));
+			m_WriteMask = (0 | ... | (std::is_const_v<T> ? 0 : T::GetComponentMask()));
+		}
 		static ComponentMask GetComponentMask() { return (0 | ... | T::GetComponentMask()); } // only for c++17
-		virtual void Update(ECSScene* ecsScene, T*...components) = 0;
-	private:
-		void UpdateEntry(ECSScene* ecsScene, ECSComponentContainerMgr& mgr) final {
-			for(EntityID entityID: m_Entities) {
-				Update(ecsScene, mgr.GetComponent<T>(entityID)...);
+		virtual void Update(ECSScene* ecsScene, T*...components) {}
+	protected:
+		virtual void UpdateEntities(ECSScene* ecsScene, const ECSChunkView& chunk, T*...columns) {
+			if(chunk.NumEntities) {
+				chunk.WrittenMask |= m_WriteMask;
 			}
+			for(uint32 i = 0; i < chunk.NumEntities; ++i) {
+				Update(ecsScene, (columns + i)...);
+			}
+		}
+	private:
+		void UpdateChunk(ECSScene* ecsScene, const ECSChunkView& chunk) final {
+			UpdateEntities(ecsScene, chunk, chunk.Archetype->GetColumn<std::remove_const_t<T>>(chunk.ChunkIndex)...);
 		}
 	};
 
 
+	// Records structural changes from any thread, they are applied when the scene plays the buffer back.
+	class ECSCommandBuffer {
+	public:
+		NON_COPYABLE(ECSCommandBuffer);
+		NON_MOVEABLE(ECSCommandBuffer);
+		explicit ECSCommandBuffer(ECSScene* scene);
+		~ECSCommandBuffer();
+		bool IsEmpty() const { return m_Commands.IsEmpty(); }
+
+		// The id is reserved at once, the entity becomes valid after playback.
+		EntityID CreateEntity();
+
+		void DestroyEntity(EntityID entityID);
+
+		// The component is moved into the entity on playback, replacing the existing one.
+		// Return the recorded component, it can be filled in until playback.
+		template<class T> T* AddComponent(EntityID entityID, T component = T()) {
+			MutexLock lock(m_Mutex);
+			void* data = m_Data.Allocate(sizeof(T), alignof(T));
+			new (data) T(MoveTemp(component));
+			PushCommand(entityID, ECommandType::AddComponent, T::GetComponentID(), data);
+			return (T*)data;
+		}
+
+		template<class T> void RemoveComponent(EntityID entityID) {
+			MutexLock lock(m_Mutex);
+			PushCommand(entityID, ECommandType::RemoveComponent, T::GetComponentID(), nullptr);
+		}
+
+		// Return the component recorded by the last AddComponent of the entity, null if none is recorded or it is removed after.
+		template<class T> T* GetComponent(EntityID entityID) {
+			MutexLock lock(m_Mutex);
+			return (T*)FindRecordedComponent(entityID, std::remove_const_t<T>::GetComponentID());
+		}
+
+	private:
+		friend ECSScene;
+		enum class ECommandType: uint8 {
+			CreateEntity,
+			DestroyEntity,
+			AddComponent,
+			RemoveComponent
+		};
+		struct Command {
+			EntityID Entity;
+			uint32 Sequence;
+			ECommandType Type;
+			ComponentID Component;
+			void* Data; // Component to add, set to null once consumed
+		};
+		ECSScene* m_Scene;
+		Mutex m_Mutex;
+		TArray<Command> m_Commands;
+		LinearAllocator m_Data;
+		TUnorderedMap<uint64, void*> m_RecordedComponents; // Last recorded component of (entity, component id)
+		void PushCommand(EntityID entityID, ECommandType type, ComponentID componentID, void* data);
+		void* FindRecordedComponent(EntityID entityID, ComponentID componentID) const;
+		// Destruct the components not consumed and clear the commands.
+		void Reset();
+	};
+
 	// Scene
 	class ECSScene {
 	public:
-		ECSScene() = default;
+		ECSScene();
 		~ECSScene() = default;
 
 		template<class T> void RegisterSystem() {
-			m_Systems[T::GetComponentMask()].Reset(new T());
+			RegisterSystem(T::GetComponentMask(), new T());
 		}
 
-		EntityID NewEntity() {
-			EntityID entityID = m_MaxEntity++;
-			m_EntityMasks[entityID] = 0;
-			return entityID;
-		}
+		EntityID NewEntity();
 
+		// Return false if the entity is removed, even though its index is reused.
+		bool IsValid(EntityID entityID) const;
+
+		// Adding or removing components moves the entity to another archetype, component pointers got before are invalid.
 		template<class T> T* AddComponent(EntityID entityID) {
-			if(auto maskIter = m_EntityMasks.find(entityID); maskIter != m_EntityMasks.end()) {
-				maskIter->second |= T::GetComponentMask();
-				if(auto sysIter = m_Systems.find(maskIter->second); sysIter != m_Systems.end()) {
-					sysIter->second->AddEntity(entityID);
-				}
-				return m_ComponentContainerMgr.AddComponent<T>(entityID);
-			}
-			LOG_FATAL("[ECSScene::AddComponent] Invalid entity ID! %u", entityID);
-			return nullptr;
+			return (T*)AddComponent(entityID, T::GetComponentID());
 		}
 
+		// Getting a non-const component marks its chunk column changed, use GetComponent<const T> for reading.
 		template<class T> T* GetComponent(EntityID entityID) {
-			return m_ComponentContainerMgr.GetComponent<T>(entityID);
+			return (T*)GetComponent(entityID, T::GetComponentID(), !std::is_const_v<T>);
 		}
 
 		template<class T> void RemoveComponent(EntityID entityID) {
-			if (auto maskIter = m_EntityMasks.find(entityID); maskIter != m_EntityMasks.end()) {
-				if (auto sysIter = m_Systems.find(maskIter->second); sysIter != m_Systems.end()) {
-					sysIter->second->RemoveEntity(entityID);
-				}
-				maskIter->second &= ~T::GetComponentMask();
-				m_ComponentContainerMgr.RemoveComponent<T>(entityID);
-			}
-			else {
-				LOG_FATAL("[ECSScene::RemoveComponent] Invalid entity ID! %u", entityID);
-			}
+			RemoveComponent(entityID, T::GetComponentID());
 		}
 
-		void RemoveEntity(EntityID entityID) {
-			if(auto iter = m_EntityMasks.find(entityID); iter != m_EntityMasks.end()) {
-				for (auto& [comMask, sys] : m_Systems) {
-					if (comMask & iter->second) {
-						sys->RemoveEntity(entityID);
-					}
-				}
-				m_EntityMasks.erase(entityID);
-				m_ComponentContainerMgr.RemoveEntity(entityID);
-			}
-		}
+		void RemoveEntity(EntityID entityID);
 
-		void SystemUpdate() {
-			for(auto&[comMask, sys]: m_Systems) {
-				sys->UpdateEntry(this, m_ComponentContainerMgr);
-			}
-		}
+		// Default command buffer of the scene, played back by PlaybackCommands().
+		ECSCommandBuffer& GetCommandBuffer() { return m_CommandBuffer; }
+
+		// Sync point for deferred structural changes, must not be called during SystemUpdate.
+		// Commands are sorted by entity, each entity moves to its final archetype once.
+		void PlaybackCommands(ECSCommandBuffer& cmdBuffer);
+		void PlaybackCommands() { PlaybackCommands(m_CommandBuffer); }
+
+		// Increased by every SystemUpdate, used as the change version of component writes.
+		uint32 GetVersion() const { return m_Version; }
+
+		// Archetypes are kept when they become empty.
+		uint32 GetNumArchetypes() const { return m_Archetypes.Size(); }
+
+		// Run systems as a task graph built from their component access, entities must not be added or removed during updating.
+		void SystemUpdate();
 
 	private:
-		EntityID m_MaxEntity{ 0 };
-		ECSComponentContainerMgr m_ComponentContainerMgr;
-		TUnorderedMap<EntityID, ComponentMask> m_EntityMasks;
+		friend ECSCommandBuffer;
+		struct EntityRecord {
+			ComponentMask Mask{ 0 };
+			uint32 ArchetypeIndex{ INVALID_INDEX };
+			uint32 Slot{ INVALID_INDEX }; // Next free index if the record is free
+			uint32 Generation{ 0 };
+			bool Valid{ false };
+		};
+		TArray<EntityRecord> m_EntityRecords;
+		// Free records are reused in FIFO order, so that a generation wraps as late as possible.
+		uint32 m_FreeHead{ INVALID_INDEX };
+		uint32 m_FreeTail{ INVALID_INDEX };
+		// Reserved indices beyond the record array, the records are appended when the entities are created.
+		uint32 m_NumReservedRecords{ 0 };
+		Mutex m_ReserveMutex; // Guards the free list and reservation
+		ECSCommandBuffer m_CommandBuffer;
+		EntityRecord* FindRecord(EntityID entityID);
+		// Thread safe, entity ids are reserved before the records are created.
+		EntityID ReserveEntity();
+		void CreateReservedEntity(EntityID entityID);
+		TArray<TUniquePtr<ECSArchetype>> m_Archetypes;
+		TUnorderedMap<ComponentMask, uint32> m_ArchetypeIndices; // Only for creating archetypes, transitions use cached edges
 		TUnorderedMap<uint32, TUniquePtr<ECSSystemBase>> m_Systems;
+		TArray<ECSSystemBase*> m_SystemOrder; // Registration order
+		Engine::TaskGraph m_SystemGraph;
+		bool m_SystemGraphDirty{ true };
+		uint32 m_Version{ 1 };
+		void BuildSystemGraph();
+		void RegisterSystem(ComponentMask mask, ECSSystemBase* system);
+		void* AddComponent(EntityID entityID, ComponentID componentID);
+		void* GetComponent(EntityID entityID, ComponentID componentID, bool bWrite);
+		void RemoveComponent(EntityID entityID, ComponentID componentID);
+		uint32 GetOrCreateArchetype(ComponentMask mask);
+		uint32 GetArchetypeAfterChange(uint32 archetypeIndex, ComponentID componentID, bool bAdd);
+		void MoveEntity(EntityID entityID, uint32 dstArchetypeIndex);
 	};
 }
 
@@ -234,6 +343,14 @@ void CreatMeshObject(Object::ECSScene* scene) {
 	scene->AddComponent<StaticMesh>(entityID);
 }
 
+void SpawnMeshObjectAsync(Object::ECSScene* scene) {
+	// from any thread, applied at the next PlaybackCommands()
+	Object::ECSCommandBuffer& cmdBuffer = scene->GetCommandBuffer();
+	Object::EntityID entityID = cmdBuffer.CreateEntity();
+	cmdBuffer.AddComponent<Transform>(entityID, Transform{ { 0,0,0 }, { 1,1,1 }, {} });
+	cmdBuffer.AddComponent<StaticMesh>(entityID);
+}
+
 void RegisterComponents(Object::ECSScene* scene) {
 	scene->RegisterSystem<MeshRenderSys>();
 }
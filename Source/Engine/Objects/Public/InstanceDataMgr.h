@@ -1,8 +1,12 @@
 #pragma once
 #include "Math/Public/Transform.h"
 #include "Math/Public/Geometry.h"
+#include "Math/Public/FrustumCulling.h"
 #include "Core/Public/TArray.h"
+#include "Core/Public/FrameAllocator.h"
 #include "RHI/Public/RHI.h"
+#include "Render/Public/SoftwareOcclusion.h"
+#include "System/Public/ConfigManager.h"
 //#define INSTANCE_HALF_FLOAT // TODO half float is not supported by Nvidia GPU on Vulkan
 
 namespace Object {
@@ -26,15 +30,21 @@ namespace Object {
 		uint32 InstanceEnd;
 	};
 
+	// Instances are stored in slots grouped by leaf clusters, each leaf keeps free slots after its instances for incremental adding.
+	// Instances added, removed or moved after Build refit the affected clusters and only the dirty slots are uploaded,
+	// the tree is rebuilt in FlushUpdates when its quality dropped. Only UploadUpdates touches the RHI.
 	class InstanceDataMgr {
 	public:
 		struct ClusterNode {
 			Math::AABB3 AABB;
 			uint32 InstanceStart;
-			uint32 InstanceEnd;
+			uint32 InstanceEnd; // a node without instances has InstanceStart == InstanceEnd
 			uint32 ChildStart;
 			uint32 ChildEnd;
+			uint32 Parent;      // INVALID_INDEX for the root and overflow leaves
+			uint32 SlotEnd;     // leaves only, slots [InstanceEnd, SlotEnd) are free
 			bool HasChild() const;
+			bool IsEmpty() const;
 		};
 		InstanceDataMgr();
 		~InstanceDataMgr() = default;
@@ -42,21 +52,65 @@ namespace Object {
 		InstanceDataMgr(InstanceDataMgr&& rhs) noexcept;
 		InstanceDataMgr& operator=(InstanceDataMgr&& rhs)noexcept;
 		void Reset();
+		// Builder of the following builds and rebuilds, the ClusterTreeBuild project setting by default.
+		void SetClusterTreeBuild(Engine::EClusterTreeBuild buildMethod);
+		// Handles of the built instances are the indices of transforms.
 		void Build(const Math::AABB3& resAABB, const TArray<Math::FTransform>& transforms);
+		// Returns the handle of the new instance, handles of removed instances are reused.
+		uint32 AddInstance(const Math::FTransform& transform);
+		void RemoveInstance(uint32 handle);
+		void UpdateInstance(uint32 handle, const Math::FTransform& transform);
+		// Rebuild the tree if the edits degraded it, CPU only and safe on worker threads.
+		void FlushUpdates();
+		// Upload the dirty slots, or the whole buffer if it was rebuilt or outgrown. Called on the game thread before rendering.
+		void UploadUpdates();
+		// Changed whenever instances or clusters changed.
+		uint32 GetVersion() const;
+		uint32 GetNumInstances() const;
 		RHIBuffer* GetInstanceBuffer();
+		// Instances and AABBs of all slots, free slots are never referenced by clusters.
 		TConstArrayView<InstanceData> GetInstances() const;
 		TConstArrayView<Math::AABB3> GetInstanceAABBs() const;
 		TConstArrayView<ClusterNode> GetClusters() const;
 		bool IsEmpty() const;
-		void GenerateInstanceID(const Math::Frustum& frustum, TArray<uint32>& outInstanceIDs);
+		// Clusters hidden in the occlusion depth are skipped if it is given.
+		void GenerateInstanceID(const Math::Frustum& frustum, TFrameArray<uint32>& outInstanceIDs, const Render::SoftwareOcclusion* occlusion = nullptr);
 		void GenerateDrawRanges(const Math::Frustum& frustum, TArray<InstanceDrawRange>& ranges);
 	private:
 		RHIBufferPtr m_InstanceBuffer;
 		TArray<InstanceData> m_Instances;
 		TArray<Math::AABB3> m_AABBs;
-		TArray<ClusterNode> m_ClusterNodes;
+		Math::TAABB3SoA<TArray<float>> m_AABBStreams; // Same as m_AABBs, for culling instances of intersected leaves
+		TArray<ClusterNode> m_ClusterNodes; // tree nodes, then overflow leaves which are not in the tree
 		uint32 m_ClusterSize;
-		void RecursivelyGenerateInstanceID(uint32 nodeIndex, const Math::Frustum& frustum, TArray<uint32>& outInstanceIDs);
+		uint32 m_NumTreeNodes;
+		Math::AABB3 m_ResAABB;
+		TArray<uint32> m_SlotHandles; // INVALID_INDEX for free slots
+		TArray<uint32> m_HandleSlots; // INVALID_INDEX for removed handles
+		TArray<uint32> m_FreeHandles;
+		TArray<uint32> m_DirtySlots;
+		uint32 m_NumInstances;
+		uint32 m_Version;
+		uint32 m_BufferSlots;       // slot capacity of m_InstanceBuffer
+		double m_LeafArea;          // sum of leaf surface areas, updated incrementally
+		double m_BuiltLeafArea;
+		uint32 m_BuiltClusterSize;
+		uint32 m_BuiltNumInstances;
+		bool m_BufferRetired;       // the whole buffer is uploaded by UploadUpdates
+		Engine::EClusterTreeBuild m_ClusterTreeBuild;
+		void BuildClusters(TArray<InstanceData>& instances, TArray<Math::AABB3>& aabbs, TArray<uint32>& handles);
+		void Rebuild();
+		void UploadInstanceBuffer();
+		uint32 FindLeaf(uint32 slot) const;
+		uint32 FindInsertLeaf(const Math::AABB3& aabb);
+		uint32 AddOverflowLeaf();
+		void InsertSlot(uint32 handle, const InstanceData& instance, const Math::AABB3& aabb);
+		void RemoveSlot(uint32 slot);
+		void SetSlot(uint32 slot, const InstanceData& instance, const Math::AABB3& aabb, uint32 handle);
+		void RefitLeaf(uint32 leafIndex);
+		void RecursivelyGenerateInstanceID(uint32 nodeIndex, const Math::Frustum& frustum, const Render::SoftwareOcclusion* occlusion, TFrameArray<uint32>& outInstanceIDs);
 		void RecursivelyGenerateDrawRanges(uint32 nodeIndex, const Math::Frustum& frustum, TArray<InstanceDrawRange>& ranges);
+		void RecursivelyPushLeafInstances(uint32 nodeIndex, TFrameArray<uint32>& outInstanceIDs);
+		void RecursivelyPushLeafRanges(uint32 nodeIndex, TArray<InstanceDrawRange>& ranges);
 	};
 }
\ No newline at end of file
@@ -54,6 +54,15 @@ namespace Object {
 		LevelActor* GetActor() { return m_Actor; }
 		RenderScene* GetScene();
 		uint32 GetEntityID();
+	protected:
+		// ECS components are added and removed through the command buffer of the scene.
+		// Return the recorded component until it is played back, then the one in the scene.
+		template<class T> T* GetECSComponent() {
+			if(T* component = GetScene()->GetCommandBuffer().GetComponent<T>(GetEntityID())) {
+				return component;
+			}
+			return GetScene()->GetComponent<T>(GetEntityID());
+		}
 	private:
 		LevelActor* m_Actor;
 	};
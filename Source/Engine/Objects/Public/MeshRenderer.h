@@ -2,10 +2,14 @@
 #include "Objects/Public/ECS.h"
 #include "Objects/Public/RenderScene.h"
 #include "Objects/Public/InstanceDataMgr.h"
+#include "Objects/Public/SceneBVH.h"
 #include "Objects/Public/Material.h"
 #include "Objects/Public/RenderResource.h"
+#include "Render/Public/InstanceCullingCPU.h"
 #include "Asset/Public/MeshAsset.h"
 #include "Core/Public/Container.h"
+#include "Core/Public/Concurrency.h"
+#include "Math/Public/FrustumCulling.h"
 
 
 namespace Object {
@@ -47,7 +51,6 @@ namespace Object {
 	// transform
 	struct TransformECSComponent {
 		ObjectTransformData TransformData;
-		uint32 CacheIndex{ INVALID_INDEX };
 		void SetTransform(const Math::FTransform& transform);
 		REGISTER_ECS_COMPONENT(TransformECSComponent);
 	};
@@ -59,18 +62,35 @@ namespace Object {
 		REGISTER_ECS_COMPONENT(InstancedDataECSComponent);
 	};
 
-	class MeshRenderSystem : public ECSSystem<TransformECSComponent, MeshECSComponent> {
+	// meshes drawn into the software occlusion depth buffer, usually the big primitives of a mesh
+	struct OccluderECSComponent {
+		TArray<const Render::OccluderMesh*> Meshes;
+		REGISTER_ECS_COMPONENT(OccluderECSComponent);
+	};
+
+	// Visits only the chunks with transforms or meshes changed, the renderer keeps the entities of the other chunks between frames.
+	class MeshRenderSystem : public ECSSystem<const TransformECSComponent, const MeshECSComponent> {
+	public:
+		MeshRenderSystem();
 	private:
-		void Update(ECSScene* ecsScene, TransformECSComponent* transform, MeshECSComponent* meshCom) override;
+		// Entities each chunk registered in the renderer at its last update, released when the chunk is updated again.
+		TUnorderedMap<const ECSArchetype*, TArray<TArray<EntityID>>> m_ChunkEntities;
+		void UpdateEntities(ECSScene* ecsScene, const ECSChunkView& chunk, const TransformECSComponent* transforms, const MeshECSComponent* meshComs) override;
 		RENDER_SCENE_REGISTER_SYSTEM(MeshRenderSystem);
 	};
 
-	class InstancedMeshRenderSystem : public ECSSystem<MeshECSComponent, InstancedDataECSComponent> {
+	class InstancedMeshRenderSystem : public ECSSystem<const MeshECSComponent, InstancedDataECSComponent> {
 	private:
-		void Update(ECSScene* ecsScene, MeshECSComponent* meshCom, InstancedDataECSComponent* instanceCom) override;
+		void Update(ECSScene* ecsScene, const MeshECSComponent* meshCom, InstancedDataECSComponent* instanceCom) override;
 		RENDER_SCENE_REGISTER_SYSTEM(InstancedMeshRenderSystem);
 	};
 
+	class OccluderRenderSystem : public ECSSystem<const TransformECSComponent, const OccluderECSComponent> {
+	private:
+		void Update(ECSScene* ecsScene, const TransformECSComponent* transform, const OccluderECSComponent* occluder) override;
+		RENDER_SCENE_REGISTER_SYSTEM(OccluderRenderSystem);
+	};
+
 	// Manage all materials and pipeline states with reference counter, the pso with no reference will be removed.
 	class PrimitiveMaterialPSOCache {
 	public:
@@ -79,6 +99,8 @@ namespace Object {
 			uint32 MaterialIndex;
 		};
 		RHIGraphicsPipelineState* GetPSO(MaterialChild* handle, bool bInstanced);
+		// Index of the PSO returned by the last GetPSO of the handle, used as the pipeline ID of draw sort keys.
+		uint32 GetPSOIndex(const MaterialChild* handle, bool bInstanced) const;
 		void AddMaterialRef(MaterialChild* handle);
 		void RemoveMaterialRef(MaterialChild* handle);
 		uint32 GetMaterialSize() const;
@@ -103,6 +125,7 @@ namespace Object {
 		TIDMapContainer<PSOCache> m_PSOCaches;
 		TArray<MaterialCache> m_MaterialCaches;
 		TMap<MaterialInterface*, uint32> m_MapMaterialIndex;
+		Mutex m_RefMutex; // ECS systems add references concurrently
 
 		uint32 FixMaterialIndex(const MaterialChild* handle);
 		uint32 FindOrAddMaterial(MaterialInterface* material);
@@ -115,12 +138,19 @@ namespace Object {
 		PrimitiveMgr();
 		~PrimitiveMgr() = default;
 
-		void AddPrimitive(MeshECSComponent* mesh, TransformECSComponent* transform);
+		// Registrations of an entity are counted, it is rendered until all of them are removed.
+		void AddPrimitive(EntityID entity, const MeshECSComponent* mesh, const TransformECSComponent* transform, bool bTransformChanged, bool bMeshChanged);
 
-		void AddInstancedPrimitive(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData);
+		void RemovePrimitive(EntityID entity);
 
+		void AddInstancedPrimitive(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData);
+
+		// Upload the instance data flushed this frame, then prepare the renderers.
 		void PreDrawCall();
 
+		// Cull primitives against all views at once, called before generating draw calls of these views.
+		void CullViews(TConstArrayView<RenderCameraBase*> views);
+
 		void GenerateBasePassDrawCall(Object::RenderCamera* camera);
 
 		void GenerateDirectionalShadowDrawCall(Object::ShadowCamera* camera, RHIGraphicsPipelineState* pso, RHIGraphicsPipelineState* instancedPSO);
@@ -130,6 +160,8 @@ namespace Object {
 		TUniquePtr<PrimitiveMaterialPSOCache> m_MaterialPSOCache;
 		TUniquePtr<PrimitiveRendererBase> m_PrimitiveRenderer;
 		TUniquePtr<PrimitiveInstancedRendererBase> m_PrimitiveInstancedRenderer;
+		TArray<InstanceDataMgr*> m_InstanceUploads; // flushed by ECS systems, uploaded on the game thread in PreDrawCall
+		Mutex m_InstanceUploadMutex;
 	};
 
 	class IPrimitiveRendererBase {
@@ -137,6 +169,7 @@ namespace Object {
 		IPrimitiveRendererBase(PrimitiveMaterialPSOCache* materialPSOCache) : m_MaterialPSOCache(materialPSOCache) {}
 		virtual ~IPrimitiveRendererBase() = default;
 		virtual void PreDrawCall() = 0;
+		virtual void CullViews(TConstArrayView<RenderCameraBase*> views) {/*Do nothing*/ }
 		virtual void GenerateBasePassDrawCall(Object::RenderCamera* camera) = 0;
 		virtual void GenerateDirectionalShadowDrawCall(Object::ShadowCamera* camera, RHIGraphicsPipelineState* pso) = 0;
 
@@ -148,7 +181,10 @@ namespace Object {
 	class PrimitiveRendererBase: public IPrimitiveRendererBase {
 	public:
 		using IPrimitiveRendererBase::IPrimitiveRendererBase;
-		virtual void Add(MeshECSComponent* mesh, TransformECSComponent* transform) = 0;
+		// The cached transform and AABBs are updated only if bTransformChanged, the primitives only if bMeshChanged.
+		virtual void Add(EntityID entity, const MeshECSComponent* mesh, const TransformECSComponent* transform, bool bTransformChanged, bool bMeshChanged) = 0;
+		virtual void Remove(EntityID entity) = 0;
+		// Free the entities with no registration.
 		virtual void Reset() = 0;
 	};
 
@@ -156,7 +192,7 @@ namespace Object {
 	class PrimitiveInstancedRendererBase: public IPrimitiveRendererBase {
 	public:
 		using IPrimitiveRendererBase::IPrimitiveRendererBase;
-		virtual void Add(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) = 0;
+		virtual void Add(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) = 0;
 		virtual void Reset() = 0;
 	};
 
@@ -164,21 +200,26 @@ namespace Object {
 	public:
 		using PrimitiveRendererBase::PrimitiveRendererBase;
 		~PrimitiveRendererCPUDriven() override = default;
-		void Add(MeshECSComponent* mesh, TransformECSComponent* transform) override;
+		void Add(EntityID entity, const MeshECSComponent* mesh, const TransformECSComponent* transform, bool bTransformChanged, bool bMeshChanged) override;
+		void Remove(EntityID entity) override;
 		void Reset() override;
-		void PreDrawCall() override {/*Do nothing*/ }
+		void PreDrawCall() override;
+		void CullViews(TConstArrayView<RenderCameraBase*> views) override;
 		void GenerateBasePassDrawCall(Object::RenderCamera* camera) override;
 		void GenerateDirectionalShadowDrawCall(Object::ShadowCamera* camera, RHIGraphicsPipelineState* pso) override;
 	private:
 		struct PrimitiveCache: PrimitiveMaterialPSOCache::MaterialChild{
 			PrimitiveResource* Primitive;
 			Math::AABB3 AABB;
+			uint32 ProxyIndex{ INVALID_INDEX }; // proxy in m_SceneBVH
 		};
 		struct PrimitiveCacheGroup {
 			ObjectTransformData Transform;
 			TArray<PrimitiveCache> PrimitiveCaches;
 			uint32 BufferIndex{ INVALID_INDEX }; // index of transform buffer
-			uint32 RefCount{ 0 };
+			uint32 RefCount{ 0 }; // registrations by the chunks holding the entity
+			EntityID Entity{ INVALID_ENTITY };
+			TEnumFlag<ERenderPassType> RenderFlags;
 			bool IsValid() const { return PrimitiveCaches.Size(); }
 		};
 		struct PCGDestructor {
@@ -188,18 +229,30 @@ namespace Object {
 		};
 		// all primitives
 		TIDReuseArray<PrimitiveCacheGroup, PCGDestructor> m_PrimitiveStorage;
-		// primitives indices in per pass
-		TStaticArray<TArray<uint32>, EnumCast(ERenderPassType::MaxNum)> m_RenderingCacheArray;
+		TUnorderedMap<EntityID, uint32> m_EntityGroups; // group index of each entity
+		// AABBs of all primitives, refitted when transforms changed
+		SceneBVH m_SceneBVH;
+		TArray<TPair<uint32, uint32>> m_ProxyPrimitives; // group index and primitive index of each proxy
 		// dynamic buffer of per primitive group.
 		TArray<RHIDynamicBuffer> m_TransformBuffers;
 		const RHIDynamicBuffer& GetTransformBuffer(uint32 groupIndex);
+		// result of CullViews, cleared by Reset
+		TArray<const RenderCameraBase*> m_CulledViews;
+		TArray<TPair<uint32, uint32>> m_CulledPrimitives; // group index and primitive index
+		TArray<uint32> m_CulledViewMasks;
+		void BuildPrimitiveCaches(PrimitiveCacheGroup& cacheGroup, const MeshECSComponent* mesh);
+		void ReleasePrimitiveCaches(PrimitiveCacheGroup& cacheGroup);
+		// Cull the registered primitives with the scene BVH, outputs pairs of group index and primitive index.
+		void CullPrimitives(const Math::Frustum* frustums, uint32 numFrustums, TFrameArray<TPair<uint32, uint32>>& outPrimitives, TFrameArray<uint32>& outViewMasks);
+		// Use the result of CullViews if the camera is culled there, otherwise cull the pass.
+		void GetVisiblePrimitives(const RenderCameraBase* camera, ERenderPassType pass, TFrameArray<TPair<uint32, uint32>>& outVisible);
 	};
 
 	class PrimitiveInstancedRendererCPUDriven: public PrimitiveInstancedRendererBase {
 	public:
 		using PrimitiveInstancedRendererBase::PrimitiveInstancedRendererBase;
 		~PrimitiveInstancedRendererCPUDriven() override = default;
-		void Add(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) override;
+		void Add(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) override;
 		void Reset() override;
 		void PreDrawCall() override {/*Do nothing*/ }
 		void GenerateBasePassDrawCall(Object::RenderCamera* camera) override;
@@ -230,7 +283,7 @@ namespace Object {
 	public:
 		PrimitiveInstancedRendererGPUDriven(PrimitiveMaterialPSOCache* cache);
 		~PrimitiveInstancedRendererGPUDriven() override = default;
-		void Add(MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) override;
+		void Add(const MeshECSComponent* mesh, InstancedDataECSComponent* instanceData) override;
 		void Reset() override;
 		void PreDrawCall() override;
 		void GenerateBasePassDrawCall(Object::RenderCamera* camera) override;
@@ -241,7 +294,7 @@ namespace Object {
 		};
 		struct InstancedPrimitiveCacheGroup {
 			InstanceDataMgr* DataMgr;
-			RHIBuffer* CacheInstanceBuffer; // check if buffer retired
+			uint32 CacheVersion; // check if instances or clusters changed
 			TArray<InstancedPrimitiveCache> PrimitiveCaches;
 			TEnumFlag<ERenderPassType> RenderFlag;
 			uint32 RefCount;
@@ -254,13 +307,17 @@ namespace Object {
 		};
 		// all primitives
 		TIDReuseArray<InstancedPrimitiveCacheGroup, IPCGDestructor> m_PrimitiveStorage;
-		// global GPU data
+		// global GPU data, also kept in memory for culling on CPU
 		RHIBufferPtr m_InstanceAABBBuffer;
 		RHIBufferPtr m_ClusterAABBBuffer;
+		TArray<Render::InstanceCullingAABB> m_InstanceAABBs;
+		TArray<Render::InstanceCullingAABB> m_ClusterAABBs;
 		// per pass GPU data
 		struct PassBuffers {
 			RHIBufferPtr IndirectCmd; // raw indirect cmd buffer, copied to per camera when culling
 			RHIBufferPtr Cluster;
+			TArray<DrawIndexedIndirectCommand> IndirectCmds;
+			TArray<Render::InstanceCullingCluster> Clusters;
 			uint32 ClusterSize;
 			uint32 AlignedInstanceSize; // all instance size aligned by 4
 			uint32 PrimitiveSize;
@@ -273,6 +330,8 @@ namespace Object {
 		uint32 m_SRVAlignment;
 		bool m_IsBufferDirty;
 		bool m_EnableOcclusionTest;
+		bool m_EnableCPUCulling; // run InstanceCullingCPU and upload the results instead of dispatching the culling shader
+		uint32 m_CaptureIndex;
 
 		bool CheckBufferRetired(); // check if need update buffer, called before UpdateGPUBuffers
 
@@ -280,6 +339,13 @@ namespace Object {
 
 		void GPUCulling(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass);
 
+		void CPUCulling(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass);
+
+		Render::InstanceCullingParams GetCPUCullingParams(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass, Render::HZBCPU& hzb) const;
+
+		// record the culling inputs of the frame Rendering.InstanceCullingCaptureFrame for InstanceCullingTest
+		void CaptureCulling(Object::RenderCameraBase* camera, RenderContext& context, ERenderPassType pass);
+
 		uint32 AlignInstanceSize(uint32 size) const;
 	};
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "RHI/Public/RHI.h"
 #include "Render/Public/DrawCall.h"
 #include "Render/Public/HZBBuilder.h"
+#include "Render/Public/SoftwareOcclusion.h"
 
 namespace Object {
 
@@ -10,10 +11,12 @@ namespace Object {
 
 	struct RenderContext {
 		Render::DrawCallQueue CullingQueue;
-		Render::DrawCallQueue RenderingQueue;
+		uint32 NumCulledClusters{ 0 }; // clusters tested by CullingQueue, the cost of the culling pass
+		Render::DrawCommandQueue RenderingQueue;
 		RHIBufferPtr CullResultBuffer;
 		RHIBufferPtr IndirectCmdBuffer;
 		Render::HZBBuilder* HZB{ nullptr };
+		const Render::SoftwareOcclusion* Occlusion{ nullptr }; // set by the scene for the main view, cleared by Reset
 		void Reset(Render::HZBBuilder* hzb);
 	};
 
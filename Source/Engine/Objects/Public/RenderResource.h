@@ -6,6 +6,8 @@
 #include "Asset/Public/MeshAsset.h"
 #include "Asset/Public/MaterialAsset.h"
 #include "RHI/Public/RHI.h"
+#include "Render/Public/SoftwareOcclusion.h"
+#include "System/Public/TaskFuture.h"
 
 namespace Object {
 
@@ -23,10 +25,18 @@ namespace Object {
 
 		// texture
 		static RHITexturePtr CreateTextureFromAsset(const Asset::TextureAsset& asset);
+		// Blocks until loaded, launch LoadTextureAsync of all textures first to overlap the file IO.
 		RHITexture* GetTexture(const XString& fileName);
+		// Load file on background thread, create and register the texture on game thread. Loads of one file in flight share a future.
+		Engine::TFuture<RHITexture*> LoadTextureAsync(const XString& fileName);
 
 		// primitive
+		// Blocks until loaded, launch LoadPrimitiveAsync of all primitives first to overlap the file IO.
 		PrimitiveResource* GetPrimitive(const XString& fileName);
+		// Load file on background thread, create and register the buffers on game thread. Loads of one file in flight share a future.
+		Engine::TFuture<PrimitiveResource*> LoadPrimitiveAsync(const XString& fileName);
+		// CPU copy of the primitive positions for software occlusion, loaded on first use.
+		const Render::OccluderMesh* GetOccluderMesh(const XString& fileName);
 
 		// pipeline state
 		typedef RHIShader*(*ComputePipelineInitializer)();
@@ -37,7 +47,11 @@ namespace Object {
 		RHIComputePipelineState* GetComputePipelineState(uint32 psoID);
 	private:
 		TMap<XString, PrimitiveResource> m_Primitives;
+		TMap<XString, Render::OccluderMesh> m_OccluderMeshes;
 		TMap<XString, RHITexturePtr> m_Textures;
+		// loads in flight, dropped by the first lookup after registering; a failed load stays and keeps returning null
+		TMap<XString, Engine::TFuture<PrimitiveResource*>> m_PendingPrimitives;
+		TMap<XString, Engine::TFuture<RHITexture*>> m_PendingTextures;
 		TArray<RHIGraphicsPipelineStatePtr> m_GraphicsPipelineStates;
 		TArray<RHIComputePipelineStatePtr> m_ComputePipelineStates;
 		StaticResourceMgr();
@@ -5,6 +5,7 @@
 #include "RHI/Public/RHI.h"
 #include "Render/Public/Renderer.h"
 #include "Render/Public/HZBBuilder.h"
+#include "Render/Public/SoftwareOcclusion.h"
 
 namespace Object {
 	class RenderCamera;
@@ -21,6 +22,8 @@ namespace Object {
 		RenderCamera* GetMainCamera() { return m_Camera.Get(); }
 		DirectionalLight* GetDirectionalLight() { return m_DirectionalLight.Get(); }
 		PrimitiveMgr* GetPrimitiveMgr() { return m_PrimitiveMgr.Get(); }
+		// Null if software occlusion is disabled.
+		Render::SoftwareOcclusion* GetSoftwareOcclusion() { return m_SoftwareOcclusion.Get(); }
 		Render::DrawCallQueue& GetLightingPassDrawCallQueue() { return m_LightingPassDrawCallQueue; }
 		void Update();
 		void Render(Render::RenderGraph& rg, Render::RGTextureNode* targetNode);
@@ -38,17 +41,20 @@ namespace Object {
 		Render::DrawCallQueue m_LightingPassDrawCallQueue;
 		// fo gBuffer
 		USize2D m_TargetSize;
-		RHITexturePtr m_GBufferNormal;
-		RHITexturePtr m_GBufferAlbedo;
-		RHITexturePtr m_Depth;
+		RHITexture* m_GBufferNormal{ nullptr }; // transient, set when the lighting pass runs
+		RHITexture* m_GBufferAlbedo{ nullptr };
 		RHITexturePtr m_DepthSRV;
 		// for deferred lighting
 		TUniquePtr<RHIGraphicsPipelineState> m_DeferredLightingPSO;
 		// for hzb
 		Render::HZBBuilder m_HzbBuilder;
+		// for cpu occlusion culling
+		TUniquePtr<Render::SoftwareOcclusion> m_SoftwareOcclusion;
 
 		void CreateDeferredLightingDrawCall();
 		void CreateTextureResources();
+		RHITextureDesc GetGBufferDesc(ERHIFormat format) const;
+		RHITextureDesc GetDepthDesc() const;
 	};
 #define RENDER_SCENE_REGISTER_SYSTEM(cls) private:\
 	inline static const uint8 s_RegisterSystem = (Object::RenderScene::AddConstructFunc([](RenderScene* scene){scene->RegisterSystem<cls>();}), 0)
@@ -0,0 +1,93 @@
+#pragma once
+#include "Math/Public/Geometry.h"
+#include "Core/Public/TArray.h"
+#include "Core/Public/Container.h"
+#include "Core/Public/FrameAllocator.h"
+#include "System/Public/TaskFuture.h"
+
+namespace Object {
+	// Dynamic AABB tree of scene primitives for hierarchical culling, reference Box2D b2DynamicTree.
+	// Moved proxies refit their ancestors, the tree is rebuilt on a background worker when refitting degraded its quality.
+	// Not thread safe except CullViews, which can run concurrently with other CullViews.
+	class SceneBVH {
+	public:
+		SceneBVH();
+		~SceneBVH();
+		NON_COPYABLE(SceneBVH);
+		NON_MOVEABLE(SceneBVH);
+		// Returns the proxy id, ids of removed proxies are reused.
+		uint32 Insert(const Math::AABB3& aabb);
+		void Remove(uint32 proxy);
+		void Update(uint32 proxy, const Math::AABB3& aabb);
+		const Math::AABB3& GetAABB(uint32 proxy) const;
+		uint32 GetNumProxies() const;
+		// Apply the finished rebuild, and launch a new one if the cost grew too much since the last build. Called once per frame.
+		void Tick();
+		// Wait for the pending rebuild and apply it.
+		void FlushRebuild();
+		// Surface area of all internal nodes relative to the root, lower is better.
+		float GetCost() const;
+		// Bit v of outViewMasks[i] is set if proxy outProxies[i] is visible in frustums[v], proxies invisible in all frustums are not output.
+		void CullViews(const Math::Frustum* frustums, uint32 numFrustums, TFrameArray<uint32>& outProxies, TFrameArray<uint32>& outViewMasks) const;
+
+	private:
+		struct Node {
+			Math::AABB3 AABB;
+			uint32 Parent;
+			uint32 Child0; // INVALID_INDEX for leaves
+			uint32 Child1; // proxy id for leaves
+			bool IsLeaf() const { return INVALID_INDEX == Child0; }
+		};
+		struct Proxy {
+			Math::AABB3 AABB;
+			uint32 Leaf; // INVALID_INDEX if removed
+		};
+		struct BuildPrimitive {
+			Math::AABB3 AABB;
+			Math::FVector3 Center;
+			uint32 Proxy;
+		};
+		struct BuildResult {
+			TArray<Node> Nodes;
+			uint32 Root;
+			double InternalArea;
+		};
+		enum class EProxyOp : uint8 {
+			Insert,
+			Remove,
+			Update
+		};
+		struct CullEntry {
+			uint32 Node;
+			uint32 TestMask;  // views intersected by the parent
+			uint32 InnerMask; // views containing the parent
+		};
+
+		TArray<Node> m_Nodes;
+		TArray<uint32> m_FreeNodes;
+		TArray<Proxy> m_Proxies;
+		TArray<uint32> m_FreeProxies;
+		uint32 m_Root;
+		uint32 m_NumProxies;
+		double m_InternalArea; // sum of internal node surface areas, updated incrementally
+		float m_BuiltCost;
+		// background rebuild, the snapshot and the result are only touched by the task until it completes
+		Engine::TFuture<void> m_RebuildTask;
+		TArray<BuildPrimitive> m_RebuildSnapshot;
+		BuildResult m_RebuildResult;
+		TArray<TPair<EProxyOp, uint32>> m_RebuildPendingOps; // proxy changes during the rebuild, replayed on the new tree
+
+		uint32 AllocateNode();
+		void FreeNode(uint32 index);
+		void SetInternalAABB(uint32 index, const Math::AABB3& aabb);
+		void InsertLeaf(uint32 leaf);
+		void RemoveLeaf(uint32 leaf);
+		void RefitAncestors(uint32 index);
+		void LaunchRebuild();
+		void ApplyRebuild();
+		void CullSubtree(const Math::Frustum* frustums, uint32 numFrustums, CullEntry root, TFrameArray<uint32>& outProxies, TFrameArray<uint32>& outViewMasks) const;
+		static uint32 BuildRecursive(TArray<BuildPrimitive>& primitives, uint32 start, uint32 end, uint32 parent, BuildResult& result);
+		// Partition the primitives by the binned SAH split on the max axis of centers, returns the start of the right side.
+		static uint32 PartitionSAH(TArray<BuildPrimitive>& primitives, uint32 start, uint32 end, const Math::AABB3& centerBounds);
+	};
+}
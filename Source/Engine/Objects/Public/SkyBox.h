@@ -27,8 +27,8 @@ namespace Object {
 		REGISTER_ACTOR_COMPONENT(SkyBoxComponent);
 	};
 
-	class SkyBoxSystem : public ECSSystem<SkyBoxECSComp> {
-		void Update(ECSScene* scene, SkyBoxECSComp* component) override;
+	class SkyBoxSystem : public ECSSystem<const SkyBoxECSComp> {
+		void Update(ECSScene* scene, const SkyBoxECSComp* component) override;
 		RENDER_SCENE_REGISTER_SYSTEM(SkyBoxSystem);
 	};
 }
\ No newline at end of file
@@ -30,9 +30,14 @@ namespace Object {
 		const XString& GetMeshFile() const { return m_MeshFile; }
 		void SetCastShadow(bool bCastShadow);
 		bool GetCastShadow() const { return m_CastShadow; }
+		// Occluders hide the meshes behind them in software occlusion culling.
+		void SetOccluder(bool bOccluder);
+		bool GetOccluder() const { return m_Occluder; }
 	private:
 		XString m_MeshFile;
 		bool m_CastShadow;
+		bool m_Occluder{ false };
+		void UpdateOccluderMeshes();
 		REGISTER_ACTOR_COMPONENT(MeshComponent);
 	};
 
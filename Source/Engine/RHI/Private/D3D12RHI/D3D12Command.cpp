@@ -39,6 +39,7 @@ void D3D12CommandList::Reset() {
 		m_CommandList->Reset(m_Allocator, nullptr);
 		m_DescriptorCache->Reset();
 		m_ResStates.clear();
+		m_PendingBarriers.Reset();
 		m_IsRecording = true;
 	}
 }
@@ -253,11 +254,78 @@ void D3D12CommandList::CopyBufferToBuffer(RHIBuffer* srcBuffer, RHIBuffer* dstBu
 }
 
 void D3D12CommandList::TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subRes) {
+	TArray<D3D12_RESOURCE_BARRIER> barriers;
+	AppendTextureBarriers(texture, stateAfter, subRes, barriers);
+	if(barriers.Size()) {
+		m_CommandList->ResourceBarrier(barriers.Size(), barriers.Data());
+	}
+}
+
+void D3D12CommandList::TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) {
+	TArray<D3D12_RESOURCE_BARRIER> barriers;
+	AppendBufferBarrier(buffer, stateAfter, barriers);
+	if(barriers.Size()) {
+		m_CommandList->ResourceBarrier(barriers.Size(), barriers.Data());
+	}
+}
+
+void D3D12CommandList::TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) {
+	TArray<D3D12_RESOURCE_BARRIER> barriers; barriers.Reserve(textures.Size() + buffers.Size());
+	// the states are tracked at the begin of a split barrier, the end repeats the begun barriers
+	auto beginSplit = [this, &barriers](uint32 first) {
+		for(uint32 i = first; i < barriers.Size(); ++i) {
+			barriers[i].Flags = D3D12_RESOURCE_BARRIER_FLAG_BEGIN_ONLY;
+			m_PendingBarriers.PushBack(barriers[i]);
+		}
+	};
+	for(const RHITextureTransition& transition: textures) {
+		if(EBarrierSplit::End == transition.Split) {
+			AppendTextureEndBarriers(transition.Texture, transition.SubRes, barriers);
+			continue;
+		}
+		const uint32 first = barriers.Size();
+		AppendTextureBarriers(transition.Texture, transition.StateAfter, transition.SubRes, barriers);
+		if(EBarrierSplit::Begin == transition.Split) {
+			beginSplit(first);
+		}
+	}
+	for(const RHIBufferTransition& transition: buffers) {
+		if(EBarrierSplit::End == transition.Split) {
+			AppendEndBarriers(((D3D12Buffer*)transition.Buffer)->GetResource(), 0, barriers);
+			continue;
+		}
+		const uint32 first = barriers.Size();
+		AppendBufferBarrier(transition.Buffer, transition.StateAfter, barriers);
+		if(EBarrierSplit::Begin == transition.Split) {
+			beginSplit(first);
+		}
+	}
+	if(barriers.Size()) {
+		m_CommandList->ResourceBarrier(barriers.Size(), barriers.Data());
+	}
+}
+
+void D3D12CommandList::GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) {
+}
+
+void D3D12CommandList::BeginDebugLabel(const char* msg, const float* color) {
+	PIXBeginEvent(m_CommandList.Get(), 0xffffffff, msg);
+}
+
+void D3D12CommandList::EndDebugLabel() {
+	PIXEndEvent(m_CommandList.Get());
+}
+
+void D3D12CommandList::TransitionResourceState(ID3D12Resource* resource, D3D12_RESOURCE_STATES stateBefore, D3D12_RESOURCE_STATES stateAfter, uint32 subResIndex) {
+	const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(resource, stateBefore, stateAfter, subResIndex);
+	m_CommandList->ResourceBarrier(1, &barrier);
+}
+
+void D3D12CommandList::AppendTextureBarriers(RHITexture* texture, EResourceState stateAfter, RHITextureSubRes subRes, TArray<D3D12_RESOURCE_BARRIER>& barriers) {
 	D3D12Texture* d3d12Texture = (D3D12Texture*)texture;
 	ID3D12Resource* resource = d3d12Texture->GetResource();
 	const auto& texDesc = texture->GetDesc();
 	D3D12_RESOURCE_STATES d3d12StateBefore;
-	//d3d12StateBefore = ToD3D12ResourceState(stateBefore);
 	const D3D12_RESOURCE_STATES d3d12StateAfter  = ToD3D12ResourceState(stateAfter);
 
 	// get resource state
@@ -275,13 +343,11 @@ void D3D12CommandList::TransitionTextureState(RHITexture* texture, EResourceStat
 	if(texDesc.IsAllSubRes(subRes)) {
 		d3d12StateBefore = resState->GetSubResState(D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
 		if(d3d12StateBefore != d3d12StateAfter) {
-			TransitionResourceState(resource, d3d12StateBefore, d3d12StateAfter, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES);
+			barriers.PushBack(CD3DX12_RESOURCE_BARRIER::Transition(resource, d3d12StateBefore, d3d12StateAfter, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES));
 			resState->SetState(d3d12StateAfter);
 		}
 	}
 	else {
-		const uint32 barrierCount = subRes.ArraySize * subRes.MipSize;
-		TArray<D3D12_RESOURCE_BARRIER> barriers; barriers.Reserve(barrierCount);
 		for (uint32 arr = 0; arr < subRes.ArraySize; ++arr) {
 			for (uint32 mip = 0; mip < subRes.MipSize; ++mip) {
 				const uint32 arrayIndex = subRes.ArrayIndex + arr;
@@ -294,37 +360,45 @@ void D3D12CommandList::TransitionTextureState(RHITexture* texture, EResourceStat
 				}
 			}
 		}
-		if(barriers.Size()) {
-			m_CommandList->ResourceBarrier(barriers.Size(), barriers.Data());
-		}
 	}
 }
 
-void D3D12CommandList::TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) {
+void D3D12CommandList::AppendBufferBarrier(RHIBuffer* buffer, EResourceState stateAfter, TArray<D3D12_RESOURCE_BARRIER>& barriers) {
 	D3D12Buffer* d3d12Buffer = (D3D12Buffer*)buffer;
-	ID3D12Resource* resource = d3d12Buffer->GetResource();
 	const D3D12_RESOURCE_STATES d3d12StateBefore = d3d12Buffer->GetState();
-	//const D3D12_RESOURCE_STATES d3d12StateBefore = ToD3D12ResourceState(stateBefore);
 	const D3D12_RESOURCE_STATES d3d12StateAfter = ToD3D12ResourceState(stateAfter);
-	const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(resource, d3d12StateBefore, d3d12StateAfter, 0);
-	m_CommandList->ResourceBarrier(1, &barrier);
-	d3d12Buffer->SetState(d3d12StateAfter);
-}
-
-void D3D12CommandList::GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) {
-}
-
-void D3D12CommandList::BeginDebugLabel(const char* msg, const float* color) {
-	PIXBeginEvent(m_CommandList.Get(), 0xffffffff, msg);
+	if(d3d12StateBefore != d3d12StateAfter) {
+		barriers.PushBack(CD3DX12_RESOURCE_BARRIER::Transition(d3d12Buffer->GetResource(), d3d12StateBefore, d3d12StateAfter, 0));
+		d3d12Buffer->SetState(d3d12StateAfter);
+	}
 }
 
-void D3D12CommandList::EndDebugLabel() {
-	PIXEndEvent(m_CommandList.Get());
+void D3D12CommandList::AppendEndBarriers(ID3D12Resource* resource, uint32 subResIndex, TArray<D3D12_RESOURCE_BARRIER>& barriers) {
+	for(uint32 i = 0; i < m_PendingBarriers.Size();) {
+		D3D12_RESOURCE_BARRIER& barrier = m_PendingBarriers[i];
+		if(barrier.Transition.pResource == resource && (D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES == subResIndex || barrier.Transition.Subresource == subResIndex)) {
+			barrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_END_ONLY;
+			barriers.PushBack(barrier);
+			m_PendingBarriers.SwapRemoveAt(i);
+		}
+		else {
+			++i;
+		}
+	}
 }
 
-void D3D12CommandList::TransitionResourceState(ID3D12Resource* resource, D3D12_RESOURCE_STATES stateBefore, D3D12_RESOURCE_STATES stateAfter, uint32 subResIndex) {
-	const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(resource, stateBefore, stateAfter, subResIndex);
-	m_CommandList->ResourceBarrier(1, &barrier);
+void D3D12CommandList::AppendTextureEndBarriers(RHITexture* texture, RHITextureSubRes subRes, TArray<D3D12_RESOURCE_BARRIER>& barriers) {
+	ID3D12Resource* resource = ((D3D12Texture*)texture)->GetResource();
+	const auto& texDesc = texture->GetDesc();
+	if(texDesc.IsAllSubRes(subRes)) {
+		AppendEndBarriers(resource, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, barriers);
+		return;
+	}
+	for (uint32 arr = 0; arr < subRes.ArraySize; ++arr) {
+		for (uint32 mip = 0; mip < subRes.MipSize; ++mip) {
+			AppendEndBarriers(resource, D3D12CalcSubresource(subRes.MipIndex + mip, subRes.ArrayIndex + arr, 0, texDesc.MipSize, texDesc.ArraySize), barriers);
+		}
+	}
 }
 
 void D3D12CommandList::CheckBegin() {
@@ -335,6 +409,7 @@ void D3D12CommandList::CheckBegin() {
 
 void D3D12CommandList::CheckClose() {
 	if(m_IsRecording) {
+		CHECK(m_PendingBarriers.IsEmpty()); // split barriers are ended on the list they are begun
 		// check the  resource state and write to texture
 		for(auto& [tex, resStateOnCmd] : m_ResStates) {
 			ResourceState& resStateOnTex = tex->GetResState();
@@ -56,6 +56,7 @@ public:
 	void CopyBufferToBuffer(RHIBuffer* srcBuffer, RHIBuffer* dstBuffer, uint32 srcOffset, uint32 dstOffset, uint32 byteSize) override;
 	void TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subRes) override;
 	void TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) override;
+	void TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) override;
 	void GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) override;
 	void BeginDebugLabel(const char* msg, const float* color) override;
 	void EndDebugLabel() override;
@@ -72,7 +73,14 @@ private:
 	bool m_IsRecording;
 	// call before draw/dispatch
 	TUnorderedMap<D3D12Texture*, ResourceState> m_ResStates;
+	TArray<D3D12_RESOURCE_BARRIER> m_PendingBarriers; // begun split barriers to end
 	void PreDraw();
+	// appends the barriers from the tracked states, skips subresources already in the state
+	void AppendTextureBarriers(RHITexture* texture, EResourceState stateAfter, RHITextureSubRes subRes, TArray<D3D12_RESOURCE_BARRIER>& barriers);
+	void AppendBufferBarrier(RHIBuffer* buffer, EResourceState stateAfter, TArray<D3D12_RESOURCE_BARRIER>& barriers);
+	// appends the end barriers of the split barriers begun on the resource, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES ends all of them
+	void AppendEndBarriers(ID3D12Resource* resource, uint32 subResIndex, TArray<D3D12_RESOURCE_BARRIER>& barriers);
+	void AppendTextureEndBarriers(RHITexture* texture, RHITextureSubRes subRes, TArray<D3D12_RESOURCE_BARRIER>& barriers);
 };
 
 class D3D12Queue {
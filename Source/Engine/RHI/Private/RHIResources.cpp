@@ -344,8 +344,9 @@ bool RHIShaderParam::operator==(const RHIShaderParam& rhs) const {
         if(IsDynamicBuffer != rhs.IsDynamicBuffer) {
             return false;
         }
-        return IsDynamicBuffer ? (Data.DynamicBuffer == rhs.Data.DynamicBuffer) : (Data.Buffer == rhs.Data.Buffer && Data.Offset == rhs.Data.Offset && Data.Size == rhs.Data.Offset);
+        return IsDynamicBuffer ? (Data.DynamicBuffer == rhs.Data.DynamicBuffer) : (Data.Buffer == rhs.Data.Buffer && Data.Offset == rhs.Data.Offset && Data.Size == rhs.Data.Size);
     case EBindingType::Texture:
+    case EBindingType::RWTexture:
         return Data.Texture == rhs.Data.Texture && Data.SubRes == rhs.Data.SubRes;
     case EBindingType::Sampler:
         return Data.Sampler == rhs.Data.Sampler;
@@ -70,6 +70,34 @@ namespace {
 		return flags;
 	}
 
+	VkImageMemoryBarrier ToImageMemoryBarrier(const RHITextureTransition& transition) {
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = ToImageLayout(transition.StateBefore);
+		barrier.newLayout = ToImageLayout(transition.StateAfter);
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = static_cast<VulkanRHITexture*>(transition.Texture)->GetImage();
+		ToImageSubResourceRange(transition.SubRes, barrier.subresourceRange);
+		barrier.srcAccessMask = ToVkAccessFlags(transition.StateBefore);
+		barrier.dstAccessMask = ToVkAccessFlags(transition.StateAfter);
+		return barrier;
+	}
+
+	VkBufferMemoryBarrier ToBufferMemoryBarrier(const RHIBufferTransition& transition) {
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.pNext = nullptr;
+		barrier.srcAccessMask = ToVkAccessFlags(transition.StateBefore);
+		barrier.dstAccessMask = ToVkAccessFlags(transition.StateAfter);
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = ((VulkanBuffer*)transition.Buffer)->GetBuffer();
+		barrier.offset = 0;
+		barrier.size = transition.Buffer->GetDesc().ByteSize;
+		return barrier;
+	}
+
 	void GenerateMipMap(VkCommandBuffer cmd, VkImage image, uint32 levelCount, uint32 width, uint32 height, VkImageAspectFlags aspect, uint32 baseLayer, uint32 layerCount) {
 		for (uint32 i = 1; i < levelCount; i++){
 			VkImageBlit imageBlit{};
@@ -212,12 +240,18 @@ m_QueueType(queue){
 
 VulkanCommandBuffer::~VulkanCommandBuffer() {
 	ASSERT(!m_HasBegun, "Command buffer must be Destroyed after ending.");
+	VkDevice device = m_Owner->GetDevice()->GetDevice();
+	for(VkEvent event: m_Events) {
+		vkDestroyEvent(device, event, nullptr);
+	}
 	m_Owner->FreeCommandBuffer(this);
 }
 
 void VulkanCommandBuffer::Reset() {
 	vkResetCommandBuffer(m_Handle, 0);
 	m_PipelineDescriptorSetCache->Reset();
+	m_SplitBarriers.Reset();
+	m_EventIndex = 0;
 	CheckBegin();
 }
 
@@ -412,42 +446,60 @@ void VulkanCommandBuffer::CopyTextureToTexture(RHITexture* srcTex, RHITexture* d
 }
 
 void VulkanCommandBuffer::TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subRes) {
-	VulkanRHITexture* vkTex = static_cast<VulkanRHITexture*>(texture);
-	const VkImageLayout oldLayout = ToImageLayout(stateBefore);
-	const VkImageLayout newLayout = ToImageLayout(stateAfter);
-
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.oldLayout = oldLayout;
-	barrier.newLayout = newLayout;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.image = vkTex->GetImage();
-	ToImageSubResourceRange(subRes, barrier.subresourceRange);
-	barrier.srcAccessMask = ToVkAccessFlags(stateBefore);
-	barrier.dstAccessMask = ToVkAccessFlags(stateAfter);
+	const VkImageMemoryBarrier barrier = ToImageMemoryBarrier({ texture, stateBefore, stateAfter, subRes });
 	VkPipelineStageFlags srcStage = GetBarrierPipelineStage(barrier.srcAccessMask, m_QueueType);
 	VkPipelineStageFlags dstStage = GetBarrierPipelineStage(barrier.dstAccessMask, m_QueueType);
 	vkCmdPipelineBarrier(m_Handle, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
 void VulkanCommandBuffer::TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) {
-	VulkanBuffer* vkBuffer = (VulkanBuffer*)buffer;
-	VkBufferMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-	barrier.pNext = nullptr;
-	barrier.srcAccessMask = ToVkAccessFlags(stateBefore);
-	barrier.dstAccessMask = ToVkAccessFlags(stateAfter);
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.buffer = vkBuffer->GetBuffer();
-	barrier.offset = 0;
-	barrier.size = buffer->GetDesc().ByteSize;
+	const VkBufferMemoryBarrier barrier = ToBufferMemoryBarrier({ buffer, stateBefore, stateAfter });
 	VkPipelineStageFlags srcStage = GetBarrierPipelineStage(barrier.srcAccessMask, m_QueueType);
 	VkPipelineStageFlags dstStage = GetBarrierPipelineStage(barrier.dstAccessMask, m_QueueType);
 	vkCmdPipelineBarrier(m_Handle, srcStage, dstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 }
 
+void VulkanCommandBuffer::TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) {
+	if(!textures.Size() && !buffers.Size()) {
+		return;
+	}
+	EndSplitBarriers(textures, buffers);
+	TArray<VkImageMemoryBarrier> imageBarriers; imageBarriers.Reserve(textures.Size());
+	TArray<VkBufferMemoryBarrier> bufferBarriers; bufferBarriers.Reserve(buffers.Size());
+	TArray<VkImageMemoryBarrier> beginImageBarriers;
+	TArray<VkBufferMemoryBarrier> beginBufferBarriers;
+	VkAccessFlags srcAccess = 0, dstAccess = 0;
+	for(const RHITextureTransition& transition: textures) {
+		if(EBarrierSplit::Begin == transition.Split) {
+			beginImageBarriers.PushBack(ToImageMemoryBarrier(transition));
+		}
+		else if(EBarrierSplit::None == transition.Split) {
+			const VkImageMemoryBarrier& barrier = imageBarriers.EmplaceBack(ToImageMemoryBarrier(transition));
+			srcAccess |= barrier.srcAccessMask;
+			dstAccess |= barrier.dstAccessMask;
+		}
+	}
+	for(const RHIBufferTransition& transition: buffers) {
+		if(EBarrierSplit::Begin == transition.Split) {
+			beginBufferBarriers.PushBack(ToBufferMemoryBarrier(transition));
+		}
+		else if(EBarrierSplit::None == transition.Split) {
+			const VkBufferMemoryBarrier& barrier = bufferBarriers.EmplaceBack(ToBufferMemoryBarrier(transition));
+			srcAccess |= barrier.srcAccessMask;
+			dstAccess |= barrier.dstAccessMask;
+		}
+	}
+	if(imageBarriers.Size() || bufferBarriers.Size()) {
+		// one barrier waits for the union of the stages
+		VkPipelineStageFlags srcStage = GetBarrierPipelineStage(srcAccess, m_QueueType);
+		VkPipelineStageFlags dstStage = GetBarrierPipelineStage(dstAccess, m_QueueType);
+		vkCmdPipelineBarrier(m_Handle, srcStage, dstStage, 0, 0, nullptr, bufferBarriers.Size(), bufferBarriers.Data(), imageBarriers.Size(), imageBarriers.Data());
+	}
+	if(beginImageBarriers.Size() || beginBufferBarriers.Size()) {
+		BeginSplitBarriers(MoveTemp(beginImageBarriers), MoveTemp(beginBufferBarriers));
+	}
+}
+
 void VulkanCommandBuffer::GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) {
 	VulkanRHITexture* vkTex = static_cast<VulkanRHITexture*>(texture);
 	const auto& desc = vkTex->GetDesc();
@@ -474,6 +526,85 @@ void VulkanCommandBuffer::EndDebugLabel() {
 	}
 }
 
+void VulkanCommandBuffer::BeginSplitBarriers(TArray<VkImageMemoryBarrier>&& imageBarriers, TArray<VkBufferMemoryBarrier>&& bufferBarriers) {
+	if(m_EventIndex >= m_Events.Size()) {
+		VkEventCreateInfo info{ VK_STRUCTURE_TYPE_EVENT_CREATE_INFO, nullptr, 0 };
+		vkCreateEvent(m_Owner->GetDevice()->GetDevice(), &info, nullptr, &m_Events.EmplaceBack());
+	}
+	SplitBarriers& split = m_SplitBarriers.EmplaceBack();
+	split.Event = m_Events[m_EventIndex++];
+	VkAccessFlags srcAccess = 0;
+	for(const VkImageMemoryBarrier& barrier: imageBarriers) {
+		srcAccess |= barrier.srcAccessMask;
+	}
+	for(const VkBufferMemoryBarrier& barrier: bufferBarriers) {
+		srcAccess |= barrier.srcAccessMask;
+	}
+	split.SrcStage = GetBarrierPipelineStage(srcAccess, m_QueueType);
+	split.ImageBarriers = MoveTemp(imageBarriers);
+	split.BufferBarriers = MoveTemp(bufferBarriers);
+	vkCmdSetEvent(m_Handle, split.Event, split.SrcStage);
+}
+
+void VulkanCommandBuffer::EndSplitBarriers(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) {
+	// the begun barriers of the ended transitions are waited in one call
+	TArray<VkImageMemoryBarrier> imageBarriers;
+	TArray<VkBufferMemoryBarrier> bufferBarriers;
+	TArray<VkEvent> events;
+	VkPipelineStageFlags srcStage = 0;
+	VkAccessFlags dstAccess = 0;
+	// moves the first begun barrier matching the ended one to the barriers to wait
+	auto endBarrier = [this, &events, &srcStage, &dstAccess](auto getBarriers, auto isMatched, auto& endedBarriers) {
+		for(SplitBarriers& split: m_SplitBarriers) {
+			auto& barriers = getBarriers(split);
+			for(uint32 i = 0; i < barriers.Size(); ++i) {
+				if(isMatched(barriers[i])) {
+					if(std::find(events.begin(), events.end(), split.Event) == events.end()) {
+						events.PushBack(split.Event);
+						srcStage |= split.SrcStage;
+					}
+					dstAccess |= barriers[i].dstAccessMask;
+					endedBarriers.PushBack(barriers[i]);
+					barriers.SwapRemoveAt(i);
+					return;
+				}
+			}
+		}
+	};
+	for(const RHITextureTransition& transition: textures) {
+		if(EBarrierSplit::End == transition.Split) {
+			const VkImageMemoryBarrier ended = ToImageMemoryBarrier(transition);
+			endBarrier([](SplitBarriers& split)->auto& { return split.ImageBarriers; }, [&ended](const VkImageMemoryBarrier& barrier) {
+				return barrier.image == ended.image && 0 == memcmp(&barrier.subresourceRange, &ended.subresourceRange, sizeof(VkImageSubresourceRange));
+			}, imageBarriers);
+		}
+	}
+	for(const RHIBufferTransition& transition: buffers) {
+		if(EBarrierSplit::End == transition.Split) {
+			const VkBuffer ended = ((VulkanBuffer*)transition.Buffer)->GetBuffer();
+			endBarrier([](SplitBarriers& split)->auto& { return split.BufferBarriers; }, [ended](const VkBufferMemoryBarrier& barrier) {
+				return barrier.buffer == ended;
+			}, bufferBarriers);
+		}
+	}
+	if(events.IsEmpty()) {
+		return;
+	}
+	const VkPipelineStageFlags dstStage = GetBarrierPipelineStage(dstAccess, m_QueueType);
+	vkCmdWaitEvents(m_Handle, events.Size(), events.Data(), srcStage, dstStage, 0, nullptr, bufferBarriers.Size(), bufferBarriers.Data(), imageBarriers.Size(), imageBarriers.Data());
+	// an event with all its barriers ended is reset after the wait
+	for(uint32 i = 0; i < m_SplitBarriers.Size();) {
+		const SplitBarriers& split = m_SplitBarriers[i];
+		if(split.ImageBarriers.IsEmpty() && split.BufferBarriers.IsEmpty()) {
+			vkCmdResetEvent(m_Handle, split.Event, dstStage);
+			m_SplitBarriers.RemoveAt(i);
+		}
+		else {
+			++i;
+		}
+	}
+}
+
 void VulkanCommandBuffer::CheckBegin() {
 	if(!m_HasBegun) {
 		VkCommandBufferBeginInfo info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr };
@@ -493,6 +624,7 @@ void VulkanCommandBuffer::PrepareDraw(){
 
 void VulkanCommandBuffer::CheckEnd() {
 	if(m_HasBegun) {
+		CHECK(m_SplitBarriers.IsEmpty()); // split barriers are ended on the command buffer they are begun
 		vkEndCommandBuffer(m_Handle);
 		m_HasBegun = false;
 	}
@@ -61,6 +61,7 @@ public:
 	void CopyTextureToTexture(RHITexture* srcTex, RHITexture* dstTex, const RHITextureCopyRegion& region) override;
 	void TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subRes) override;
 	void TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) override;
+	void TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) override;
 	void GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) override;
 	void BeginDebugLabel(const char* msg, const float* color) override;
 	void EndDebugLabel() override;
@@ -73,6 +74,18 @@ private:
 	VkViewport m_Viewport {};
 	VkRect2D m_Scissor {};
 	bool m_HasBegun{ false };
+	// split barriers are begun by setting an event and ended by waiting for it
+	struct SplitBarriers {
+		VkEvent Event;
+		VkPipelineStageFlags SrcStage;
+		TArray<VkImageMemoryBarrier> ImageBarriers;
+		TArray<VkBufferMemoryBarrier> BufferBarriers;
+	};
+	TArray<SplitBarriers> m_SplitBarriers;
+	TArray<VkEvent> m_Events;
+	uint32 m_EventIndex{ 0 };
+	void BeginSplitBarriers(TArray<VkImageMemoryBarrier>&& imageBarriers, TArray<VkBufferMemoryBarrier>&& bufferBarriers);
+	void EndSplitBarriers(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers);
 	void CheckBegin();
 	void CheckEnd();
 	// call before draw/dispatch
@@ -111,6 +111,11 @@ constexpr uint32 VK_WAIT_MAX = UINT32_MAX;
 	macroName(PFN_vkCreateFramebuffer                        , vkCreateFramebuffer)\
 	macroName(PFN_vkDestroyFramebuffer                       , vkDestroyFramebuffer)\
 	macroName(PFN_vkCmdPipelineBarrier                       , vkCmdPipelineBarrier)\
+	macroName(PFN_vkCreateEvent                              , vkCreateEvent)\
+	macroName(PFN_vkDestroyEvent                             , vkDestroyEvent)\
+	macroName(PFN_vkCmdSetEvent                              , vkCmdSetEvent)\
+	macroName(PFN_vkCmdResetEvent                            , vkCmdResetEvent)\
+	macroName(PFN_vkCmdWaitEvents                            , vkCmdWaitEvents)\
 	macroName(PFN_vkCreateDescriptorPool                     , vkCreateDescriptorPool)\
 	macroName(PFN_vkResetDescriptorPool                      , vkResetDescriptorPool)\
 	macroName(PFN_vkDestroyDescriptorPool                    , vkDestroyDescriptorPool)\
@@ -1,5 +1,28 @@
 #pragma once
 #include "RHIResources.h"
+#include "Core/Public/TArrayView.h"
+
+// A split transition is begun after the last use of the resource and ended before the next use, on the same command buffer.
+enum class EBarrierSplit : uint8 {
+	None,
+	Begin,
+	End
+};
+
+struct RHITextureTransition {
+	RHITexture* Texture;
+	EResourceState StateBefore;
+	EResourceState StateAfter;
+	RHITextureSubRes SubRes;
+	EBarrierSplit Split{ EBarrierSplit::None };
+};
+
+struct RHIBufferTransition {
+	RHIBuffer* Buffer;
+	EResourceState StateBefore;
+	EResourceState StateAfter;
+	EBarrierSplit Split{ EBarrierSplit::None };
+};
 
 // command buffer
 class RHICommandBuffer {
@@ -31,6 +54,8 @@ public:
 	virtual void CopyBufferToBuffer(RHIBuffer* srcBuffer, RHIBuffer* dstBuffer, uint32 srcOffset, uint32 dstOffset, uint32 byteSize) = 0;
 	virtual void TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subDesc={}) = 0;
 	virtual void TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) = 0;
+	// issues all transitions in one barrier, the end of a split transition is issued with the same description as its begin
+	virtual void TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) = 0;
 	virtual void GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) = 0;
 
 	virtual void BeginDebugLabel(const char* msg, const float* color) = 0;
@@ -1,5 +1,50 @@
 #include "Render/Public/DrawCall.h"
 
+namespace {
+	// Stable LSD radix sort of keys with 8 bit digits, order is permuted with the keys.
+	// Histograms of all digits are counted in one pass, digits equal in all keys are skipped.
+	void RadixSort(TArray<uint64>& keys, TArray<uint32>& order, TArray<uint64>& tmpKeys, TArray<uint32>& tmpOrder) {
+		const uint32 size = keys.Size();
+		if(size < 2) {
+			return;
+		}
+		uint32 offsets[8][256] = {};
+		for(uint32 i = 0; i < size; ++i) {
+			const uint64 key = keys[i];
+			for(uint32 digit = 0; digit < 8; ++digit) {
+				++offsets[digit][(key >> (digit * 8)) & 0xFF];
+			}
+		}
+		tmpKeys.Resize(size);
+		tmpOrder.Resize(size);
+		uint64* srcKeys = keys.Data(); uint64* dstKeys = tmpKeys.Data();
+		uint32* srcOrder = order.Data(); uint32* dstOrder = tmpOrder.Data();
+		for(uint32 digit = 0; digit < 8; ++digit) {
+			const uint32 shift = digit * 8;
+			if(offsets[digit][(srcKeys[0] >> shift) & 0xFF] == size) {
+				continue;
+			}
+			uint32 sum = 0;
+			for(uint32& offset : offsets[digit]) {
+				const uint32 count = offset;
+				offset = sum;
+				sum += count;
+			}
+			for(uint32 i = 0; i < size; ++i) {
+				const uint32 dst = offsets[digit][(srcKeys[i] >> shift) & 0xFF]++;
+				dstKeys[dst] = srcKeys[i];
+				dstOrder[dst] = srcOrder[i];
+			}
+			std::swap(srcKeys, dstKeys);
+			std::swap(srcOrder, dstOrder);
+		}
+		if(srcKeys != keys.Data()) {
+			keys.Swap(tmpKeys);
+			order.Swap(tmpOrder);
+		}
+	}
+}
+
 namespace Render {
 	DrawCall::DrawCall(DrawCall&& rhs) noexcept: m_Func(MoveTemp(rhs.m_Func)) {
 	}
@@ -28,4 +73,140 @@ namespace Render {
 			operator[](i).Execute(cmd);
 		}
 	}
+
+	uint64 DrawCommandQueue::MakeSortKey(uint32 layer, uint32 pipelineID, uint32 materialID, float depth) {
+		const float clampedDepth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+		const uint64 depthBits = (uint64)(clampedDepth * 65535.0f);
+		return ((uint64)(layer & 0xFF) << 56) | ((uint64)(pipelineID & 0xFFFFF) << 36) | ((uint64)(materialID & 0xFFFFF) << 16) | depthBits;
+	}
+
+	DrawCommand& DrawCommandQueue::AddCommand(uint64 sortKey) {
+		if(!m_Keys.IsEmpty() && sortKey < m_Keys.Back()) {
+			m_IsSorted = false;
+		}
+		m_Keys.PushBack(sortKey);
+		return m_Commands.EmplaceBack();
+	}
+
+	uint32 DrawCommandQueue::AddParamBlock() {
+		m_ParamBlocks.PushBack({ m_Params.Size(), 0 });
+		return m_ParamBlocks.Size() - 1;
+	}
+
+	void DrawCommandQueue::AddParam(uint32 setIndex, uint32 bindIndex, const RHIShaderParam& param) {
+		CHECK(!m_ParamBlocks.IsEmpty());
+		m_Params.PushBack({ setIndex, bindIndex, param });
+		++m_ParamBlocks.Back().NumParams;
+	}
+
+	void DrawCommandQueue::AddParam(RHIShaderBinding binding, const RHIShaderParam& param) {
+		AddParam(binding.Set, binding.Binding, param);
+	}
+
+	void DrawCommandQueue::Reset() {
+		m_Commands.Reset();
+		m_Params.Reset();
+		m_ParamBlocks.Reset();
+		m_Keys.Reset();
+		m_IsSorted = true;
+	}
+
+	void DrawCommandQueue::Sort() {
+		if(m_IsSorted) {
+			return;
+		}
+		m_Order.Resize(m_Keys.Size());
+		for(uint32 i = 0; i < m_Order.Size(); ++i) {
+			m_Order[i] = i;
+		}
+		RadixSort(m_Keys, m_Order, m_TmpKeys, m_TmpOrder);
+		// Commands are moved to the sorted order once, Execute walks them in memory order.
+		m_TmpCommands.Resize(m_Commands.Size());
+		for(uint32 i = 0; i < m_Order.Size(); ++i) {
+			m_TmpCommands[i] = m_Commands[m_Order[i]];
+		}
+		m_Commands.Swap(m_TmpCommands);
+		m_IsSorted = true;
+	}
+
+	void DrawCommandQueue::Execute(RHICommandBuffer* cmd) {
+		Sort();
+		m_Stats = {};
+		m_Stats.NumCommands = m_Commands.Size();
+		RHIGraphicsPipelineState* boundPSO = nullptr;
+		DrawMaterialBindFunc boundMaterialFunc = nullptr;
+		void* boundMaterial = nullptr;
+		RHIBuffer* boundVB = nullptr;
+		RHIBuffer* boundIB = nullptr;
+		// Blocks set since the last pipeline bind, binding a pipeline resets the layout.
+		uint32 boundViewParams = INVALID_INDEX;
+		uint32 boundObjectParams = INVALID_INDEX;
+		auto setParamBlock = [&](uint32 block, uint32& boundBlock) {
+			if(INVALID_INDEX == block) {
+				return;
+			}
+			if(block == boundBlock) {
+				++m_Stats.NumParamBlocksSaved;
+				return;
+			}
+			const DrawParamBlock& paramBlock = m_ParamBlocks[block];
+			for(uint32 i = paramBlock.ParamOffset; i < paramBlock.ParamOffset + paramBlock.NumParams; ++i) {
+				const DrawParam& drawParam = m_Params[i];
+				cmd->SetShaderParam(drawParam.SetIndex, drawParam.BindIndex, drawParam.Param);
+			}
+			boundBlock = block;
+			++m_Stats.NumParamBlocks;
+			m_Stats.NumParams += paramBlock.NumParams;
+		};
+		for(const DrawCommand& command: m_Commands) {
+			if(command.PSO != boundPSO) {
+				cmd->BindGraphicsPipeline(command.PSO);
+				boundPSO = command.PSO;
+				boundMaterialFunc = nullptr;
+				boundMaterial = nullptr;
+				boundViewParams = INVALID_INDEX;
+				boundObjectParams = INVALID_INDEX;
+				++m_Stats.NumPipelineBinds;
+			}
+			else {
+				++m_Stats.NumPipelineBindsSaved;
+			}
+			// Material params are expected in slots not used by the params of commands.
+			if(command.BindMaterial) {
+				if(command.BindMaterial != boundMaterialFunc || command.Material != boundMaterial) {
+					command.BindMaterial(cmd, command.Material);
+					boundMaterialFunc = command.BindMaterial;
+					boundMaterial = command.Material;
+					++m_Stats.NumMaterialBinds;
+				}
+				else {
+					++m_Stats.NumMaterialBindsSaved;
+				}
+			}
+			setParamBlock(command.ViewParams, boundViewParams);
+			setParamBlock(command.ObjectParams, boundObjectParams);
+			if(command.VertexBuffer != boundVB) {
+				cmd->BindVertexBuffer(command.VertexBuffer, 0, 0);
+				boundVB = command.VertexBuffer;
+				++m_Stats.NumVertexBufferBinds;
+			}
+			else {
+				++m_Stats.NumVertexBufferBindsSaved;
+			}
+			if(command.IndexBuffer != boundIB) {
+				cmd->BindIndexBuffer(command.IndexBuffer, 0);
+				boundIB = command.IndexBuffer;
+				++m_Stats.NumIndexBufferBinds;
+			}
+			else {
+				++m_Stats.NumIndexBufferBindsSaved;
+			}
+			if(command.IndirectBuffer) {
+				cmd->DrawIndexedIndirect(command.IndirectBuffer, command.IndirectOffset, 1);
+			}
+			else {
+				cmd->DrawIndexed(command.IndexCount, command.InstanceCount, 0, 0, command.FirstInstance);
+			}
+		}
+	}
 }
@@ -94,6 +94,7 @@ namespace Render {
 		// generate mip 0 firstly
 		{
 			RGComputeNode* buildHZBMip0 = rg.CreateComputeNode("BuildHZBMip0");
+			buildHZBMip0->SetPreferredQueue(EQueueType::Compute);
 			const RHITextureSubRes srcSubRes = RHITextureSubRes{ 0, 1, 0, 1, ETextureDimension::Tex2D, ETextureViewFlags::DepthStencil };
 			buildHZBMip0->ReadSRV(depthNode, srcSubRes);
 			const RHITextureSubRes dstSubRes = RHITextureSubRes{ 0, 1, 0, 1, ETextureDimension::Tex2D, ETextureViewFlags::Color };
@@ -102,6 +103,7 @@ namespace Render {
 			// calculate thread group size
 			uint32 groupX = Math::Max(1u, (m_ActualWidth + PER_GROUP_OUTPUT_ROW - 1) / PER_GROUP_OUTPUT_ROW);
 			uint32 groupY = Math::Max(1u, (m_ActualHeight + PER_GROUP_OUTPUT_ROW - 1) / PER_GROUP_OUTPUT_ROW);
+			buildHZBMip0->SetEstimatedCost(m_ActualWidth * m_ActualHeight);
 
 			// size buffer
 			Math::FVector4 sizeInfo = { (float)m_ActualWidth, (float)m_ActualHeight, (float)srcWidth, (float)srcHeight};
@@ -126,6 +128,7 @@ namespace Render {
 			RGTextureNode* lastHzbNode = hzbNode;
 			hzbNode = rg.CopyTextureNode(hzbNode, StringFormat("HZB%u", i));
 			RGComputeNode* buildHZBMip = rg.CreateComputeNode(StringFormat("BuildHZBMip%u", i));
+			buildHZBMip->SetPreferredQueue(EQueueType::Compute);
 			const RHITextureSubRes srcSubRes = RHITextureSubRes{ 0, 1, (uint8)(i-1), 1, ETextureDimension::Tex2D, ETextureViewFlags::Color };
 			buildHZBMip->ReadSRV(lastHzbNode, srcSubRes);
 			const RHITextureSubRes dstSubRes = RHITextureSubRes{ 0, 1, i, 1, ETextureDimension::Tex2D, ETextureViewFlags::Color };
@@ -135,6 +138,7 @@ namespace Render {
 			uint32 heightSize = (uint32)Math::Ceil(widthScale * (float)srcHeight);
 			uint32 groupX = Math::Max(1u, (dstSize + PER_GROUP_OUTPUT_ROW - 1) / PER_GROUP_OUTPUT_ROW);
 			uint32 groupY = Math::Max(1u, (heightSize + PER_GROUP_OUTPUT_ROW - 1) / PER_GROUP_OUTPUT_ROW);
+			buildHZBMip->SetEstimatedCost(dstSize * heightSize);
 			Math::IVector4 sizeInfo = { (int)dstSize };
 
 			RHIDynamicBuffer sizeBuffer = RHI::Instance()->AllocateDynamicBuffer(EBufferFlags::Uniform, sizeof(sizeInfo), &sizeInfo, 0);
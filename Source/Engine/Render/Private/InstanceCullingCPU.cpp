@@ -0,0 +1,347 @@
+#include "Render/Public/InstanceCullingCPU.h"
+#include "Math/Public/Math.h"
+#include "System/Public/ThreadPool.h"
+#include <cmath>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define INSTANCE_CULLING_SSE 1
+#include <emmintrin.h>
+#else
+#define INSTANCE_CULLING_SSE 0
+#endif
+
+namespace {
+	// same values as InstanceCulling.hlsl
+	constexpr uint32 NUM_INSTANCE_PER_CLUSTER = 16;
+	constexpr uint32 TEST_RESULT_OUTER = 0;
+	constexpr uint32 TEST_RESULT_INTERSECTED = 1;
+	constexpr uint32 TEST_RESULT_INNER = 2;
+	constexpr uint32 NUM_CLUSTERS_PER_TASK = 256;
+	constexpr uint32 CAPTURE_MAGIC = 0x50414349; // "ICAP"
+	constexpr uint32 CAPTURE_VERSION = 1;
+
+	static_assert(sizeof(Render::InstanceCullingParams) == 192, "InstanceCullingParams must match CameraInfo of InstanceCulling.hlsl");
+	static_assert(sizeof(Render::InstanceCullingAABB) == 32, "InstanceCullingAABB must match AABBData of InstanceCulling.hlsl");
+	static_assert(sizeof(Render::InstanceCullingCluster) == 20, "InstanceCullingCluster must match ClusterData of InstanceCulling.hlsl");
+
+	inline Math::FVector3 ToVector3(const Math::FVector4& v) {
+		return { v.X, v.Y, v.Z };
+	}
+
+	// texel of the clamped point sampler, NaN goes to 0
+	inline uint32 ToTexel(float coord, uint32 size) {
+		const float texel = std::floor(coord * (float)size);
+		return texel > 0.0f ? (uint32)Math::Min(texel, (float)(size - 1)) : 0u;
+	}
+
+	inline uint32 PlaneTestAABB(const Math::Plane& plane, const Math::FVector3& center, const Math::FVector3& extent) {
+		const float signedDistance = plane.Normal.Dot(center) - plane.Distance;
+		const float r = extent.X * Math::Abs(plane.Normal.X) + extent.Y * Math::Abs(plane.Normal.Y) + extent.Z * Math::Abs(plane.Normal.Z);
+		if(signedDistance < r && signedDistance > -r) {
+			return TEST_RESULT_INTERSECTED;
+		}
+		if(signedDistance >= r) {
+			return TEST_RESULT_INNER;
+		}
+		return TEST_RESULT_OUTER;
+	}
+
+	uint32 FrustumTestAABB(const Math::Frustum& frustum, const Math::FVector3& aabbMin, const Math::FVector3& aabbMax) {
+		const Math::FVector3 center = (aabbMax + aabbMin) * 0.5f;
+		const Math::FVector3 extent = (aabbMax - aabbMin) * 0.5f;
+		uint32 testResult = TEST_RESULT_INNER;
+		for(const Math::Plane* plane : { &frustum.Near, &frustum.Far, &frustum.Left, &frustum.Right, &frustum.Bottom, &frustum.Top }) {
+			const uint32 planeTestResult = PlaneTestAABB(*plane, center, extent);
+			if(TEST_RESULT_OUTER == planeTestResult) {
+				return TEST_RESULT_OUTER;
+			}
+			testResult = Math::Min(testResult, planeTestResult);
+		}
+		return testResult;
+	}
+
+	// bit i is set if the instance i of the 4 AABBs is not outside the frustum
+	uint32 FrustumTestAABBx4(const Math::Frustum& frustum, const Render::InstanceCullingAABB* aabbs) {
+#if INSTANCE_CULLING_SSE
+		__m128 minX = _mm_loadu_ps(&aabbs[0].AABBMin.X);
+		__m128 minY = _mm_loadu_ps(&aabbs[1].AABBMin.X);
+		__m128 minZ = _mm_loadu_ps(&aabbs[2].AABBMin.X);
+		__m128 minW = _mm_loadu_ps(&aabbs[3].AABBMin.X);
+		_MM_TRANSPOSE4_PS(minX, minY, minZ, minW);
+		__m128 maxX = _mm_loadu_ps(&aabbs[0].AABBMax.X);
+		__m128 maxY = _mm_loadu_ps(&aabbs[1].AABBMax.X);
+		__m128 maxZ = _mm_loadu_ps(&aabbs[2].AABBMax.X);
+		__m128 maxW = _mm_loadu_ps(&aabbs[3].AABBMax.X);
+		_MM_TRANSPOSE4_PS(maxX, maxY, maxZ, maxW);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 centerX = _mm_mul_ps(_mm_add_ps(maxX, minX), half);
+		const __m128 centerY = _mm_mul_ps(_mm_add_ps(maxY, minY), half);
+		const __m128 centerZ = _mm_mul_ps(_mm_add_ps(maxZ, minZ), half);
+		const __m128 extentX = _mm_mul_ps(_mm_sub_ps(maxX, minX), half);
+		const __m128 extentY = _mm_mul_ps(_mm_sub_ps(maxY, minY), half);
+		const __m128 extentZ = _mm_mul_ps(_mm_sub_ps(maxZ, minZ), half);
+		__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for(const Math::Plane* plane : { &frustum.Near, &frustum.Far, &frustum.Left, &frustum.Right, &frustum.Bottom, &frustum.Top }) {
+			const Math::FVector3& n = plane->Normal;
+			const __m128 distance = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(n.X), centerX), _mm_mul_ps(_mm_set1_ps(n.Y), centerY)), _mm_mul_ps(_mm_set1_ps(n.Z), centerZ)), _mm_set1_ps(plane->Distance));
+			const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(Math::Abs(n.X)), extentX), _mm_mul_ps(_mm_set1_ps(Math::Abs(n.Y)), extentY)), _mm_mul_ps(_mm_set1_ps(Math::Abs(n.Z)), extentZ));
+			// not outer: intersected (-r < s < r) or inner (s >= r)
+			const __m128 notOuter = _mm_or_ps(_mm_cmpgt_ps(distance, _mm_sub_ps(_mm_setzero_ps(), radius)), _mm_cmpge_ps(distance, radius));
+			visible = _mm_and_ps(visible, notOuter);
+		}
+		return (uint32)_mm_movemask_ps(visible);
+#else
+		uint32 mask = 0;
+		for(uint32 i = 0; i < 4; ++i) {
+			if(TEST_RESULT_OUTER != FrustumTestAABB(frustum, ToVector3(aabbs[i].AABBMin), ToVector3(aabbs[i].AABBMax))) {
+				mask |= 1u << i;
+			}
+		}
+		return mask;
+#endif
+	}
+
+	template<typename T> void WriteArray(File::WriteFile& file, const TArray<T>& data) {
+		const uint32 size = data.Size();
+		file.Write(&size, sizeof(uint32));
+		if(size) {
+			file.Write(data.Data(), data.ByteSize());
+		}
+	}
+
+	template<typename T> void ReadArray(File::ReadFile& file, TArray<T>& data) {
+		uint32 size = 0;
+		file.Read(&size, sizeof(uint32));
+		data.Resize(size);
+		if(size) {
+			file.Read(data.Data(), data.ByteSize());
+		}
+	}
+
+	bool OcclusionTestAABB(const Render::InstanceCullingParams& params, const Render::HZBCPU& hzb, const Math::FVector3& aabbMin, const Math::FVector3& aabbMax) {
+		Math::FVector3 ndcMin{ 1.0f, 1.0f, 1.0f };
+		Math::FVector3 ndcMax{ -1.0f, -1.0f, -1.0f };
+		for(uint32 i = 0; i < 8; ++i) {
+			const Math::FVector4 corner{ (i & 1) ? aabbMax.X : aabbMin.X, (i & 2) ? aabbMax.Y : aabbMin.Y, (i & 4) ? aabbMax.Z : aabbMin.Z, 1.0f };
+			const Math::FVector4 clip = params.ViewProjectMatrix * corner;
+			// crossing the near plane
+			if(clip.Z < 0.0f) {
+				return true;
+			}
+			const Math::FVector3 ndc{ clip.X / clip.W * 0.5f + 0.5f, clip.Y / clip.W * 0.5f + 0.5f, clip.Z / clip.W };
+			ndcMin = { Math::Min(ndcMin.X, ndc.X), Math::Min(ndcMin.Y, ndc.Y), Math::Min(ndcMin.Z, ndc.Z) };
+			ndcMax = { Math::Max(ndcMax.X, ndc.X), Math::Max(ndcMax.Y, ndc.Y), Math::Max(ndcMax.Z, ndc.Z) };
+		}
+		// y-down in texture, scaled to the actual size
+		const float rectMinX = ndcMin.X * params.HZBSizeScale.X;
+		const float rectMaxX = ndcMax.X * params.HZBSizeScale.X;
+		const float rectMinY = (1.0f - ndcMax.Y) * params.HZBSizeScale.Y;
+		const float rectMaxY = (1.0f - ndcMin.Y) * params.HZBSizeScale.Y;
+		const float rectSizeX = rectMaxX - rectMinX;
+		const float rectSizeY = rectMaxY - rectMinY;
+		// too big to cull
+		if(Math::Max(rectSizeX, rectSizeY) > 1.0f) {
+			return true;
+		}
+		// the mip where the rect covers 2x2 texels at most
+		const float numRectPixels = Math::Max(rectSizeX, rectSizeY) * (float)hzb.GetSize();
+		const float mipLevel = std::ceil(std::log2(Math::Max(numRectPixels, 1.0f)));
+		const uint32 mip = mipLevel < (float)hzb.GetMipSize() ? (uint32)mipLevel : hzb.GetMipSize() - 1;
+		const float hzbDepth = Math::Max(Math::Max(hzb.Sample(rectMinX, rectMinY, mip), hzb.Sample(rectMaxX, rectMinY, mip)),
+			Math::Max(hzb.Sample(rectMinX, rectMaxY, mip), hzb.Sample(rectMaxX, rectMaxY, mip)));
+		return ndcMin.Z <= hzbDepth;
+	}
+}
+
+namespace Render {
+
+	bool InstanceCullingCapture::Save(File::PathStr filePath) const {
+		File::WriteFile file(filePath, true);
+		if(!file.IsOpen()) {
+			return false;
+		}
+		file.Write(&CAPTURE_MAGIC, sizeof(uint32));
+		file.Write(&CAPTURE_VERSION, sizeof(uint32));
+		file.Write(&Params, sizeof(InstanceCullingParams));
+		WriteArray(file, InstanceAABBs);
+		WriteArray(file, ClusterAABBs);
+		WriteArray(file, Clusters);
+		WriteArray(file, IndirectCmds);
+		file.Write(&NumInstanceIDs, sizeof(uint32));
+		file.Write(&DepthWidth, sizeof(uint32));
+		file.Write(&DepthHeight, sizeof(uint32));
+		WriteArray(file, Depth);
+		return true;
+	}
+
+	bool InstanceCullingCapture::Load(File::PathStr filePath) {
+		File::ReadFile file(filePath, true);
+		if(!file.IsOpen()) {
+			return false;
+		}
+		uint32 magic = 0, version = 0;
+		file.Read(&magic, sizeof(uint32));
+		file.Read(&version, sizeof(uint32));
+		if(CAPTURE_MAGIC != magic || CAPTURE_VERSION != version) {
+			return false;
+		}
+		file.Read(&Params, sizeof(InstanceCullingParams));
+		ReadArray(file, InstanceAABBs);
+		ReadArray(file, ClusterAABBs);
+		ReadArray(file, Clusters);
+		ReadArray(file, IndirectCmds);
+		file.Read(&NumInstanceIDs, sizeof(uint32));
+		file.Read(&DepthWidth, sizeof(uint32));
+		file.Read(&DepthHeight, sizeof(uint32));
+		ReadArray(file, Depth);
+		return Depth.Size() == DepthWidth * DepthHeight;
+	}
+
+	HZBCPU::HZBCPU(): m_Size(0), m_ActualWidth(0), m_ActualHeight(0) {
+	}
+
+	void HZBCPU::Build(const float* depth, uint32 width, uint32 height) {
+		m_Mips.Reset();
+		m_Texels.Reset();
+		m_Size = Math::LowerPowerOf2(Math::Max(width, height));
+		if(m_Size <= 1) {
+			m_Size = 0;
+			return;
+		}
+		const float aspect = (float)width / (float)height;
+		if(width < height) {
+			m_ActualHeight = m_Size;
+			m_ActualWidth = (uint32)Math::Ceil((float)m_ActualHeight * aspect);
+		}
+		else {
+			m_ActualWidth = m_Size;
+			m_ActualHeight = (uint32)Math::Ceil((float)m_ActualWidth / aspect);
+		}
+		uint32 numTexels = 0;
+		for(uint32 size = m_Size; size >= 1; size >>= 1) {
+			m_Mips.PushBack({ numTexels, size });
+			numTexels += size * size;
+		}
+		m_Texels.Resize(numTexels);
+		// mip 0 is blit from the depth with point sampler, uv is the coord divided by the actual size
+		float* mip0 = m_Texels.Data();
+		for(uint32 y = 0; y < m_Size; ++y) {
+			const uint32 srcY = ToTexel((float)y / (float)m_ActualHeight, height);
+			for(uint32 x = 0; x < m_Size; ++x) {
+				mip0[y * m_Size + x] = depth[srcY * width + ToTexel((float)x / (float)m_ActualWidth, width)];
+			}
+		}
+		// furthest of 2x2 texels
+		for(uint32 i = 1; i < m_Mips.Size(); ++i) {
+			const Mip& src = m_Mips[i - 1];
+			const Mip& dst = m_Mips[i];
+			const float* srcTexels = m_Texels.Data() + src.Offset;
+			float* dstTexels = m_Texels.Data() + dst.Offset;
+			for(uint32 y = 0; y < dst.Size; ++y) {
+				const float* row0 = srcTexels + (y * 2) * src.Size;
+				const float* row1 = row0 + src.Size;
+				for(uint32 x = 0; x < dst.Size; ++x) {
+					dstTexels[y * dst.Size + x] = Math::Max(Math::Max(row0[x * 2], row0[x * 2 + 1]), Math::Max(row1[x * 2], row1[x * 2 + 1]));
+				}
+			}
+		}
+	}
+
+	float HZBCPU::Sample(float u, float v, uint32 mip) const {
+		const Mip& level = m_Mips[Math::Min(mip, m_Mips.Size() - 1)];
+		return m_Texels[level.Offset + ToTexel(v, level.Size) * level.Size + ToTexel(u, level.Size)];
+	}
+
+	void InstanceCullingCPU::Cull(const InstanceCullingParams& params, const HZBCPU* hzb,
+		TConstArrayView<InstanceCullingAABB> instanceAABBs, TConstArrayView<InstanceCullingAABB> clusterAABBs,
+		TConstArrayView<InstanceCullingCluster> clusters, TArrayView<DrawIndexedIndirectCommand> cmds, TArrayView<uint32> instanceIDs) {
+		const uint32 numClusters = Math::Min(params.NumClusters, clusters.Size());
+		if(hzb && !hzb->GetMipSize()) {
+			hzb = nullptr;
+		}
+		m_Results.Resize(numClusters);
+
+		auto visibleTestAABB = [&params, hzb](const Math::FVector3& aabbMin, const Math::FVector3& aabbMax) {
+			uint32 testResult = FrustumTestAABB(params.Frustum, aabbMin, aabbMax);
+			if(hzb && TEST_RESULT_OUTER != testResult && !OcclusionTestAABB(params, *hzb, aabbMin, aabbMax)) {
+				testResult = TEST_RESULT_OUTER;
+			}
+			return testResult;
+		};
+
+		// 1. test clusters and instances on workers, one cluster is one thread of the shader
+		Engine::ParallelFor(0u, numClusters, NUM_CLUSTERS_PER_TASK, [&](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 clusterIndex = rangeBegin; clusterIndex < rangeEnd; ++clusterIndex) {
+				const InstanceCullingCluster& cluster = clusters[clusterIndex];
+				const InstanceCullingAABB& clusterRange = clusterAABBs[cluster.ClusterIndex];
+				const uint32 instanceStart = (uint32)clusterRange.AABBMin.W;
+				const uint32 instanceEnd = (uint32)clusterRange.AABBMax.W;
+				ClusterResult& result = m_Results[clusterIndex];
+				result = { 0, 0, 0, false };
+				const uint32 testResult = visibleTestAABB(ToVector3(clusterRange.AABBMin), ToVector3(clusterRange.AABBMax));
+				if(TEST_RESULT_OUTER == testResult) {
+					continue;
+				}
+				if(TEST_RESULT_INNER == testResult) {
+					result.IsInner = true;
+					result.Count = instanceEnd - instanceStart;
+					continue;
+				}
+				// intersected, test each instance
+				const uint32 numInstances = Math::Min(instanceEnd - instanceStart, NUM_INSTANCE_PER_CLUSTER);
+				InstanceCullingAABB aabbs[NUM_INSTANCE_PER_CLUSTER]{};
+				memcpy(aabbs, &instanceAABBs[instanceStart + cluster.SrcInstanceOffset], numInstances * sizeof(InstanceCullingAABB));
+				uint32 mask = 0;
+				for(uint32 i = 0; i < numInstances; i += 4) {
+					mask |= FrustumTestAABBx4(params.Frustum, aabbs + i) << i;
+				}
+				for(uint32 i = 0; i < numInstances; ++i) {
+					if(!((mask >> i) & 1u)) {
+						continue;
+					}
+					if(hzb && !OcclusionTestAABB(params, *hzb, ToVector3(aabbs[i].AABBMin), ToVector3(aabbs[i].AABBMax))) {
+						continue;
+					}
+					result.VisibleMask |= 1u << i;
+					++result.Count;
+				}
+			}
+		});
+
+		// 2. the atomic adds of the shader, in cluster order. The first primitive decides the write offset.
+		for(uint32 clusterIndex = 0; clusterIndex < numClusters; ++clusterIndex) {
+			ClusterResult& result = m_Results[clusterIndex];
+			if(!result.Count) {
+				continue;
+			}
+			const InstanceCullingCluster& cluster = clusters[clusterIndex];
+			result.WriteOffset = cluster.DstInstanceOffset + cmds[cluster.PrimitiveStart].InstanceCount;
+			for(uint32 i = 0; i < cluster.PrimitiveCount; ++i) {
+				cmds[cluster.PrimitiveStart + i].InstanceCount += result.Count;
+			}
+		}
+
+		// 3. write instance IDs on workers
+		Engine::ParallelFor(0u, numClusters, NUM_CLUSTERS_PER_TASK, [&](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 clusterIndex = rangeBegin; clusterIndex < rangeEnd; ++clusterIndex) {
+				const ClusterResult& result = m_Results[clusterIndex];
+				if(!result.Count) {
+					continue;
+				}
+				const uint32 instanceStart = (uint32)clusterAABBs[clusters[clusterIndex].ClusterIndex].AABBMin.W;
+				uint32 writeIndex = result.WriteOffset;
+				if(result.IsInner) {
+					for(uint32 i = 0; i < result.Count; ++i) {
+						instanceIDs[writeIndex++] = instanceStart + i;
+					}
+				}
+				else {
+					for(uint32 i = 0; i < NUM_INSTANCE_PER_CLUSTER; ++i) {
+						if((result.VisibleMask >> i) & 1u) {
+							instanceIDs[writeIndex++] = instanceStart + i;
+						}
+					}
+				}
+			}
+		});
+	}
+}
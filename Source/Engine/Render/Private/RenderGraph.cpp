@@ -1,4 +1,5 @@
 #include "Render/Public/RenderGraph.h"
+#include "Math/Public/Math.h"
 #include "Core/Public/TQueue.h"
 #include "Core/Public/Container.h"
 #include "System/Public/Timer.h"
@@ -7,7 +8,7 @@ namespace Render {
 
 	bool RenderGraph::ParrallelNodes{ false };
 
-	RenderGraph::RenderGraph(RenderGraphView* view) : m_PresentNodeID(RG_INVALID_NODE), m_View(view) {
+	RenderGraph::RenderGraph(RenderGraphView* view, RGTransientTexturePool* transientPool) : m_PresentNodeID(RG_INVALID_NODE), m_View(view), m_TransientPool(transientPool), m_IsCompiled(false) {
 	}
 
 	RGRenderNode* RenderGraph::CreateRenderNode(XString&& name) {
@@ -52,6 +53,15 @@ namespace Render {
 		return node;
 	}
 
+	RGTextureNode* RenderGraph::CreateTransientTextureNode(const RHITextureDesc& desc, XString&& name) {
+		ASSERT(m_TransientPool, "[RenderGraph::CreateTransientTextureNode] No transient pool!");
+		const RGNodeID nodeID = m_Nodes.Size();
+		RGTextureNode* node = (RGTextureNode*)m_Nodes.EmplaceBack(new RGTextureNode(nodeID, desc)).Get();
+		node->SetName(MoveTemp(name));
+		m_TransientNodes.PushBack(nodeID);
+		return node;
+	}
+
 	RGOutputNode* RenderGraph::CreateOutputNode(RGTextureNode* prevNode, XString&& name) {
 		RGNodeID nodeID = m_Nodes.Size();
 		RGOutputNode* node = (RGOutputNode*)m_Nodes.EmplaceBack(new RGOutputNode(nodeID)).Get();
@@ -73,55 +83,383 @@ namespace Render {
 		return node;
 	}
 
+	void RenderGraph::Compile() {
+		const uint32 numNodes = m_Nodes.Size();
+		// prev pass adjacency, the passes writing the input resources of a node
+		m_PrevPassOffsets.Reset();
+		m_PrevPassOffsets.Reserve(numNodes + 1);
+		m_PrevPassIDs.Reset();
+		for(const auto& node: m_Nodes) {
+			const uint32 offset = m_PrevPassIDs.Size();
+			m_PrevPassOffsets.PushBack(offset);
+			if(ERGNodeType::Resource == node->GetNodeType()) {
+				continue;
+			}
+			for(const RGNodeID prevID: node->m_PrevNodes) {
+				for(const RGNodeID ppID: m_Nodes[prevID]->m_PrevNodes) {
+					m_PrevPassIDs.PushBack(ppID);
+				}
+			}
+			// sort and remove duplicated ids
+			std::sort(m_PrevPassIDs.begin() + offset, m_PrevPassIDs.end());
+			const uint32 uniqueSize = (uint32)(std::unique(m_PrevPassIDs.begin() + offset, m_PrevPassIDs.end()) - m_PrevPassIDs.begin());
+			m_PrevPassIDs.Resize(uniqueSize);
+		}
+		m_PrevPassOffsets.PushBack(m_PrevPassIDs.Size());
+
+		// passes not reached from outputs are culled, the others are ordered as they are first required by outputs
+		m_ExecuteOrder.Reset();
+		m_SubmitNodes.Reset();
+		m_SubmitNodes.Resize(numNodes, RG_INVALID_NODE);
+		m_NodesCulled.Reset();
+		m_NodesCulled.Resize(numNodes, true);
+		for(RGNodeID outputID: m_Outputs) {
+			CHECK(ERGNodeType::Output == m_Nodes[outputID]->GetNodeType());
+			CompileNode(outputID);
+		}
+
+		// lifetimes of resources, resources used by no step are culled
+		TArray<uint32> steps(numNodes, INVALID_INDEX);
+		for(uint32 i = 0; i < m_ExecuteOrder.Size(); ++i) {
+			steps[m_ExecuteOrder[i]] = i;
+		}
+		m_Lifetimes.Reset();
+		m_Lifetimes.Resize(numNodes);
+		for(const auto& node: m_Nodes) {
+			if(ERGNodeType::Resource != node->GetNodeType()) {
+				continue;
+			}
+			RGResourceLifetime& lifetime = m_Lifetimes[node->m_NodeID];
+			auto addUse = [&lifetime, &steps](RGNodeID userID) {
+				const uint32 step = steps[userID];
+				if(INVALID_INDEX != step) {
+					lifetime.FirstUse = INVALID_INDEX == lifetime.FirstUse ? step : Math::Min(lifetime.FirstUse, step);
+					lifetime.LastUse = INVALID_INDEX == lifetime.LastUse ? step : Math::Max(lifetime.LastUse, step);
+				}
+			};
+			for(const RGNodeID prevID: node->m_PrevNodes) {
+				addUse(prevID);
+			}
+			for(const RGNodeID nextID: node->m_NextNodes) {
+				addUse(nextID);
+			}
+			m_NodesCulled[node->m_NodeID] = INVALID_INDEX == lifetime.FirstUse;
+		}
+		PlaceTransientResources();
+		BuildQueueSchedule();
+		BuildBarriers();
+		m_IsCompiled = true;
+	}
+
 	void RenderGraph::Run(ICmdAllocator* cmdAlloc) {
 		ASSERT(RG_INVALID_NODE != m_PresentNodeID, "[RenderGraph::Run] No present node!");
-		// run prev nodes and mark
-		m_NodesSolved.Resize(m_Nodes.Size(), false);
-		// run output nodes
-		for(RGNodeID outputID: m_Outputs) {
-			RGNode* node = m_Nodes[outputID].Get();
-			CHECK(ERGNodeType::Output == node->GetNodeType());
-			if(ParrallelNodes) {
-				RecursivelyRunPrevNodesParallel(node, cmdAlloc);
+		if(!m_IsCompiled) {
+			Compile();
+		}
+		AcquireTransientResources();
+		if(ParrallelNodes) {
+			// a node submits the passes it runs first, together, before it runs. passes are recorded in their own command buffers, without split barriers.
+			TArray<RHICommandBuffer*> passCmds(m_Nodes.Size(), nullptr);
+			for(uint32 step = 0; step < m_ExecuteOrder.Size(); ++step) {
+				const RGNodeID nodeID = m_ExecuteOrder[step];
+				RGNode* node = m_Nodes[nodeID].Get();
+				TArray<RHICommandBuffer*> cmdArray;
+				for(const RGNodeID prevPassID: GetPrevPassNodes(nodeID)) {
+					if(m_SubmitNodes[prevPassID] == nodeID) {
+						cmdArray.PushBack(passCmds[prevPassID]);
+					}
+				}
+				if(ERGNodeType::Output == node->GetNodeType() && !m_StepBarriers[step].IsEmpty()) {
+					RHICommandBuffer* cmd = cmdAlloc->GetCmd(EQueueType::Graphics);
+					RecordBarriers(cmd, step, false);
+					cmd->Close();
+					cmdArray.PushBack(cmd);
+				}
+				if(cmdArray.Size()) {
+					RHI::Instance()->SubmitCommandBuffers(cmdArray, EQueueType::Graphics, GetNodeFence(node), nodeID == m_PresentNodeID);
+				}
+				if(ERGNodeType::Pass == node->GetNodeType()) {
+					RGPassNode* passNode = (RGPassNode*)node;
+					RHICommandBuffer* cmd = cmdAlloc->GetCmd(EQueueType::Graphics);
+					RecordBarriers(cmd, step, false);
+					passNode->Run(cmd);
+					cmd->Close();
+					passCmds[nodeID] = cmd;
+				}
+				else {
+					((RGOutputNode*)node)->Run();
+				}
 			}
-			else {
-				RecursivelyRunPrevNodes(node, cmdAlloc);
+		}
+		else {
+			// steps are recorded in one command buffer until it is submitted
+			RHICommandBuffer* cmd = nullptr;
+			auto submit = [this, &cmd, cmdAlloc](RGNode* node) {
+				if(!cmd) {
+					cmd = cmdAlloc->GetCmd(EQueueType::Graphics);
+				}
+				RHI::Instance()->SubmitCommandBuffers(cmd, EQueueType::Graphics, node ? GetNodeFence(node) : nullptr, node && node->m_NodeID == m_PresentNodeID);
+				cmd = nullptr;
+			};
+			for(uint32 step = 0; step < m_ExecuteOrder.Size(); ++step) {
+				RGNode* node = m_Nodes[m_ExecuteOrder[step]].Get();
+				const bool isPass = ERGNodeType::Pass == node->GetNodeType();
+				if(isPass && IsSubmitNode(node)) {
+					submit(node);
+				}
+				if(isPass || !m_StepBarriers[step].IsEmpty()) {
+					if(!cmd) {
+						cmd = cmdAlloc->GetCmd(EQueueType::Graphics);
+					}
+					RecordBarriers(cmd, step, true);
+				}
+				if(isPass) {
+					((RGPassNode*)node)->Run(cmd);
+				}
+				else {
+					if(IsSubmitNode(node)) {
+						submit(node);
+					}
+					((RGOutputNode*)node)->Run();
+				}
+			}
+			if(cmd) {
+				submit(nullptr);
 			}
-			((RGOutputNode*)node)->Run();
 		}
 
 		// record view
 		if(m_View) {
-			m_View->UpdateFrame = Engine::Timer::GetFrame();
-			m_View->OutputIDs = m_Outputs;
-			auto& nodeViews = m_View->Nodes;
-			nodeViews.Reset();
-			nodeViews.Reserve(m_Nodes.Size());
-			for(auto& node: m_Nodes) {
-				auto& nodeView = nodeViews.EmplaceBack();
-				nodeView.Name = node->m_Name;
-				nodeView.Type = node->GetNodeType();
-				nodeView.PrevNodes = node->m_PrevNodes;
+			RecordView();
+		}
+	}
+
+	TConstArrayView<RGNodeID> RenderGraph::GetPrevPassNodes(RGNodeID nodeID) const {
+		CHECK(nodeID + 1 < m_PrevPassOffsets.Size());
+		const uint32 offset = m_PrevPassOffsets[nodeID];
+		return { m_PrevPassIDs.Data() + offset, m_PrevPassOffsets[nodeID + 1] - offset };
+	}
+
+	void RenderGraph::CompileNode(RGNodeID nodeID) {
+		m_NodesCulled[nodeID] = false;
+		for(const RGNodeID prevPassID: GetPrevPassNodes(nodeID)) {
+			if(m_NodesCulled[prevPassID]) {
+				CHECK(ERGNodeType::Pass == m_Nodes[prevPassID]->GetNodeType());
+				m_SubmitNodes[prevPassID] = nodeID;
+				CompileNode(prevPassID);
 			}
 		}
+		m_ExecuteOrder.PushBack(nodeID);
 	}
 
-	TArray<RGNodeID> RenderGraph::GetPrevPassNodes(RGNode* node) {
-		if(ERGNodeType::Resource == node->GetNodeType()) {
-			return node->m_PrevNodes;
+	void RenderGraph::PlaceTransientResources() {
+		// textures with the same description share a key
+		TArray<const RHITextureDesc*> descs;
+		TArray<RGTransientResource> resources;
+		m_PlacedNodes.Reset();
+		for(RGNodeID nodeID: m_TransientNodes) {
+			if(m_NodesCulled[nodeID]) {
+				continue;
+			}
+			const RHITextureDesc& desc = ((RGTextureNode*)m_Nodes[nodeID].Get())->GetDesc();
+			uint32 key = 0;
+			while(key < descs.Size() && !RGTransientTexturePool::IsSameDesc(*descs[key], desc)) {
+				++key;
+			}
+			if(key == descs.Size()) {
+				descs.PushBack(&desc);
+			}
+			const RGResourceLifetime& lifetime = m_Lifetimes[nodeID];
+			resources.PushBack({ key, RGTransientTexturePool::GetTextureByteSize(desc), lifetime.FirstUse, lifetime.LastUse });
+			m_PlacedNodes.PushBack(nodeID);
 		}
-		TSet<RGNodeID> nodeIDSet;
-		for (const RGNodeID prevID : node->m_PrevNodes) {
-			const RGNode* pResNode = m_Nodes[prevID].Get();
-			for (const RGNodeID ppID : pResNode->m_PrevNodes) {
-				nodeIDSet.insert(ppID);
+		m_TransientPlacement.Place(resources);
+	}
+
+	void RenderGraph::BuildQueueSchedule() {
+		TArray<uint32> passIndices(m_Nodes.Size(), INVALID_INDEX);
+		m_ScheduledPasses.Reset();
+		for(RGNodeID nodeID: m_ExecuteOrder) {
+			if(ERGNodeType::Pass == m_Nodes[nodeID]->GetNodeType()) {
+				passIndices[nodeID] = m_ScheduledPasses.Size();
+				m_ScheduledPasses.PushBack(nodeID);
 			}
 		}
-		TArray<RGNodeID> nodeIDArray; nodeIDArray.Reserve((uint32)nodeIDSet.size());
-		for(const RGNodeID ppID: nodeIDSet) {
-			nodeIDArray.PushBack(ppID);
+		TArray<RGSchedulePass> passes;
+		passes.Reserve(m_ScheduledPasses.Size());
+		TArray<uint32> deps;
+		for(RGNodeID nodeID: m_ScheduledPasses) {
+			const RGPassNode* passNode = (RGPassNode*)m_Nodes[nodeID].Get();
+			RGSchedulePass& pass = passes.EmplaceBack();
+			pass.Queue = passNode->SupportQueue(passNode->m_PreferredQueue) ? passNode->m_PreferredQueue : EQueueType::Graphics;
+			pass.Cost = Math::Max(1u, passNode->m_EstimatedCost ? passNode->m_EstimatedCost : passNode->GetDefaultCost());
+			pass.DepOffset = deps.Size();
+			for(const RGNodeID prevPassID: GetPrevPassNodes(nodeID)) {
+				CHECK(INVALID_INDEX != passIndices[prevPassID]);
+				deps.PushBack(passIndices[prevPassID]);
+			}
+			pass.DepCount = deps.Size() - pass.DepOffset;
+		}
+		m_QueueSchedule.Build(passes, deps);
+	}
+
+	void RenderGraph::BuildBarriers() {
+		const uint32 numNodes = m_Nodes.Size();
+		const uint32 numSteps = m_ExecuteOrder.Size();
+		m_StepBarriers.Reset();
+		m_StepBarriers.Resize(numSteps);
+
+		// states of the resource node parts, part 0 is the whole resource and part i + 1 is the registered sub resource i
+		TArray<uint32> partOffsets(numNodes + 1, 0);
+		for(uint32 i = 0; i < numNodes; ++i) {
+			uint32 numParts = 0;
+			if(ERGNodeType::Resource == m_Nodes[i]->GetNodeType()) {
+				const RGResourceNode* node = (RGResourceNode*)m_Nodes[i].Get();
+				numParts = node->IsTexture() ? 1 + ((RGTextureNode*)node)->m_SubResStates.Size() : 1;
+			}
+			partOffsets[i + 1] = partOffsets[i] + numParts;
+		}
+		TArray<EResourceState> states(partOffsets[numNodes], EResourceState::Unknown);
+
+		// nodes sharing an RHI resource or a transient slot have one identity, the touches of an identity are 2 * step for a barrier before the step
+		// and 2 * step + 1 for a use by the step. a split transition begins after the last touch.
+		TArray<uint32> identities(numNodes, INVALID_INDEX);
+		TArray<bool> transients(numNodes, false);
+		uint32 numIdentities = 0;
+		{
+			TUnorderedMap<const void*, uint32> rhiIdentities;
+			for(const auto& node: m_Nodes) {
+				if(ERGNodeType::Resource != node->GetNodeType() || m_NodesCulled[node->m_NodeID]) {
+					continue;
+				}
+				const RGResourceNode* resourceNode = (RGResourceNode*)node.Get();
+				const void* rhi = resourceNode->IsTexture() ? (const void*)((RGTextureNode*)resourceNode)->m_RHI : (const void*)((RGBufferNode*)resourceNode)->m_Buffer;
+				if(rhi) {
+					const auto [iter, inserted] = rhiIdentities.try_emplace(rhi, numIdentities);
+					numIdentities += inserted;
+					identities[node->m_NodeID] = iter->second;
+				}
+			}
+			for(uint32 i = 0; i < m_PlacedNodes.Size(); ++i) {
+				identities[m_PlacedNodes[i]] = numIdentities + m_TransientPlacement.GetResourceSlot(i);
+				transients[m_PlacedNodes[i]] = true;
+			}
+			numIdentities += m_TransientPlacement.GetSlots().Size();
+		}
+		TArray<uint32> lastTouches(numIdentities, INVALID_INDEX);
+
+		// command buffer segments of the steps, a transition is split only in a segment
+		TArray<uint32> segments(numSteps);
+		uint32 segment = 0;
+		for(uint32 step = 0; step < numSteps; ++step) {
+			RGNode* node = m_Nodes[m_ExecuteOrder[step]].Get();
+			const bool isSubmit = IsSubmitNode(node);
+			segment += isSubmit && ERGNodeType::Pass == node->GetNodeType();
+			segments[step] = segment;
+			segment += isSubmit && ERGNodeType::Output == node->GetNodeType();
+		}
+
+		// nodes are transitioned to their target states at the step after the last pass using them
+		TArray<uint32> lastPassUses(numNodes, INVALID_INDEX);
+		for(uint32 step = 0; step < numSteps; ++step) {
+			const RGNode* node = m_Nodes[m_ExecuteOrder[step]].Get();
+			if(ERGNodeType::Pass == node->GetNodeType()) {
+				for(const RGResourceUse& use: ((RGPassNode*)node)->m_Uses) {
+					lastPassUses[use.Resource] = step;
+				}
+			}
+		}
+		TArray<RGNodeID> finalNodes;
+		for(RGNodeID nodeID = 0; nodeID < numNodes; ++nodeID) {
+			if(INVALID_INDEX != lastPassUses[nodeID] && !transients[nodeID]) {
+				finalNodes.PushBack(nodeID);
+			}
+		}
+		std::sort(finalNodes.begin(), finalNodes.end(), [&lastPassUses](RGNodeID a, RGNodeID b) { return lastPassUses[a] < lastPassUses[b]; });
+
+		auto addTransition = [&](uint32 step, RGNodeID nodeID, uint32 part, EResourceState stateAfter) {
+			EResourceState& state = states[partOffsets[nodeID] + part];
+			RGTransition transition{ nodeID, part ? (uint8)(part - 1) : RG_DEFAULT_SUB_RES, state, stateAfter, EBarrierSplit::None };
+			state = stateAfter;
+			uint32& lastTouch = lastTouches[identities[nodeID]];
+			const uint32 beginStep = INVALID_INDEX == lastTouch ? INVALID_INDEX : lastTouch / 2 + 1;
+			if(INVALID_INDEX != beginStep && beginStep < step && segments[beginStep] == segments[step]) {
+				transition.Split = EBarrierSplit::Begin;
+				m_StepBarriers[beginStep].PushBack(transition);
+				transition.Split = EBarrierSplit::End;
+			}
+			m_StepBarriers[step].PushBack(transition);
+			lastTouch = INVALID_INDEX == lastTouch ? 2 * step : Math::Max(lastTouch, 2 * step);
+		};
+		// sub resources in other states than the whole resource are transitioned with it
+		auto transitionToState = [&](uint32 step, RGNodeID nodeID, uint8 subResIdx, EResourceState stateAfter) {
+			if(EResourceState::Unknown == stateAfter) {
+				return;
+			}
+			const uint32 offset = partOffsets[nodeID];
+			const uint32 numParts = partOffsets[nodeID + 1] - offset;
+			if(RG_DEFAULT_SUB_RES != subResIdx) {
+				if(states[offset + 1 + subResIdx] != stateAfter) {
+					addTransition(step, nodeID, 1 + subResIdx, stateAfter);
+				}
+			}
+			else if(states[offset] != stateAfter) {
+				addTransition(step, nodeID, 0, stateAfter);
+				for(uint32 part = 1; part < numParts; ++part) {
+					states[offset + part] = stateAfter;
+				}
+			}
+			else {
+				for(uint32 part = 1; part < numParts; ++part) {
+					if(states[offset + part] != stateAfter) {
+						addTransition(step, nodeID, part, stateAfter);
+					}
+				}
+			}
+		};
+
+		uint32 finalIndex = 0;
+		for(uint32 step = 0; step < numSteps; ++step) {
+			for(; finalIndex < finalNodes.Size() && lastPassUses[finalNodes[finalIndex]] + 1 == step; ++finalIndex) {
+				const RGNodeID nodeID = finalNodes[finalIndex];
+				const RGResourceNode* node = (RGResourceNode*)m_Nodes[nodeID].Get();
+				if(!node->IsTexture()) {
+					transitionToState(step, nodeID, RG_DEFAULT_SUB_RES, ((RGBufferNode*)node)->m_TargetState);
+				}
+				else if(const RGTextureNode* textureNode = (RGTextureNode*)node; EResourceState::Unknown != textureNode->m_TargetState) {
+					transitionToState(step, nodeID, RG_DEFAULT_SUB_RES, textureNode->m_TargetState);
+				}
+				else {
+					for(uint32 i = 0; i < textureNode->m_SubResStates.Size(); ++i) {
+						transitionToState(step, nodeID, (uint8)i, textureNode->m_SubResStates[i].TargetState);
+					}
+				}
+			}
+			const RGNode* node = m_Nodes[m_ExecuteOrder[step]].Get();
+			if(ERGNodeType::Pass != node->GetNodeType()) {
+				continue;
+			}
+			for(const RGResourceUse& use: ((RGPassNode*)node)->m_Uses) {
+				transitionToState(step, use.Resource, use.SubResIndex, use.State);
+				lastTouches[identities[use.Resource]] = 2 * step + 1;
+			}
+		}
+	}
+
+	void RenderGraph::AcquireTransientResources() {
+		if(m_PlacedNodes.IsEmpty()) {
+			return;
+		}
+		const auto& slots = m_TransientPlacement.GetSlots();
+		TArray<RHITexture*> slotTextures(slots.Size(), nullptr);
+		for(uint32 i = 0; i < m_PlacedNodes.Size(); ++i) {
+			RGTextureNode* node = (RGTextureNode*)m_Nodes[m_PlacedNodes[i]].Get();
+			RHITexture*& texture = slotTextures[m_TransientPlacement.GetResourceSlot(i)];
+			if(!texture) {
+				texture = m_TransientPool->Acquire(node->GetDesc());
+			}
+			node->m_RHI = texture;
 		}
-		return nodeIDArray;
 	}
 
 	RHIFence* RenderGraph::GetNodeFence(RGNode* node) {
@@ -134,66 +472,68 @@ namespace Render {
 		return nullptr;
 	}
 
-	void RenderGraph::RecursivelyRunPrevNodes(RGNode* node, ICmdAllocator* cmdAlloc) {
-		// get fence
-		RHIFence* fence = GetNodeFence(node);
-		bool isPresent = node->m_NodeID == m_PresentNodeID;
-		// execute prev nodes
-		const TArray<RGNodeID> prevPassIDs = GetPrevPassNodes(node);
-		for(const RGNodeID prevPassID: prevPassIDs) {
-			if(!m_NodesSolved[prevPassID]) {
-				CHECK(ERGNodeType::Pass == m_Nodes[prevPassID]->GetNodeType());
-				RGPassNode* prevPassNode = (RGPassNode*)m_Nodes[prevPassID].Get();
-				RecursivelyRunPrevNodes(prevPassNode, cmdAlloc);
-				const EQueueType queueType = prevPassNode->GetQueue();
-				RHICommandBuffer* cmd = cmdAlloc->GetCmd(queueType);
-				prevPassNode->Run(cmd);
-				RHI::Instance()->SubmitCommandBuffers(cmd, queueType, fence, isPresent);
-				m_NodesSolved[prevPassID] = true;
-			}
-		}
-	}
-
-	void RenderGraph::RecursivelyRunPrevNodesParallel(RGNode* node, ICmdAllocator* cmdAlloc) {
-		RHIFence* fence = GetNodeFence(node);
-		bool bPresent = node->m_NodeID == m_PresentNodeID;
-		// execute prev nodes
-		const TArray<RGNodeID> prevPassIDs = GetPrevPassNodes(node);
-
-		//// pre-allocate cmd // TODO because of error in d3d12 when allocating command before last command executed.
-		//{
-		//	TStaticArray<uint32, EnumCast(EQueueType::Count)> cmdCounts(0);
-		//	for(const RGNodeID prevPassID: prevPassIDs) {
-		//		if(!m_NodesSolved[prevPassID]) {
-		//			CHECK(ERGNodeType::Pass == m_Nodes[prevPassID]->GetNodeType());
-		//			RGPassNode* prevPassNode = (RGPassNode*)m_Nodes[prevPassID].Get();
-		//			++cmdCounts[EnumCast(prevPassNode->GetQueue())];
-		//		}
-		//	}
-		//	for(uint32 i=0; i<cmdCounts.Size(); ++i) {
-		//		cmdAlloc->Reserve((EQueueType)i, cmdCounts[i]);
-		//	}
-		//}
-
-		TStaticArray<TArray<RHICommandBuffer*>, EnumCast(EQueueType::Count)> cmdArrays;
-		for(const RGNodeID prevPassID: prevPassIDs) {
-			if(!m_NodesSolved[prevPassID]) {
-				CHECK(ERGNodeType::Pass == m_Nodes[prevPassID]->GetNodeType());
-				RGPassNode* prevPassNode = (RGPassNode*)m_Nodes[prevPassID].Get();
-				RecursivelyRunPrevNodesParallel(prevPassNode, cmdAlloc);
-				const EQueueType queue = prevPassNode->GetQueue();
-				RHICommandBuffer* cmd = cmdAlloc->GetCmd(queue);
-				prevPassNode->Run(cmd);
-				cmd->Close();
-				cmdArrays[EnumCast(queue)].PushBack(cmd);
-				m_NodesSolved[prevPassID] = true;
+	bool RenderGraph::IsSubmitNode(RGNode* node) {
+		return GetNodeFence(node) || node->m_NodeID == m_PresentNodeID;
+	}
+
+	void RenderGraph::RecordBarriers(RHICommandBuffer* cmd, uint32 step, bool bSplit) {
+		RGBarrierBatch batch;
+		for(const RGTransition& transition: m_StepBarriers[step]) {
+			EBarrierSplit split = transition.Split;
+			if(!bSplit) {
+				if(EBarrierSplit::Begin == split) {
+					continue;
+				}
+				split = EBarrierSplit::None;
+			}
+			RGResourceNode* node = (RGResourceNode*)m_Nodes[transition.Resource].Get();
+			if(node->IsTexture()) {
+				RGTextureNode* textureNode = (RGTextureNode*)node;
+				batch.AddTexture(textureNode->GetRHI(), transition.StateBefore, transition.StateAfter, textureNode->GetSubRes(transition.SubResIndex), split);
+			}
+			else {
+				batch.AddBuffer(((RGBufferNode*)node)->m_Buffer, transition.StateBefore, transition.StateAfter, split);
 			}
 		}
-		// submit cmds of prev nodes with fence
-		for (uint32 i = 0; i < EnumCast(EQueueType::Count); ++i) {
-			if (auto& cmdArray = cmdArrays[i]; cmdArray.Size()) {
-				RHI::Instance()->SubmitCommandBuffers(cmdArray, (EQueueType)i, fence, bPresent);
+		batch.Submit(cmd);
+	}
+
+	void RenderGraph::RecordView() {
+		m_View->UpdateFrame = Engine::Timer::GetFrame();
+		m_View->OutputIDs = m_Outputs;
+		m_View->ExecuteOrder = m_ExecuteOrder;
+		m_View->TransientNaiveSize = m_TransientPlacement.GetNaiveSize();
+		m_View->TransientAllocatedSize = m_TransientPlacement.GetAllocatedSize();
+		m_View->TransientPeakSize = m_TransientPlacement.GetPeakSize();
+		m_View->NumQueueBatches = m_QueueSchedule.GetBatches().Size();
+		m_View->NumSyncPoints = m_QueueSchedule.GetNumSyncPoints();
+		m_View->SerialTime = m_QueueSchedule.GetSerialTime();
+		m_View->ScheduledTime = m_QueueSchedule.GetScheduledTime();
+		m_View->NumTransitions = m_View->NumSplitTransitions = 0;
+		for(const auto& barriers: m_StepBarriers) {
+			for(const RGTransition& transition: barriers) {
+				m_View->NumTransitions += EBarrierSplit::Begin != transition.Split;
+				m_View->NumSplitTransitions += EBarrierSplit::End == transition.Split;
 			}
 		}
+		auto& nodeViews = m_View->Nodes;
+		nodeViews.Reset();
+		nodeViews.Reserve(m_Nodes.Size());
+		for(auto& node: m_Nodes) {
+			auto& nodeView = nodeViews.EmplaceBack();
+			nodeView.Name = node->m_Name;
+			nodeView.Type = node->GetNodeType();
+			nodeView.PrevNodes = node->m_PrevNodes;
+			nodeView.IsCulled = m_NodesCulled[node->m_NodeID];
+			nodeView.Lifetime = m_Lifetimes[node->m_NodeID];
+			nodeView.Queue = EQueueType::Graphics;
+			nodeView.Batch = INVALID_INDEX;
+		}
+		const auto& batches = m_QueueSchedule.GetBatches();
+		for(uint32 i = 0; i < m_ScheduledPasses.Size(); ++i) {
+			auto& nodeView = nodeViews[m_ScheduledPasses[i]];
+			nodeView.Batch = m_QueueSchedule.GetPassBatch(i);
+			nodeView.Queue = batches[nodeView.Batch].Queue;
+		}
 	}
 }
@@ -3,6 +3,43 @@
 
 namespace Render {
 
+	void RGBarrierBatch::AddTexture(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subRes, EBarrierSplit split) {
+		for(uint32 i = 0; EBarrierSplit::None == split && i < m_Textures.Size(); ++i) {
+			RHITextureTransition& transition = m_Textures[i];
+			if(transition.Texture == texture && transition.SubRes == subRes && EBarrierSplit::None == transition.Split) {
+				transition.StateAfter = stateAfter;
+				if(transition.StateBefore == stateAfter) {
+					m_Textures.RemoveAt(i);
+				}
+				return;
+			}
+		}
+		m_Textures.PushBack({ texture, stateBefore, stateAfter, subRes, split });
+	}
+
+	void RGBarrierBatch::AddBuffer(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter, EBarrierSplit split) {
+		for(uint32 i = 0; EBarrierSplit::None == split && i < m_Buffers.Size(); ++i) {
+			RHIBufferTransition& transition = m_Buffers[i];
+			if(transition.Buffer == buffer && EBarrierSplit::None == transition.Split) {
+				transition.StateAfter = stateAfter;
+				if(transition.StateBefore == stateAfter) {
+					m_Buffers.RemoveAt(i);
+				}
+				return;
+			}
+		}
+		m_Buffers.PushBack({ buffer, stateBefore, stateAfter, split });
+	}
+
+	void RGBarrierBatch::Submit(RHICommandBuffer* cmd) {
+		if(IsEmpty()) {
+			return;
+		}
+		cmd->TransitionResourceStates({ m_Textures.Data(), m_Textures.Size() }, { m_Buffers.Data(), m_Buffers.Size() });
+		m_Textures.Reset();
+		m_Buffers.Reset();
+	}
+
 	void RGNode::Connect(RGNode* prevNode, RGNode* nextNode) {
 		++prevNode->m_RefCount;
 		++nextNode->m_RefCount;
@@ -10,13 +47,18 @@ namespace Render {
 		nextNode->m_PrevNodes.PushBack(prevNode->m_NodeID);
 	}
 
+	void RGPassNode::AddUse(RGResourceNode* node, uint8 subResIdx, EResourceState state) {
+		m_Uses.PushBack({ node->GetNodeID(), subResIdx, state });
+	}
+
 	void RGRenderNode::ReadSRV(RGTextureNode* node) {
-		m_SRVs.PushBack(node);
+		AddUse(node, RG_DEFAULT_SUB_RES, EResourceState::ShaderResourceView);
 		node->SetTargetState(EResourceState::ShaderResourceView);
 		RGNode::Connect(node, this);
 	}
 
 	void RGRenderNode::ReadSRV(RGBufferNode* node) {
+		AddUse(node, RG_DEFAULT_SUB_RES, EResourceState::ShaderResourceView);
 		node->SetTargetState(EResourceState::ShaderResourceView);
 		RGNode::Connect(node, this);
 	}
@@ -25,6 +67,7 @@ namespace Render {
 		ASSERT(i < RHI_COLOR_TARGET_MAX, "Color target index out of range!");
 		const uint8 subResIdx = node->RegisterSubRes(subRes);
 		m_ColorTargets[i] = { node, subRes, subResIdx, bClear};
+		AddUse(node, subResIdx, EResourceState::ColorTarget);
 		node->SetTargetState(EResourceState::ColorTarget);
 		RGNode::Connect(node, this);
 	}
@@ -37,6 +80,7 @@ namespace Render {
 		ASSERT(i < RHI_COLOR_TARGET_MAX, "Color target index out of range!");
 		const uint8 subResIdx = node->RegisterSubRes(subRes);
 		m_ColorTargets[i] = {node, subRes, subResIdx, bClear};
+		AddUse(node, subResIdx, EResourceState::ColorTarget);
 
 		const auto& backBufferDesc = node->GetDesc();
 		m_RenderArea = { 0,0, backBufferDesc.Width, backBufferDesc.Height };
@@ -50,6 +94,7 @@ namespace Render {
 	void RGRenderNode::ReadDepthTarget(RGTextureNode* node, RHITextureSubRes subRes, bool bClear) {
 		const uint8 subResIdx = node->RegisterSubRes(subRes);
 		m_DepthTarget = { node, subRes, subResIdx, bClear };
+		AddUse(node, subResIdx, EResourceState::DepthStencil);
 		node->SetTargetState(EResourceState::DepthStencil);
 		RGNode::Connect(node, this);
 	}
@@ -61,6 +106,7 @@ namespace Render {
 	void RGRenderNode::WriteDepthTarget(RGTextureNode* node, RHITextureSubRes subRes, bool bClear) {
 		const uint8 subResIdx = node->RegisterSubRes(subRes);
 		m_DepthTarget = { node, subRes, subResIdx, bClear };
+		AddUse(node, subResIdx, EResourceState::DepthStencil);
 		RGNode::Connect(this, node);
 	}
 
@@ -72,19 +118,6 @@ namespace Render {
 		if (!m_Name.empty()) {
 			cmd->BeginDebugLabel(m_Name.c_str(), nullptr);
 		}
-		// state transition before rendering
-		{
-			for (uint32 i = 0; i < RHI_COLOR_TARGET_MAX; ++i) {
-				if (!m_ColorTargets[i].Node) {
-					break;
-				}
-				m_ColorTargets[i].Node->TransitionSubResToState(cmd, EResourceState::ColorTarget, m_ColorTargets[i].SubResIndex);
-			}
-			if (m_DepthTarget.Node) {
-				m_DepthTarget.Node->TransitionSubResToState(cmd, EResourceState::DepthStencil, m_DepthTarget.SubResIndex);
-			}
-		}
-
 		// do rendering
 		if (m_Task) {
 			// setup render pass info
@@ -114,19 +147,6 @@ namespace Render {
 			m_Task(cmd);
 			cmd->EndRendering();
 		}
-
-		// state transition after rendering 
-		{
-			for (uint32 i = 0; i < RHI_COLOR_TARGET_MAX; ++i) {
-				if (!m_ColorTargets[i].Node) {
-					break;
-				}
-				m_ColorTargets[i].Node->TransitionSubResToTargetState(cmd, m_ColorTargets[i].SubResIndex);
-			}
-			if (m_DepthTarget.Node) {
-				m_DepthTarget.Node->TransitionSubResToTargetState(cmd, m_DepthTarget.SubResIndex);
-			}
-		}
 		if (!m_Name.empty()) {
 			cmd->EndDebugLabel();
 		}
@@ -134,7 +154,7 @@ namespace Render {
 
 	void RGComputeNode::ReadSRV(RGTextureNode* node, RHITextureSubRes subRes) {
 		const uint8 subResIdx = node->RegisterSubRes(subRes);
-		m_SRVs.PushBack({node, subResIdx});
+		AddUse(node, subResIdx, EResourceState::ShaderResourceView);
 		node->SetSubResTargetState(subResIdx, EResourceState::ShaderResourceView);
 		RGNode::Connect(node, this);
 	}
@@ -144,14 +164,14 @@ namespace Render {
 	}
 
 	void RGComputeNode::ReadSRV(RGBufferNode* node) {
-		m_SRVBuffers.PushBack(node);
+		AddUse(node, RG_DEFAULT_SUB_RES, EResourceState::ShaderResourceView);
 		node->SetTargetState(EResourceState::ShaderResourceView);
 		RGNode::Connect(node, this);
 	}
 
 	void RGComputeNode::WriteUAV(RGTextureNode* node, RHITextureSubRes subRes) {
 		const uint8 subResIdx = node->RegisterSubRes(subRes);
-		m_UAVs.PushBack({ node, subResIdx });
+		AddUse(node, subResIdx, EResourceState::UnorderedAccessView);
 		node->SetSubResTargetState(subResIdx, EResourceState::ShaderResourceView);
 		RGNode::Connect(this, node);
 	}
@@ -161,7 +181,7 @@ namespace Render {
 	}
 
 	void RGComputeNode::WriteUAV(RGBufferNode* node) {
-		m_UAVBuffers.PushBack(node);
+		AddUse(node, RG_DEFAULT_SUB_RES, EResourceState::UnorderedAccessView);
 		node->SetTargetState(EResourceState::UnorderedAccessView);
 		RGNode::Connect(this, node);
 	}
@@ -170,33 +190,9 @@ namespace Render {
 		if (!m_Name.empty()) {
 			cmd->BeginDebugLabel(m_Name.c_str(), nullptr);
 		}
-		// state transition before dispatch
-		{
-			for (auto& srv : m_SRVs) {
-				srv.Node->TransitionSubResToState(cmd, EResourceState::ShaderResourceView, srv.SubResIndex);
-			}
-			for (auto& uav : m_UAVs) {
-				uav.Node->TransitionSubResToState(cmd, EResourceState::UnorderedAccessView, uav.SubResIndex);
-			}
-			for (RGBufferNode* srv: m_SRVBuffers) {
-				srv->TransitionToState(cmd, EResourceState::ShaderResourceView);
-			}
-			for (RGBufferNode* uav : m_UAVBuffers) {
-				uav->TransitionToState(cmd, EResourceState::UnorderedAccessView);
-			}
-		}
 		if (m_Task) {
 			m_Task(cmd);
 		}
-		// state transition after dispatch
-		{
-			for (auto& uav : m_UAVs) {
-				uav.Node->TransitionSubResToTargetState(cmd, uav.SubResIndex);
-			}
-			for (auto& uav: m_UAVBuffers) {
-				uav->TransitionToState(cmd, uav->GetTargetState());
-			}
-		}
 		if (!m_Name.empty()) {
 			cmd->EndDebugLabel();
 		}
@@ -212,6 +208,9 @@ namespace Render {
 		cpyPair.CpySize = {w, h};
 		cpyPair.SrcSubResIndex = src->RegisterSubRes(subRes);
 		cpyPair.DstSubResIndex = dst->RegisterSubRes(subRes);
+		AddUse(src, cpyPair.SrcSubResIndex, EResourceState::TransferSrc);
+		AddUse(dst, cpyPair.DstSubResIndex, EResourceState::TransferDst);
+		src->SetSubResTargetState(cpyPair.SrcSubResIndex, EResourceState::TransferSrc);
 		RGNode::Connect(src, this);
 		RGNode::Connect(this, dst);
 	}
@@ -220,21 +219,24 @@ namespace Render {
 		CopyTexture(src, dst, src->GetDesc().GetDefaultSubRes());
 	}
 
+	uint32 RGTransferNode::GetDefaultCost() const {
+		uint32 cost = 0;
+		for(const auto& cpyPair: m_Cpy) {
+			cost += cpyPair.CpySize.w * cpyPair.CpySize.h;
+		}
+		return cost;
+	}
+
 	void RGTransferNode::Run(RHICommandBuffer* cmd) {
 		if(!m_Name.empty()) {
 			cmd->BeginDebugLabel(m_Name.c_str(), nullptr);
 		}
 		for(auto& cpyPair: m_Cpy) {
-			// transition state
-			cpyPair.Src->TransitionSubResToState(cmd, EResourceState::TransferSrc, cpyPair.SrcSubResIndex);
-			cpyPair.Dst->TransitionSubResToState(cmd, EResourceState::TransferDst, cpyPair.DstSubResIndex);
 			RHITextureCopyRegion region{};
 			region.DstSubRes = region.SrcSubRes = cpyPair.SubRes;
 			region.SrcOffset = region.DstOffset = { 0, 0, 0 };
 			region.Extent = { cpyPair.CpySize.w, cpyPair.CpySize.h, 1 };
 			cmd->CopyTextureToTexture(cpyPair.Src->GetRHI(), cpyPair.Dst->GetRHI(), region);
-			cpyPair.Src->TransitionSubResToTargetState(cmd, cpyPair.SrcSubResIndex);
-			cpyPair.Dst->TransitionSubResToTargetState(cmd, cpyPair.DstSubResIndex);
 		}
 		if (!m_Name.empty()) {
 			cmd->EndDebugLabel();
@@ -246,9 +248,7 @@ namespace Render {
 	}
 
 	RHITexture* RGTextureNode::GetRHI() {
-		if(!m_RHI) {
-			m_RHI = RHI::Instance()->CreateTexture(m_Desc);
-		}
+		CHECK(m_RHI); // transient textures are acquired when the graph runs
 		return m_RHI;
 	}
 
@@ -256,13 +256,6 @@ namespace Render {
 		m_TargetState = state;
 	}
 
-	void RGBufferNode::TransitionToState(RHICommandBuffer* cmd, EResourceState state) {
-		if(EResourceState::Unknown != state && state != m_CurrentState) {
-			cmd->TransitionBufferState(m_Buffer, m_CurrentState, state);
-			m_CurrentState = state;
-		}
-	}
-
 	EResourceState RGBufferNode::GetTargetState() const {
 		return m_TargetState;
 	}
@@ -273,7 +266,7 @@ namespace Render {
 	}
 
 	void RGTextureNode::SetSubResTargetState(uint8 subResIdx, EResourceState targetState) {
-		if(DEFAULT_SUB_RES == subResIdx) {
+		if(RG_DEFAULT_SUB_RES == subResIdx) {
 			SetTargetState(targetState);
 			return;
 		}
@@ -282,7 +275,7 @@ namespace Render {
 
 	uint8 RGTextureNode::RegisterSubRes(RHITextureSubRes subRes) {
 		if(subRes == m_Desc.GetDefaultSubRes()) {
-			return DEFAULT_SUB_RES;
+			return RG_DEFAULT_SUB_RES;
 		}
 		for(uint32 i=0; i< m_SubResStates.Size(); ++i) {
 			if(m_SubResStates[i].SubRes == subRes) {
@@ -290,45 +283,11 @@ namespace Render {
 			}
 		}
 		const uint8 index = (uint8)m_SubResStates.Size();
-		m_SubResStates.PushBack({ subRes, m_TargetState });
+		m_SubResStates.PushBack({ subRes });
 		return index;
 	}
 
-	void RGTextureNode::TransitionSubResToState(RHICommandBuffer* cmd, EResourceState dstState, uint8 subResIdx) {
-		if(DEFAULT_SUB_RES == subResIdx) {
-			TransitionToState(cmd, dstState);
-			return;
-		}
-		if(dstState != EResourceState::Unknown && m_SubResStates[subResIdx].CurrentState != dstState) {
-			cmd->TransitionTextureState(m_RHI, m_SubResStates[subResIdx].CurrentState, dstState, m_SubResStates[subResIdx].SubRes);
-			m_SubResStates[subResIdx].CurrentState = dstState;
-		}
-	}
-
-	void RGTextureNode::TransitionSubResToTargetState(RHICommandBuffer* cmd, uint8 subResIdx) {
-		if(DEFAULT_SUB_RES == subResIdx) {
-			TransitionToTargetState(cmd);
-			return;
-		}
-		auto& subResState = m_SubResStates[subResIdx];
-		const EResourceState dstState = subResState.TargetState != EResourceState::Unknown ? subResState.TargetState : m_TargetState;
-		if(EResourceState::Unknown != dstState && subResState.CurrentState != dstState) {
-			cmd->TransitionTextureState(m_RHI, subResState.CurrentState, dstState, subResState.SubRes);
-			subResState.CurrentState = dstState;
-		}
-	}
-
-	void RGTextureNode::TransitionToState(RHICommandBuffer* cmd, EResourceState dstState) {
-		if(dstState != EResourceState::Unknown && m_CurrentState != dstState) {
-			cmd->TransitionTextureState(m_RHI, m_CurrentState, dstState, m_Desc.GetDefaultSubRes());
-			for(auto& subResState: m_SubResStates) {
-				subResState.CurrentState = dstState;
-			}
-			m_CurrentState = dstState;
-		}
-	}
-
-	void RGTextureNode::TransitionToTargetState(RHICommandBuffer* cmd) {
-		TransitionToState(cmd, m_TargetState);
+	RHITextureSubRes RGTextureNode::GetSubRes(uint8 subResIdx) const {
+		return RG_DEFAULT_SUB_RES == subResIdx ? m_Desc.GetDefaultSubRes() : m_SubResStates[subResIdx].SubRes;
 	}
-}
+}
\ No newline at end of file
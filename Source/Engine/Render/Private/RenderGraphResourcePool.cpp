@@ -0,0 +1,122 @@
+#include "Render/Public/RenderGraphResourcePool.h"
+#include "Core/Public/Algorithm.h"
+#include "Math/Public/Math.h"
+
+namespace {
+	uint32 GetTextureDescHash(const RHITextureDesc& desc) {
+		// the clear value is left out, it is compared by IsSameDesc
+		const uint32 formatWord = (uint32)EnumCast(desc.Dimension) | ((uint32)EnumCast(desc.Format) << 8) | ((uint32)EnumCast(desc.Flags) << 16);
+		const uint32 words[5] = { formatWord, desc.Width, desc.Height, desc.Depth, (uint32)desc.ArraySize | ((uint32)desc.MipSize << 16) | ((uint32)desc.Samples << 24) };
+		return DataArrayHash32(words, 5);
+	}
+}
+
+namespace Render {
+
+	void RGTransientPlacement::Place(TConstArrayView<RGTransientResource> resources) {
+		const uint32 numResources = resources.Size();
+		m_ResourceSlots.Reset();
+		m_ResourceSlots.Resize(numResources, INVALID_INDEX);
+		m_Slots.Reset();
+		m_NaiveSize = m_AllocatedSize = m_PeakSize = 0;
+		if(!numResources) {
+			return;
+		}
+		TArray<uint32> order(numResources);
+		uint32 maxStep = 0;
+		for(uint32 i = 0; i < numResources; ++i) {
+			order[i] = i;
+			CHECK(resources[i].FirstUse <= resources[i].LastUse);
+			maxStep = Math::Max(maxStep, resources[i].LastUse);
+			m_NaiveSize += resources[i].Size;
+		}
+		std::stable_sort(order.begin(), order.end(), [&resources](uint32 a, uint32 b) { return resources[a].FirstUse < resources[b].FirstUse; });
+		for(uint32 resourceIndex: order) {
+			const RGTransientResource& resource = resources[resourceIndex];
+			uint32 slotIndex = INVALID_INDEX;
+			for(uint32 i = 0; i < m_Slots.Size(); ++i) {
+				if(m_Slots[i].Key == resource.Key && m_Slots[i].LastUse < resource.FirstUse) {
+					slotIndex = i;
+					break;
+				}
+			}
+			if(INVALID_INDEX == slotIndex) {
+				slotIndex = m_Slots.Size();
+				m_Slots.PushBack({ resource.Key, resource.Size, resource.LastUse });
+				m_AllocatedSize += resource.Size;
+			}
+			else {
+				Slot& slot = m_Slots[slotIndex];
+				slot.LastUse = resource.LastUse;
+				if(slot.Size < resource.Size) {
+					m_AllocatedSize += resource.Size - slot.Size;
+					slot.Size = resource.Size;
+				}
+			}
+			m_ResourceSlots[resourceIndex] = slotIndex;
+		}
+		// sweep the steps for the live memory
+		TArray<int64> deltas(maxStep + 2, 0);
+		for(const RGTransientResource& resource: resources) {
+			deltas[resource.FirstUse] += (int64)resource.Size;
+			deltas[resource.LastUse + 1] -= (int64)resource.Size;
+		}
+		int64 liveSize = 0;
+		for(int64 delta: deltas) {
+			liveSize += delta;
+			m_PeakSize = Math::Max(m_PeakSize, (uint64)liveSize);
+		}
+	}
+
+	uint64 RGTransientTexturePool::GetTextureByteSize(const RHITextureDesc& desc) {
+		const uint64 layerSize = (uint64)desc.Get2DArraySize() * Math::Max<uint32>(desc.Depth, 1u) * Math::Max<uint8>(desc.Samples, 1u) * desc.GetPixelByteSize();
+		uint64 byteSize = 0;
+		for(uint8 mip = 0; mip < Math::Max<uint8>(desc.MipSize, 1u); ++mip) {
+			byteSize += layerSize * desc.GetMipLevelWidth(mip) * desc.GetMipLevelHeight(mip);
+		}
+		return byteSize;
+	}
+
+	bool RGTransientTexturePool::IsSameDesc(const RHITextureDesc& lhs, const RHITextureDesc& rhs) {
+		return lhs.Dimension == rhs.Dimension && lhs.Format == rhs.Format && lhs.Flags == rhs.Flags &&
+			lhs.Width == rhs.Width && lhs.Height == rhs.Height && lhs.Depth == rhs.Depth &&
+			lhs.ArraySize == rhs.ArraySize && lhs.MipSize == rhs.MipSize && lhs.Samples == rhs.Samples &&
+			0 == memcmp(&lhs.ClearValue.Color, &rhs.ClearValue.Color, sizeof(lhs.ClearValue.Color));
+	}
+
+	RHITexture* RGTransientTexturePool::Acquire(const RHITextureDesc& desc) {
+		TArray<Entry>& entries = m_Entries[GetTextureDescHash(desc)];
+		for(Entry& entry: entries) {
+			if(!entry.Acquired && IsSameDesc(entry.Texture->GetDesc(), desc)) {
+				entry.Acquired = true;
+				entry.IdleFrames = 0;
+				return entry.Texture.Get();
+			}
+		}
+		Entry& entry = entries.EmplaceBack();
+		entry.Texture = RHI::Instance()->CreateTexture(desc);
+		entry.IdleFrames = 0;
+		entry.Acquired = true;
+		++m_NumTextures;
+		m_ByteSize += GetTextureByteSize(desc);
+		return entry.Texture.Get();
+	}
+
+	void RGTransientTexturePool::Tick() {
+		for(auto iter = m_Entries.begin(); iter != m_Entries.end();) {
+			TArray<Entry>& entries = iter->second;
+			for(uint32 i = 0; i < entries.Size();) {
+				Entry& entry = entries[i];
+				if(!entry.Acquired && ++entry.IdleFrames > MAX_IDLE_FRAMES) {
+					--m_NumTextures;
+					m_ByteSize -= GetTextureByteSize(entry.Texture->GetDesc());
+					entries.SwapRemoveAt(i);
+					continue;
+				}
+				entry.Acquired = false;
+				++i;
+			}
+			iter = entries.IsEmpty() ? m_Entries.erase(iter) : std::next(iter);
+		}
+	}
+}
@@ -0,0 +1,242 @@
+#include "Render/Public/RenderGraphSchedule.h"
+#include "Math/Public/Math.h"
+
+namespace {
+	// known is the last batch of a queue that completed, INVALID_INDEX if none
+	inline bool IsBatchKnown(uint32 known, uint32 batchIndex) {
+		return INVALID_INDEX != known && known >= batchIndex;
+	}
+
+	inline uint32 MaxBatch(uint32 a, uint32 b) {
+		return INVALID_INDEX == a ? b : (INVALID_INDEX == b ? a : Math::Max(a, b));
+	}
+}
+
+namespace Render {
+
+	void RGQueueSchedule::Build(TConstArrayView<RGSchedulePass> passes, TConstArrayView<uint32> deps) {
+		const uint32 numPasses = passes.Size();
+		m_Order.Reset();
+		m_Batches.Reset();
+		m_PassBatches.Reset();
+		m_PassBatches.Resize(numPasses, INVALID_INDEX);
+		m_NumSyncPoints = 0;
+		m_SerialTime = m_ScheduledTime = 0;
+		if(!numPasses) {
+			return;
+		}
+		TArray<uint32> picks;
+		PickPasses(passes, deps, picks);
+		BuildBatches(passes, deps, picks);
+		Simulate(passes);
+	}
+
+	void RGQueueSchedule::PickPasses(TConstArrayView<RGSchedulePass> passes, TConstArrayView<uint32> deps, TArray<uint32>& picks) {
+		const uint32 numPasses = passes.Size();
+		// successors and the longest path from each pass to the end
+		TArray<uint32> succOffsets(numPasses + 1, 0);
+		TArray<uint64> levels(numPasses, 0);
+		for(uint32 i = 0; i < numPasses; ++i) {
+			for(uint32 j = 0; j < passes[i].DepCount; ++j) {
+				const uint32 dep = deps[passes[i].DepOffset + j];
+				CHECK(dep < i);
+				++succOffsets[dep + 1];
+			}
+		}
+		for(uint32 i = 0; i < numPasses; ++i) {
+			succOffsets[i + 1] += succOffsets[i];
+		}
+		TArray<uint32> succs(succOffsets[numPasses]);
+		TArray<uint32> succCounts(numPasses, 0);
+		for(uint32 i = 0; i < numPasses; ++i) {
+			for(uint32 j = 0; j < passes[i].DepCount; ++j) {
+				const uint32 dep = deps[passes[i].DepOffset + j];
+				succs[succOffsets[dep] + succCounts[dep]++] = i;
+			}
+		}
+		for(uint32 i = numPasses; i-- > 0;) {
+			for(uint32 j = succOffsets[i]; j < succOffsets[i + 1]; ++j) {
+				levels[i] = Math::Max(levels[i], levels[succs[j]]);
+			}
+			levels[i] += passes[i].Cost;
+		}
+
+		// list scheduling on the estimated queue times
+		TArray<uint32> pendingDeps(numPasses);
+		TArray<uint64> readyTimes(numPasses, 0);
+		TArray<uint32> readyPasses;
+		for(uint32 i = 0; i < numPasses; ++i) {
+			pendingDeps[i] = passes[i].DepCount;
+			if(!pendingDeps[i]) {
+				readyPasses.PushBack(i);
+			}
+		}
+		TStaticArray<uint64, NUM_QUEUES> queueTimes(0);
+		picks.Reset();
+		picks.Reserve(numPasses);
+		while(!readyPasses.IsEmpty()) {
+			uint32 best = 0;
+			uint64 bestStart = UINT64_MAX;
+			for(uint32 i = 0; i < readyPasses.Size(); ++i) {
+				const uint32 pass = readyPasses[i];
+				const uint64 start = Math::Max(queueTimes[EnumCast(passes[pass].Queue)], readyTimes[pass]);
+				const uint32 bestPass = readyPasses[best];
+				if(start < bestStart || (start == bestStart && (levels[pass] > levels[bestPass] || (levels[pass] == levels[bestPass] && pass < bestPass)))) {
+					best = i;
+					bestStart = start;
+				}
+			}
+			const uint32 pass = readyPasses[best];
+			readyPasses.SwapRemoveAt(best);
+			picks.PushBack(pass);
+			const uint64 end = bestStart + passes[pass].Cost;
+			queueTimes[EnumCast(passes[pass].Queue)] = end;
+			for(uint32 j = succOffsets[pass]; j < succOffsets[pass + 1]; ++j) {
+				const uint32 succ = succs[j];
+				readyTimes[succ] = Math::Max(readyTimes[succ], end);
+				if(!--pendingDeps[succ]) {
+					readyPasses.PushBack(succ);
+				}
+			}
+		}
+		CHECK(picks.Size() == numPasses);
+	}
+
+	void RGQueueSchedule::BuildBatches(TConstArrayView<RGSchedulePass> passes, TConstArrayView<uint32> deps, TConstArrayView<uint32> picks) {
+		struct BuildingBatch {
+			EQueueType Queue;
+			TArray<uint32> Passes;
+			TStaticArray<uint32, NUM_QUEUES> Waits;
+			TStaticArray<uint32, NUM_QUEUES> Known; // last batch of each queue completed before the batch starts
+		};
+		TArray<BuildingBatch> batches;
+		TArray<uint32> submitOrder;
+		TStaticArray<uint32, NUM_QUEUES> openBatches(INVALID_INDEX);
+		TStaticArray<uint32, NUM_QUEUES> lastBatches(INVALID_INDEX);
+		auto closeBatch = [&submitOrder, &openBatches](uint32 queue) {
+			if(INVALID_INDEX != openBatches[queue]) {
+				submitOrder.PushBack(openBatches[queue]);
+				openBatches[queue] = INVALID_INDEX;
+			}
+		};
+		for(const uint32 pass: picks) {
+			const uint32 queue = EnumCast(passes[pass].Queue);
+			// batches of other queues to wait for, an open batch is closed to signal its end
+			TStaticArray<uint32, NUM_QUEUES> waits(INVALID_INDEX);
+			for(uint32 j = 0; j < passes[pass].DepCount; ++j) {
+				const uint32 depBatch = m_PassBatches[deps[passes[pass].DepOffset + j]];
+				const uint32 depQueue = EnumCast(batches[depBatch].Queue);
+				if(depQueue != queue) {
+					if(openBatches[depQueue] == depBatch) {
+						closeBatch(depQueue);
+					}
+					waits[depQueue] = MaxBatch(waits[depQueue], depBatch);
+				}
+			}
+			// waits are at the start of a batch, a wait the open batch does not cover starts a new one
+			uint32 batchIndex = openBatches[queue];
+			if(INVALID_INDEX != batchIndex) {
+				for(uint32 i = 0; i < NUM_QUEUES; ++i) {
+					if(INVALID_INDEX != waits[i] && !IsBatchKnown(batches[batchIndex].Known[i], waits[i])) {
+						closeBatch(queue);
+						batchIndex = INVALID_INDEX;
+						break;
+					}
+				}
+			}
+			if(INVALID_INDEX == batchIndex) {
+				batchIndex = batches.Size();
+				BuildingBatch& batch = batches.EmplaceBack();
+				batch.Queue = passes[pass].Queue;
+				batch.Waits.Reset(INVALID_INDEX);
+				const uint32 prevBatch = lastBatches[queue];
+				if(INVALID_INDEX != prevBatch) {
+					batch.Known = batches[prevBatch].Known;
+				}
+				else {
+					batch.Known.Reset(INVALID_INDEX);
+				}
+				batch.Known[queue] = prevBatch;
+				for(uint32 i = 0; i < NUM_QUEUES; ++i) {
+					if(INVALID_INDEX != waits[i] && !IsBatchKnown(batch.Known[i], waits[i])) {
+						batch.Waits[i] = waits[i];
+						const BuildingBatch& waitBatch = batches[waits[i]];
+						for(uint32 k = 0; k < NUM_QUEUES; ++k) {
+							batch.Known[k] = MaxBatch(batch.Known[k], waitBatch.Known[k]);
+						}
+						batch.Known[i] = MaxBatch(batch.Known[i], waits[i]);
+					}
+				}
+				openBatches[queue] = lastBatches[queue] = batchIndex;
+			}
+			batches[batchIndex].Passes.PushBack(pass);
+			m_PassBatches[pass] = batchIndex;
+		}
+		// open batches are waited by no batch, submitted in the order of creation
+		TArray<uint32> submitIndices(batches.Size(), INVALID_INDEX);
+		for(uint32 i = 0; i < submitOrder.Size(); ++i) {
+			submitIndices[submitOrder[i]] = i;
+		}
+		for(uint32 i = 0; i < batches.Size(); ++i) {
+			if(INVALID_INDEX == submitIndices[i] && openBatches[EnumCast(batches[i].Queue)] == i) {
+				submitIndices[i] = submitOrder.Size();
+				submitOrder.PushBack(i);
+			}
+		}
+		CHECK(submitOrder.Size() == batches.Size());
+
+		m_Order.Reserve(picks.Size());
+		m_Batches.Reserve(batches.Size());
+		for(const uint32 batchIndex: submitOrder) {
+			const BuildingBatch& building = batches[batchIndex];
+			Batch& batch = m_Batches.EmplaceBack();
+			batch.Queue = building.Queue;
+			batch.PassOffset = m_Order.Size();
+			batch.PassCount = building.Passes.Size();
+			for(uint32 i = 0; i < NUM_QUEUES; ++i) {
+				const uint32 wait = building.Waits[i];
+				batch.Waits[i] = INVALID_INDEX == wait ? INVALID_INDEX : submitIndices[wait];
+				if(INVALID_INDEX != wait) {
+					CHECK(batch.Waits[i] < m_Batches.Size() - 1);
+					++m_NumSyncPoints;
+				}
+			}
+			batch.Start = batch.End = 0;
+			for(const uint32 pass: building.Passes) {
+				m_Order.PushBack(pass);
+			}
+		}
+		for(uint32& passBatch: m_PassBatches) {
+			passBatch = submitIndices[passBatch];
+		}
+	}
+
+	void RGQueueSchedule::Simulate(TConstArrayView<RGSchedulePass> passes) {
+		m_PassStarts.Reset();
+		m_PassStarts.Resize(passes.Size(), 0);
+		m_PassEnds.Reset();
+		m_PassEnds.Resize(passes.Size(), 0);
+		for(const RGSchedulePass& pass: passes) {
+			m_SerialTime += pass.Cost;
+		}
+		TStaticArray<uint64, NUM_QUEUES> queueTimes(0);
+		for(Batch& batch: m_Batches) {
+			uint64& queueTime = queueTimes[EnumCast(batch.Queue)];
+			batch.Start = queueTime;
+			for(const uint32 wait: batch.Waits) {
+				if(INVALID_INDEX != wait) {
+					batch.Start = Math::Max(batch.Start, m_Batches[wait].End);
+				}
+			}
+			uint64 time = batch.Start;
+			for(uint32 i = batch.PassOffset; i < batch.PassOffset + batch.PassCount; ++i) {
+				const uint32 pass = m_Order[i];
+				m_PassStarts[pass] = time;
+				time += passes[pass].Cost;
+				m_PassEnds[pass] = time;
+			}
+			batch.End = queueTime = time;
+			m_ScheduledTime = Math::Max(m_ScheduledTime, time);
+		}
+	}
+}
@@ -85,7 +85,7 @@ namespace Render {
 		}
 
 		RHITexture* backBuffer = viewport->GetBackBuffer();
-		RenderGraph rg(m_RGViewDirty ? &m_RGView: nullptr);
+		RenderGraph rg(m_RGViewDirty ? &m_RGView: nullptr, &m_TransientTexturePool);
 		// get back buffer
 		RGTextureNode* backBufferNode = rg.CreateTextureNode(backBuffer, "BackBuffer");
 		// render scene
@@ -96,6 +96,7 @@ namespace Render {
 		// present
 		RGPresentNode* presentNode = rg.CreatePresentNode(backBufferNode, "Present");
 		presentNode->InsertFenceBefore(fence);
+		rg.Compile();
 		// ========= run the graph ==============
 		RHI::Instance()->BeginRendering();
 		fence->Reset();
@@ -103,6 +104,7 @@ namespace Render {
 		cmdPool->Reset();
 		rg.Run(cmdPool);
 		cmdPool->GC();
+		m_TransientTexturePool.Tick();
 
 		// ========= wait next fence for beginning next frame ==============
 		RHIFence* nextFence = m_Fences[(frameIndex + 1) % RHI_FRAME_IN_FLIGHT_MAX].Get();
@@ -0,0 +1,326 @@
+#include "Render/Public/SoftwareOcclusion.h"
+#include "Math/Public/Math.h"
+#include "System/Public/ThreadPool.h"
+#include "Core/Public/FrameAllocator.h"
+#include <algorithm>
+#include <cfloat>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define OCCLUSION_SSE 1
+#include <emmintrin.h>
+#else
+#define OCCLUSION_SSE 0
+#endif
+
+namespace {
+	constexpr uint32 TILE_WIDTH = 64;
+	constexpr uint32 TILE_HEIGHT = 32;
+	constexpr uint32 PIXEL_ALIGNMENT = 4; // pixels written per SSE iteration
+	constexpr uint32 MAX_CLIPPED_TRIANGLES = 2; // a triangle clipped by the near plane turns into 2 triangles at most
+	constexpr float FAR_DEPTH = 1.0f;
+
+	// Clip the polygon against the near plane z >= 0 of the clip space, returns the number of output vertices.
+	uint32 ClipNearPlane(const Math::FVector4* vertices, uint32 numVertices, Math::FVector4* outVertices) {
+		uint32 numOut = 0;
+		for(uint32 i = 0; i < numVertices; ++i) {
+			const Math::FVector4& v0 = vertices[i];
+			const Math::FVector4& v1 = vertices[(i + 1) % numVertices];
+			if(v0.Z >= 0.0f) {
+				outVertices[numOut++] = v0;
+			}
+			if((v0.Z >= 0.0f) != (v1.Z >= 0.0f)) {
+				const float t = v0.Z / (v0.Z - v1.Z);
+				outVertices[numOut++] = v0 + (v1 - v0) * t;
+			}
+		}
+		return numOut;
+	}
+}
+
+namespace Render {
+
+	SoftwareOcclusion::SoftwareOcclusion(uint32 width, uint32 height) : m_Width(0), m_Height(0), m_NumTilesX(0), m_NumTilesY(0), m_HasDepth(false) {
+		Resize(width, height);
+	}
+
+	void SoftwareOcclusion::Resize(uint32 width, uint32 height) {
+		width = Math::AlignUp(Math::Max(width, PIXEL_ALIGNMENT), PIXEL_ALIGNMENT);
+		height = Math::Max(height, 1u);
+		if(width == m_Width && height == m_Height) {
+			return;
+		}
+		m_Width = width;
+		m_Height = height;
+		m_NumTilesX = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+		m_NumTilesY = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+		m_TileBins.Resize(m_NumTilesX * m_NumTilesY);
+		// furthest depth pyramid down to 1x1
+		m_Levels.Reset();
+		uint32 offset = 0;
+		for(;;) {
+			m_Levels.PushBack({ offset, width, height });
+			offset += width * height;
+			if(width == 1 && height == 1) {
+				break;
+			}
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+		}
+		m_DepthPyramid.Resize(offset);
+		m_HasDepth = false;
+	}
+
+	void SoftwareOcclusion::Reset() {
+		m_Occluders.Reset();
+		m_HasDepth = false;
+	}
+
+	void SoftwareOcclusion::AddOccluder(const OccluderMesh* mesh, const Math::FMatrix4x4& worldMatrix) {
+		MutexLock lock(m_OccluderMutex);
+		m_Occluders.PushBack({ mesh, worldMatrix });
+	}
+
+	void SoftwareOcclusion::Rasterize(const Math::FMatrix4x4& viewProjectMatrix) {
+		m_ViewProjectMatrix = viewProjectMatrix;
+		m_HasDepth = false;
+		if(m_Occluders.IsEmpty()) {
+			return;
+		}
+		// occluders write their triangles into reserved ranges, so they are set up concurrently
+		const uint32 numOccluders = m_Occluders.Size();
+		m_OccluderTriangleStarts.Resize(numOccluders);
+		m_OccluderTriangleCounts.Resize(numOccluders);
+		uint32 numTriangles = 0;
+		for(uint32 i = 0; i < numOccluders; ++i) {
+			m_OccluderTriangleStarts[i] = numTriangles;
+			numTriangles += m_Occluders[i].Mesh->Indices.Size() / 3 * MAX_CLIPPED_TRIANGLES;
+		}
+		m_Triangles.Resize(numTriangles);
+		Engine::ParallelFor(0u, numOccluders, 1u, [this](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+				SetupTriangles(i);
+			}
+		});
+		BinTriangles();
+		const PyramidLevel& level0 = m_Levels[0];
+		std::fill(m_DepthPyramid.Data(), m_DepthPyramid.Data() + level0.Width * level0.Height, FAR_DEPTH);
+		Engine::ParallelFor(0u, m_TileBins.Size(), 1u, [this](uint32 rangeBegin, uint32 rangeEnd) {
+			for(uint32 i = rangeBegin; i < rangeEnd; ++i) {
+				RasterizeTile(i);
+			}
+		});
+		BuildPyramid();
+		m_HasDepth = true;
+	}
+
+	bool SoftwareOcclusion::HasDepth() const {
+		return m_HasDepth;
+	}
+
+	bool SoftwareOcclusion::TestAABB(const Math::AABB3& aabb) const {
+		if(!m_HasDepth) {
+			return true;
+		}
+		// corners are the min corner plus the projected edges
+		const Math::FVector3 extent = aabb.Max - aabb.Min;
+		const Math::FVector4 base = m_ViewProjectMatrix * Math::FVector4(aabb.Min, 1.0f);
+		const Math::FVector4 edgeX = m_ViewProjectMatrix * Math::FVector4(extent.X, 0.0f, 0.0f, 0.0f);
+		const Math::FVector4 edgeY = m_ViewProjectMatrix * Math::FVector4(0.0f, extent.Y, 0.0f, 0.0f);
+		const Math::FVector4 edgeZ = m_ViewProjectMatrix * Math::FVector4(0.0f, 0.0f, extent.Z, 0.0f);
+		float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+		for(uint32 i = 0; i < 8; ++i) {
+			Math::FVector4 corner = base;
+			corner = (i & 1) ? corner + edgeX : corner;
+			corner = (i & 2) ? corner + edgeY : corner;
+			corner = (i & 4) ? corner + edgeZ : corner;
+			// crossing the near plane
+			if(corner.Z < 0.0f) {
+				return true;
+			}
+			const float invW = 1.0f / corner.W;
+			const float x = (corner.X * invW * 0.5f + 0.5f) * (float)m_Width;
+			const float y = (0.5f - corner.Y * invW * 0.5f) * (float)m_Height;
+			minX = Math::Min(minX, x);
+			maxX = Math::Max(maxX, x);
+			minY = Math::Min(minY, y);
+			maxY = Math::Max(maxY, y);
+			minZ = Math::Min(minZ, corner.Z * invW);
+		}
+		if(maxX < 0.0f || maxY < 0.0f || minX >= (float)m_Width || minY >= (float)m_Height) {
+			return true;
+		}
+		const uint32 x0 = (uint32)Math::Max(minX, 0.0f);
+		const uint32 y0 = (uint32)Math::Max(minY, 0.0f);
+		const uint32 x1 = (uint32)Math::Min(maxX, (float)(m_Width - 1));
+		const uint32 y1 = (uint32)Math::Min(maxY, (float)(m_Height - 1));
+		// the level where the rect covers 2x2 texels at most
+		uint32 levelIndex = 0;
+		while((x1 >> levelIndex) - (x0 >> levelIndex) > 1 || (y1 >> levelIndex) - (y0 >> levelIndex) > 1) {
+			++levelIndex;
+		}
+		const PyramidLevel& level = m_Levels[levelIndex];
+		const float* depth = m_DepthPyramid.Data() + level.Offset;
+		float furthest = 0.0f;
+		for(uint32 y = y0 >> levelIndex; y <= (y1 >> levelIndex); ++y) {
+			for(uint32 x = x0 >> levelIndex; x <= (x1 >> levelIndex); ++x) {
+				furthest = Math::Max(furthest, depth[y * level.Width + x]);
+			}
+		}
+		return minZ <= furthest;
+	}
+
+	void SoftwareOcclusion::SetupTriangles(uint32 occluderIndex) {
+		const Occluder& occluder = m_Occluders[occluderIndex];
+		const OccluderMesh& mesh = *occluder.Mesh;
+		const Math::FMatrix4x4 matrix = m_ViewProjectMatrix * occluder.WorldMatrix;
+		TFrameArray<Math::FVector4> clipVertices(mesh.Vertices.Size());
+		for(uint32 i = 0; i < mesh.Vertices.Size(); ++i) {
+			clipVertices[i] = matrix * Math::FVector4(mesh.Vertices[i], 1.0f);
+		}
+		ScreenTriangle* outTriangles = m_Triangles.Data() + m_OccluderTriangleStarts[occluderIndex];
+		uint32 numOut = 0;
+		const float width = (float)m_Width, height = (float)m_Height;
+		for(uint32 i = 0; i + 2 < mesh.Indices.Size(); i += 3) {
+			Math::FVector4 polygon[4];
+			const Math::FVector4 triangle[3] = { clipVertices[mesh.Indices[i]], clipVertices[mesh.Indices[i + 1]], clipVertices[mesh.Indices[i + 2]] };
+			uint32 numVertices = 3;
+			if(triangle[0].Z < 0.0f || triangle[1].Z < 0.0f || triangle[2].Z < 0.0f) {
+				numVertices = ClipNearPlane(triangle, 3, polygon);
+			}
+			else {
+				polygon[0] = triangle[0];
+				polygon[1] = triangle[1];
+				polygon[2] = triangle[2];
+			}
+			// fan triangulation of the clipped polygon
+			for(uint32 j = 2; j < numVertices; ++j) {
+				ScreenTriangle& out = outTriangles[numOut];
+				const Math::FVector4* vertices[3] = { &polygon[0], &polygon[j - 1], &polygon[j] };
+				for(uint32 k = 0; k < 3; ++k) {
+					const float invW = 1.0f / vertices[k]->W;
+					out.X[k] = (vertices[k]->X * invW * 0.5f + 0.5f) * width;
+					out.Y[k] = (0.5f - vertices[k]->Y * invW * 0.5f) * height;
+					out.Z[k] = vertices[k]->Z * invW;
+				}
+				out.MinX = Math::Min(out.X[0], Math::Min(out.X[1], out.X[2]));
+				out.MaxX = Math::Max(out.X[0], Math::Max(out.X[1], out.X[2]));
+				out.MinY = Math::Min(out.Y[0], Math::Min(out.Y[1], out.Y[2]));
+				out.MaxY = Math::Max(out.Y[0], Math::Max(out.Y[1], out.Y[2]));
+				const float area = (out.X[1] - out.X[0]) * (out.Y[2] - out.Y[0]) - (out.X[2] - out.X[0]) * (out.Y[1] - out.Y[0]);
+				const bool bOffScreen = out.MaxX < 0.0f || out.MaxY < 0.0f || out.MinX >= width || out.MinY >= height;
+				const bool bBeyondFar = out.Z[0] > FAR_DEPTH && out.Z[1] > FAR_DEPTH && out.Z[2] > FAR_DEPTH;
+				if(!bOffScreen && !bBeyondFar && Math::FAbs(area) > FLT_EPSILON) {
+					++numOut;
+				}
+			}
+		}
+		m_OccluderTriangleCounts[occluderIndex] = numOut;
+	}
+
+	void SoftwareOcclusion::BinTriangles() {
+		for(TArray<uint32>& bin: m_TileBins) {
+			bin.Reset();
+		}
+		for(uint32 i = 0; i < m_Occluders.Size(); ++i) {
+			const uint32 start = m_OccluderTriangleStarts[i];
+			for(uint32 t = start; t < start + m_OccluderTriangleCounts[i]; ++t) {
+				const ScreenTriangle& triangle = m_Triangles[t];
+				const uint32 tileX0 = (uint32)Math::Max(triangle.MinX, 0.0f) / TILE_WIDTH;
+				const uint32 tileY0 = (uint32)Math::Max(triangle.MinY, 0.0f) / TILE_HEIGHT;
+				const uint32 tileX1 = Math::Min((uint32)Math::Min(triangle.MaxX, (float)m_Width) / TILE_WIDTH, m_NumTilesX - 1);
+				const uint32 tileY1 = Math::Min((uint32)Math::Min(triangle.MaxY, (float)m_Height) / TILE_HEIGHT, m_NumTilesY - 1);
+				for(uint32 tileY = tileY0; tileY <= tileY1; ++tileY) {
+					for(uint32 tileX = tileX0; tileX <= tileX1; ++tileX) {
+						m_TileBins[tileY * m_NumTilesX + tileX].PushBack(t);
+					}
+				}
+			}
+		}
+	}
+
+	void SoftwareOcclusion::RasterizeTile(uint32 tileIndex) {
+		const uint32 tileX = tileIndex % m_NumTilesX, tileY = tileIndex / m_NumTilesX;
+		const int32 tileX0 = (int32)(tileX * TILE_WIDTH), tileY0 = (int32)(tileY * TILE_HEIGHT);
+		const int32 tileX1 = (int32)Math::Min((tileX + 1) * TILE_WIDTH, m_Width);
+		const int32 tileY1 = (int32)Math::Min((tileY + 1) * TILE_HEIGHT, m_Height);
+		float* depth = m_DepthPyramid.Data();
+		for(uint32 triangleIndex: m_TileBins[tileIndex]) {
+			const ScreenTriangle& tri = m_Triangles[triangleIndex];
+			// edge k is opposite to vertex k, pixel centers with all edges >= 0 are covered
+			const float area = (tri.X[1] - tri.X[0]) * (tri.Y[2] - tri.Y[0]) - (tri.X[2] - tri.X[0]) * (tri.Y[1] - tri.Y[0]);
+			const float sign = area > 0.0f ? 1.0f : -1.0f;
+			float edgeA[3], edgeB[3], edgeC[3];
+			for(uint32 k = 0; k < 3; ++k) {
+				const uint32 i = (k + 1) % 3, j = (k + 2) % 3;
+				edgeA[k] = (tri.Y[i] - tri.Y[j]) * sign;
+				edgeB[k] = (tri.X[j] - tri.X[i]) * sign;
+				edgeC[k] = -(edgeA[k] * tri.X[i] + edgeB[k] * tri.Y[i]);
+			}
+			// depth plane from barycentric weights
+			const float invArea = 1.0f / Math::FAbs(area);
+			const float depthA = (edgeA[0] * tri.Z[0] + edgeA[1] * tri.Z[1] + edgeA[2] * tri.Z[2]) * invArea;
+			const float depthB = (edgeB[0] * tri.Z[0] + edgeB[1] * tri.Z[1] + edgeB[2] * tri.Z[2]) * invArea;
+			const float depthC = (edgeC[0] * tri.Z[0] + edgeC[1] * tri.Z[1] + edgeC[2] * tri.Z[2]) * invArea;
+
+			// clamp before converting, vertices close to the near plane are far off screen
+			const int32 x0 = (int32)Math::Max(Math::Floor(tri.MinX), (float)tileX0) & ~(int32)(PIXEL_ALIGNMENT - 1);
+			const int32 x1 = (int32)Math::Min(Math::Ceil(tri.MaxX) + 1.0f, (float)tileX1);
+			const int32 y0 = (int32)Math::Max(Math::Floor(tri.MinY), (float)tileY0);
+			const int32 y1 = (int32)Math::Min(Math::Ceil(tri.MaxY) + 1.0f, (float)tileY1);
+			for(int32 y = y0; y < y1; ++y) {
+				const float centerY = (float)y + 0.5f;
+				float* row = depth + y * m_Width;
+#if OCCLUSION_SSE
+				const __m128 laneX = _mm_add_ps(_mm_set1_ps((float)x0 + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[0]), laneX), _mm_set1_ps(edgeB[0] * centerY + edgeC[0]));
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[1]), laneX), _mm_set1_ps(edgeB[1] * centerY + edgeC[1]));
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[2]), laneX), _mm_set1_ps(edgeB[2] * centerY + edgeC[2]));
+				__m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depthA), laneX), _mm_set1_ps(depthB * centerY + depthC));
+				const __m128 stepE0 = _mm_set1_ps(edgeA[0] * PIXEL_ALIGNMENT);
+				const __m128 stepE1 = _mm_set1_ps(edgeA[1] * PIXEL_ALIGNMENT);
+				const __m128 stepE2 = _mm_set1_ps(edgeA[2] * PIXEL_ALIGNMENT);
+				const __m128 stepZ = _mm_set1_ps(depthA * PIXEL_ALIGNMENT);
+				const __m128 zero = _mm_setzero_ps();
+				for(int32 x = x0; x < x1; x += PIXEL_ALIGNMENT) {
+					const __m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+					if(_mm_movemask_ps(covered)) {
+						const __m128 old = _mm_loadu_ps(row + x);
+						const __m128 closer = _mm_min_ps(old, z);
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(covered, closer), _mm_andnot_ps(covered, old)));
+					}
+					e0 = _mm_add_ps(e0, stepE0);
+					e1 = _mm_add_ps(e1, stepE1);
+					e2 = _mm_add_ps(e2, stepE2);
+					z = _mm_add_ps(z, stepZ);
+				}
+#else
+				for(int32 x = x0; x < x1; ++x) {
+					const float centerX = (float)x + 0.5f;
+					if(edgeA[0] * centerX + edgeB[0] * centerY + edgeC[0] >= 0.0f &&
+						edgeA[1] * centerX + edgeB[1] * centerY + edgeC[1] >= 0.0f &&
+						edgeA[2] * centerX + edgeB[2] * centerY + edgeC[2] >= 0.0f) {
+						row[x] = Math::Min(row[x], depthA * centerX + depthB * centerY + depthC);
+					}
+				}
+#endif
+			}
+		}
+	}
+
+	void SoftwareOcclusion::BuildPyramid() {
+		for(uint32 i = 1; i < m_Levels.Size(); ++i) {
+			const PyramidLevel& src = m_Levels[i - 1];
+			const PyramidLevel& dst = m_Levels[i];
+			const float* srcDepth = m_DepthPyramid.Data() + src.Offset;
+			float* dstDepth = m_DepthPyramid.Data() + dst.Offset;
+			for(uint32 y = 0; y < dst.Height; ++y) {
+				const uint32 srcY0 = y * 2, srcY1 = Math::Min(y * 2 + 1, src.Height - 1);
+				for(uint32 x = 0; x < dst.Width; ++x) {
+					const uint32 srcX0 = x * 2, srcX1 = Math::Min(x * 2 + 1, src.Width - 1);
+					dstDepth[y * dst.Width + x] = Math::Max(
+						Math::Max(srcDepth[srcY0 * src.Width + srcX0], srcDepth[srcY0 * src.Width + srcX1]),
+						Math::Max(srcDepth[srcY1 * src.Width + srcX0], srcDepth[srcY1 * src.Width + srcX1]));
+				}
+			}
+		}
+	}
+}
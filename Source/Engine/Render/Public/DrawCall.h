@@ -26,4 +26,88 @@ namespace Render {
 		void PushDrawCall(DrawCallFunc&& f);
 		void Execute(RHICommandBuffer* cmd);
 	};
+
+	// Binds the parameters of a material, Material of the draw command is passed back.
+	typedef void(*DrawMaterialBindFunc)(RHICommandBuffer* cmd, void* material);
+
+	struct DrawParam {
+		uint32 SetIndex;
+		uint32 BindIndex;
+		RHIShaderParam Param;
+	};
+
+	// Params set together, stored once in the queue and shared by the commands referencing the block.
+	struct DrawParamBlock {
+		uint32 ParamOffset;
+		uint32 NumParams;
+	};
+
+	// Plain draw command, its parameters are blocks stored in the queue.
+	struct DrawCommand {
+		RHIGraphicsPipelineState* PSO{ nullptr };
+		DrawMaterialBindFunc BindMaterial{ nullptr };
+		void* Material{ nullptr };
+		RHIBuffer* VertexBuffer{ nullptr };
+		RHIBuffer* IndexBuffer{ nullptr };
+		RHIBuffer* IndirectBuffer{ nullptr }; // draws with the indexed indirect command at IndirectOffset if set
+		uint32 IndirectOffset{ 0 };
+		uint32 IndexCount{ 0 };
+		uint32 InstanceCount{ 1 };
+		uint32 FirstInstance{ 0 };
+		// Blocks returned by DrawCommandQueue::AddParamBlock, the params of the two blocks and of the material must not share slots.
+		uint32 ViewParams{ INVALID_INDEX };
+		uint32 ObjectParams{ INVALID_INDEX };
+	};
+
+	// State changes issued and skipped by the last DrawCommandQueue::Execute.
+	struct DrawCommandStats {
+		uint32 NumCommands{ 0 };
+		uint32 NumPipelineBinds{ 0 };
+		uint32 NumPipelineBindsSaved{ 0 };
+		uint32 NumMaterialBinds{ 0 };
+		uint32 NumMaterialBindsSaved{ 0 };
+		uint32 NumParamBlocks{ 0 };
+		uint32 NumParamBlocksSaved{ 0 };
+		uint32 NumParams{ 0 };
+		uint32 NumVertexBufferBinds{ 0 };
+		uint32 NumVertexBufferBindsSaved{ 0 };
+		uint32 NumIndexBufferBinds{ 0 };
+		uint32 NumIndexBufferBindsSaved{ 0 };
+	};
+
+	// Draw commands executed in the order of their sort keys, redundant binds between neighbouring commands are skipped.
+	// Param blocks are compared by index, a block is set again only after the command block or the pipeline changes.
+	class DrawCommandQueue {
+	public:
+		// Key bits from high to low: layer 8, pipeline 20, material 20, depth 16. Depth is clamped to [0, 1], smaller is drawn first.
+		static uint64 MakeSortKey(uint32 layer, uint32 pipelineID, uint32 materialID, float depth);
+		DrawCommandQueue() = default;
+		~DrawCommandQueue() = default;
+		NON_COPYABLE(DrawCommandQueue);
+		DrawCommand& AddCommand(uint64 sortKey);
+		// Parameters added after AddParamBlock belong to the returned block.
+		uint32 AddParamBlock();
+		void AddParam(uint32 setIndex, uint32 bindIndex, const RHIShaderParam& param);
+		void AddParam(RHIShaderBinding binding, const RHIShaderParam& param);
+		void Reset();
+		bool IsEmpty() const { return m_Commands.IsEmpty(); }
+		uint32 Size() const { return m_Commands.Size(); }
+		// Sort the commands with a radix sort over the keys, equal keys keep the order of adding.
+		void Sort();
+		// Sorts the commands if they are not sorted.
+		void Execute(RHICommandBuffer* cmd);
+		const DrawCommandStats& GetStats() const { return m_Stats; }
+	private:
+		TArray<DrawCommand> m_Commands;
+		TArray<DrawParam> m_Params;
+		TArray<DrawParamBlock> m_ParamBlocks;
+		TArray<uint64> m_Keys;
+		// scratch of the sort, kept to reuse the memory
+		TArray<uint32> m_Order;
+		TArray<uint32> m_TmpOrder;
+		TArray<uint64> m_TmpKeys;
+		TArray<DrawCommand> m_TmpCommands;
+		DrawCommandStats m_Stats;
+		bool m_IsSorted{ true };
+	};
 }
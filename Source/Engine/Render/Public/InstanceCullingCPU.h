@@ -0,0 +1,93 @@
+#pragma once
+#include "Core/Public/TArray.h"
+#include "Core/Public/TArrayView.h"
+#include "Core/Public/BaseStructs.h"
+#include "Core/Public/File.h"
+#include "Math/Public/Geometry.h"
+#include "Math/Public/Matrix.h"
+#include "RHI/Public/RHIResources.h"
+
+namespace Render {
+	// Layouts shared with InstanceCulling.hlsl.
+	struct InstanceCullingParams {
+		Math::Frustum Frustum;
+		Math::FMatrix4x4 ViewProjectMatrix;
+		Math::FVector4 HZBSizeScale; // (width scale, height scale, unused, unused)
+		uint32 NumClusters;
+		uint32 Padding[3];
+	};
+
+	struct InstanceCullingAABB {
+		Math::FVector4 AABBMin; // (AABBMin.xyz, instance start)
+		Math::FVector4 AABBMax; // (AABBMax.xyz, instance end)
+	};
+
+	struct InstanceCullingCluster {
+		uint32 ClusterIndex;
+		uint32 SrcInstanceOffset;
+		uint32 DstInstanceOffset;
+		uint32 PrimitiveStart;
+		uint32 PrimitiveCount;
+	};
+
+	// Inputs of one culling dispatch, recorded by the GPU driven renderer and replayed by InstanceCullingTest.
+	struct InstanceCullingCapture {
+		InstanceCullingParams Params{};
+		TArray<InstanceCullingAABB> InstanceAABBs;
+		TArray<InstanceCullingAABB> ClusterAABBs;
+		TArray<InstanceCullingCluster> Clusters;
+		TArray<DrawIndexedIndirectCommand> IndirectCmds; // before culling, zero instance counts
+		uint32 NumInstanceIDs{ 0 };
+		// the depth the HZB is built from, empty if the occlusion test is off
+		TArray<float> Depth;
+		uint32 DepthWidth{ 0 };
+		uint32 DepthHeight{ 0 };
+		bool Save(File::PathStr filePath) const;
+		bool Load(File::PathStr filePath);
+	};
+
+	// CPU copy of the furthest HZB built by HZBBuilder, from a depth buffer in memory.
+	class HZBCPU {
+	public:
+		HZBCPU();
+		~HZBCPU() = default;
+		// Same size, blit and reduction as HZBBuilder, texels out of the actual size are clamped to the depth edge.
+		void Build(const float* depth, uint32 width, uint32 height);
+		uint32 GetSize() const { return m_Size; }
+		uint32 GetMipSize() const { return m_Mips.Size(); }
+		USize2D GetActualSize() const { return { m_ActualWidth, m_ActualHeight }; }
+		// Point sampled with clamped uv, as the shader samples the HZB.
+		float Sample(float u, float v, uint32 mip) const;
+	private:
+		struct Mip {
+			uint32 Offset;
+			uint32 Size;
+		};
+		uint32 m_Size;
+		uint32 m_ActualWidth;
+		uint32 m_ActualHeight;
+		TArray<Mip> m_Mips;
+		TArray<float> m_Texels;
+	};
+
+	// Reference of InstanceCulling.hlsl, produces the same indirect commands and instance IDs as the compute shader.
+	// Used to validate the shader and as the fallback of the GPU driven renderer where compute culling is unavailable.
+	class InstanceCullingCPU {
+	public:
+		InstanceCullingCPU() = default;
+		~InstanceCullingCPU() = default;
+		// cmds must be initialized with zero instance counts, instance IDs are written at the cluster destination offsets.
+		// Instances are written in cluster order, the shader writes the same set in each range but the order depends on atomics.
+		void Cull(const InstanceCullingParams& params, const HZBCPU* hzb,
+			TConstArrayView<InstanceCullingAABB> instanceAABBs, TConstArrayView<InstanceCullingAABB> clusterAABBs,
+			TConstArrayView<InstanceCullingCluster> clusters, TArrayView<DrawIndexedIndirectCommand> cmds, TArrayView<uint32> instanceIDs);
+	private:
+		struct ClusterResult {
+			uint32 VisibleMask; // bit i for instance i of an intersected cluster
+			uint32 Count;
+			uint32 WriteOffset;
+			bool IsInner;
+		};
+		TArray<ClusterResult> m_Results;
+	};
+}
@@ -2,38 +2,97 @@
 #include "RHI/Public/RHI.h"
 #include "Core/Public/TArray.h"
 #include "Core/Public/TUniquePtr.h"
+#include "Core/Public/FrameAllocator.h"
 #include "Render/Public/RenderGraphNode.h"
+#include "Render/Public/RenderGraphResourcePool.h"
+#include "Render/Public/RenderGraphSchedule.h"
 
 namespace Render {
 
 	struct RenderGraphView;
 
+	// Indices of the first and the last step using the resource in the execute order.
+	struct RGResourceLifetime {
+		uint32 FirstUse{ INVALID_INDEX };
+		uint32 LastUse{ INVALID_INDEX };
+	};
+
+	// A transition of a resource node before a step, the texture sub resource is RG_DEFAULT_SUB_RES or registered to the node.
+	struct RGTransition {
+		RGNodeID Resource;
+		uint8 SubResIndex;
+		EResourceState StateBefore;
+		EResourceState StateAfter;
+		EBarrierSplit Split;
+	};
+
 	// A render graph without resource manager.
 	class RenderGraph {
 	public:
 		static bool ParrallelNodes;
 		NON_COPYABLE(RenderGraph);
 		NON_MOVEABLE(RenderGraph);
-		RenderGraph(RenderGraphView* view=nullptr);
+		RenderGraph(RenderGraphView* view=nullptr, RGTransientTexturePool* transientPool=nullptr);
 		RGRenderNode* CreateRenderNode(XString&& name);
 		RGTransferNode* CreateTransferNode(XString&& name);
 		RGComputeNode* CreateComputeNode(XString&& name);
 		RGBufferNode* CreateBufferNode(RHIBuffer* buffer, XString&& name);
 		RGTextureNode* CreateTextureNode(RHITexture* texture, XString&& name);
 		RGTextureNode* CopyTextureNode(RGTextureNode* textureNode, XString&& name);
+		// The texture is taken from the transient pool when the graph runs, shared with transient textures of disjoint lifetimes.
+		RGTextureNode* CreateTransientTextureNode(const RHITextureDesc& desc, XString&& name);
 		RGOutputNode* CreateOutputNode(RGTextureNode* prevNode, XString&& name);
 		RGPresentNode* CreatePresentNode(RGTextureNode* prevNode, XString&& name);
+		// Builds the pass adjacency, culls passes not reaching any output, orders the passes and outputs, computes resource lifetimes,
+		// schedules the passes on their preferred queues and computes the barriers of each step. Nodes must not be created or connected after compiling. Needs no RHI.
+		void Compile();
+		// Compiles the graph if it is not compiled.
 		void Run(ICmdAllocator* cmdAlloc);
+		bool IsCompiled() const { return m_IsCompiled; }
+		// Passes and outputs in the order of running.
+		TConstArrayView<RGNodeID> GetExecuteOrder() const { return m_ExecuteOrder; }
+		bool IsNodeCulled(RGNodeID nodeID) const { return m_NodesCulled[nodeID]; }
+		const RGResourceLifetime& GetResourceLifetime(RGNodeID nodeID) const { return m_Lifetimes[nodeID]; }
+		TConstArrayView<RGNodeID> GetPrevPassNodes(RGNodeID nodeID) const;// the last pass nodes before the node
+		const RGTransientPlacement& GetTransientPlacement() const { return m_TransientPlacement; }
+		// Transitions issued as one barrier before the step. A split transition begins at a step after the last use of the resource and ends at the step using it,
+		// both in one command buffer. Nodes sharing a texture or a transient slot are tracked separately and never split across each other's uses.
+		TConstArrayView<RGTransition> GetStepBarriers(uint32 step) const { return m_StepBarriers[step]; }
+		// Pass i of the schedule is the node GetScheduledPasses()[i]. The schedule is a plan only, passes run on the graphics queue in the execute order:
+		// running them on other queues needs queue ownership transfers of the resources and states valid on those queues.
+		const RGQueueSchedule& GetQueueSchedule() const { return m_QueueSchedule; }
+		TConstArrayView<RGNodeID> GetScheduledPasses() const { return m_ScheduledPasses; }
 	private:
 		TArray<TUniquePtr<RGNode>> m_Nodes;
-		TArray<bool> m_NodesSolved;
 		TArray<RGNodeID> m_Outputs;
 		RGNodeID m_PresentNodeID;
 		RenderGraphView* m_View;
-		TArray<RGNodeID> GetPrevPassNodes(RGNode* node);// the last pass node before the node
+		RGTransientTexturePool* m_TransientPool;
+		TArray<RGNodeID> m_TransientNodes;
+		// compiled
+		TArray<uint32> m_PrevPassOffsets; // prev pass ids of node i are in [m_PrevPassOffsets[i], m_PrevPassOffsets[i+1])
+		TArray<RGNodeID> m_PrevPassIDs;
+		TArray<RGNodeID> m_ExecuteOrder;
+		TArray<RGNodeID> m_SubmitNodes; // a pass is submitted with the fence of the node running it first
+		TArray<bool> m_NodesCulled;
+		TArray<RGResourceLifetime> m_Lifetimes;
+		TArray<RGNodeID> m_PlacedNodes; // transient nodes not culled, in the order of placed resources
+		RGTransientPlacement m_TransientPlacement;
+		TArray<RGNodeID> m_ScheduledPasses; // passes in the execute order
+		RGQueueSchedule m_QueueSchedule;
+		TArray<TArray<RGTransition>> m_StepBarriers;
+		bool m_IsCompiled;
+		void PlaceTransientResources();
+		void BuildQueueSchedule();
+		void BuildBarriers();
+		void AcquireTransientResources();
+		void CompileNode(RGNodeID nodeID);
 		RHIFence* GetNodeFence(RGNode* node);
-		void RecursivelyRunPrevNodes(RGNode* node, ICmdAllocator* cmdAlloc);
-		void RecursivelyRunPrevNodesParallel(RGNode* node, ICmdAllocator* cmdAlloc);
+		// commands are submitted before a pass with a fence and after the barriers of an output with a fence or presenting
+		bool IsSubmitNode(RGNode* node);
+		// split transitions are issued whole at their ends if bSplit is false
+		void RecordBarriers(RHICommandBuffer* cmd, uint32 step, bool bSplit);
+		void RecordView();
 	};
 
 	struct RenderGraphView {
@@ -41,9 +100,23 @@ namespace Render {
 			ERGNodeType Type;
 			XString Name;
 			TArray<RGNodeID> PrevNodes;
+			bool IsCulled;
+			RGResourceLifetime Lifetime; // valid for resource nodes
+			EQueueType Queue; // queue planned for scheduled passes, all passes run on graphics
+			uint32 Batch;
 		};
 		TArray<RGNodeID> OutputIDs;
+		TArray<RGNodeID> ExecuteOrder;
 		TArray<Node> Nodes;
+		uint64 TransientNaiveSize;
+		uint64 TransientAllocatedSize;
+		uint64 TransientPeakSize;
+		uint32 NumQueueBatches;
+		uint32 NumSyncPoints;
+		uint64 SerialTime;
+		uint64 ScheduledTime;
+		uint32 NumTransitions;
+		uint32 NumSplitTransitions;
 		uint32 UpdateFrame;
 	};
 }
\ No newline at end of file
@@ -17,7 +17,32 @@ namespace Render {
 	};
 	typedef uint32 RGNodeID;
 	constexpr RGNodeID RG_INVALID_NODE = UINT32_MAX;
+	constexpr uint8 RG_DEFAULT_SUB_RES = UINT8_MAX; // the sub resource index of a whole texture or a buffer
 
+	// A resource used by a pass in the state the pass needs.
+	struct RGResourceUse {
+		RGNodeID Resource;
+		uint8 SubResIndex;
+		EResourceState State;
+	};
+
+	// Transitions of a pass boundary, issued as one barrier.
+	class RGBarrierBatch {
+	public:
+		RGBarrierBatch() = default;
+		~RGBarrierBatch() = default;
+		// a transition of a subresource already in the batch is merged into it, split transitions are not merged
+		void AddTexture(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subRes, EBarrierSplit split=EBarrierSplit::None);
+		void AddBuffer(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter, EBarrierSplit split=EBarrierSplit::None);
+		// issues the batch and clears it
+		void Submit(RHICommandBuffer* cmd);
+		bool IsEmpty() const { return m_Textures.IsEmpty() && m_Buffers.IsEmpty(); }
+		const TArray<RHITextureTransition>& GetTextureTransitions() const { return m_Textures; }
+		const TArray<RHIBufferTransition>& GetBufferTransitions() const { return m_Buffers; }
+	private:
+		TArray<RHITextureTransition> m_Textures;
+		TArray<RHIBufferTransition> m_Buffers;
+	};
 
 	class ICmdAllocator {
 	public:
@@ -31,6 +56,7 @@ namespace Render {
 		RGNode(RGNodeID nodeID) : m_NodeID(nodeID), m_RefCount(0) {}
 		virtual ~RGNode() = default;
 		void SetName(XString&& name) { m_Name = MoveTemp(name);  }
+		RGNodeID GetNodeID() const { return m_NodeID; }
 	protected:
 		friend RenderGraph;
 		RGNodeID m_NodeID;
@@ -45,15 +71,26 @@ namespace Render {
 #pragma region PassNode
 	class RGPassNode: public RGNode {
 	public:
-		RGPassNode(RGNodeID nodeID) : RGNode(nodeID), m_Fence(nullptr), m_EnableParallel(false){}
+		RGPassNode(RGNodeID nodeID) : RGNode(nodeID), m_Fence(nullptr), m_EnableParallel(false), m_PreferredQueue(EQueueType::Graphics), m_EstimatedCost(0) {}
 		void InsertFenceBefore(RHIFence* fence) { m_Fence = fence; }
 		void EnableParallel() { m_EnableParallel = true; }
+		// The queue the graph schedules the pass on if the pass supports it.
+		void SetPreferredQueue(EQueueType queue) { m_PreferredQueue = queue; }
+		// Estimated GPU time used by the queue schedule, in pixels or threads processed. Render and copy passes default to the pixels they touch.
+		void SetEstimatedCost(uint32 cost) { m_EstimatedCost = cost; }
 	protected:
 		friend RenderGraph;
 		RHIFence* m_Fence;
 		bool m_EnableParallel;
+		EQueueType m_PreferredQueue;
+		uint32 m_EstimatedCost;
+		TArray<RGResourceUse> m_Uses; // the graph transitions the resources before the pass runs
 		ERGNodeType GetNodeType() const override { return ERGNodeType::Pass; }
-		virtual EQueueType GetQueue() const = 0;
+		void AddUse(RGResourceNode* node, uint8 subResIdx, EResourceState state);
+		// Queues the schedule may plan the pass on, passes are recorded on the graphics queue.
+		virtual bool SupportQueue(EQueueType queue) const = 0;
+		// cost used when none is set
+		virtual uint32 GetDefaultCost() const { return 1; }
 		virtual void Run(RHICommandBuffer* cmd) = 0;
 	};
 
@@ -76,7 +113,6 @@ namespace Render {
 		const Rect& GetRenderArea() const { return m_RenderArea; }
 		void SetTask(RenderTask&& f) { m_Task = MoveTemp(f); }
 	private:
-		TArray<RGTextureNode*> m_SRVs;
 		struct TargetInfo {
 			RGTextureNode* Node{ nullptr };
 			RHITextureSubRes SubRes{};
@@ -87,7 +123,8 @@ namespace Render {
 		TStaticArray<TargetInfo, RHI_COLOR_TARGET_MAX> m_ColorTargets;
 		Rect m_RenderArea;
 		RenderTask m_Task;
-		EQueueType GetQueue() const override { return EQueueType::Graphics; }
+		bool SupportQueue(EQueueType queue) const override { return EQueueType::Graphics == queue; }
+		uint32 GetDefaultCost() const override { return m_RenderArea.w * m_RenderArea.h; }
 		void Run(RHICommandBuffer* cmd) override;
 	};
 
@@ -104,16 +141,8 @@ namespace Render {
 		void WriteUAV(RGBufferNode* node);
 		void SetTask(ComputeTask&& f) { m_Task = MoveTemp(f); }
 	private:
-		struct TextureResInfo {
-			RGTextureNode* Node;
-			uint8 SubResIndex;
-		};
-		TArray<TextureResInfo> m_SRVs;
-		TArray<TextureResInfo> m_UAVs;
-		TArray<RGBufferNode*> m_SRVBuffers;
-		TArray<RGBufferNode*> m_UAVBuffers;
 		ComputeTask m_Task;
-		EQueueType GetQueue() const override { return EQueueType::Graphics; }  // TODO Compute queue is preferred, but transition state must in graphics queue
+		bool SupportQueue(EQueueType queue) const override { return EQueueType::Transfer != queue; }
 		void Run(RHICommandBuffer* cmd) override;
 	};
 
@@ -132,7 +161,8 @@ namespace Render {
 			uint8 DstSubResIndex;
 		};
 		TArray<CpyResourcePair> m_Cpy;
-		EQueueType GetQueue() const override { return EQueueType::Graphics; } // TODO Transfer queue is preferred, but transition state must in graphics queue
+		bool SupportQueue(EQueueType queue) const override { return true; }
+		uint32 GetDefaultCost() const override;
 		void Run(RHICommandBuffer* cmd) override;
 	};
 
@@ -166,6 +196,7 @@ namespace Render {
 	class RGResourceNode : public RGNode{
 	public:
 		RGResourceNode(RGNodeID nodeID) : RGNode(nodeID){}
+		virtual bool IsTexture() const = 0;
 	private:
 		ERGNodeType GetNodeType() const override { return ERGNodeType::Resource; }
 	};
@@ -173,13 +204,13 @@ namespace Render {
 	class RGBufferNode : public RGResourceNode {
 	public:
 		RGBufferNode(RGNodeID nodeID, RHIBuffer* buffer) : RGResourceNode(nodeID), m_Buffer(buffer) {}
+		bool IsTexture() const override { return false; }
 		void SetTargetState(EResourceState state);
-		void TransitionToState(RHICommandBuffer* cmd, EResourceState state);
 		EResourceState GetTargetState() const;
 	private:
+		friend RenderGraph;
 		RHIBuffer* m_Buffer;
-		EResourceState m_CurrentState{ EResourceState::Unknown };
-		EResourceState m_TargetState{ EResourceState::Unknown }; // the state at next pass input
+		EResourceState m_TargetState{ EResourceState::Unknown }; // the state after the last pass using the buffer
 	};
 
 	class RGTextureNode : public RGResourceNode {
@@ -187,27 +218,23 @@ namespace Render {
 		RGTextureNode(RGNodeID nodeID, const RHITextureDesc& desc) : RGResourceNode(nodeID), m_Desc(desc), m_RHI(nullptr) {}
 		explicit RGTextureNode(uint32 nodeID, RHITexture* texture) : RGResourceNode(nodeID), m_Desc(texture->GetDesc()), m_RHI(texture) {}
 		explicit RGTextureNode(uint32 nodeID, const RGTextureNode* rhs) : RGResourceNode(nodeID), m_Desc(rhs->m_Desc), m_RHI(rhs->m_RHI) {}
+		bool IsTexture() const override { return true; }
 		const RHITextureDesc& GetDesc() const { return m_Desc; }
 		RHITexture* GetRHI();
 		void SetTargetState(EResourceState targetState);
 		void SetSubResTargetState(uint8 subResIdx, EResourceState targetState);
 		uint8 RegisterSubRes(RHITextureSubRes subRes); // register sub resource for connected node, return the index of m_SubResStates
-		void TransitionSubResToState(RHICommandBuffer* cmd, EResourceState dstState, uint8 subResIdx);
-		void TransitionSubResToTargetState(RHICommandBuffer* cmd, uint8 subResIdx);
-		void TransitionToState(RHICommandBuffer* cmd, EResourceState dstState);
-		void TransitionToTargetState(RHICommandBuffer* cmd);
+		RHITextureSubRes GetSubRes(uint8 subResIdx) const;
 	protected:
-		static constexpr uint8 DEFAULT_SUB_RES = UINT8_MAX;
+		friend RenderGraph;
 		RHITextureDesc m_Desc;
 		RHITexture* m_RHI;
 		struct SubResState {
 			RHITextureSubRes SubRes{};
-			EResourceState CurrentState{EResourceState::Unknown};
 			EResourceState TargetState{ EResourceState::Unknown };
 		};
 		TArray<SubResState> m_SubResStates;
-		EResourceState m_CurrentState{ EResourceState::Unknown };
-		EResourceState m_TargetState{ EResourceState::Unknown }; // the state at next pass input
+		EResourceState m_TargetState{ EResourceState::Unknown }; // the state after the last pass using the texture
 	};
 #pragma endregion
 }
\ No newline at end of file
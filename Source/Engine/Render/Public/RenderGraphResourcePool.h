@@ -0,0 +1,71 @@
+#pragma once
+#include "RHI/Public/RHI.h"
+#include "Core/Public/TArray.h"
+#include "Core/Public/TArrayView.h"
+#include "Core/Public/Container.h"
+
+namespace Render {
+
+	// A transient resource used from the step FirstUse to the step LastUse of the graph.
+	struct RGTransientResource {
+		uint32 Key; // resources with the same key are compatible to share memory
+		uint64 Size;
+		uint32 FirstUse;
+		uint32 LastUse;
+	};
+
+	// Places transient resources with the same key and disjoint lifetimes into the same slot.
+	// Interval graph coloring: resources are placed by first use into any free slot, so the slots of a key equal its max overlap.
+	class RGTransientPlacement {
+	public:
+		struct Slot {
+			uint32 Key;
+			uint64 Size;
+			uint32 LastUse;
+		};
+		RGTransientPlacement() = default;
+		~RGTransientPlacement() = default;
+		void Place(TConstArrayView<RGTransientResource> resources);
+		uint32 GetResourceSlot(uint32 resourceIndex) const { return m_ResourceSlots[resourceIndex]; }
+		const TArray<Slot>& GetSlots() const { return m_Slots; }
+		// Memory if each resource had its own allocation.
+		uint64 GetNaiveSize() const { return m_NaiveSize; }
+		// Memory of all slots.
+		uint64 GetAllocatedSize() const { return m_AllocatedSize; }
+		// Max memory of resources alive in the same step, the lower bound of any placement.
+		uint64 GetPeakSize() const { return m_PeakSize; }
+	private:
+		TArray<uint32> m_ResourceSlots;
+		TArray<Slot> m_Slots;
+		uint64 m_NaiveSize{ 0 };
+		uint64 m_AllocatedSize{ 0 };
+		uint64 m_PeakSize{ 0 };
+	};
+
+	// Textures of transient render graph nodes, reused across frames by description.
+	class RGTransientTexturePool {
+	public:
+		// Textures not acquired for more frames are released, must be more than the frames in flight.
+		static constexpr uint32 MAX_IDLE_FRAMES = RHI_FRAME_IN_FLIGHT_MAX + 2;
+		static uint64 GetTextureByteSize(const RHITextureDesc& desc);
+		static bool IsSameDesc(const RHITextureDesc& lhs, const RHITextureDesc& rhs);
+		NON_COPYABLE(RGTransientTexturePool);
+		RGTransientTexturePool() = default;
+		~RGTransientTexturePool() = default;
+		// Returns a texture not acquired in this frame, created if there is none.
+		RHITexture* Acquire(const RHITextureDesc& desc);
+		// Called after the graph of a frame runs, releases idle textures.
+		void Tick();
+		uint32 GetNumTextures() const { return m_NumTextures; }
+		uint64 GetByteSize() const { return m_ByteSize; }
+	private:
+		struct Entry {
+			RHITexturePtr Texture;
+			uint32 IdleFrames;
+			bool Acquired;
+		};
+		TMap<uint32, TArray<Entry>> m_Entries; // by hash of the description
+		uint32 m_NumTextures{ 0 };
+		uint64 m_ByteSize{ 0 };
+	};
+}
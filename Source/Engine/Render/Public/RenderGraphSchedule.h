@@ -0,0 +1,57 @@
+#pragma once
+#include "RHI/Public/RHIEnum.h"
+#include "Core/Public/TArray.h"
+#include "Core/Public/TArrayView.h"
+
+namespace Render {
+
+	// A pass to schedule, its dependencies are deps[DepOffset, DepOffset + DepCount) and must be passes before it.
+	struct RGSchedulePass {
+		EQueueType Queue;
+		uint32 Cost; // estimated GPU time in any unit
+		uint32 DepOffset;
+		uint32 DepCount;
+	};
+
+	// Partitions passes into per queue submission batches with cross queue sync points.
+	// Passes are picked by list scheduling: the ready pass able to start first on its queue, then the one with the longest path to the end,
+	// so compute work runs beside graphics work it does not depend on. Batches are simulated on a timeline of the estimated costs.
+	class RGQueueSchedule {
+	public:
+		static constexpr uint32 NUM_QUEUES = EnumCast(EQueueType::Count);
+		struct Batch {
+			EQueueType Queue;
+			uint32 PassOffset; // passes of the batch are GetOrder()[PassOffset, PassOffset + PassCount)
+			uint32 PassCount;
+			TStaticArray<uint32, NUM_QUEUES> Waits; // batch of each queue to wait for before the batch starts, INVALID_INDEX if none
+			uint64 Start;
+			uint64 End;
+		};
+		RGQueueSchedule() = default;
+		~RGQueueSchedule() = default;
+		void Build(TConstArrayView<RGSchedulePass> passes, TConstArrayView<uint32> deps);
+		// Passes in the order of submission, batches are in the order of submission and a batch waits only for batches before it.
+		TConstArrayView<uint32> GetOrder() const { return m_Order; }
+		const TArray<Batch>& GetBatches() const { return m_Batches; }
+		uint32 GetPassBatch(uint32 passIndex) const { return m_PassBatches[passIndex]; }
+		uint64 GetPassStart(uint32 passIndex) const { return m_PassStarts[passIndex]; }
+		uint64 GetPassEnd(uint32 passIndex) const { return m_PassEnds[passIndex]; }
+		uint32 GetNumSyncPoints() const { return m_NumSyncPoints; }
+		// Time of all passes on one queue.
+		uint64 GetSerialTime() const { return m_SerialTime; }
+		// Time of the simulated timeline, a batch starts when its queue is free and the batches it waits for end.
+		uint64 GetScheduledTime() const { return m_ScheduledTime; }
+	private:
+		TArray<uint32> m_Order;
+		TArray<Batch> m_Batches;
+		TArray<uint32> m_PassBatches;
+		TArray<uint64> m_PassStarts;
+		TArray<uint64> m_PassEnds;
+		uint32 m_NumSyncPoints{ 0 };
+		uint64 m_SerialTime{ 0 };
+		uint64 m_ScheduledTime{ 0 };
+		void PickPasses(TConstArrayView<RGSchedulePass> passes, TConstArrayView<uint32> deps, TArray<uint32>& picks);
+		void BuildBatches(TConstArrayView<RGSchedulePass> passes, TConstArrayView<uint32> deps, TConstArrayView<uint32> picks);
+		void Simulate(TConstArrayView<RGSchedulePass> passes);
+	};
+}
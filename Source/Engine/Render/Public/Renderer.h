@@ -52,6 +52,7 @@ namespace Render {
 		TStaticArray<RHIFencePtr, RHI_FRAME_IN_FLIGHT_MAX> m_Fences;
 		USize2D m_CacheWindowSize;
 		TUniquePtr<ISceneRenderer> m_SceneRenderer;
+		RGTransientTexturePool m_TransientTexturePool;
 		RenderGraphView m_RGView;
 		bool m_SizeDirty;
 		bool m_RGViewDirty;
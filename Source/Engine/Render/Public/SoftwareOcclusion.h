@@ -0,0 +1,74 @@
+#pragma once
+#include "Core/Public/TArray.h"
+#include "Core/Public/Concurrency.h"
+#include "Math/Public/Geometry.h"
+#include "Math/Public/Matrix.h"
+
+namespace Render {
+	// Triangles drawn into the software depth buffer, usually a simplified version of a big mesh.
+	struct OccluderMesh {
+		TArray<Math::FVector3> Vertices;
+		TArray<uint32> Indices;
+	};
+
+	// CPU counterpart of the HZB occlusion test, does not need the RHI.
+	// Occluders are rasterized into a small depth buffer on workers, AABBs are tested against the furthest depth pyramid of it.
+	class SoftwareOcclusion {
+	public:
+		SoftwareOcclusion(uint32 width = 256, uint32 height = 128);
+		~SoftwareOcclusion() = default;
+		NON_COPYABLE(SoftwareOcclusion);
+		void Resize(uint32 width, uint32 height);
+		// Remove the occluders and the depth of the last frame.
+		void Reset();
+		// Thread safe, the mesh must be alive until Rasterize returns.
+		void AddOccluder(const OccluderMesh* mesh, const Math::FMatrix4x4& worldMatrix);
+		// Rasterize occluders with the view project matrix of the camera, then build the depth pyramid.
+		void Rasterize(const Math::FMatrix4x4& viewProjectMatrix);
+		// If there is nothing rasterized, all AABBs are visible.
+		bool HasDepth() const;
+		// Returns false if the AABB is hidden behind the occluders, thread safe after Rasterize.
+		bool TestAABB(const Math::AABB3& aabb) const;
+		uint32 GetWidth() const { return m_Width; }
+		uint32 GetHeight() const { return m_Height; }
+		// Row major depth of the full resolution, 1.0 is the far plane.
+		const float* GetDepth() const { return m_DepthPyramid.Data(); }
+		const Math::FMatrix4x4& GetViewProjectMatrix() const { return m_ViewProjectMatrix; }
+
+	private:
+		struct Occluder {
+			const OccluderMesh* Mesh;
+			Math::FMatrix4x4 WorldMatrix;
+		};
+		struct ScreenTriangle {
+			float X[3];
+			float Y[3];
+			float Z[3];
+			float MinX, MinY, MaxX, MaxY;
+		};
+		struct PyramidLevel {
+			uint32 Offset;
+			uint32 Width;
+			uint32 Height;
+		};
+		uint32 m_Width;
+		uint32 m_Height;
+		uint32 m_NumTilesX;
+		uint32 m_NumTilesY;
+		Math::FMatrix4x4 m_ViewProjectMatrix;
+		TArray<Occluder> m_Occluders;
+		Mutex m_OccluderMutex;
+		TArray<ScreenTriangle> m_Triangles;
+		TArray<uint32> m_OccluderTriangleStarts; // triangles of occluder i start at m_OccluderTriangleStarts[i]
+		TArray<uint32> m_OccluderTriangleCounts;
+		TArray<TArray<uint32>> m_TileBins;       // triangles overlapping each tile
+		TArray<float> m_DepthPyramid;            // level 0 is the rasterized depth
+		TArray<PyramidLevel> m_Levels;
+		bool m_HasDepth;
+
+		void SetupTriangles(uint32 occluderIndex);
+		void BinTriangles();
+		void RasterizeTile(uint32 tileIndex);
+		void BuildPyramid();
+	};
+}
@@ -0,0 +1,91 @@
+#include "System/Public/TaskFuture.h"
+#include "Core/Public/Log.h"
+
+namespace Engine {
+	static constexpr uint32 GAME_THREAD_INDEX = 0;
+
+	TaskStateBase::TaskStateBase(ETaskType InLane, ETaskPriority InPriority, uint32 NumPrerequisites) :
+	RefCount(0), NumPrerequisitesRest(NumPrerequisites + 1), CompletionCounter(1), bCompleted(false), Lane(InLane), Priority(InPriority) {
+		bPersistent = true; // Released by ref count.
+	}
+
+	TaskStateBase::~TaskStateBase() {
+	}
+
+	void TaskStateBase::Execute(uint32 ThreadIndex) {
+		Run();
+		LockContinuations();
+		bCompleted = true;
+		TArray<TaskStateBase*> CompletedContinuations;
+		CompletedContinuations.Swap(Continuations);
+		UnlockContinuations();
+		CompletionCounter.Done();
+		for(TaskStateBase* Continuation: CompletedContinuations) {
+			Continuation->OnPrerequisiteCompleted();
+			Continuation->Release();
+		}
+		// Reference held by the scheduler.
+		Release();
+	}
+
+	void TaskStateBase::AddRef() {
+		RefCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void TaskStateBase::Release() {
+		if(1 == RefCount.fetch_sub(1, std::memory_order_acq_rel)) {
+			delete this;
+		}
+	}
+
+	bool TaskStateBase::IsCompleted() const {
+		return CompletionCounter.IsComplete();
+	}
+
+	void TaskStateBase::Wait() {
+		// The awaited task may depend on game thread tasks, the game thread pumps them while waiting.
+		CompletionCounter.Wait(EWaitSite::Future, true, CurrentThreadIndex() == GAME_THREAD_INDEX);
+	}
+
+	void TaskStateBase::Start() {
+		OnPrerequisiteCompleted();
+	}
+
+	void TaskStateBase::AddContinuation(TaskStateBase* Continuation) {
+		LockContinuations();
+		if(!bCompleted) {
+			Continuation->AddRef();
+			Continuations.PushBack(Continuation);
+			UnlockContinuations();
+			return;
+		}
+		UnlockContinuations();
+		Continuation->OnPrerequisiteCompleted();
+	}
+
+	void TaskStateBase::OnPrerequisiteCompleted() {
+		if(1 == NumPrerequisitesRest.fetch_sub(1, std::memory_order_acq_rel)) {
+			Schedule();
+		}
+	}
+
+	void TaskStateBase::Schedule() {
+		AddRef();
+		if(Lane == INLINE_TASK_LANE) {
+			Execute(CurrentThreadIndex());
+		}
+		else {
+			XXThreadPool::Instance()->EnqueueTaskRef(Lane, this, Priority);
+		}
+	}
+
+	void TaskStateBase::LockContinuations() {
+		while(ContinuationLock.test_and_set(std::memory_order_acquire)) {
+			std::this_thread::yield();
+		}
+	}
+
+	void TaskStateBase::UnlockContinuations() {
+		ContinuationLock.clear(std::memory_order_release);
+	}
+}
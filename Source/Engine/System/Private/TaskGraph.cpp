@@ -1,10 +1,11 @@
 #include "System/Public/TaskGraph.h"
 #include "System/Public/ThreadPool.h"
 #include "Core/Public/TQueue.h"
-#include <concurrentqueue.h>
+#include "Core/Public/Log.h"
 
 namespace Engine {
-	TaskNode::TaskNode() : IndexInGraph(UINT32_MAX), NumEnters(0){
+	TaskNode::TaskNode() : OwnerGraph(nullptr), IndexInGraph(INVALID_NODE), NumEnters(0), NumEntersRest(0), bArenaAllocated(false) {
+		bPersistent = true;
 	}
 
 	void TaskNode::SetName(XStringView InName) {
@@ -14,25 +15,41 @@ namespace Engine {
 	TaskNode::~TaskNode(){
 	}
 
-	TaskGraph::TaskGraph() {
+	void TaskNode::Execute(uint32 ThreadIndex) {
+		ExecuteTask();
+		OwnerGraph->OnNodeCompleted(this);
+	}
+
+	TaskGraph::TaskGraph() : NumPendingTasks(0), bCompiled(false), bDispatched(false) {
 	}
 
 	TaskGraph::~TaskGraph() {
+		CHECK(!bDispatched || IsComplete());
+		Reset();
 	}
 
 	void TaskGraph::AddNode(TUniquePtr<TaskNode>&& InNode) {
+		RegisterNode(InNode.Get());
+		ExternalNodes.PushBack(MoveTemp(InNode));
+	}
+
+	void TaskGraph::RegisterNode(TaskNode* Node) {
+		CHECK(!bDispatched || IsComplete());
 		const uint32 NodeIndex = TaskNodes.Size();
-		TaskNodes.PushBack(MoveTemp(InNode));
-		TaskNodes.Back()->IndexInGraph = (TaskNodeIndex)NodeIndex;
-		NumPendingTasks.fetch_add(1, std::memory_order_release);
+		CHECK(NodeIndex < TaskNode::INVALID_NODE);
+		Node->IndexInGraph = (TaskNodeIndex)NodeIndex;
+		Node->OwnerGraph = this;
+		TaskNodes.PushBack(Node);
+		bCompiled = false;
 	}
 
 	void TaskGraph::Connect(TaskNode* Left, TaskNode* Right) {
-		CHECK(TaskNodes[Left->IndexInGraph].Get() == Left);
-		CHECK(TaskNodes[Right->IndexInGraph].Get() == Right);
+		CHECK(TaskNodes[Left->IndexInGraph] == Left);
+		CHECK(TaskNodes[Right->IndexInGraph] == Right);
 		CHECK(Left != Right);
 		Left->Exits.Add(Right->IndexInGraph);
 		++Right->NumEnters;
+		bCompiled = false;
 	}
 
 	bool TaskGraph::CheckCircle() const {
@@ -43,7 +60,7 @@ namespace Engine {
 		}
 		TArray<bool> NodeVisited(NumNodes); // Whether node visited.
 		TArray<uint32> NodeEnters(NumNodes); // Num enter nodes of per node.
-		TRingQueue<TaskNodeIndex> ZeroDegreeNodes(NumNodes); // Nodes without any entries.
+		TRingQueue<TaskNodeIndex> ZeroDegreeNodes(NumNodes + 1); // Nodes without any entries.
 		for (TaskNodeIndex i = 0; i < NumNodes; ++i) {
 			const TaskNodeIndex InDegree = TaskNodes[i]->NumEnters;
 			NodeEnters[i] = InDegree;
@@ -67,35 +84,94 @@ namespace Engine {
 		return NumNodes != 0;
 	}
 
-	void TaskGraph::WaitUntilComplete() {
-		ASSERT(!CheckCircle(), "Task graph circle checked!");
+	void TaskGraph::Compile() {
+		// Kahn's algorithm, the visiting order is the execution order.
 		const uint32 NumNodes = TaskNodes.Size();
+		ExecutionOrder.Reset();
+		ExecutionOrder.Reserve(NumNodes);
+		RootNodes.Reset();
+		TArray<uint32> NodeEnters(NumNodes);
+		for (TaskNodeIndex i = 0; i < NumNodes; ++i) {
+			NodeEnters[i] = TaskNodes[i]->NumEnters;
+			if (0u == NodeEnters[i]) {
+				RootNodes.PushBack(i);
+				ExecutionOrder.PushBack(i);
+			}
+		}
+		for(uint32 i = 0; i < ExecutionOrder.Size(); ++i) {
+			for(const TaskNodeIndex Exit : TaskNodes[ExecutionOrder[i]]->Exits) {
+				if(--NodeEnters[Exit] == 0) {
+					ExecutionOrder.PushBack(Exit);
+				}
+			}
+		}
+		ASSERT(ExecutionOrder.Size() == NumNodes, "Task graph circle checked!");
+		bCompiled = true;
+	}
+
+	void TaskGraph::Dispatch() {
+		CHECK(!bDispatched || IsComplete());
+		if(!bCompiled) {
+			Compile();
+		}
+		const uint32 NumNodes = TaskNodes.Size();
+		bDispatched = true;
+		NumPendingTasks.Reset(NumNodes);
 		for(TaskNodeIndex i=0; i<NumNodes; ++i) {
 			TaskNodes[i]->NumEntersRest.store(TaskNodes[i]->NumEnters, std::memory_order_relaxed);
 		}
-		for(TaskNodeIndex i=0; i<NumNodes; ++i) {
-			if (0u == TaskNodes[i]->NumEnters) {
-				EnqueueNode(i);
+		std::atomic_thread_fence(std::memory_order_release);
+		// No worker threads, run in compiled order directly.
+		if(XXThreadPool::Instance()->GetNumThreads() <= 1) {
+			for(const TaskNodeIndex NodeIndex: ExecutionOrder) {
+				TaskNodes[NodeIndex]->ExecuteTask();
 			}
+			NumPendingTasks.Complete();
+			return;
+		}
+		for(const TaskNodeIndex NodeIndex: RootNodes) {
+			XXThreadPool::Instance()->EnqueueTaskRef(ETaskType::Worker, TaskNodes[NodeIndex]);
+		}
+	}
+
+	bool TaskGraph::IsComplete() const {
+		return NumPendingTasks.IsComplete();
+	}
+
+	void TaskGraph::WaitUntilComplete() {
+		if(!bDispatched) {
+			Dispatch();
 		}
 		// Run in current thread if possible.
-		while(NumPendingTasks.load(std::memory_order_acquire) != 0) {
-			Engine::XXThreadPool::Instance()->ExecutePendingTask(ETaskType::Worker);
+		NumPendingTasks.Wait(EWaitSite::TaskGraph, true);
+		bDispatched = false;
+	}
+
+	void TaskGraph::Reset() {
+		CHECK(!bDispatched || IsComplete());
+		for(TaskNode* Node: TaskNodes) {
+			if(Node->bArenaAllocated) {
+				Node->~TaskNode();
+			}
 		}
+		TaskNodes.Reset();
+		ExternalNodes.Reset();
+		ExecutionOrder.Reset();
+		RootNodes.Reset();
+		NodeArena.Reset();
+		bCompiled = false;
+		bDispatched = false;
 	}
 
-	void TaskGraph::EnqueueNode(TaskNodeIndex Index) {
-		EnqueueWorkerThreadTask([this, Index]() {
-			TaskNode* Node = TaskNodes[Index].Get();
-			Node->ExecuteTask();
-			NumPendingTasks.fetch_sub(1, std::memory_order_release);
-			for (const TaskNodeIndex ExitIndex : Node->Exits) {
-				TaskNode* ExitNode = TaskNodes[ExitIndex].Get();
-				const TaskNodeIndex NumPrevEnters = ExitNode->NumEntersRest.fetch_sub(1, std::memory_order_acq_rel);
-				if (1 == NumPrevEnters) {
-					EnqueueNode(ExitIndex);
-				}
+	void TaskGraph::OnNodeCompleted(TaskNode* Node) {
+		for (const TaskNodeIndex ExitIndex : Node->Exits) {
+			TaskNode* ExitNode = TaskNodes[ExitIndex];
+			const TaskNodeIndex NumPrevEnters = ExitNode->NumEntersRest.fetch_sub(1, std::memory_order_acq_rel);
+			if (1 == NumPrevEnters) {
+				XXThreadPool::Instance()->EnqueueTaskRef(ETaskType::Worker, ExitNode);
 			}
-		});
+		}
+		// Must be the last access, the graph may be reset once all nodes completed.
+		NumPendingTasks.Done();
 	}
 }
@@ -2,13 +2,21 @@
 #include "System/Public/ConfigManager.h"
 #include "Core/Public/Log.h"
 #include "Core/Public/EnumClass.h"
+#include "Core/Public/Concurrency.h"
+#include "System/Private/WorkStealingQueue.h"
 #include <concurrentqueue.h>
 #include <lightweightsemaphore.h>
+#include <condition_variable>
+#include <chrono>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #ifdef _WIN32
 #include <Windows.h>
 #include <processthreadsapi.h>
 #else
 #include <pthread.h>
+#include <sys/resource.h>
 #endif
 
 namespace Engine{
@@ -23,20 +31,300 @@ namespace Engine{
 #endif
 	}
 
-	static thread_local uint32 GThreadIndex;
-	TStaticArray<moodycamel::ConcurrentQueue<ThreadTaskPtr>, EnumCast(ETaskType::MaxNum)> GPendingTasks;
+	// Threads of background lane yield cpu to frame critical threads.
+	inline void SetCurrentThreadLowPriority() {
+#ifdef _WIN32
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif __linux__
+		setpriority(PRIO_PROCESS, 0, 10);
+#endif
+	}
+
+	static constexpr uint32 INVALID_THREAD_INDEX = UINT32_MAX;
+	static constexpr uint32 WORKER_IDLE_SPIN_COUNT = 64; // Rounds of failed stealing before parking a worker.
+	static constexpr uint32 GAME_THREAD_INDEX = 0;
+	static constexpr uint32 PARALLEL_FOR_CHUNKS_PER_THREAD = 4; // More chunks than threads to balance uneven bodies.
+	static constexpr uint32 PARALLEL_FOR_MAX_TASKS = 64;
+	static constexpr uint32 WAIT_SPIN_COUNT = 256;  // Busy spins before yielding.
+	static constexpr uint32 WAIT_YIELD_COUNT = 32;  // Yields before parking.
+	static constexpr std::chrono::microseconds WAIT_PARK_TIMEOUT{ 1000 }; // Parked waiters wake up periodically to help executing tasks.
+
+	static thread_local uint32 GThreadIndex{ INVALID_THREAD_INDEX };
+	static thread_local uint32 GStealSeed{ 0 };
+
+	typedef TWorkStealingQueue<ThreadTask*> WorkerTaskQueue;
+	static constexpr uint32 NUM_WORKER_QUEUE_PRIORITIES = EnumCast(ETaskPriority::Background); // Background priority uses a shared FIFO.
+	struct WorkerQueueSet {
+		WorkerTaskQueue Queues[NUM_WORKER_QUEUE_PRIORITIES];
+	};
+	// Lane with dedicated threads, tasks are executed in FIFO order.
+	struct DedicatedLane {
+		moodycamel::ConcurrentQueue<ThreadTask*> Tasks;
+		moodycamel::LightweightSemaphore Smp;
+		uint32 NumThreads{ 0 };
+	};
+
+	// Game thread tasks, only consumed in XXThreadPool::Tick.
+	moodycamel::ConcurrentQueue<ThreadTask*> GGameThreadTasks;
+	// Worker tasks enqueued from threads not owned by thread pool, per priority.
+	moodycamel::ConcurrentQueue<ThreadTask*> GInjectedWorkerTasks[NUM_WORKER_QUEUE_PRIORITIES];
+	// Background priority worker tasks, picked only when no other worker task found.
+	moodycamel::ConcurrentQueue<ThreadTask*> GBackgroundWorkerTasks;
+	// Deques per thread in pool, indexed by thread index, the game thread owns the first one.
+	TArray<TUniquePtr<WorkerQueueSet>> GWorkerQueues;
 	moodycamel::LightweightSemaphore GWorkerSmp;
-	TArray<std::thread> AllThreads; // All threads except main thread
-	std::atomic_bool bRunning;
+	std::atomic<int32> GNumParkedWorkers{ 0 };
+	DedicatedLane GRenderLane;
+	DedicatedLane GBackgroundLane;
+
+	// All blocking waiters park on this condition, completing is rare compared to spinning so sharing is fine.
+	Mutex GParkingMutex;
+	std::condition_variable GParkingCondition;
+
+	struct WaitStatsAtomic {
+		std::atomic<uint64> NumWaits{ 0 };
+		std::atomic<uint64> NumParks{ 0 };
+		std::atomic<uint64> SpinNanoseconds{ 0 };
+		std::atomic<uint64> SleepNanoseconds{ 0 };
+	};
+	WaitStatsAtomic GWaitStats[EnumCast(EWaitSite::MaxNum)];
+
+	inline DedicatedLane* GetDedicatedLane(ETaskType InType) {
+		if(InType == ETaskType::Render) {
+			return &GRenderLane;
+		}
+		if(InType == ETaskType::Background) {
+			return &GBackgroundLane;
+		}
+		return nullptr;
+	}
 
 	void SetCurrentThreadIndex(uint32 Index) {
 		GThreadIndex = Index;
+		GStealSeed = Index * 0x9E3779B9u + 1u;
 	}
 
 	uint32 CurrentThreadIndex() {
 		return GThreadIndex;
 	}
 
+	inline uint32 NextStealIndex() {
+		// reference https://en.wikipedia.org/wiki/Xorshift
+		uint32 State = GStealSeed;
+		State ^= State << 13;
+		State ^= State >> 17;
+		State ^= State << 5;
+		GStealSeed = State;
+		return State;
+	}
+
+	inline void ExecuteAndReleaseTask(ThreadTask* Task, uint32 ThreadIndex) {
+		// Persistent task may be destroyed by its owner as soon as Execute returns.
+		if(Task->IsPersistent()) {
+			Task->Execute(ThreadIndex);
+		}
+		else {
+			ThreadTaskPtr TaskPtr{ Task };
+			TaskPtr->Execute(ThreadIndex);
+		}
+	}
+
+	inline void ReleaseTask(ThreadTask* Task) {
+		if(!Task->IsPersistent()) {
+			delete Task;
+		}
+	}
+
+	// For each priority, pops local deque first for cache locality, then global queue, then steals from a random victim.
+	// bBackgroundTasks: also pick background priority tasks after all others.
+	ThreadTask* AcquireWorkerTask(uint32 ThreadIndex, bool bBackgroundTasks) {
+		ThreadTask* Task = nullptr;
+		const uint32 NumQueues = GWorkerQueues.Size();
+		const bool bPoolThread = ThreadIndex < NumQueues;
+		const uint32 StartIndex = NumQueues > 0 ? NextStealIndex() % NumQueues : 0;
+		for(uint32 Priority = 0; Priority < NUM_WORKER_QUEUE_PRIORITIES; ++Priority) {
+			if(bPoolThread && GWorkerQueues[ThreadIndex]->Queues[Priority].Pop(Task)) {
+				return Task;
+			}
+			if(GInjectedWorkerTasks[Priority].try_dequeue(Task)) {
+				return Task;
+			}
+			for(uint32 i = 0; i < NumQueues; ++i) {
+				const uint32 VictimIndex = (StartIndex + i) % NumQueues;
+				if(VictimIndex != ThreadIndex && GWorkerQueues[VictimIndex]->Queues[Priority].Steal(Task)) {
+					return Task;
+				}
+			}
+		}
+		if(bBackgroundTasks && GBackgroundWorkerTasks.try_dequeue(Task)) {
+			return Task;
+		}
+		return nullptr;
+	}
+
+	bool HasPendingWorkerTask(bool bBackgroundTasks) {
+		if(bBackgroundTasks && GBackgroundWorkerTasks.size_approx() > 0) {
+			return true;
+		}
+		for(uint32 Priority = 0; Priority < NUM_WORKER_QUEUE_PRIORITIES; ++Priority) {
+			if(GInjectedWorkerTasks[Priority].size_approx() > 0) {
+				return true;
+			}
+			for(const TUniquePtr<WorkerQueueSet>& QueueSet: GWorkerQueues) {
+				if(!QueueSet->Queues[Priority].IsEmpty()) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Claim one parked worker, return false if none is parked.
+	bool ClaimParkedWorker() {
+		int32 NumParked = GNumParkedWorkers.load(std::memory_order_relaxed);
+		while(NumParked > 0) {
+			if(GNumParkedWorkers.compare_exchange_weak(NumParked, NumParked - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Signal the semaphore only if some worker is parked, so busy workers cost nothing per task.
+	void WakeParkedWorker() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(ClaimParkedWorker()) {
+			GWorkerSmp.signal(1);
+		}
+	}
+
+	void ParkWorker() {
+		GNumParkedWorkers.fetch_add(1, std::memory_order_seq_cst);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		// Check again after registering, a task may be enqueued before producer saw the parked counter.
+		if(HasPendingWorkerTask(true) && ClaimParkedWorker()) {
+			return;
+		}
+		// Either no task, or a producer has claimed this worker and will signal.
+		GWorkerSmp.wait();
+	}
+
+	inline void CpuPause() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	TaskCounter::TaskCounter(uint32 InitialCount) : State(InitialCount) {
+	}
+
+	void TaskCounter::Reset(uint32 Count) {
+		CHECK((State.load(std::memory_order_relaxed) >> 32) == 0);
+		State.store(Count, std::memory_order_release);
+	}
+
+	void TaskCounter::Add(uint32 Count) {
+		State.fetch_add(Count, std::memory_order_relaxed);
+	}
+
+	bool TaskCounter::Done() {
+		const uint64 PrevState = State.fetch_sub(1, std::memory_order_acq_rel);
+		CHECK((PrevState & COUNT_MASK) != 0);
+		if((PrevState & COUNT_MASK) == 1) {
+			OnCompleted(PrevState);
+			return true;
+		}
+		return false;
+	}
+
+	void TaskCounter::Complete() {
+		const uint64 PrevState = State.fetch_and(~COUNT_MASK, std::memory_order_acq_rel);
+		if((PrevState & COUNT_MASK) != 0) {
+			OnCompleted(PrevState);
+		}
+	}
+
+	bool TaskCounter::IsComplete() const {
+		return (State.load(std::memory_order_acquire) & COUNT_MASK) == 0;
+	}
+
+	void TaskCounter::OnCompleted(uint64 PrevState) {
+		// Only touch global objects here, parked waiters were registered before the decrement.
+		if(PrevState >= PARKED_ONE) {
+			MutexLock Lock(GParkingMutex);
+			GParkingCondition.notify_all();
+		}
+	}
+
+	void TaskCounter::Wait(EWaitSite Site, bool bExecuteTasks, bool bExecuteGameThreadTasks) {
+		CHECK(!bExecuteGameThreadTasks || CurrentThreadIndex() == GAME_THREAD_INDEX);
+		if(IsComplete()) {
+			return;
+		}
+		typedef std::chrono::steady_clock Clock;
+		const Clock::time_point StartTime = Clock::now();
+		uint64 SleepNanoseconds = 0;
+		uint64 NumParks = 0;
+		uint32 NumIdleRounds = 0;
+		while(!IsComplete()) {
+			if(bExecuteGameThreadTasks && XXThreadPool::Instance()->ExecutePendingTask(ETaskType::GameThread)) {
+				NumIdleRounds = 0;
+				continue;
+			}
+			// Waiters only help frame critical tasks, a background task may run far longer than the wait.
+			if(bExecuteTasks && XXThreadPool::Instance()->ExecutePendingTask(ETaskType::Worker, false)) {
+				NumIdleRounds = 0;
+				continue;
+			}
+			++NumIdleRounds;
+			if(NumIdleRounds < WAIT_SPIN_COUNT) {
+				CpuPause();
+				continue;
+			}
+			if(NumIdleRounds < WAIT_SPIN_COUNT + WAIT_YIELD_COUNT) {
+				std::this_thread::yield();
+				continue;
+			}
+			// Never sleep while there are tasks this thread could run, they may be what we are waiting for.
+			if((bExecuteTasks && HasPendingWorkerTask(false)) || (bExecuteGameThreadTasks && GGameThreadTasks.size_approx() > 0)) {
+				NumIdleRounds = 0;
+				continue;
+			}
+			const Clock::time_point ParkTime = Clock::now();
+			{
+				std::unique_lock<Mutex> Lock(GParkingMutex);
+				// Register as parked only if not completed yet, counter can't be released while registered.
+				uint64 CurState = State.load(std::memory_order_acquire);
+				bool bRegistered = false;
+				while((CurState & COUNT_MASK) != 0) {
+					if(State.compare_exchange_weak(CurState, CurState + PARKED_ONE, std::memory_order_acq_rel, std::memory_order_acquire)) {
+						bRegistered = true;
+						break;
+					}
+				}
+				if(bRegistered) {
+					if(bExecuteTasks || bExecuteGameThreadTasks) {
+						GParkingCondition.wait_for(Lock, WAIT_PARK_TIMEOUT, [this]() { return IsComplete(); });
+					}
+					else {
+						GParkingCondition.wait(Lock, [this]() { return IsComplete(); });
+					}
+					State.fetch_sub(PARKED_ONE, std::memory_order_acq_rel);
+					++NumParks;
+				}
+			}
+			SleepNanoseconds += (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - ParkTime).count();
+			NumIdleRounds = 0;
+		}
+		const uint64 TotalNanoseconds = (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - StartTime).count();
+		WaitStatsAtomic& Stats = GWaitStats[EnumCast(Site)];
+		Stats.NumWaits.fetch_add(1, std::memory_order_relaxed);
+		Stats.NumParks.fetch_add(NumParks, std::memory_order_relaxed);
+		Stats.SpinNanoseconds.fetch_add(TotalNanoseconds - NUM_MIN(SleepNanoseconds, TotalNanoseconds), std::memory_order_relaxed);
+		Stats.SleepNanoseconds.fetch_add(SleepNanoseconds, std::memory_order_relaxed);
+	}
 
 	ThreadFence::ThreadFence() {
 		Reset();
@@ -46,21 +334,19 @@ namespace Engine{
 	}
 
 	void ThreadFence::Reset() {
-		StatusFlag.store(false, std::memory_order_release);
+		Counter.Reset(1);
 	}
 
 	void ThreadFence::Signal() {
-		StatusFlag.store(true, std::memory_order_release);
+		Counter.Complete();
 	}
 
 	void ThreadFence::Wait() {
-		while(!IsSignaled()) {
-			// Wait();
-		}
+		Counter.Wait(EWaitSite::ThreadFence, false);
 	}
 
 	bool ThreadFence::IsSignaled() const {
-		return StatusFlag.load(std::memory_order_acquire);
+		return Counter.IsComplete();
 	}
 
 	XXThreadPool::XXThreadPool() {
@@ -69,73 +355,269 @@ namespace Engine{
 		if (NumThreadsHardware == 0) {
 			LOG_WARNING("std::thread::hardware_concurrency returns 0!");
 		}
-		const uint32 NumThreadsConfig = ConfigMgr::Instance().GetEngineConfig().NumSubThreads;
-		const uint32 NumThreads = NUM_MIN(NumThreadsConfig, NumThreadsHardware - 1);
+		const XXEngineConfig& EngineConfig = ConfigMgr::Instance().GetEngineConfig();
+		const uint32 NumThreadsConfig = EngineConfig.NumSubThreads;
+		NumWorkerThreads = NUM_MIN(NumThreadsConfig, NumThreadsHardware - 1);
+		GRenderLane.NumThreads = EngineConfig.NumRenderThreads;
+		GBackgroundLane.NumThreads = EngineConfig.NumBackgroundThreads;
+
+		// Create task queues for game thread and workers before launching.
+		GWorkerQueues.Reserve(NumWorkerThreads + 1);
+		for(uint32 i = 0; i < NumWorkerThreads + 1; ++i) {
+			GWorkerQueues.PushBack(TUniquePtr<WorkerQueueSet>(new WorkerQueueSet()));
+		}
 
 		// Launch threads
 		bRunning.store(true, std::memory_order_release);
 		// Setup game thread
 		SetCurrentThreadName("GameThread");
-		SetCurrentThreadIndex(0);
+		SetCurrentThreadIndex(GAME_THREAD_INDEX);
+		AllThreads.Reserve(NumWorkerThreads + GRenderLane.NumThreads + GBackgroundLane.NumThreads);
 		// Launch worker thread
-		if(NumThreads > 0) {
-			AllThreads.Reserve(NumThreads);
-			for (uint32 i = 0; i < NumThreads; ++i) {
-				const uint32 WorkerIndex = i;
-				AllThreads.Add(std::thread{ [this, WorkerIndex]() {
-					const XString ThreadName = StringFormat("Worker%u", WorkerIndex);
-					SetCurrentThreadName(ThreadName);
-					SetCurrentThreadIndex(WorkerIndex + 1);
-					WorkerThreadLoop();
-				} });
-			}
+		for (uint32 i = 0; i < NumWorkerThreads; ++i) {
+			const uint32 WorkerIndex = i;
+			AllThreads.Add(std::thread{ [this, WorkerIndex]() {
+				const XString ThreadName = StringFormat("Worker%u", WorkerIndex);
+				SetCurrentThreadName(ThreadName);
+				SetCurrentThreadIndex(WorkerIndex + 1);
+				WorkerThreadLoop();
+			} });
+		}
+		// Launch lane threads, thread index is after workers.
+		for (uint32 i = 0; i < GRenderLane.NumThreads; ++i) {
+			const uint32 ThreadIndex = AllThreads.Size() + 1;
+			AllThreads.Add(std::thread{ [this, i, ThreadIndex]() {
+				SetCurrentThreadName(StringFormat("RenderThread%u", i));
+				SetCurrentThreadIndex(ThreadIndex);
+				LaneThreadLoop(ETaskType::Render);
+			} });
+		}
+		for (uint32 i = 0; i < GBackgroundLane.NumThreads; ++i) {
+			const uint32 ThreadIndex = AllThreads.Size() + 1;
+			AllThreads.Add(std::thread{ [this, i, ThreadIndex]() {
+				SetCurrentThreadName(StringFormat("Background%u", i));
+				SetCurrentThreadIndex(ThreadIndex);
+				SetCurrentThreadLowPriority();
+				LaneThreadLoop(ETaskType::Background);
+			} });
 		}
 	}
 
 	XXThreadPool::~XXThreadPool() {
 		bRunning.store(false, std::memory_order_release);
-		//GWorkerFence.Signal();
-		GWorkerSmp.signal(AllThreads.Size());
+		GWorkerSmp.signal(NumWorkerThreads);
+		GRenderLane.Smp.signal(GRenderLane.NumThreads);
+		GBackgroundLane.Smp.signal(GBackgroundLane.NumThreads);
 		for(uint32 i=0; i<AllThreads.Size(); ++i) {
 			AllThreads[i].join();
 		}
+		// Release tasks never executed.
+		ThreadTask* Task;
+		while(GGameThreadTasks.try_dequeue(Task)) {
+			ReleaseTask(Task);
+		}
+		for(uint32 Priority = 0; Priority < NUM_WORKER_QUEUE_PRIORITIES; ++Priority) {
+			while(GInjectedWorkerTasks[Priority].try_dequeue(Task)) {
+				ReleaseTask(Task);
+			}
+			for(TUniquePtr<WorkerQueueSet>& QueueSet: GWorkerQueues) {
+				while(QueueSet->Queues[Priority].Steal(Task)) {
+					ReleaseTask(Task);
+				}
+			}
+		}
+		while(GBackgroundWorkerTasks.try_dequeue(Task)) {
+			ReleaseTask(Task);
+		}
+		for(DedicatedLane* Lane: {&GRenderLane, &GBackgroundLane}) {
+			while(Lane->Tasks.try_dequeue(Task)) {
+				ReleaseTask(Task);
+			}
+			Lane->NumThreads = 0;
+		}
+		GWorkerQueues.Reset();
+		GNumParkedWorkers.store(0, std::memory_order_relaxed);
 	}
 
 	void XXThreadPool::Tick() {
 		// Handle game thread tasks
 		{
-			constexpr uint32 GameThreadIndex = 0;
-			ThreadTaskPtr Task;
-			while (GPendingTasks[EnumCast(ETaskType::GameThread)].try_dequeue(Task)) {
-				Task->Execute(GameThreadIndex);
+			ThreadTask* Task;
+			while (GGameThreadTasks.try_dequeue(Task)) {
+				ExecuteAndReleaseTask(Task, GAME_THREAD_INDEX);
 			}
 		}
 	}
 
-	void XXThreadPool::EnqueueTaskPtr(ETaskType InType, ThreadTaskPtr&& InTask) {
-		GPendingTasks[EnumCast(InType)].enqueue(ForwardTemp(InTask));
-		if(InType == ETaskType::Worker) {
-			GWorkerSmp.signal(1);
+	void XXThreadPool::EnqueueTaskPtr(ETaskType InType, ThreadTaskPtr&& InTask, ETaskPriority InPriority) {
+		CHECK(!InTask->IsPersistent());
+		EnqueueTaskRef(InType, InTask.Release(), InPriority);
+	}
+
+	void XXThreadPool::EnqueueTaskRef(ETaskType InType, ThreadTask* Task, ETaskPriority InPriority) {
+		InType = ResolveTaskType(InType, InPriority);
+		if(InType == ETaskType::GameThread) {
+			GGameThreadTasks.enqueue(Task);
+			return;
+		}
+		if(DedicatedLane* Lane = GetDedicatedLane(InType)) {
+			Lane->Tasks.enqueue(Task);
+			Lane->Smp.signal(1);
+			return;
+		}
+		// Without worker threads only waiters run worker tasks, and they never pick background ones.
+		if(InPriority == ETaskPriority::Background && NumWorkerThreads > 0) {
+			GBackgroundWorkerTasks.enqueue(Task);
+		}
+		else {
+			const uint32 PriorityIndex = NUM_MIN(EnumCast(InPriority), NUM_WORKER_QUEUE_PRIORITIES - 1);
+			const uint32 ThreadIndex = CurrentThreadIndex();
+			if(ThreadIndex < GWorkerQueues.Size()) {
+				GWorkerQueues[ThreadIndex]->Queues[PriorityIndex].Push(Task);
+			}
+			else {
+				GInjectedWorkerTasks[PriorityIndex].enqueue(Task);
+			}
 		}
+		WakeParkedWorker();
 	}
 
 	uint32 XXThreadPool::GetNumThreads() const {
-		return AllThreads.Size() + 1;
+		return NumWorkerThreads + 1;
 	}
 
-	bool XXThreadPool::ExecutePendingTask(ETaskType InType) {
-		ThreadTaskPtr Task;
-		if (GPendingTasks[EnumCast(InType)].try_dequeue(Task)) {
-			Task->Execute(CurrentThreadIndex());
+	uint32 XXThreadPool::GetNumLaneThreads(ETaskType InType) const {
+		if(const DedicatedLane* Lane = GetDedicatedLane(InType)) {
+			return Lane->NumThreads;
+		}
+		if(InType == ETaskType::Worker) {
+			return NumWorkerThreads;
+		}
+		return 1;
+	}
+
+	bool XXThreadPool::ExecutePendingTask(ETaskType InType, bool bBackgroundTasks) {
+		const uint32 ThreadIndex = CurrentThreadIndex();
+		InType = ResolveTaskType(InType, ETaskPriority::Normal);
+		ThreadTask* Task = nullptr;
+		if(InType == ETaskType::GameThread) {
+			GGameThreadTasks.try_dequeue(Task);
+		}
+		else if(DedicatedLane* Lane = GetDedicatedLane(InType)) {
+			Lane->Tasks.try_dequeue(Task);
+		}
+		else {
+			Task = AcquireWorkerTask(ThreadIndex, bBackgroundTasks);
+		}
+		if(Task) {
+			ExecuteAndReleaseTask(Task, ThreadIndex);
 			return true;
 		}
 		return false;
 	}
 
+	WaitStats XXThreadPool::GetWaitStats(EWaitSite Site) const {
+		const WaitStatsAtomic& Stats = GWaitStats[EnumCast(Site)];
+		WaitStats Result;
+		Result.NumWaits = Stats.NumWaits.load(std::memory_order_relaxed);
+		Result.NumParks = Stats.NumParks.load(std::memory_order_relaxed);
+		Result.SpinNanoseconds = Stats.SpinNanoseconds.load(std::memory_order_relaxed);
+		Result.SleepNanoseconds = Stats.SleepNanoseconds.load(std::memory_order_relaxed);
+		return Result;
+	}
+
+	void XXThreadPool::ResetWaitStats() {
+		for(WaitStatsAtomic& Stats: GWaitStats) {
+			Stats.NumWaits.store(0, std::memory_order_relaxed);
+			Stats.NumParks.store(0, std::memory_order_relaxed);
+			Stats.SpinNanoseconds.store(0, std::memory_order_relaxed);
+			Stats.SleepNanoseconds.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	ETaskType XXThreadPool::ResolveTaskType(ETaskType InType, ETaskPriority InPriority) const {
+		// Lanes without threads fall back: render lane to game thread, background lane to workers.
+		if(InType == ETaskType::Render && 0 == GRenderLane.NumThreads) {
+			return ETaskType::GameThread;
+		}
+		if(InType == ETaskType::Background && 0 == GBackgroundLane.NumThreads) {
+			return ETaskType::Worker;
+		}
+		return InType;
+	}
+
 	void XXThreadPool::WorkerThreadLoop() {
+		uint32 NumIdleSpins = 0;
 		while (bRunning.load(std::memory_order_relaxed)) {
-			GWorkerSmp.wait();
-			ExecutePendingTask(ETaskType::Worker);
+			if(ExecutePendingTask(ETaskType::Worker)) {
+				NumIdleSpins = 0;
+				continue;
+			}
+			if(++NumIdleSpins < WORKER_IDLE_SPIN_COUNT) {
+				std::this_thread::yield();
+				continue;
+			}
+			NumIdleSpins = 0;
+			ParkWorker();
+		}
+	}
+
+	void XXThreadPool::LaneThreadLoop(ETaskType InType) {
+		DedicatedLane* Lane = GetDedicatedLane(InType);
+		while (bRunning.load(std::memory_order_relaxed)) {
+			// One signal per task.
+			Lane->Smp.wait();
+			ExecutePendingTask(InType);
+		}
+	}
+
+	void ParallelForContext::RunChunks() {
+		for(;;) {
+			const uint32 ChunkIndex = NextChunk.fetch_add(1, std::memory_order_relaxed);
+			if(ChunkIndex >= NumChunks) {
+				break;
+			}
+			const uint32 RangeBegin = Begin + ChunkIndex * ChunkSize;
+			const uint32 RangeEnd = NUM_MIN(RangeBegin + ChunkSize, End);
+			Invoke(Body, RangeBegin, RangeEnd);
+		}
+	}
+
+	class ParallelForTask: public ThreadTask {
+	public:
+		ParallelForTask() { bPersistent = true; }
+		virtual void Execute(uint32 ThreadIndex) override {
+			Context->RunChunks();
+			// Must be the last access, the context and this task are released by the caller then.
+			Context->NumPendingTasks.Done();
+		}
+		ParallelForContext* Context{ nullptr };
+	};
+
+	void ParallelForImpl(ParallelForContext& Context, uint32 GrainSize) {
+		const uint32 Count = Context.End - Context.Begin;
+		const uint32 NumThreads = XXThreadPool::Instance()->GetNumThreads();
+		const uint32 MaxChunks = NumThreads * PARALLEL_FOR_CHUNKS_PER_THREAD;
+		const uint32 MinChunkSize = (Count + MaxChunks - 1) / MaxChunks;
+		Context.ChunkSize = NUM_MAX(NUM_MAX(GrainSize, MinChunkSize), 1u);
+		Context.NumChunks = (Count + Context.ChunkSize - 1) / Context.ChunkSize;
+		Context.NextChunk.store(0, std::memory_order_relaxed);
+
+		// Helpers pull chunks dynamically, the caller is also a helper.
+		uint32 NumTasks = NUM_MIN(NumThreads - 1, Context.NumChunks - 1);
+		NumTasks = NUM_MIN(NumTasks, PARALLEL_FOR_MAX_TASKS);
+		if(0 == NumTasks) {
+			Context.Invoke(Context.Body, Context.Begin, Context.End);
+			return;
+		}
+		ParallelForTask Tasks[PARALLEL_FOR_MAX_TASKS];
+		Context.NumPendingTasks.Reset(NumTasks);
+		for(uint32 i = 0; i < NumTasks; ++i) {
+			Tasks[i].Context = &Context;
+			XXThreadPool::Instance()->EnqueueTaskRef(ETaskType::Worker, &Tasks[i]);
 		}
+		Context.RunChunks();
+		// Wait all helpers leaving, tasks not stolen yet are popped back and finish immediately.
+		Context.NumPendingTasks.Wait(EWaitSite::ParallelFor, true);
 	}
 }
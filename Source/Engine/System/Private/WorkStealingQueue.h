@@ -0,0 +1,121 @@
+#pragma once
+#include "Core/Public/Defines.h"
+#include "Core/Public/TArray.h"
+#include "Core/Public/Log.h"
+#include <atomic>
+
+namespace Engine {
+
+	// Chase-Lev work stealing deque, reference https://fzn.fr/readings/ppopp13.pdf
+	// Only the owner thread can Push/Pop (LIFO at bottom), any thread can Steal (FIFO at top).
+	// T must be trivially copyable, usually a pointer.
+	template<class T>
+	class TWorkStealingQueue {
+	public:
+		NON_COPYABLE(TWorkStealingQueue);
+		NON_MOVEABLE(TWorkStealingQueue);
+
+		explicit TWorkStealingQueue(int64 InitialCapacity = 256) : Top(0), Bottom(0) {
+			Buffer.store(new RingBuffer(InitialCapacity), std::memory_order_relaxed);
+		}
+
+		~TWorkStealingQueue() {
+			delete Buffer.load(std::memory_order_relaxed);
+			for(RingBuffer* Retired: RetiredBuffers) {
+				delete Retired;
+			}
+		}
+
+		// Owner thread only.
+		void Push(T Item) {
+			const int64 B = Bottom.load(std::memory_order_relaxed);
+			const int64 TopVal = Top.load(std::memory_order_acquire);
+			RingBuffer* Ring = Buffer.load(std::memory_order_relaxed);
+			if(B - TopVal > Ring->Capacity - 1) {
+				// Old buffer may still be read by thieves, retire it instead of deleting.
+				RetiredBuffers.PushBack(Ring);
+				Ring = Ring->Grow(B, TopVal);
+				Buffer.store(Ring, std::memory_order_release);
+			}
+			Ring->Put(B, Item);
+			std::atomic_thread_fence(std::memory_order_release);
+			Bottom.store(B + 1, std::memory_order_relaxed);
+		}
+
+		// Owner thread only, pops the latest pushed item.
+		bool Pop(T& OutItem) {
+			const int64 B = Bottom.load(std::memory_order_relaxed) - 1;
+			RingBuffer* Ring = Buffer.load(std::memory_order_relaxed);
+			Bottom.store(B, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64 TopVal = Top.load(std::memory_order_relaxed);
+			if(TopVal > B) {
+				// Empty
+				Bottom.store(B + 1, std::memory_order_relaxed);
+				return false;
+			}
+			OutItem = Ring->Get(B);
+			if(TopVal == B) {
+				// Last item, race against thieves.
+				const bool bWon = Top.compare_exchange_strong(TopVal, TopVal + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+				Bottom.store(B + 1, std::memory_order_relaxed);
+				return bWon;
+			}
+			return true;
+		}
+
+		// Any thread, takes the oldest item.
+		bool Steal(T& OutItem) {
+			int64 TopVal = Top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const int64 B = Bottom.load(std::memory_order_acquire);
+			if(TopVal >= B) {
+				return false;
+			}
+			RingBuffer* Ring = Buffer.load(std::memory_order_acquire);
+			T Item = Ring->Get(TopVal);
+			if(!Top.compare_exchange_strong(TopVal, TopVal + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+				return false;
+			}
+			OutItem = Item;
+			return true;
+		}
+
+		// Approximate, may be stale when called from other threads.
+		bool IsEmpty() const {
+			return Bottom.load(std::memory_order_relaxed) <= Top.load(std::memory_order_relaxed);
+		}
+
+	private:
+		struct RingBuffer {
+			int64 Capacity;
+			int64 Mask;
+			std::atomic<T>* Items;
+			explicit RingBuffer(int64 InCapacity) : Capacity(InCapacity), Mask(InCapacity - 1) {
+				CHECK((InCapacity & (InCapacity - 1)) == 0);
+				Items = new std::atomic<T>[InCapacity];
+			}
+			~RingBuffer() {
+				delete[] Items;
+			}
+			T Get(int64 Index) const {
+				return Items[Index & Mask].load(std::memory_order_relaxed);
+			}
+			void Put(int64 Index, T Item) {
+				Items[Index & Mask].store(Item, std::memory_order_relaxed);
+			}
+			RingBuffer* Grow(int64 B, int64 TopVal) const {
+				RingBuffer* NewRing = new RingBuffer(Capacity * 2);
+				for(int64 i = TopVal; i < B; ++i) {
+					NewRing->Put(i, Get(i));
+				}
+				return NewRing;
+			}
+		};
+
+		alignas(64) std::atomic<int64> Top;
+		alignas(64) std::atomic<int64> Bottom;
+		std::atomic<RingBuffer*> Buffer;
+		TArray<RingBuffer*> RetiredBuffers; // Owner thread only
+	};
+}
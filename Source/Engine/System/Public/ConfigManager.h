@@ -9,12 +9,20 @@ namespace Engine{
 		D3D12,
 	};
 
+	// How InstanceDataMgr splits instances into clusters.
+	enum class EClusterTreeBuild : uint8 {
+		MedianSplit, // split at the median of the longest axis
+		BinnedSAH,   // split at the binned surface area heuristic minimum, tighter clusters
+	};
+
 	struct XXEngineConfig {
 		CONFIG_PROPERTY_BEING(XXEngineConfig)
 		CONFIG_PROPERTY_STRING(Engine, DefaultFont, );
 		CONFIG_PROPERTY_STRING(Engine, ProjectPath, );
 		CONFIG_PROPERTY_BOOL(Engine, EnablePipelineCache, true);
 		CONFIG_PROPERTY_UINT(Engine, NumSubThreads, 0);
+		CONFIG_PROPERTY_UINT(Engine, NumRenderThreads, 0);
+		CONFIG_PROPERTY_UINT(Engine, NumBackgroundThreads, 1);
 		CONFIG_PROPERTY_END(XXEngineConfig)
 	};
 
@@ -31,6 +39,12 @@ namespace Engine{
 		CONFIG_PROPERTY_BOOL(Rendering, EnableRenderDoc, false);
 		CONFIG_PROPERTY_BOOL(Rendering, UseIntegratedGPU, false);
 		CONFIG_PROPERTY_BOOL(Rendering, EnableGPUDriven, false);
+		CONFIG_PROPERTY_BOOL(Rendering, GPUDrivenCullingOnCPU, false);
+		CONFIG_PROPERTY_UINT(Rendering, InstanceCullingCaptureFrame, 0u);
+		CONFIG_PROPERTY_ENUM(Rendering, EClusterTreeBuild, ClusterTreeBuild, EClusterTreeBuild::BinnedSAH);
+		CONFIG_PROPERTY_BOOL(Rendering, EnableSoftwareOcclusion, true);
+		CONFIG_PROPERTY_UINT(Rendering, SoftwareOcclusionWidth, 256u);
+		CONFIG_PROPERTY_UINT(Rendering, SoftwareOcclusionHeight, 128u);
     	CONFIG_PROPERTY_END(XXProjectConfig)
     };
 
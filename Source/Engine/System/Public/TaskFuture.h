@@ -0,0 +1,291 @@
+#pragma once
+#include "Core/Public/Defines.h"
+#include "Core/Public/TArray.h"
+#include "Core/Public/TArrayView.h"
+#include "System/Public/ThreadPool.h"
+#include <atomic>
+#include <optional>
+#include <type_traits>
+
+// co_await support of TFuture, enabled when compiling with c++20 coroutines.
+#ifndef XX_TASK_COROUTINE
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#define XX_TASK_COROUTINE 1
+#else
+#define XX_TASK_COROUTINE 0
+#endif
+#endif
+
+#if XX_TASK_COROUTINE
+#include <coroutine>
+#include <exception>
+#endif
+
+namespace Engine {
+
+	// Run a continuation in the thread completing its last prerequisite, for cheap joins.
+	static constexpr ETaskType INLINE_TASK_LANE = ETaskType::MaxNum;
+
+	// Ref counted shared state of an async task, it is also the task enqueued into thread pool.
+	class TaskStateBase: public ThreadTask {
+	public:
+		NON_COPYABLE(TaskStateBase);
+		NON_MOVEABLE(TaskStateBase);
+		TaskStateBase(ETaskType InLane, ETaskPriority InPriority, uint32 NumPrerequisites);
+		virtual ~TaskStateBase() override;
+		virtual void Execute(uint32 ThreadIndex) override final;
+		void AddRef();
+		void Release();
+		bool IsCompleted() const;
+		void Wait();
+		// Release the prerequisite held since construction, the task is scheduled once all prerequisites completed.
+		// Prerequisites are added before Start, so the task can't be scheduled in the middle of adding them.
+		void Start();
+		// Continuation must count this task as one of its prerequisites.
+		void AddContinuation(TaskStateBase* Continuation);
+	protected:
+		virtual void Run() = 0;
+	private:
+		TArray<TaskStateBase*> Continuations; // Protected by ContinuationLock
+		std::atomic<uint32> RefCount;
+		std::atomic<uint32> NumPrerequisitesRest;
+		std::atomic_flag ContinuationLock = ATOMIC_FLAG_INIT;
+		TaskCounter CompletionCounter;
+		bool bCompleted; // Protected by ContinuationLock
+		ETaskType Lane;
+		ETaskPriority Priority;
+		void OnPrerequisiteCompleted();
+		void Schedule();
+		void LockContinuations();
+		void UnlockContinuations();
+	};
+
+	template<class T>
+	class TTaskResult: public TaskStateBase {
+	public:
+		using TaskStateBase::TaskStateBase;
+		const T& GetResult() const { return *Result; }
+	protected:
+		std::optional<T> Result;
+	};
+
+	template<>
+	class TTaskResult<void>: public TaskStateBase {
+	public:
+		using TaskStateBase::TaskStateBase;
+	};
+
+	template<class T, class Func>
+	class TTaskState: public TTaskResult<T> {
+	public:
+		template<class InFuncType>
+		TTaskState(ETaskType InLane, ETaskPriority InPriority, uint32 NumPrerequisites, InFuncType&& InBody) :
+			TTaskResult<T>(InLane, InPriority, NumPrerequisites), Body(ForwardTemp(InBody)) {}
+	protected:
+		virtual void Run() override {
+			if constexpr (std::is_void_v<T>) {
+				Body();
+			}
+			else {
+				this->Result.emplace(Body());
+			}
+		}
+	private:
+		Func Body;
+	};
+
+	// Handle of an async task, supports continuations and blocking-free joins.
+	template<class T>
+	class TFuture {
+	public:
+		typedef T ValueType;
+		TFuture() : State(nullptr) {}
+		explicit TFuture(TTaskResult<T>* InState) : State(InState) {
+			if(State) {
+				State->AddRef();
+			}
+		}
+		TFuture(const TFuture& rhs) : State(rhs.State) {
+			if(State) {
+				State->AddRef();
+			}
+		}
+		TFuture(TFuture&& rhs) noexcept : State(rhs.State) {
+			rhs.State = nullptr;
+		}
+		~TFuture() {
+			Reset();
+		}
+		TFuture& operator=(const TFuture& rhs) {
+			if(this != &rhs) {
+				Reset();
+				State = rhs.State;
+				if(State) {
+					State->AddRef();
+				}
+			}
+			return *this;
+		}
+		TFuture& operator=(TFuture&& rhs) noexcept {
+			if(this != &rhs) {
+				Reset();
+				State = rhs.State;
+				rhs.State = nullptr;
+			}
+			return *this;
+		}
+
+		bool IsValid() const { return nullptr != State; }
+		bool IsReady() const { return State && State->IsCompleted(); }
+		void Wait() const {
+			if(State) {
+				State->Wait();
+			}
+		}
+
+		// Wait and get the result.
+		template<class U = T>
+		std::enable_if_t<!std::is_void_v<U>, const U&> Get() const {
+			Wait();
+			return State->GetResult();
+		}
+
+		// Run Body on Lane after this task completed, Body receives the result by const reference if it accepts it.
+		template<class Func>
+		auto Then(ETaskType InLane, Func&& Body, ETaskPriority InPriority = ETaskPriority::Normal) const;
+
+		template<class Func>
+		auto Then(Func&& Body) const {
+			return Then(ETaskType::Worker, ForwardTemp(Body));
+		}
+
+		TaskStateBase* GetState() const { return State; }
+
+		void Reset() {
+			if(State) {
+				State->Release();
+				State = nullptr;
+			}
+		}
+
+	private:
+		TTaskResult<T>* State;
+	};
+
+	template<class Func>
+	using TTaskFuncResult = std::invoke_result_t<std::decay_t<Func>&>;
+
+	// Create a task running Body on Lane.
+	template<class Func>
+	TFuture<TTaskFuncResult<Func>> LaunchTask(ETaskType InLane, Func&& Body, ETaskPriority InPriority = ETaskPriority::Normal) {
+		typedef TTaskFuncResult<Func> ResultType;
+		TTaskState<ResultType, std::decay_t<Func>>* State = new TTaskState<ResultType, std::decay_t<Func>>(InLane, InPriority, 0, ForwardTemp(Body));
+		TFuture<ResultType> Future{ State };
+		State->Start();
+		return Future;
+	}
+
+	template<class T>
+	template<class Func>
+	auto TFuture<T>::Then(ETaskType InLane, Func&& Body, ETaskPriority InPriority) const {
+		CHECK(State);
+		typedef std::decay_t<Func> BodyType;
+		auto Wrapper = [Prev = *this, InBody = BodyType(ForwardTemp(Body))]() mutable {
+			if constexpr (std::is_void_v<T>) {
+				return InBody();
+			}
+			else if constexpr (!std::is_invocable_v<BodyType&, const T&>) {
+				return InBody();
+			}
+			else {
+				return InBody(Prev.Get());
+			}
+		};
+		typedef decltype(Wrapper()) ResultType;
+		TTaskState<ResultType, decltype(Wrapper)>* Continuation = new TTaskState<ResultType, decltype(Wrapper)>(InLane, InPriority, 1, MoveTemp(Wrapper));
+		TFuture<ResultType> Future{ Continuation };
+		State->AddContinuation(Continuation);
+		Continuation->Start();
+		return Future;
+	}
+
+	// A future completed after all given futures completed.
+	template<class T>
+	TFuture<void> WhenAll(TConstArrayView<TFuture<T>> Futures) {
+		auto Body = []() {};
+		TTaskState<void, decltype(Body)>* State = new TTaskState<void, decltype(Body)>(INLINE_TASK_LANE, ETaskPriority::Normal, Futures.Size(), MoveTemp(Body));
+		TFuture<void> Result{ State };
+		for(const TFuture<T>& Future: Futures) {
+			Future.GetState()->AddContinuation(State);
+		}
+		State->Start();
+		return Result;
+	}
+
+	template<class ...Ts>
+	TFuture<void> WhenAll(const TFuture<Ts>&... Futures) {
+		auto Body = []() {};
+		TTaskState<void, decltype(Body)>* State = new TTaskState<void, decltype(Body)>(INLINE_TASK_LANE, ETaskPriority::Normal, (uint32)sizeof...(Ts), MoveTemp(Body));
+		TFuture<void> Result{ State };
+		(Futures.GetState()->AddContinuation(State), ...);
+		State->Start();
+		return Result;
+	}
+
+	template<class Func> TFuture<TTaskFuncResult<Func>> EnqueueWorkerThreadTask(Func&& InFunc, ETaskPriority InPriority = ETaskPriority::Normal) {
+		return LaunchTask(ETaskType::Worker, ForwardTemp(InFunc), InPriority);
+	}
+
+	template<class Func> TFuture<TTaskFuncResult<Func>> EnqueueGameThreadTask(Func&& InFunc) {
+		return LaunchTask(ETaskType::GameThread, ForwardTemp(InFunc));
+	}
+
+	template<class Func> TFuture<TTaskFuncResult<Func>> EnqueueRenderThreadTask(Func&& InFunc) {
+		return LaunchTask(ETaskType::Render, ForwardTemp(InFunc));
+	}
+
+	// For long running jobs such as file IO and decompression, never queued before frame critical tasks.
+	template<class Func> TFuture<TTaskFuncResult<Func>> EnqueueBackgroundTask(Func&& InFunc) {
+		return LaunchTask(ETaskType::Background, ForwardTemp(InFunc), ETaskPriority::Background);
+	}
+
+#if XX_TASK_COROUTINE
+	// co_await a future, the coroutine is resumed on ResumeLane after the future completed.
+	template<class T>
+	struct TFutureAwaiter {
+		TFuture<T> Future;
+		ETaskType ResumeLane;
+		bool await_ready() const { return Future.IsReady(); }
+		void await_suspend(std::coroutine_handle<> Handle) {
+			Future.Then(ResumeLane, [Handle]() { Handle.resume(); });
+		}
+		decltype(auto) await_resume() const {
+			if constexpr (!std::is_void_v<T>) {
+				return Future.Get();
+			}
+		}
+	};
+
+	template<class T>
+	TFutureAwaiter<T> operator co_await(const TFuture<T>& Future) {
+		return TFutureAwaiter<T>{ Future, ETaskType::Worker };
+	}
+
+	// co_await ResumeOn(Future, ETaskType::GameThread)
+	template<class T>
+	TFutureAwaiter<T> ResumeOn(const TFuture<T>& Future, ETaskType ResumeLane) {
+		return TFutureAwaiter<T>{ Future, ResumeLane };
+	}
+
+	// Return type of fire-and-forget coroutines.
+	struct TaskCoroutine {
+		struct promise_type {
+			TaskCoroutine get_return_object() { return {}; }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+#endif
+}
@@ -5,36 +5,48 @@
 #include "Core/Public/Func.h"
 #include "Core/Public/TUniquePtr.h"
 #include "Core/Public/String.h"
+#include "Core/Public/LinearAllocator.h"
+#include "System/Public/ThreadPool.h"
 #include <atomic>
 
 namespace Engine {
 
+	class TaskGraph;
+
 	typedef uint16 TaskNodeIndex;
-	class TaskNode{
+	// Task nodes are persistent thread tasks, a graph can be dispatched many times without allocation.
+	class TaskNode: public ThreadTask {
 	public:
 		TaskNode();
 		void SetName(XStringView InName);
+		const XString& GetName() const { return Name; }
 		virtual ~TaskNode();
 		virtual void ExecuteTask() = 0;
+		virtual void Execute(uint32 ThreadIndex) override;
 	private:
 		friend class TaskGraph;
 		static constexpr TaskNodeIndex INVALID_NODE = UINT16_MAX;
 		XString Name;
 		TArray<TaskNodeIndex> Exits; // Enters: [0, 1, ..., NumEnters-1, ], Exits: [NumEnters, NumEnters+1, ...]
+		TaskGraph* OwnerGraph;
 		TaskNodeIndex IndexInGraph;
 		TaskNodeIndex NumEnters;
 		std::atomic<TaskNodeIndex> NumEntersRest;
+		bool bArenaAllocated;
 	};
 
 	template<class Lambda>
 	class TaskNodeLambda: public TaskNode {
 	public:
-		TaskNodeLambda(Lambda&& InLambda): LambdaBody(MoveTemp(InLambda)){}
+		template<class InLambdaType>
+		TaskNodeLambda(InLambdaType&& InLambda): LambdaBody(ForwardTemp(InLambda)){}
 		virtual void ExecuteTask() override { LambdaBody(); }
 	private:
 		Lambda LambdaBody;
 	};
 
+	// Build once, Compile once, then Dispatch/WaitUntilComplete every frame.
+	// Nodes are allocated in a linear arena owned by the graph, state captured by nodes can change between dispatches.
 	class TaskGraph {
 	public:
 		NON_COPYABLE(TaskGraph);
@@ -51,23 +63,43 @@ namespace Engine {
 		void AddNode(TUniquePtr<TaskNode>&& InNode);
 		void Connect(TaskNode* Left, TaskNode* Right);
 		bool CheckCircle() const;
+		// Check circle, cache topological order and root nodes. Called automatically if the graph is changed.
+		void Compile();
+		bool IsCompiled() const { return bCompiled; }
+		// Topological order of the compiled graph.
+		TConstArrayView<TaskNodeIndex> GetExecutionOrder() const { return ExecutionOrder; }
+		uint32 GetNumNodes() const { return TaskNodes.Size(); }
+		// Start executing, the graph can be dispatched again after completion.
+		void Dispatch();
+		bool IsComplete() const;
+		// Wait for the dispatched work, dispatch first if not dispatched yet.
 		void WaitUntilComplete();
+		// Destroy all nodes, memory of the arena is kept for rebuilding.
+		void Reset();
 	private:
-		TArray<TUniquePtr<TaskNode>> TaskNodes;
-		std::atomic<TaskNodeIndex> NumPendingTasks;
-		void EnqueueNode(TaskNodeIndex Index);
+		friend class TaskNode;
+		TArray<TaskNode*> TaskNodes;
+		TArray<TUniquePtr<TaskNode>> ExternalNodes; // Nodes added by AddNode, not allocated in arena.
+		TArray<TaskNodeIndex> ExecutionOrder;
+		TArray<TaskNodeIndex> RootNodes;
+		LinearAllocator NodeArena;
+		TaskCounter NumPendingTasks;
+		bool bCompiled;
+		bool bDispatched;
+		void RegisterNode(TaskNode* Node);
+		void OnNodeCompleted(TaskNode* Node);
 	};
 
 	template <class T, class ... Args>
 	T* TaskGraph::CreateNode(XStringView TaskName, Args&&... InArgs) {
-		TUniquePtr<TaskNode> NodePtr{ new T(ForwardTemp(InArgs)...)};
-		TaskNode* Node = NodePtr.Get();
+		T* Node = NodeArena.New<T>(ForwardTemp(InArgs)...);
 		Node->SetName(TaskName);
-		AddNode(MoveTemp(NodePtr));
-		return (T*)Node;
+		Node->bArenaAllocated = true;
+		RegisterNode(Node);
+		return Node;
 	}
 
 	template <class Lambda> TaskNode* TaskGraph::CreateNodeLambda(XStringView TaskName, Lambda&& InLambda) {
-		return (TaskNode*)CreateNode<TaskNodeLambda<Lambda>>(TaskName, ForwardTemp(InLambda));
+		return (TaskNode*)CreateNode<TaskNodeLambda<std::decay_t<Lambda>>>(TaskName, ForwardTemp(InLambda));
 	}
 }
@@ -5,9 +5,11 @@
 #include "Core/Public/TUniquePtr.h"
 #include <thread>
 #include <atomic>
+#include <type_traits>
 
 namespace Engine{
 
+    // 0 for game thread, [1, NumThreads) for workers, UINT32_MAX for threads not owned by XXThreadPool.
     uint32 CurrentThreadIndex();
 
     // Runnable task for thread pool
@@ -16,18 +18,62 @@ namespace Engine{
         virtual ~ThreadTask() = default;
         virtual void Execute(uint32 ThreadIndex) {/* Do nothing */}
         virtual void Interrupt() { /* Do nothing */}
+        // Persistent tasks are not deleted by thread pool after execution, the owner manages their lifetime.
+        bool IsPersistent() const { return bPersistent; }
+    protected:
+        bool bPersistent{ false };
     };
 
     typedef TUniquePtr<ThreadTask> ThreadTaskPtr;
 
     template<class Func> class ThreadTaskFunc: public ThreadTask {
     public:
-        ThreadTaskFunc(Func&& InFunc) :FuncBody(MoveTemp(InFunc)) {}
+        template<class InFuncType>
+        ThreadTaskFunc(InFuncType&& InFunc) :FuncBody(ForwardTemp(InFunc)) {}
         virtual void Execute(uint32 ThreadIndex) override { FuncBody(); }
     private:
         Func FuncBody;
     };
 
+    // Sites of blocking waits, used for wait statistics.
+    enum class EWaitSite : uint8 {
+        ThreadFence,
+        TaskGraph,
+        ParallelFor,
+        Future,
+        MaxNum,
+    };
+
+    struct WaitStats {
+        uint64 NumWaits{ 0 };
+        uint64 NumParks{ 0 };       // Times waiters went to sleep
+        uint64 SpinNanoseconds{ 0 };  // Time of spinning, yielding and executing other tasks
+        uint64 SleepNanoseconds{ 0 }; // Time of sleeping
+    };
+
+    // Counter of pending works. Waiters help executing tasks, spin, yield and then park until it reaches zero.
+    class TaskCounter {
+    public:
+        NON_COPYABLE(TaskCounter);
+        explicit TaskCounter(uint32 InitialCount = 0);
+        void Reset(uint32 Count);
+        void Add(uint32 Count);
+        // Decrease by one, return true if the counter is completed by this call.
+        // The counter may be destroyed by a waiter right after this call, no member is accessed after the decrement.
+        bool Done();
+        // Set count to zero directly.
+        void Complete();
+        bool IsComplete() const;
+        // bExecuteTasks: run pending worker tasks in current thread while waiting.
+        // bExecuteGameThreadTasks: also run game thread tasks, only for waits on the game thread.
+        void Wait(EWaitSite Site, bool bExecuteTasks, bool bExecuteGameThreadTasks = false);
+    private:
+        static constexpr uint64 PARKED_ONE = 1ull << 32;
+        static constexpr uint64 COUNT_MASK = PARKED_ONE - 1;
+        std::atomic<uint64> State; // Low 32 bits: pending count, high 32 bits: num parked waiters.
+        void OnCompleted(uint64 PrevState);
+    };
+
     // Sync
     class ThreadFence {
     public:
@@ -38,48 +84,93 @@ namespace Engine{
         void Wait();
         bool IsSignaled() const;
     private:
-        std::atomic_bool StatusFlag;
+        TaskCounter Counter;
     };
 
     enum class ETaskType : uint8 {
-        GameThread,
-        Worker,
+        GameThread, // Executed in XXThreadPool::Tick
+        Worker,     // Executed by worker threads and threads waiting for worker tasks
+        Render,     // Render submission lane, falls back to GameThread if NumRenderThreads is 0
+        Background, // IO/decompression lane, falls back to Worker with background priority if NumBackgroundThreads is 0
+        MaxNum,
+    };
+
+    // Priority of worker tasks, background tasks are picked only when no other worker task is pending.
+    enum class ETaskPriority : uint8 {
+        High,
+        Normal,
+        Background,
         MaxNum,
     };
 
+    // Each pool thread owns a work stealing deque, worker tasks are popped LIFO by the owner and stolen FIFO by others.
+    // Idle workers park on a semaphore which is signaled only when a parked worker exists.
     class XXThreadPool {
         SINGLETON_INSTANCE(XXThreadPool);
         XXThreadPool();
         ~XXThreadPool();
     public:
         void Tick();
-        void EnqueueTaskPtr(ETaskType InType, ThreadTaskPtr&& InTask);
+        void EnqueueTaskPtr(ETaskType InType, ThreadTaskPtr&& InTask, ETaskPriority InPriority = ETaskPriority::Normal);
+        // Enqueue a persistent task without transferring ownership, the task must outlive its execution.
+        void EnqueueTaskRef(ETaskType InType, ThreadTask* InTask, ETaskPriority InPriority = ETaskPriority::Normal);
+        // Num of threads executing worker tasks, including game thread.
         uint32 GetNumThreads()const;
-        bool ExecutePendingTask(ETaskType InType);
+        uint32 GetNumLaneThreads(ETaskType InType) const;
+        // bBackgroundTasks: allow picking background priority worker tasks, false for threads helping while waiting.
+        bool ExecutePendingTask(ETaskType InType, bool bBackgroundTasks = true);
+        WaitStats GetWaitStats(EWaitSite Site) const;
+        void ResetWaitStats();
     private:
         TArray<std::thread> AllThreads; // All threads except main thread
+        uint32 NumWorkerThreads;
         std::atomic_bool bRunning;
+        ETaskType ResolveTaskType(ETaskType InType, ETaskPriority InPriority) const;
         void WorkerThreadLoop();
+        void LaneThreadLoop(ETaskType InType);
     };
 
-    template<class Func> void EnqueueWorkerThreadTask(Func&& InFunc) {
-	    XXThreadPool::Instance()->EnqueueTaskPtr(ETaskType::Worker, ThreadTaskPtr(new ThreadTaskFunc<Func>(ForwardTemp(InFunc))));
-    }
+    // Enqueue helpers returning futures are declared in System/Public/TaskFuture.h
+
+    // Type erased state shared by all chunks of one ParallelFor call, lives on the caller's stack.
+    struct ParallelForContext {
+        typedef void(*InvokeFunc)(void* Body, uint32 RangeBegin, uint32 RangeEnd);
+        InvokeFunc Invoke;
+        void* Body;
+        uint32 Begin;
+        uint32 End;
+        uint32 ChunkSize;
+        uint32 NumChunks;
+        std::atomic<uint32> NextChunk{ 0 };
+        TaskCounter NumPendingTasks;
+        // Process chunks until all of them are claimed.
+        void RunChunks();
+    };
 
-    template<class Func> void EnqueueGameThreadTask(Func&& InFunc) {
-        XXThreadPool::Instance()->EnqueueTaskPtr(ETaskType::GameThread, ThreadTaskPtr(new ThreadTaskFunc<Func>(ForwardTemp(InFunc))));
+    void ParallelForImpl(ParallelForContext& Context, uint32 GrainSize);
+
+    // Run Body(RangeBegin, RangeEnd) over [Begin, End), split into at most a few chunks per thread and at least GrainSize per chunk.
+    // Body is shared by reference, no heap allocation happens on this path.
+    template<class Func> void ParallelFor(uint32 Begin, uint32 End, uint32 GrainSize, Func&& Body) {
+        if(End <= Begin) {
+            return;
+        }
+        typedef std::remove_reference_t<Func> BodyType;
+        ParallelForContext Context;
+        Context.Invoke = [](void* InBody, uint32 RangeBegin, uint32 RangeEnd) {
+            (*(BodyType*)InBody)(RangeBegin, RangeEnd);
+        };
+        Context.Body = (void*)&Body;
+        Context.Begin = Begin;
+        Context.End = End;
+        ParallelForImpl(Context, GrainSize);
     }
+
     template<class Func> void ParallelFor(Func&& InFunc, uint32 MaxNum) {
-        std::atomic<int32> NumRest = MaxNum;
-        for(uint32 i=0; i<MaxNum; ++i) {
-            XXThreadPool::Instance()->EnqueueTaskPtr(ETaskType::Worker, ThreadTaskPtr(new ThreadTaskFunc([FuncBody=MoveTemp(InFunc), i, &NumRest]() {
-                FuncBody(i);
-                NumRest.fetch_sub(1, std::memory_order_release);
-            })));
-        }
-        // Run in current thread if possible.
-        while (NumRest.load(std::memory_order_acquire) > 0) {
-            Engine::XXThreadPool::Instance()->ExecutePendingTask(ETaskType::Worker);
-        }
+        ParallelFor(0u, MaxNum, 1u, [&InFunc](uint32 RangeBegin, uint32 RangeEnd) {
+            for(uint32 i = RangeBegin; i < RangeEnd; ++i) {
+                InFunc(i);
+            }
+        });
     }
 }
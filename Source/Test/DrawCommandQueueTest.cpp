@@ -0,0 +1,423 @@
+#include "TestCommon.h"
+#include "Render/Public/DrawCall.h"
+#include <chrono>
+
+namespace {
+	constexpr uint32 NUM_PARAM_SLOTS = RHIShaderBinding::MAX_SET * RHIShaderBinding::MAX_BINDING;
+
+	uint32 Random(uint32& seed, uint32 range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	// handles are only compared, never dereferenced
+	uint64 s_Objects[1024];
+	template<class T> T* FakeHandle(uint32 index) {
+		return reinterpret_cast<T*>(&s_Objects[index]);
+	}
+
+	// state a draw must see when it is issued, indexed by its first instance
+	struct ExpectedDraw {
+		RHIGraphicsPipelineState* PSO;
+		void* Material;
+		RHIBuffer* VertexBuffer;
+		RHIBuffer* IndexBuffer;
+		TArray<Render::DrawParam> Params;
+	};
+
+	// Tracks the bound state as a device would, binding a pipeline resets the params and the material.
+	// Draws are checked against the expected state of their first instance.
+	class MockCmd: public RHICommandBuffer {
+	public:
+		const TArray<ExpectedDraw>* Expected{ nullptr };
+		TArray<uint32> DrawOrder;
+		uint32 NumMismatches{ 0 };
+		uint32 NumPipelineBinds{ 0 };
+		uint32 NumMaterialBinds{ 0 };
+		uint32 NumParams{ 0 };
+		uint32 NumVertexBufferBinds{ 0 };
+		uint32 NumIndexBufferBinds{ 0 };
+		void* Material{ nullptr };
+		void Reset() override {
+			DrawOrder.Reset();
+			NumMismatches = NumPipelineBinds = NumMaterialBinds = NumParams = NumVertexBufferBinds = NumIndexBufferBinds = 0;
+			m_PSO = nullptr;
+			m_VB = m_IB = nullptr;
+			Material = nullptr;
+			ResetParams();
+		}
+		void Close() override {}
+		void BeginRendering(const RHIRenderPassInfo& info) override {}
+		void EndRendering() override {}
+		void BindGraphicsPipeline(RHIGraphicsPipelineState* pipeline) override {
+			m_PSO = pipeline;
+			Material = nullptr;
+			ResetParams();
+			++NumPipelineBinds;
+		}
+		void BindComputePipeline(RHIComputePipelineState* pipeline) override {}
+		void SetShaderParam(uint32 setIndex, uint32 bindIndex, const RHIShaderParam& parameter) override {
+			const uint32 slot = setIndex * RHIShaderBinding::MAX_BINDING + bindIndex;
+			m_Params[slot] = parameter;
+			m_IsParamSet[slot] = true;
+			++NumParams;
+		}
+		void SetShaderParam(RHIShaderBinding binding, const RHIShaderParam& param) override { SetShaderParam(binding.Set, binding.Binding, param); }
+		void BindVertexBuffer(RHIBuffer* buffer, uint32 slot, uint64 offset) override { m_VB = buffer; ++NumVertexBufferBinds; }
+		void BindVertexBuffer(const RHIDynamicBuffer& buffer, uint32 slot, uint32 offset) override {}
+		void BindIndexBuffer(RHIBuffer* buffer, uint64 offset) override { m_IB = buffer; ++NumIndexBufferBinds; }
+		void SetViewport(FRect rect, float minDepth, float maxDepth) override {}
+		void SetScissor(Rect rect) override {}
+		void Draw(uint32 vertexCount, uint32 instanceCount, uint32 firstIndex, uint32 firstInstance) override {}
+		void DrawIndexed(uint32 indexCount, uint32 instanceCount, uint32 firstIndex, uint32 vertexOffset, uint32 firstInstance) override {
+			DrawOrder.PushBack(firstInstance);
+			if(!Expected) {
+				return;
+			}
+			const ExpectedDraw& expected = (*Expected)[firstInstance];
+			bool bMatch = m_PSO == expected.PSO && (!expected.Material || Material == expected.Material) && m_VB == expected.VertexBuffer && m_IB == expected.IndexBuffer;
+			for(const Render::DrawParam& param: expected.Params) {
+				const uint32 slot = param.SetIndex * RHIShaderBinding::MAX_BINDING + param.BindIndex;
+				bMatch = bMatch && m_IsParamSet[slot] && m_Params[slot] == param.Param;
+			}
+			NumMismatches += !bMatch;
+		}
+		void Dispatch(uint32 groupCountX, uint32 groupCountY, uint32 groupCountZ) override {}
+		void DrawIndirect(const RHIDynamicBuffer& buffer, uint32 drawCount) override {}
+		void DrawIndexedIndirect(const RHIDynamicBuffer& buffer, uint32 drawCount) override {}
+		void DrawIndirect(RHIBuffer* buffer, uint32 bufferOffset, uint32 drawCount) override {}
+		void DrawIndexedIndirect(RHIBuffer* buffer, uint32 bufferOffset, uint32 drawCount) override {}
+		void ClearColorTarget(uint32 targetIndex, const float* color, const IRect& rect) override {}
+		void CopyBufferToTexture(RHIBuffer* buffer, RHITexture* texture, RHITextureSubRes dstSubRes, IOffset3D dstOffset) override {}
+		void CopyTextureToTexture(RHITexture* srcTex, RHITexture* dstTex, const RHITextureCopyRegion& region) override {}
+		void CopyBufferToBuffer(RHIBuffer* srcBuffer, RHIBuffer* dstBuffer, uint32 srcOffset, uint32 dstOffset, uint32 byteSize) override {}
+		void TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subDesc) override {}
+		void TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) override {}
+		void TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) override {}
+		void GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) override {}
+		void BeginDebugLabel(const char* msg, const float* color) override {}
+		void EndDebugLabel() override {}
+	private:
+		RHIGraphicsPipelineState* m_PSO{ nullptr };
+		RHIBuffer* m_VB{ nullptr };
+		RHIBuffer* m_IB{ nullptr };
+		RHIShaderParam m_Params[NUM_PARAM_SLOTS];
+		bool m_IsParamSet[NUM_PARAM_SLOTS]{};
+		void ResetParams() {
+			for(bool& isSet: m_IsParamSet) {
+				isSet = false;
+			}
+		}
+	};
+
+	// records the material as bound, like the material binds of the base pass
+	void BindMaterial(RHICommandBuffer* cmd, void* material) {
+		MockCmd* mockCmd = static_cast<MockCmd*>(cmd);
+		mockCmd->Material = material;
+		++mockCmd->NumMaterialBinds;
+	}
+
+	// Commands of random keys come out ordered by key, equal keys in the order of adding.
+	void TestStableSort() {
+		uint32 seed = 5;
+		MockCmd cmd;
+		Render::DrawCommandQueue queue;
+		TArray<uint64> keys;
+		// few distinct values so many keys are equal, then keys differing only in the layer, all keys equal and sorted keys
+		auto makeKey = [&](uint32 round, uint32 i) -> uint64 {
+			switch(round) {
+			case 0: return Render::DrawCommandQueue::MakeSortKey(Random(seed, 3), Random(seed, 5), Random(seed, 300), (float)Random(seed, 4) * 0.25f);
+			case 1: return Render::DrawCommandQueue::MakeSortKey(Random(seed, 200), 0, 0, 0.0f);
+			case 2: return Render::DrawCommandQueue::MakeSortKey(1, 2, 3, 0.5f);
+			default: return Render::DrawCommandQueue::MakeSortKey(0, i / 100, i / 10, 0.0f);
+			}
+		};
+		for(uint32 round = 0; round < 4; ++round) {
+			for(uint32 num: { 0u, 1u, 2u, 3000u }) {
+				queue.Reset();
+				keys.Reset();
+				for(uint32 i = 0; i < num; ++i) {
+					const uint64 key = makeKey(round, i);
+					Render::DrawCommand& command = queue.AddCommand(key);
+					command.PSO = FakeHandle<RHIGraphicsPipelineState>(0);
+					command.FirstInstance = i;
+					keys.PushBack(key);
+				}
+				// a second execute runs the sorted commands again
+				for(uint32 run = 0; run < 2; ++run) {
+					cmd.Reset();
+					queue.Execute(&cmd);
+					TEST_CHECK(cmd.DrawOrder.Size() == num);
+					TArray<uint8> isDrawn(num);
+					for(uint8& drawn: isDrawn) {
+						drawn = 0;
+					}
+					uint32 numMisordered = 0;
+					for(uint32 i = 0; i < cmd.DrawOrder.Size(); ++i) {
+						const uint32 index = cmd.DrawOrder[i];
+						numMisordered += isDrawn[index];
+						isDrawn[index] = 1;
+						if(i > 0) {
+							const uint32 prevIndex = cmd.DrawOrder[i - 1];
+							numMisordered += keys[prevIndex] > keys[index] || (keys[prevIndex] == keys[index] && prevIndex > index);
+						}
+					}
+					if(numMisordered) {
+						printf("round %u, %u commands: %u misordered\n", round, num, numMisordered);
+					}
+					TEST_CHECK(0 == numMisordered);
+				}
+			}
+		}
+	}
+
+	// Blocks and binds are skipped while the state stays, a pipeline change sets all of them again.
+	void TestBindElision() {
+		RHIGraphicsPipelineState* psoA = FakeHandle<RHIGraphicsPipelineState>(0);
+		RHIGraphicsPipelineState* psoB = FakeHandle<RHIGraphicsPipelineState>(1);
+		void* material = FakeHandle<void>(2);
+		RHIBuffer* vb0 = FakeHandle<RHIBuffer>(3);
+		RHIBuffer* vb1 = FakeHandle<RHIBuffer>(4);
+		RHIBuffer* ib = FakeHandle<RHIBuffer>(5);
+		const Render::DrawParam viewParam{ 0, 0, RHIShaderParam::UniformBuffer(FakeHandle<RHIBuffer>(6)) };
+		const Render::DrawParam objectParams[2][2] = {
+			{ { 1, 0, RHIShaderParam::StructuredBuffer(FakeHandle<RHIBuffer>(7)) }, { 1, 1, RHIShaderParam::StructuredBuffer(FakeHandle<RHIBuffer>(8), 0, 256) } },
+			{ { 1, 0, RHIShaderParam::StructuredBuffer(FakeHandle<RHIBuffer>(7)) }, { 1, 1, RHIShaderParam::StructuredBuffer(FakeHandle<RHIBuffer>(8), 256, 256) } },
+		};
+
+		Render::DrawCommandQueue queue;
+		const uint32 viewBlock = queue.AddParamBlock();
+		queue.AddParam(viewParam.SetIndex, viewParam.BindIndex, viewParam.Param);
+		uint32 objectBlocks[2];
+		for(uint32 i = 0; i < 2; ++i) {
+			objectBlocks[i] = queue.AddParamBlock();
+			for(const Render::DrawParam& param: objectParams[i]) {
+				queue.AddParam(param.SetIndex, param.BindIndex, param.Param);
+			}
+		}
+
+		// layer, pso, object block and vertex buffer of each draw, layers 0 and 2 use the same pipeline
+		struct DrawDesc {
+			uint32 Layer;
+			RHIGraphicsPipelineState* PSO;
+			uint32 Object;
+			RHIBuffer* VB;
+		};
+		const DrawDesc draws[] = {
+			{ 0, psoA, 0, vb0 }, { 0, psoA, 0, vb0 }, { 0, psoA, 1, vb1 },
+			{ 1, psoB, 1, vb1 },
+			{ 2, psoA, 1, vb1 }, { 2, psoA, 0, vb0 },
+		};
+		TArray<ExpectedDraw> expected;
+		for(const DrawDesc& draw: draws) {
+			ExpectedDraw& expectedDraw = expected.EmplaceBack();
+			expectedDraw.PSO = draw.PSO;
+			expectedDraw.Material = material;
+			expectedDraw.VertexBuffer = draw.VB;
+			expectedDraw.IndexBuffer = ib;
+			expectedDraw.Params.PushBack(viewParam);
+			expectedDraw.Params.PushBack(objectParams[draw.Object][0]);
+			expectedDraw.Params.PushBack(objectParams[draw.Object][1]);
+		}
+		// added out of order, the sort brings back the order of the table
+		for(uint32 i: { 4, 0, 3, 1, 5, 2 }) {
+			Render::DrawCommand& command = queue.AddCommand(Render::DrawCommandQueue::MakeSortKey(draws[i].Layer, 0, 0, 0.0f));
+			command.PSO = draws[i].PSO;
+			command.BindMaterial = BindMaterial;
+			command.Material = material;
+			command.VertexBuffer = draws[i].VB;
+			command.IndexBuffer = ib;
+			command.IndexCount = 3;
+			command.FirstInstance = i;
+			command.ViewParams = viewBlock;
+			command.ObjectParams = objectBlocks[draws[i].Object];
+		}
+		MockCmd cmd;
+		cmd.Expected = &expected;
+		cmd.Reset();
+		queue.Execute(&cmd);
+		TEST_CHECK(6 == cmd.DrawOrder.Size());
+		for(uint32 i = 0; i < cmd.DrawOrder.Size(); ++i) {
+			TEST_CHECK(i == cmd.DrawOrder[i]);
+		}
+		TEST_CHECK(0 == cmd.NumMismatches);
+
+		// view block set after each of the 3 pipeline binds, object blocks by draws 0, 2, 3, 4 and 5
+		const Render::DrawCommandStats& stats = queue.GetStats();
+		TEST_CHECK(6 == stats.NumCommands);
+		TEST_CHECK(3 == stats.NumPipelineBinds && 3 == cmd.NumPipelineBinds);
+		TEST_CHECK(3 == stats.NumPipelineBindsSaved);
+		TEST_CHECK(3 == stats.NumMaterialBinds && 3 == cmd.NumMaterialBinds);
+		TEST_CHECK(3 == stats.NumMaterialBindsSaved);
+		TEST_CHECK(8 == stats.NumParamBlocks);
+		TEST_CHECK(4 == stats.NumParamBlocksSaved);
+		TEST_CHECK(13 == stats.NumParams && 13 == cmd.NumParams);
+		TEST_CHECK(3 == stats.NumVertexBufferBinds && 3 == cmd.NumVertexBufferBinds);
+		TEST_CHECK(1 == stats.NumIndexBufferBinds && 1 == cmd.NumIndexBufferBinds);
+		TEST_CHECK(5 == stats.NumIndexBufferBindsSaved);
+	}
+
+	// Random draws of a level checked against the state they expect, whatever is skipped.
+	void TestRandomDraws() {
+		constexpr uint32 NUM_DRAWS = 5000;
+		uint32 seed = 11;
+		Render::DrawCommandQueue queue;
+		TArray<ExpectedDraw> expected;
+		uint32 viewBlocks[2];
+		Render::DrawParam viewParams[2];
+		for(uint32 i = 0; i < 2; ++i) {
+			viewParams[i] = { 0, 0, RHIShaderParam::UniformBuffer(FakeHandle<RHIBuffer>(100 + i)) };
+			viewBlocks[i] = queue.AddParamBlock();
+			queue.AddParam(viewParams[i].SetIndex, viewParams[i].BindIndex, viewParams[i].Param);
+		}
+		uint32 objectBlock = INVALID_INDEX;
+		Render::DrawParam objectParam;
+		for(uint32 i = 0; i < NUM_DRAWS; ++i) {
+			// a new object every few draws, the primitives of an object share its block
+			if(0 == Random(seed, 3) || INVALID_INDEX == objectBlock) {
+				objectParam = { 1, 0, RHIShaderParam::UniformBuffer(FakeHandle<RHIBuffer>(200 + Random(seed, 500))) };
+				objectBlock = queue.AddParamBlock();
+				queue.AddParam(objectParam.SetIndex, objectParam.BindIndex, objectParam.Param);
+			}
+			const uint32 psoIndex = Random(seed, 8);
+			const uint32 materialIndex = Random(seed, 32);
+			const uint32 meshIndex = Random(seed, 64);
+			const uint32 view = Random(seed, 2);
+			ExpectedDraw& expectedDraw = expected.EmplaceBack();
+			expectedDraw.PSO = FakeHandle<RHIGraphicsPipelineState>(psoIndex);
+			expectedDraw.Material = Random(seed, 4) ? FakeHandle<void>(10 + materialIndex) : nullptr;
+			expectedDraw.VertexBuffer = FakeHandle<RHIBuffer>(50 + meshIndex);
+			expectedDraw.IndexBuffer = FakeHandle<RHIBuffer>(50 + meshIndex / 2);
+			expectedDraw.Params.PushBack(viewParams[view]);
+			expectedDraw.Params.PushBack(objectParam);
+			Render::DrawCommand& command = queue.AddCommand(Render::DrawCommandQueue::MakeSortKey(0, psoIndex, materialIndex, (float)Random(seed, 100) * 0.01f));
+			command.PSO = expectedDraw.PSO;
+			command.BindMaterial = expectedDraw.Material ? BindMaterial : nullptr;
+			command.Material = expectedDraw.Material;
+			command.VertexBuffer = expectedDraw.VertexBuffer;
+			command.IndexBuffer = expectedDraw.IndexBuffer;
+			command.FirstInstance = i;
+			command.ViewParams = viewBlocks[view];
+			command.ObjectParams = objectBlock;
+		}
+		MockCmd cmd;
+		cmd.Expected = &expected;
+		cmd.Reset();
+		queue.Execute(&cmd);
+		TEST_CHECK(NUM_DRAWS == cmd.DrawOrder.Size());
+		TEST_CHECK(0 == cmd.NumMismatches);
+		const Render::DrawCommandStats& stats = queue.GetStats();
+		TEST_CHECK(stats.NumPipelineBinds == cmd.NumPipelineBinds && stats.NumPipelineBinds <= 8);
+		TEST_CHECK(stats.NumParams == cmd.NumParams);
+		TEST_CHECK(stats.NumParamBlocksSaved > 0);
+	}
+
+	// CPU time of building and executing the draws of a level against the lambda queue issuing every bind.
+	// Draws as in the base pass: 16 PSOs, 64 materials, 200 meshes, a view block and an object block.
+	void BenchmarkExecute() {
+		constexpr uint32 NUM_DRAWS = 20000;
+		constexpr uint32 NUM_FRAMES = 50;
+		struct Draw {
+			uint32 PSOIndex;
+			uint32 MaterialIndex;
+			uint32 MeshIndex;
+			uint32 ObjectIndex;
+			float Depth;
+		};
+		uint32 seed = 3;
+		TArray<Draw> draws;
+		for(uint32 i = 0; i < NUM_DRAWS; ++i) {
+			// objects of 1 to 4 primitives
+			const uint32 objectIndex = draws.IsEmpty() ? 0 : draws.Back().ObjectIndex + (0 == Random(seed, 3));
+			draws.PushBack({ Random(seed, 16), Random(seed, 64), Random(seed, 200), objectIndex, (float)Random(seed, 1000) * 0.001f });
+		}
+		const RHIShaderParam cameraParam = RHIShaderParam::UniformBuffer(FakeHandle<RHIBuffer>(0));
+		auto getPSO = [](uint32 index) { return FakeHandle<RHIGraphicsPipelineState>(1 + index); };
+		auto getMaterial = [](uint32 index) { return FakeHandle<void>(20 + index); };
+		auto getMesh = [](uint32 index) { return FakeHandle<RHIBuffer>(100 + index); };
+		auto getObjectParam = [](uint32 index) { return RHIShaderParam::UniformBuffer(FakeHandle<RHIBuffer>(400 + index % 600)); };
+
+		MockCmd cmd;
+		Render::DrawCallQueue lambdaQueue;
+		double lambdaBuildMs = 0.0, lambdaExecuteMs = 0.0;
+		for(uint32 frame = 0; frame < NUM_FRAMES; ++frame) {
+			cmd.Reset();
+			const auto buildStart = std::chrono::steady_clock::now();
+			lambdaQueue.Reset();
+			for(const Draw& draw: draws) {
+				RHIGraphicsPipelineState* pso = getPSO(draw.PSOIndex);
+				void* material = getMaterial(draw.MaterialIndex);
+				RHIBuffer* mesh = getMesh(draw.MeshIndex);
+				const RHIShaderParam objectParam = getObjectParam(draw.ObjectIndex);
+				lambdaQueue.PushDrawCall([pso, material, mesh, cameraParam, objectParam](RHICommandBuffer* cmd) {
+					cmd->BindGraphicsPipeline(pso);
+					BindMaterial(cmd, material);
+					cmd->SetShaderParam(0, 0, cameraParam);
+					cmd->SetShaderParam(1, 0, objectParam);
+					cmd->BindVertexBuffer(mesh, 0, 0);
+					cmd->BindIndexBuffer(mesh, 0);
+					cmd->DrawIndexed(3, 1, 0, 0, 0);
+				});
+			}
+			const auto executeStart = std::chrono::steady_clock::now();
+			lambdaQueue.Execute(&cmd);
+			lambdaBuildMs += std::chrono::duration<double, std::milli>(executeStart - buildStart).count();
+			lambdaExecuteMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - executeStart).count();
+		}
+		lambdaBuildMs /= NUM_FRAMES;
+		lambdaExecuteMs /= NUM_FRAMES;
+		const uint32 lambdaParams = cmd.NumParams;
+
+		Render::DrawCommandQueue queue;
+		double buildMs = 0.0, sortMs = 0.0, executeMs = 0.0;
+		for(uint32 frame = 0; frame < NUM_FRAMES; ++frame) {
+			cmd.Reset();
+			const auto buildStart = std::chrono::steady_clock::now();
+			queue.Reset();
+			const uint32 viewBlock = queue.AddParamBlock();
+			queue.AddParam(0, 0, cameraParam);
+			uint32 objectBlock = INVALID_INDEX, blockObjectIndex = INVALID_INDEX;
+			for(const Draw& draw: draws) {
+				if(draw.ObjectIndex != blockObjectIndex) {
+					objectBlock = queue.AddParamBlock();
+					queue.AddParam(1, 0, getObjectParam(draw.ObjectIndex));
+					blockObjectIndex = draw.ObjectIndex;
+				}
+				Render::DrawCommand& command = queue.AddCommand(Render::DrawCommandQueue::MakeSortKey(0, draw.PSOIndex, draw.MaterialIndex, draw.Depth));
+				command.PSO = getPSO(draw.PSOIndex);
+				command.BindMaterial = BindMaterial;
+				command.Material = getMaterial(draw.MaterialIndex);
+				command.VertexBuffer = getMesh(draw.MeshIndex);
+				command.IndexBuffer = getMesh(draw.MeshIndex);
+				command.IndexCount = 3;
+				command.ViewParams = viewBlock;
+				command.ObjectParams = objectBlock;
+			}
+			const auto sortStart = std::chrono::steady_clock::now();
+			queue.Sort();
+			const auto executeStart = std::chrono::steady_clock::now();
+			queue.Execute(&cmd);
+			const auto executeEnd = std::chrono::steady_clock::now();
+			buildMs += std::chrono::duration<double, std::milli>(sortStart - buildStart).count();
+			sortMs += std::chrono::duration<double, std::milli>(executeStart - sortStart).count();
+			executeMs += std::chrono::duration<double, std::milli>(executeEnd - executeStart).count();
+		}
+		buildMs /= NUM_FRAMES;
+		sortMs /= NUM_FRAMES;
+		executeMs /= NUM_FRAMES;
+		const Render::DrawCommandStats& stats = queue.GetStats();
+		printf("%u draws, lambda queue: build %.3f ms, execute %.3f ms, %u params\n", NUM_DRAWS, lambdaBuildMs, lambdaExecuteMs, lambdaParams);
+		printf("command queue: build %.3f ms, sort %.3f ms, execute %.3f ms, %u pipeline binds, %u material binds, %u params\n",
+			buildMs, sortMs, executeMs, stats.NumPipelineBinds, stats.NumMaterialBinds, stats.NumParams);
+		TEST_CHECK(stats.NumPipelineBinds == 16);
+		TEST_CHECK(stats.NumParams < lambdaParams);
+	}
+}
+
+int main() {
+	TEST_RUN(TestStableSort);
+	TEST_RUN(TestBindElision);
+	TEST_RUN(TestRandomDraws);
+	TEST_RUN(BenchmarkExecute);
+	return Test::Result();
+}
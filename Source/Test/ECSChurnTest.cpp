@@ -0,0 +1,179 @@
+#include "TestCommon.h"
+#include "Objects/Public/ECS.h"
+#include "Math/Public/Math.h"
+#include <chrono>
+#include <random>
+
+namespace {
+	struct Position {
+		float X{ 0.0f };
+		float Y{ 0.0f };
+		REGISTER_ECS_COMPONENT(Position);
+	};
+
+	struct Velocity {
+		float X{ 1.0f };
+		float Y{ 0.0f };
+		REGISTER_ECS_COMPONENT(Velocity);
+	};
+
+	// The entity storage replaced by the generational handles: ids are never reused, entity masks and
+	// component indices are hash maps. Kept here to benchmark against.
+	namespace Legacy {
+		template<class T> class ComponentContainer {
+		public:
+			T* Add(Object::EntityID entityID) {
+				m_Entity2Indices[entityID] = m_Components.Size();
+				m_Components.EmplaceBack();
+				m_Entities.PushBack(entityID);
+				return &m_Components.Back();
+			}
+			T* Get(Object::EntityID entityID) {
+				auto iter = m_Entity2Indices.find(entityID);
+				return iter != m_Entity2Indices.end() ? &m_Components[iter->second] : nullptr;
+			}
+			void Remove(Object::EntityID entityID) {
+				if(auto iter = m_Entity2Indices.find(entityID); iter != m_Entity2Indices.end()) {
+					const uint32 removedIdx = iter->second;
+					const Object::EntityID backEntityID = m_Entities.Back();
+					m_Components.SwapRemoveAt(removedIdx);
+					m_Entities.SwapRemoveAt(removedIdx);
+					m_Entity2Indices[backEntityID] = removedIdx;
+					m_Entity2Indices.erase(entityID);
+				}
+			}
+		private:
+			TArray<T> m_Components;
+			TArray<Object::EntityID> m_Entities;
+			TUnorderedMap<Object::EntityID, uint32> m_Entity2Indices;
+		};
+
+		class Scene {
+		public:
+			Object::EntityID NewEntity() {
+				const Object::EntityID entityID = m_MaxEntity++;
+				m_EntityMasks[entityID] = 0;
+				return entityID;
+			}
+			Position* AddPosition(Object::EntityID entityID) {
+				m_EntityMasks[entityID] |= Position::GetComponentMask();
+				return m_Positions.Add(entityID);
+			}
+			Velocity* AddVelocity(Object::EntityID entityID) {
+				m_EntityMasks[entityID] |= Velocity::GetComponentMask();
+				return m_Velocities.Add(entityID);
+			}
+			Position* GetPosition(Object::EntityID entityID) { return m_Positions.Get(entityID); }
+			Velocity* GetVelocity(Object::EntityID entityID) { return m_Velocities.Get(entityID); }
+			void RemoveEntity(Object::EntityID entityID) {
+				if(m_EntityMasks.erase(entityID)) {
+					m_Positions.Remove(entityID);
+					m_Velocities.Remove(entityID);
+				}
+			}
+			Object::EntityID GetMaxEntity() const { return m_MaxEntity; }
+		private:
+			Object::EntityID m_MaxEntity{ 0 };
+			TUnorderedMap<Object::EntityID, Object::ComponentMask> m_EntityMasks;
+			ComponentContainer<Position> m_Positions;
+			ComponentContainer<Velocity> m_Velocities;
+		};
+	}
+
+	// a stale handle must not reach the entity that reused its index
+	void TestStaleHandle() {
+		Object::ECSScene scene;
+		const Object::EntityID removed = scene.NewEntity();
+		scene.AddComponent<Position>(removed)->X = 1.0f;
+		const Object::EntityID kept = scene.NewEntity();
+		scene.AddComponent<Position>(kept)->X = 2.0f;
+		scene.RemoveEntity(removed);
+		TEST_CHECK(!scene.IsValid(removed));
+		TEST_CHECK(!scene.GetComponent<const Position>(removed));
+
+		const Object::EntityID reused = scene.NewEntity();
+		scene.AddComponent<Position>(reused)->X = 3.0f;
+		TEST_CHECK(Object::GetEntityIndex(reused) == Object::GetEntityIndex(removed));
+		TEST_CHECK(reused != removed);
+		TEST_CHECK(scene.IsValid(reused) && !scene.IsValid(removed));
+		TEST_CHECK(!scene.GetComponent<const Position>(removed));
+		TEST_CHECK(!scene.GetComponent<Position>(removed));
+		TEST_CHECK(3.0f == scene.GetComponent<const Position>(reused)->X);
+
+		// removing through the stale handle leaves the new entity alone
+		scene.RemoveEntity(removed);
+		TEST_CHECK(scene.IsValid(reused));
+		TEST_CHECK(3.0f == scene.GetComponent<const Position>(reused)->X);
+		TEST_CHECK(2.0f == scene.GetComponent<const Position>(kept)->X);
+	}
+
+	// Entities are spawned and destroyed at random every frame, the live count stays the same.
+	// Both implementations run the same sequence, indices of the new one must stay under the live count.
+	void BenchmarkChurn() {
+		constexpr uint32 NUM_LIVE = 10000;
+		constexpr uint32 NUM_FRAMES = 200;
+		constexpr uint32 NUM_CHURN_PER_FRAME = 1000;
+
+		auto runChurn = [&](auto&& newEntity, auto&& removeEntity, auto&& getPositionX) {
+			std::mt19937 rng(7);
+			TArray<Object::EntityID> entities;
+			for(uint32 i = 0; i < NUM_LIVE; ++i) {
+				entities.PushBack(newEntity());
+			}
+			float sum = 0.0f;
+			const auto start = std::chrono::steady_clock::now();
+			for(uint32 frame = 0; frame < NUM_FRAMES; ++frame) {
+				for(uint32 i = 0; i < NUM_CHURN_PER_FRAME; ++i) {
+					const uint32 idx = rng() % entities.Size();
+					removeEntity(entities[idx]);
+					entities.SwapRemoveAt(idx);
+				}
+				for(uint32 i = 0; i < NUM_CHURN_PER_FRAME; ++i) {
+					entities.PushBack(newEntity());
+				}
+				for(Object::EntityID entity: entities) {
+					sum += getPositionX(entity);
+				}
+			}
+			const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return std::make_pair(ms, sum);
+		};
+
+		Object::ECSScene scene;
+		uint32 maxIndex = 0;
+		const auto [ms, sum] = runChurn(
+			[&]() {
+				const Object::EntityID entity = scene.NewEntity();
+				scene.AddComponent<Position>(entity)->X = 1.0f;
+				scene.AddComponent<Velocity>(entity);
+				maxIndex = Math::Max(maxIndex, Object::GetEntityIndex(entity));
+				return entity;
+			},
+			[&](Object::EntityID entity) { scene.RemoveEntity(entity); },
+			[&](Object::EntityID entity) { return scene.GetComponent<const Position>(entity)->X; });
+
+		Legacy::Scene legacyScene;
+		const auto [legacyMs, legacySum] = runChurn(
+			[&]() {
+				const Object::EntityID entity = legacyScene.NewEntity();
+				legacyScene.AddPosition(entity)->X = 1.0f;
+				legacyScene.AddVelocity(entity);
+				return entity;
+			},
+			[&](Object::EntityID entity) { legacyScene.RemoveEntity(entity); },
+			[&](Object::EntityID entity) { return legacyScene.GetPosition(entity)->X; });
+
+		printf("churn %u frames, %u live, %u spawned and destroyed per frame\n", NUM_FRAMES, NUM_LIVE, NUM_CHURN_PER_FRAME);
+		printf("  generational handles: %.2f ms, max index %u\n", ms, maxIndex);
+		printf("  legacy hash maps:     %.2f ms, max id %u\n", legacyMs, legacyScene.GetMaxEntity());
+		TEST_CHECK(sum == legacySum);
+		TEST_CHECK(maxIndex < NUM_LIVE);
+		TEST_CHECK(legacyScene.GetMaxEntity() == NUM_LIVE + NUM_FRAMES * NUM_CHURN_PER_FRAME);
+	}
+}
+
+int main() {
+	TEST_RUN(TestStaleHandle);
+	TEST_RUN(BenchmarkChurn);
+	return Test::Result();
+}
@@ -0,0 +1,323 @@
+#include "TestCommon.h"
+#include "Objects/Public/ECS.h"
+#include "Core/Public/FrameAllocator.h"
+#include "System/Public/ThreadPool.h"
+#include <atomic>
+#include <chrono>
+
+namespace {
+	struct Position {
+		float X{ 0.0f };
+		float Y{ 0.0f };
+		REGISTER_ECS_COMPONENT(Position);
+	};
+
+	struct Velocity {
+		float X{ 1.0f };
+		float Y{ 0.0f };
+		REGISTER_ECS_COMPONENT(Velocity);
+	};
+
+	struct Health {
+		uint32 Value{ 100 };
+		REGISTER_ECS_COMPONENT(Health);
+	};
+
+	struct Frozen {
+		REGISTER_ECS_COMPONENT(Frozen);
+	};
+
+	// entities visited by each system in the last update, each counter is written by its system only
+	uint32 s_NumMoved = 0;
+	uint32 s_NumHealthVisited = 0;
+	uint32 s_NumUnfrozenVisited = 0;
+
+	void ResetCounters() {
+		s_NumMoved = s_NumHealthVisited = s_NumUnfrozenVisited = 0;
+	}
+
+	class MoveSystem: public Object::ECSSystem<Position, const Velocity> {
+	public:
+		void Update(Object::ECSScene* scene, Position* position, const Velocity* velocity) override {
+			position->X += velocity->X;
+			position->Y += velocity->Y;
+			++s_NumMoved;
+		}
+	};
+
+	class HealthSystem: public Object::ECSSystem<const Health> {
+	public:
+		void Update(Object::ECSScene* scene, const Health* health) override {
+			++s_NumHealthVisited;
+		}
+	};
+
+	class UnfrozenSystem: public Object::ECSSystem<const Position> {
+	public:
+		UnfrozenSystem() {
+			m_ExcludeMask = Frozen::GetComponentMask();
+		}
+		void Update(Object::ECSScene* scene, const Position* position) override {
+			++s_NumUnfrozenVisited;
+		}
+	};
+
+	// MoveSystem with its chunks updated on workers, it touches only the components of the chunk besides the test counter
+	std::atomic<uint32> s_NumParallelMoved{ 0 };
+	class ParallelMoveSystem: public Object::ECSSystem<Position, const Velocity> {
+	public:
+		ParallelMoveSystem() {
+			m_ParallelChunks = true;
+		}
+		void Update(Object::ECSScene* scene, Position* position, const Velocity* velocity) override {
+			position->X += velocity->X;
+			position->Y += velocity->Y;
+			s_NumParallelMoved.fetch_add(1, std::memory_order_relaxed);
+		}
+	};
+
+	// counts the entities of the chunks with positions written since its last update
+	uint32 s_NumPositionChanged = 0;
+	class PositionChangedSystem: public Object::ECSSystem<const Position> {
+	public:
+		PositionChangedSystem() {
+			m_ChangeFilterMask = Position::GetComponentMask();
+		}
+		void Update(Object::ECSScene* scene, const Position* position) override {
+			++s_NumPositionChanged;
+		}
+	};
+
+	Object::EntityID NewEntity(Object::ECSScene& scene, bool bPosition, bool bVelocity, bool bHealth, bool bFrozen) {
+		const Object::EntityID entity = scene.NewEntity();
+		if(bPosition) {
+			scene.AddComponent<Position>(entity);
+		}
+		if(bVelocity) {
+			scene.AddComponent<Velocity>(entity);
+		}
+		if(bHealth) {
+			scene.AddComponent<Health>(entity);
+		}
+		if(bFrozen) {
+			scene.AddComponent<Frozen>(entity);
+		}
+		return entity;
+	}
+
+	// an entity is updated by every system whose components are a subset of its own, whichever is registered first
+	void TestSubsetMatching() {
+		Object::ECSScene scene;
+		scene.RegisterSystem<MoveSystem>();
+		const Object::EntityID moving = NewEntity(scene, true, true, false, false);
+		const Object::EntityID movingWithHealth = NewEntity(scene, true, true, true, false);
+		const Object::EntityID still = NewEntity(scene, true, false, false, false);
+		NewEntity(scene, false, false, true, false);
+		const Object::EntityID frozen = NewEntity(scene, true, true, false, true);
+		scene.RegisterSystem<HealthSystem>();
+		scene.RegisterSystem<UnfrozenSystem>();
+		ResetCounters();
+		scene.SystemUpdate();
+		TEST_CHECK(3 == s_NumMoved);
+		TEST_CHECK(2 == s_NumHealthVisited);
+		TEST_CHECK(3 == s_NumUnfrozenVisited);
+		TEST_CHECK(1.0f == scene.GetComponent<const Position>(moving)->X);
+		TEST_CHECK(1.0f == scene.GetComponent<const Position>(movingWithHealth)->X);
+		TEST_CHECK(1.0f == scene.GetComponent<const Position>(frozen)->X);
+		TEST_CHECK(0.0f == scene.GetComponent<const Position>(still)->X);
+
+		// archetypes created after the systems are matched too
+		NewEntity(scene, true, true, true, true);
+		ResetCounters();
+		scene.SystemUpdate();
+		TEST_CHECK(4 == s_NumMoved);
+		TEST_CHECK(3 == s_NumHealthVisited);
+		TEST_CHECK(3 == s_NumUnfrozenVisited);
+		TEST_CHECK(2.0f == scene.GetComponent<const Position>(moving)->X);
+	}
+
+	// adding or removing an excluded component moves the entity out of or into the system
+	void TestExcludeMask() {
+		Object::ECSScene scene;
+		scene.RegisterSystem<UnfrozenSystem>();
+		const Object::EntityID entity = NewEntity(scene, true, false, false, false);
+		NewEntity(scene, true, false, true, false);
+		ResetCounters();
+		scene.SystemUpdate();
+		TEST_CHECK(2 == s_NumUnfrozenVisited);
+		scene.AddComponent<Frozen>(entity);
+		ResetCounters();
+		scene.SystemUpdate();
+		TEST_CHECK(1 == s_NumUnfrozenVisited);
+		scene.RemoveComponent<Frozen>(entity);
+		ResetCounters();
+		scene.SystemUpdate();
+		TEST_CHECK(2 == s_NumUnfrozenVisited);
+	}
+
+	// Adding and removing a component goes back and forth between two archetypes, components of all entities are kept.
+	// Entities moved to fill the freed slots must still find their components.
+	void TestArchetypeEdges() {
+		Object::ECSScene scene;
+		constexpr uint32 NUM_ENTITIES = 3000; // a few chunks
+		TArray<Object::EntityID> entities;
+		for(uint32 i = 0; i < NUM_ENTITIES; ++i) {
+			const Object::EntityID entity = scene.NewEntity();
+			scene.AddComponent<Position>(entity)->X = (float)i;
+			entities.PushBack(entity);
+		}
+		TEST_CHECK(1 == scene.GetNumArchetypes());
+		for(uint32 round = 0; round < 4; ++round) {
+			for(uint32 i = round % 2; i < NUM_ENTITIES; i += 2) {
+				scene.AddComponent<Velocity>(entities[i])->Y = (float)i;
+			}
+			for(uint32 i = 0; i < NUM_ENTITIES; i += 3) {
+				scene.RemoveComponent<Velocity>(entities[i]);
+			}
+		}
+		TEST_CHECK(2 == scene.GetNumArchetypes());
+		uint32 numMismatches = 0;
+		for(uint32 i = 0; i < NUM_ENTITIES; ++i) {
+			const Position* position = scene.GetComponent<const Position>(entities[i]);
+			const Velocity* velocity = scene.GetComponent<const Velocity>(entities[i]);
+			numMismatches += !position || position->X != (float)i;
+			// the last two rounds add it to every entity, multiples of 3 lose it again
+			numMismatches += (0 != i % 3) != (nullptr != velocity);
+			numMismatches += velocity && velocity->Y != (float)i;
+		}
+		TEST_CHECK(0 == numMismatches);
+
+		// removing the last component leaves the entity with no archetype, adding one brings it back
+		const Object::EntityID entity = entities[0];
+		scene.RemoveComponent<Position>(entity);
+		TEST_CHECK(scene.IsValid(entity) && !scene.GetComponent<const Position>(entity));
+		TEST_CHECK(0.0f == scene.AddComponent<Position>(entity)->X);
+		TEST_CHECK(2 == scene.GetNumArchetypes());
+	}
+
+	// Chunks updated on workers give the results of the serial update, and their written columns are stamped.
+	void TestParallelChunks() {
+		constexpr uint32 NUM_ENTITIES = 20000; // tens of chunks over three archetypes
+		constexpr uint32 NUM_FRAMES = 4;
+		Object::ECSScene serialScene, parallelScene;
+		serialScene.RegisterSystem<MoveSystem>();
+		parallelScene.RegisterSystem<ParallelMoveSystem>();
+		parallelScene.RegisterSystem<PositionChangedSystem>();
+		TArray<Object::EntityID> serialEntities, parallelEntities;
+		for(uint32 i = 0; i < NUM_ENTITIES; ++i) {
+			for(Object::ECSScene* scene: { &serialScene, &parallelScene }) {
+				const Object::EntityID entity = NewEntity(*scene, true, i % 4 != 0, i % 3 == 0, false);
+				if(Velocity* velocity = scene->GetComponent<Velocity>(entity)) {
+					velocity->X = (float)(i % 7);
+					velocity->Y = 1.0f;
+				}
+				(scene == &serialScene ? serialEntities : parallelEntities).PushBack(entity);
+			}
+		}
+		const uint32 numMoving = NUM_ENTITIES - (NUM_ENTITIES + 3) / 4;
+		uint32 numMismatches = 0;
+		for(uint32 frame = 0; frame < NUM_FRAMES; ++frame) {
+			FrameAllocator::BeginFrame();
+			ResetCounters();
+			s_NumParallelMoved = 0;
+			s_NumPositionChanged = 0;
+			serialScene.SystemUpdate();
+			parallelScene.SystemUpdate();
+			TEST_CHECK(numMoving == s_NumMoved);
+			TEST_CHECK(numMoving == s_NumParallelMoved.load());
+			// every chunk with a velocity is written, the entities with only a position keep their chunks unchanged after the first frame
+			TEST_CHECK((0 == frame ? NUM_ENTITIES : numMoving) == s_NumPositionChanged);
+		}
+		for(uint32 i = 0; i < NUM_ENTITIES; ++i) {
+			const Position* serialPosition = serialScene.GetComponent<const Position>(serialEntities[i]);
+			const Position* parallelPosition = parallelScene.GetComponent<const Position>(parallelEntities[i]);
+			numMismatches += serialPosition->X != parallelPosition->X || serialPosition->Y != parallelPosition->Y;
+		}
+		TEST_CHECK(0 == numMismatches);
+		TEST_CHECK((float)NUM_FRAMES == parallelScene.GetComponent<const Position>(parallelEntities[1])->Y);
+	}
+
+	// Components recorded in the command buffer are readable and writable until playback moves them into the scene.
+	void TestRecordedComponents() {
+		Object::ECSScene scene;
+		Object::ECSCommandBuffer& cmdBuffer = scene.GetCommandBuffer();
+		const Object::EntityID entity = scene.NewEntity();
+		cmdBuffer.AddComponent<Position>(entity)->X = 1.0f;
+		TEST_CHECK(1.0f == cmdBuffer.GetComponent<const Position>(entity)->X);
+		TEST_CHECK(!scene.GetComponent<const Position>(entity));
+		// the last add wins
+		cmdBuffer.AddComponent<Position>(entity, Position{ 2.0f, 0.0f });
+		cmdBuffer.GetComponent<Position>(entity)->Y = 3.0f;
+		cmdBuffer.AddComponent<Velocity>(entity);
+		cmdBuffer.RemoveComponent<Velocity>(entity);
+		TEST_CHECK(!cmdBuffer.GetComponent<Velocity>(entity));
+		scene.PlaybackCommands();
+		TEST_CHECK(!cmdBuffer.GetComponent<Position>(entity));
+		const Position* position = scene.GetComponent<const Position>(entity);
+		TEST_CHECK(position && 2.0f == position->X && 3.0f == position->Y);
+		TEST_CHECK(!scene.GetComponent<const Velocity>(entity));
+
+		// removing and adding back in the same frame keeps the new component
+		cmdBuffer.RemoveComponent<Position>(entity);
+		cmdBuffer.AddComponent<Position>(entity)->X = 4.0f;
+		TEST_CHECK(2.0f == scene.GetComponent<const Position>(entity)->X);
+		scene.PlaybackCommands();
+		TEST_CHECK(4.0f == scene.GetComponent<const Position>(entity)->X);
+
+		// a destroyed entity has no recorded components
+		const Object::EntityID spawned = cmdBuffer.CreateEntity();
+		cmdBuffer.AddComponent<Health>(spawned)->Value = 7;
+		TEST_CHECK(7 == cmdBuffer.GetComponent<const Health>(spawned)->Value);
+		cmdBuffer.DestroyEntity(spawned);
+		TEST_CHECK(!cmdBuffer.GetComponent<Health>(spawned));
+		scene.PlaybackCommands();
+		TEST_CHECK(!scene.IsValid(spawned));
+	}
+
+	// 1M component adds and removes, moving entities between two archetypes through the cached edges
+	void BenchmarkAddRemove() {
+		Object::ECSScene scene;
+		scene.RegisterSystem<MoveSystem>();
+		scene.RegisterSystem<UnfrozenSystem>();
+		constexpr uint32 NUM_ENTITIES = 10000;
+		constexpr uint32 NUM_ROUNDS = 50;
+		TArray<Object::EntityID> entities;
+		for(uint32 i = 0; i < NUM_ENTITIES; ++i) {
+			const Object::EntityID entity = scene.NewEntity();
+			scene.AddComponent<Position>(entity)->X = (float)i;
+			entities.PushBack(entity);
+		}
+		const auto start = std::chrono::steady_clock::now();
+		for(uint32 round = 0; round < NUM_ROUNDS; ++round) {
+			for(Object::EntityID entity: entities) {
+				scene.AddComponent<Velocity>(entity);
+			}
+			for(Object::EntityID entity: entities) {
+				scene.RemoveComponent<Velocity>(entity);
+			}
+		}
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		const uint32 numOps = 2 * NUM_ENTITIES * NUM_ROUNDS;
+		printf("%u component adds and removes: %.2f ms, %.1f ns per op\n", numOps, ms, ms * 1e6 / numOps);
+		TEST_CHECK(2 == scene.GetNumArchetypes());
+		uint32 numMismatches = 0;
+		for(uint32 i = 0; i < NUM_ENTITIES; ++i) {
+			const Position* position = scene.GetComponent<const Position>(entities[i]);
+			numMismatches += !position || position->X != (float)i || scene.GetComponent<const Velocity>(entities[i]);
+		}
+		TEST_CHECK(0 == numMismatches);
+	}
+}
+
+int main() {
+	// systems run on the task graph
+	Engine::XXThreadPool::Initialize();
+	TEST_RUN(TestSubsetMatching);
+	TEST_RUN(TestExcludeMask);
+	TEST_RUN(TestArchetypeEdges);
+	TEST_RUN(TestParallelChunks);
+	TEST_RUN(TestRecordedComponents);
+	TEST_RUN(BenchmarkAddRemove);
+	Engine::XXThreadPool::Release();
+	return Test::Result();
+}
@@ -0,0 +1,221 @@
+#include "TestCommon.h"
+#include "Math/Public/FrustumCulling.h"
+#include "Math/Public/Math.h"
+#include "Core/Public/TArray.h"
+#include <chrono>
+#include <cmath>
+
+namespace {
+	constexpr uint32 GUARD = 0xcdcdcdcd;
+	constexpr uint32 NUM_GUARDS = 8;
+	// not multiples of 4 or 8 go through the scalar tail of the SIMD kernels
+	constexpr uint32 TEST_SIZES[] = { 0, 1, 3, 4, 5, 7, 8, 9, 12, 13, 15, 16, 17, 31, 33, 1000, 1003 };
+
+	uint32 Random(uint32& seed, uint32 range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	float RandomFloat(uint32& seed, float min, float max) {
+		return min + (max - min) * (float)Random(seed, 65536) / 65535.0f;
+	}
+
+	// camera at the origin turned by yaw around y, frustum as Object::Camera builds it
+	Math::Frustum MakeViewFrustum(float yaw) {
+		const float nearDistance = 0.5f, farDistance = 100.0f;
+		const Math::FVector3 eye{ 0.0f, 0.0f, 0.0f };
+		const Math::FVector3 front{ std::sin(yaw), 0.0f, std::cos(yaw) };
+		const Math::FVector3 up{ 0.0f, 1.0f, 0.0f };
+		const Math::FVector3 right = up.Cross(front).Normalize();
+		const float halfHeight = farDistance * std::tan(Math::PI * 0.2f);
+		const Math::FVector3 frontVec = front * farDistance;
+		const Math::FVector3 rightVec = right * halfHeight * 2.0f;
+		const Math::FVector3 upVec = up * halfHeight;
+		Math::Frustum frustum;
+		frustum.Near = { eye + front * nearDistance, front };
+		frustum.Far = { eye + frontVec, -front };
+		frustum.Left = { eye, up.Cross((frontVec - rightVec).Normalize()) };
+		frustum.Right = { eye, (frontVec + rightVec).Normalize().Cross(up) };
+		frustum.Bottom = { eye, (frontVec - upVec).Normalize().Cross(right) };
+		frustum.Top = { eye, right.Cross((frontVec + upVec).Normalize()) };
+		return frustum;
+	}
+
+	// the box [-8, 8]^3 with axis aligned planes, boxes touching a plane are exact in floats
+	Math::Frustum MakeBoxFrustum() {
+		Math::Frustum frustum;
+		frustum.Near = { { 0.0f, 0.0f, -8.0f }, { 0.0f, 0.0f, 1.0f } };
+		frustum.Far = { { 0.0f, 0.0f, 8.0f }, { 0.0f, 0.0f, -1.0f } };
+		frustum.Left = { { -8.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f } };
+		frustum.Right = { { 8.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f } };
+		frustum.Bottom = { { 0.0f, -8.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+		frustum.Top = { { 0.0f, 8.0f, 0.0f }, { 0.0f, -1.0f, 0.0f } };
+		return frustum;
+	}
+
+	// random boxes around the origin, every third one on a quarter grid so some touch the planes of the box frustum
+	void BuildBoxes(uint32 seed, uint32 num, TArray<Math::AABB3>& aabbs, Math::TAABB3SoA<TArray<float>>& soa) {
+		aabbs.Reset();
+		soa.Reset();
+		for(uint32 i = 0; i < num; ++i) {
+			Math::AABB3 aabb;
+			if(i % 3 == 0) {
+				const Math::FVector3 center{ (float)Random(seed, 97) * 0.25f - 12.0f, (float)Random(seed, 97) * 0.25f - 12.0f, (float)Random(seed, 97) * 0.25f - 12.0f };
+				const Math::FVector3 extent{ (float)Random(seed, 17) * 0.25f, (float)Random(seed, 17) * 0.25f, (float)Random(seed, 17) * 0.25f };
+				aabb = Math::AABB3::CenterExtent(center, extent);
+			}
+			else {
+				const Math::FVector3 center{ RandomFloat(seed, -120.0f, 120.0f), RandomFloat(seed, -60.0f, 60.0f), RandomFloat(seed, -120.0f, 120.0f) };
+				const Math::FVector3 extent{ RandomFloat(seed, 0.0f, 10.0f), RandomFloat(seed, 0.0f, 10.0f), RandomFloat(seed, 0.0f, 10.0f) };
+				aabb = Math::AABB3::CenterExtent(center, extent);
+			}
+			aabbs.PushBack(aabb);
+			soa.PushBack(aabb);
+		}
+	}
+
+	TArray<Math::ECullingKernel> GetTestKernels() {
+		TArray<Math::ECullingKernel> kernels;
+		const Math::ECullingKernel supported = Math::GetSupportedCullingKernel();
+		for(Math::ECullingKernel kernel: { Math::ECullingKernel::Scalar, Math::ECullingKernel::SSE, Math::ECullingKernel::AVX }) {
+			if(kernel <= supported) {
+				kernels.PushBack(kernel);
+			}
+		}
+		return kernels;
+	}
+
+	const char* GetKernelName(Math::ECullingKernel kernel) {
+		switch(kernel) {
+		case Math::ECullingKernel::Scalar: return "Scalar";
+		case Math::ECullingKernel::SSE: return "SSE";
+		case Math::ECullingKernel::AVX: return "AVX";
+		default: return "Auto";
+		}
+	}
+
+	// output buffers of exactly num entries followed by guards, the kernels must not write past num
+	bool CheckGuards(const TArray<uint32>& output, uint32 num) {
+		for(uint32 i = num; i < num + NUM_GUARDS; ++i) {
+			if(GUARD != output[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void TestCullAABBs() {
+		const Math::Frustum frustums[] = { MakeViewFrustum(0.0f), MakeViewFrustum(2.1f), MakeBoxFrustum() };
+		const TArray<Math::ECullingKernel> kernels = GetTestKernels();
+		TArray<Math::AABB3> aabbs;
+		Math::TAABB3SoA<TArray<float>> soa;
+		TArray<uint32> expected, output;
+		uint32 numMismatches = 0, numGuardFailures = 0, numVisibleTotal = 0;
+		for(uint32 num: TEST_SIZES) {
+			BuildBoxes(num * 31 + 1, num + 3, aabbs, soa);
+			for(const Math::Frustum& frustum: frustums) {
+				// unaligned starts as the renderer culls ranges of a larger stream
+				for(uint32 start = 0; start < 3; ++start) {
+					const Math::AABB3Streams streams = soa.GetStreams().Offset(start, num);
+					expected.Reset();
+					for(uint32 i = 0; i < num; ++i) {
+						if(frustum.TestAABBSimple(aabbs[start + i])) {
+							expected.PushBack(i);
+						}
+					}
+					numVisibleTotal += expected.Size();
+					for(Math::ECullingKernel kernel: kernels) {
+						output.Resize(num + NUM_GUARDS);
+						for(uint32& index: output) {
+							index = GUARD;
+						}
+						const uint32 count = Math::CullAABBs(frustum, streams, output.Data(), kernel);
+						bool bMatch = count == expected.Size();
+						for(uint32 i = 0; bMatch && i < count; ++i) {
+							bMatch = output[i] == expected[i];
+						}
+						if(!bMatch) {
+							printf("%s kernel mismatch: %u boxes from %u, %u visible, expected %u\n", GetKernelName(kernel), num, start, count, expected.Size());
+						}
+						numMismatches += !bMatch;
+						numGuardFailures += !CheckGuards(output, num);
+					}
+				}
+			}
+		}
+		TEST_CHECK(0 == numMismatches);
+		TEST_CHECK(0 == numGuardFailures);
+		TEST_CHECK(numVisibleTotal > 0);
+	}
+
+	void TestCullAABBsMultiView() {
+		// views over MAX_CULLING_VIEWS are ignored
+		TArray<Math::Frustum> frustums;
+		for(uint32 v = 0; v < Math::MAX_CULLING_VIEWS + 1; ++v) {
+			frustums.PushBack(v % 4 == 3 ? MakeBoxFrustum() : MakeViewFrustum((float)v * 0.4f));
+		}
+		const TArray<Math::ECullingKernel> kernels = GetTestKernels();
+		TArray<Math::AABB3> aabbs;
+		Math::TAABB3SoA<TArray<float>> soa;
+		TArray<uint32> expected, output;
+		uint32 numMismatches = 0, numGuardFailures = 0;
+		for(uint32 num: TEST_SIZES) {
+			BuildBoxes(num * 17 + 5, num + 1, aabbs, soa);
+			const Math::AABB3Streams streams = soa.GetStreams().Offset(1, num);
+			for(uint32 numViews: { 0u, 1u, 3u, Math::MAX_CULLING_VIEWS, Math::MAX_CULLING_VIEWS + 1 }) {
+				expected.Resize(num);
+				for(uint32 i = 0; i < num; ++i) {
+					expected[i] = 0;
+					for(uint32 v = 0; v < Math::Min(numViews, Math::MAX_CULLING_VIEWS); ++v) {
+						expected[i] |= (frustums[v].TestAABBSimple(aabbs[1 + i]) ? 1u : 0u) << v;
+					}
+				}
+				for(Math::ECullingKernel kernel: kernels) {
+					// the masks are written, not combined with the previous content
+					output.Resize(num + NUM_GUARDS);
+					for(uint32& mask: output) {
+						mask = GUARD;
+					}
+					Math::CullAABBsMultiView(frustums.Data(), numViews, streams, output.Data(), kernel);
+					bool bMatch = true;
+					for(uint32 i = 0; bMatch && i < num; ++i) {
+						bMatch = output[i] == expected[i];
+					}
+					if(!bMatch) {
+						printf("%s kernel mismatch: %u boxes, %u views\n", GetKernelName(kernel), num, numViews);
+					}
+					numMismatches += !bMatch;
+					numGuardFailures += !CheckGuards(output, num);
+				}
+			}
+		}
+		TEST_CHECK(0 == numMismatches);
+		TEST_CHECK(0 == numGuardFailures);
+	}
+
+	void BenchmarkKernels() {
+		constexpr uint32 NUM_BOXES = 100000;
+		constexpr uint32 NUM_ROUNDS = 50;
+		TArray<Math::AABB3> aabbs;
+		Math::TAABB3SoA<TArray<float>> soa;
+		BuildBoxes(3, NUM_BOXES, aabbs, soa);
+		const Math::Frustum frustum = MakeViewFrustum(0.7f);
+		TArray<uint32> output(NUM_BOXES);
+		for(Math::ECullingKernel kernel: GetTestKernels()) {
+			uint32 count = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for(uint32 round = 0; round < NUM_ROUNDS; ++round) {
+				count += Math::CullAABBs(frustum, soa.GetStreams(), output.Data(), kernel);
+			}
+			const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			printf("%s: %.2f ns per box, %u visible\n", GetKernelName(kernel), ms * 1e6 / (NUM_BOXES * NUM_ROUNDS), count / NUM_ROUNDS);
+		}
+	}
+}
+
+int main() {
+	TEST_RUN(TestCullAABBs);
+	TEST_RUN(TestCullAABBsMultiView);
+	TEST_RUN(BenchmarkKernels);
+	return Test::Result();
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include "Render/Public/InstanceCullingCPU.h"
+#include <cmath>
+
+// HLSL types and intrinsics to run the compute shaders as C++. The test CMakeLists copies the shaders with the attributes and
+// semantics C++ can't parse stripped, a test includes a shader in a struct and binds the resources as members of the struct.
+namespace HLSL {
+	typedef uint32_t uint;
+
+	template<typename T, int N> struct Vec;
+
+	// components of a vector picked by a swizzle, e.g. xyz of a float4
+	template<typename T, int N, int... I> struct Swizzle {
+		static constexpr int M = sizeof...(I);
+		T E[N];
+		template<typename U> operator Vec<U, M>() const { return Vec<U, M>((U)E[I]...); }
+		Swizzle& operator=(const Vec<T, M>& v) { int k = 0; ((E[I] = v.E[k++]), ...); return *this; }
+		Swizzle& operator=(const Swizzle& s) { return *this = (Vec<T, M>)s; }
+		Swizzle& operator/=(T s) { ((E[I] /= s), ...); return *this; }
+		Vec<T, M> operator*(T s) const { return (Vec<T, M>)*this * s; }
+	};
+
+	// element wise operators, ADL finds them for a swizzle operand converted to the vector
+	template<typename T, int N> struct VecOps {
+		typedef Vec<T, N> V;
+		template<typename F> static V Map(const V& a, const V& b, F f) { V r; for(int i = 0; i < N; ++i) { r.E[i] = f(a.E[i], b.E[i]); } return r; }
+		friend V operator+(const V& a, const V& b) { return Map(a, b, [](T x, T y) { return x + y; }); }
+		friend V operator-(const V& a, const V& b) { return Map(a, b, [](T x, T y) { return x - y; }); }
+		friend V operator*(const V& a, const V& b) { return Map(a, b, [](T x, T y) { return x * y; }); }
+		friend V operator/(const V& a, const V& b) { return Map(a, b, [](T x, T y) { return x / y; }); }
+		friend V operator+(const V& a, T s) { return a + V(s); }
+		friend V operator-(const V& a, T s) { return a - V(s); }
+		friend V operator*(const V& a, T s) { return a * V(s); }
+		friend V operator*(T s, const V& a) { return V(s) * a; }
+		friend V min(const V& a, const V& b) { return Map(a, b, [](T x, T y) { return y < x ? y : x; }); }
+		friend V max(const V& a, const V& b) { return Map(a, b, [](T x, T y) { return x < y ? y : x; }); }
+		friend V abs(const V& a) { return Map(a, a, [](T x, T) { return x < 0 ? -x : x; }); }
+		friend T dot(const V& a, const V& b) { T r = 0; for(int i = 0; i < N; ++i) { r += a.E[i] * b.E[i]; } return r; }
+	};
+
+	// union members copy as arrays, the vector copies the elements
+#define HLSL_VEC_COMMON(N)\
+	Vec() = default;\
+	Vec(const Vec& v) { *this = v; }\
+	explicit Vec(T s) { for(T& e: E) { e = s; } }\
+	Vec& operator=(const Vec& v) { for(int i = 0; i < N; ++i) { E[i] = v.E[i]; } return *this; }\
+	Vec& operator*=(const Vec& v) { return *this = *this * v; }
+
+	template<typename T> struct Vec<T, 2>: VecOps<T, 2> {
+		union {
+			T E[2];
+			struct { T x, y; };
+			Swizzle<T, 2, 0, 1> xy;
+		};
+		HLSL_VEC_COMMON(2)
+		Vec(T x_, T y_) { x = x_; y = y_; }
+	};
+
+	template<typename T> struct Vec<T, 3>: VecOps<T, 3> {
+		union {
+			T E[3];
+			struct { T x, y, z; };
+			Swizzle<T, 3, 0, 1> xy;
+		};
+		HLSL_VEC_COMMON(3)
+		Vec(T x_, T y_, T z_) { x = x_; y = y_; z = z_; }
+	};
+
+	template<typename T> struct Vec<T, 4>: VecOps<T, 4> {
+		union {
+			T E[4];
+			struct { T x, y, z, w; };
+			Swizzle<T, 4, 0, 1> xy;
+			Swizzle<T, 4, 0, 1, 2> xyz;
+		};
+		HLSL_VEC_COMMON(4)
+		Vec(T x_, T y_, T z_, T w_) { x = x_; y = y_; z = z_; w = w_; }
+		Vec(const Vec<T, 3>& v, T w_) { x = v.x; y = v.y; z = v.z; w = w_; }
+	};
+#undef HLSL_VEC_COMMON
+
+	typedef Vec<float, 2> float2;
+	typedef Vec<float, 3> float3;
+	typedef Vec<float, 4> float4;
+	typedef Vec<uint, 2> uint2;
+	typedef Vec<uint, 3> uint3;
+
+	// column major as the shader compiler packs matrices by default
+	struct float4x4 {
+		float M[16];
+		float Get(int row, int col) const { return M[col * 4 + row]; }
+	};
+
+	inline float4 mul(const float4x4& m, const float4& v) {
+		float4 r;
+		for(int row = 0; row < 4; ++row) {
+			r.E[row] = m.Get(row, 0) * v.x + m.Get(row, 1) * v.y + m.Get(row, 2) * v.z + m.Get(row, 3) * v.w;
+		}
+		return r;
+	}
+
+	template<typename T> T min(T a, T b) { return b < a ? b : a; }
+	template<typename T> T max(T a, T b) { return a < b ? b : a; }
+	inline float step(float y, float x) { return x >= y ? 1.0f : 0.0f; }
+	inline float ceil(float x) { return std::ceil(x); }
+	inline float log2(float x) { return std::log2(x); }
+
+	// threads of a dispatch run one after another, the atomics are plain adds
+	inline void InterlockedAdd(uint& dest, uint value) { dest += value; }
+	inline void InterlockedAdd(uint& dest, uint value, uint& original) { original = dest; dest += value; }
+
+	template<typename T> using ConstantBuffer = T;
+
+	// Out of range reads return zero and writes are dropped, as robust buffer access of the GPU. NumOutOfRange counts them.
+	template<typename T> struct StructuredBuffer {
+		const T* Data{ nullptr };
+		uint Size{ 0 };
+		uint NumOutOfRange{ 0 };
+		T operator[](uint i) { return i < Size ? Data[i] : (++NumOutOfRange, T{}); }
+	};
+
+	template<typename T> struct RWStructuredBuffer {
+		T* Data{ nullptr };
+		uint Size{ 0 };
+		uint NumOutOfRange{ 0 };
+		T Dropped{};
+		T& operator[](uint i) { return i < Size ? Data[i] : (++NumOutOfRange, Dropped = T{}); }
+	};
+
+	struct SamplerState {};
+
+	// the HZB read by the culling shader, sampled as its point clamp sampler
+	template<typename T> struct Texture2D {
+		const Render::HZBCPU* HZB{ nullptr };
+		T SampleLevel(SamplerState, const float2& uv, float mip) const { return HZB->Sample(uv.x, uv.y, (uint)mip); }
+		void GetDimensions(uint mip, uint& width, uint& height, uint& numLevels) const {
+			width = height = max(HZB->GetSize() >> mip, 1u);
+			numLevels = HZB->GetMipSize();
+		}
+	};
+}
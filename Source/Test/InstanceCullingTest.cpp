@@ -0,0 +1,337 @@
+#include "TestCommon.h"
+#include "Render/Public/InstanceCullingCPU.h"
+#include "Math/Public/Math.h"
+#include "System/Public/ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+#include "HLSLCpp.h"
+
+namespace HLSL {
+	// InstanceCulling.hlsl as the renderer compiles it without and with the HZB
+	struct InstanceCullingCS {
+#include "InstanceCulling.hlsl"
+	};
+#define OCCLUSION_TEST
+	struct InstanceCullingOcclusionCS {
+#include "InstanceCulling.hlsl"
+	};
+#undef OCCLUSION_TEST
+}
+
+namespace {
+	using Render::InstanceCullingAABB;
+	using Render::InstanceCullingCluster;
+	using Render::InstanceCullingCapture;
+
+	// the buffers are uploaded as bytes
+	static_assert(sizeof(HLSL::InstanceCullingCS::CameraInfo) == sizeof(Render::InstanceCullingParams));
+	static_assert(sizeof(HLSL::InstanceCullingCS::AABBData) == sizeof(InstanceCullingAABB));
+	static_assert(sizeof(HLSL::InstanceCullingCS::ClusterData) == sizeof(InstanceCullingCluster));
+	static_assert(sizeof(HLSL::InstanceCullingCS::IndirectDrawBuffer) == sizeof(DrawIndexedIndirectCommand));
+
+	constexpr uint32 SRV_ALIGNMENT = 4;
+	constexpr float CAMERA_NEAR = 0.5f;
+	constexpr float CAMERA_FAR = 200.0f;
+
+	uint32 Random(uint32& seed, uint32 range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	float RandomFloat(uint32& seed, float min, float max) {
+		return min + (max - min) * (float)Random(seed, 65536) / 65535.0f;
+	}
+
+	template<typename T, typename U> void BindBuffer(T& buffer, U* data, uint32 size) {
+		static_assert(sizeof(*buffer.Data) == sizeof(U));
+		buffer.Data = (decltype(buffer.Data))data;
+		buffer.Size = size;
+	}
+
+	// Runs the shader one thread after another, the thread order is shuffled as the atomics of the GPU decide the write order.
+	template<typename Shader> void DispatchShader(Shader& shader, const InstanceCullingCapture& capture, uint32 seed, TArray<DrawIndexedIndirectCommand>& cmds, TArray<uint32>& instanceIDs) {
+		memcpy((void*)&shader.uParams, &capture.Params, sizeof(capture.Params));
+		BindBuffer(shader.uInstanceAABBs, capture.InstanceAABBs.Data(), capture.InstanceAABBs.Size());
+		BindBuffer(shader.uClusterAABBs, capture.ClusterAABBs.Data(), capture.ClusterAABBs.Size());
+		BindBuffer(shader.uClusterData, capture.Clusters.Data(), capture.Clusters.Size());
+		BindBuffer(shader.uIndirectDrawCmds, cmds.Data(), cmds.Size());
+		BindBuffer(shader.uInstanceIDs, instanceIDs.Data(), instanceIDs.Size());
+		const uint32 numThreads = (capture.Params.NumClusters + NUM_THREAD_PER_GROUP - 1) / NUM_THREAD_PER_GROUP * NUM_THREAD_PER_GROUP;
+		TArray<uint32> threads(numThreads);
+		for(uint32 i = 0; i < numThreads; ++i) {
+			threads[i] = i;
+		}
+		for(uint32 i = numThreads; i > 1; --i) {
+			std::swap(threads[i - 1], threads[Random(seed, i)]);
+		}
+		for(uint32 tIndex: threads) {
+			shader.MainCS(HLSL::uint3(tIndex, 0, 0));
+		}
+		TEST_CHECK(0 == shader.uInstanceAABBs.NumOutOfRange && 0 == shader.uClusterAABBs.NumOutOfRange && 0 == shader.uClusterData.NumOutOfRange);
+		TEST_CHECK(0 == shader.uIndirectDrawCmds.NumOutOfRange && 0 == shader.uInstanceIDs.NumOutOfRange);
+	}
+
+	void RunShader(const InstanceCullingCapture& capture, const Render::HZBCPU* hzb, uint32 seed, TArray<DrawIndexedIndirectCommand>& cmds, TArray<uint32>& instanceIDs) {
+		if(hzb) {
+			HLSL::InstanceCullingOcclusionCS shader;
+			shader.uHZB.HZB = hzb;
+			DispatchShader(shader, capture, seed, cmds, instanceIDs);
+		}
+		else {
+			HLSL::InstanceCullingCS shader;
+			DispatchShader(shader, capture, seed, cmds, instanceIDs);
+		}
+	}
+
+	struct CullingResult {
+		TArray<DrawIndexedIndirectCommand> Cmds;
+		TArray<uint32> InstanceIDs;
+	};
+
+	// the same commands, and the same set of IDs in the range of each primitive group
+	void CompareResults(const InstanceCullingCapture& capture, const CullingResult& cpu, const CullingResult& gpu) {
+		TEST_CHECK(cpu.Cmds.Size() == gpu.Cmds.Size());
+		for(uint32 i = 0; i < cpu.Cmds.Size() && i < gpu.Cmds.Size(); ++i) {
+			TEST_CHECK(cpu.Cmds[i].InstanceCount == gpu.Cmds[i].InstanceCount);
+			TEST_CHECK(cpu.Cmds[i].IndexCount == gpu.Cmds[i].IndexCount);
+		}
+		TArray<bool> checkedPrimitives(capture.IndirectCmds.Size(), false);
+		for(uint32 i = 0; i < capture.Params.NumClusters; ++i) {
+			const InstanceCullingCluster& cluster = capture.Clusters[i];
+			if(checkedPrimitives[cluster.PrimitiveStart]) {
+				continue;
+			}
+			checkedPrimitives[cluster.PrimitiveStart] = true;
+			const uint32 count = gpu.Cmds[cluster.PrimitiveStart].InstanceCount;
+			TEST_CHECK(cluster.DstInstanceOffset + count <= capture.NumInstanceIDs);
+			if(cluster.DstInstanceOffset + count > capture.NumInstanceIDs) {
+				continue;
+			}
+			TArray<uint32> cpuIDs(count), gpuIDs(count);
+			memcpy(cpuIDs.Data(), cpu.InstanceIDs.Data() + cluster.DstInstanceOffset, count * sizeof(uint32));
+			memcpy(gpuIDs.Data(), gpu.InstanceIDs.Data() + cluster.DstInstanceOffset, count * sizeof(uint32));
+			std::sort(cpuIDs.begin(), cpuIDs.end());
+			std::sort(gpuIDs.begin(), gpuIDs.end());
+			TEST_CHECK(std::equal(cpuIDs.begin(), cpuIDs.end(), gpuIDs.begin()));
+			TEST_CHECK(std::adjacent_find(gpuIDs.begin(), gpuIDs.end()) == gpuIDs.end());
+			TEST_CHECK(std::find(gpuIDs.begin(), gpuIDs.end(), INVALID_INDEX) == gpuIDs.end());
+		}
+	}
+
+	// run InstanceCullingCPU and InstanceCulling.hlsl on a capture, return the visible count of the first primitives
+	uint32 CullAndCompare(const InstanceCullingCapture& capture, uint32 seed) {
+		Render::HZBCPU hzb;
+		if(capture.Depth.Size()) {
+			hzb.Build(capture.Depth.Data(), capture.DepthWidth, capture.DepthHeight);
+		}
+		const Render::HZBCPU* hzbPtr = hzb.GetMipSize() ? &hzb : nullptr;
+		CullingResult cpu, gpu;
+		for(CullingResult* result: { &cpu, &gpu }) {
+			result->Cmds = capture.IndirectCmds;
+			result->InstanceIDs.Resize(capture.NumInstanceIDs, INVALID_INDEX);
+		}
+		Render::InstanceCullingCPU culling;
+		culling.Cull(capture.Params, hzbPtr, capture.InstanceAABBs, capture.ClusterAABBs, capture.Clusters, cpu.Cmds, cpu.InstanceIDs);
+		RunShader(capture, hzbPtr, seed, gpu.Cmds, gpu.InstanceIDs);
+		CompareResults(capture, cpu, gpu);
+
+		uint32 numVisible = 0;
+		TArray<bool> countedPrimitives(capture.IndirectCmds.Size(), false);
+		for(const InstanceCullingCluster& cluster: capture.Clusters) {
+			if(!countedPrimitives[cluster.PrimitiveStart]) {
+				countedPrimitives[cluster.PrimitiveStart] = true;
+				numVisible += gpu.Cmds[cluster.PrimitiveStart].InstanceCount;
+			}
+		}
+		return numVisible;
+	}
+
+	// camera at the origin turned by yaw around y, frustum as Object::Camera builds it
+	void SetupView(InstanceCullingCapture& capture, float yaw) {
+		const Math::FVector3 eye{ 0.0f, 0.0f, 0.0f };
+		const Math::FVector3 front{ std::sin(yaw), 0.0f, std::cos(yaw) };
+		const Math::FVector3 up{ 0.0f, 1.0f, 0.0f };
+		const Math::FVector3 right = up.Cross(front).Normalize();
+		const float fov = Math::PI * 0.4f;
+		const float aspect = 2.0f;
+		const float halfHeight = CAMERA_FAR * std::tan(fov * 0.5f);
+		const float halfWidth = halfHeight * aspect;
+		const Math::FVector3 frontVec = front * CAMERA_FAR;
+		const Math::FVector3 rightVec = right * halfWidth;
+		const Math::FVector3 upVec = up * halfHeight;
+		Math::Frustum& frustum = capture.Params.Frustum;
+		frustum.Near = { eye + front * CAMERA_NEAR, front };
+		frustum.Far = { eye + frontVec, -front };
+		frustum.Left = { eye, up.Cross((frontVec - rightVec).Normalize()) };
+		frustum.Right = { eye, (frontVec + rightVec).Normalize().Cross(up) };
+		frustum.Bottom = { eye, (frontVec - upVec).Normalize().Cross(right) };
+		frustum.Top = { eye, right.Cross((frontVec + upVec).Normalize()) };
+		capture.Params.ViewProjectMatrix = Math::FMatrix4x4::PerspectiveMatrix(fov, aspect, CAMERA_NEAR, CAMERA_FAR) * Math::FMatrix4x4::LookAtMatrix(eye, eye + front, up);
+	}
+
+	// far depth with an occluder in the left half of the screen, at the view depth of the occluder
+	void SetupDepth(InstanceCullingCapture& capture, uint32 width, uint32 height, float occluderDepth) {
+		capture.DepthWidth = width;
+		capture.DepthHeight = height;
+		capture.Depth.Resize(width * height, 1.0f);
+		const float ndcDepth = CAMERA_FAR / (CAMERA_FAR - CAMERA_NEAR) - CAMERA_FAR * CAMERA_NEAR / ((CAMERA_FAR - CAMERA_NEAR) * occluderDepth);
+		for(uint32 y = 0; y < height; ++y) {
+			for(uint32 x = 0; x < width / 2; ++x) {
+				capture.Depth[y * width + x] = ndcDepth;
+			}
+		}
+		Render::HZBCPU hzb;
+		hzb.Build(capture.Depth.Data(), width, height);
+		const USize2D actualSize = hzb.GetActualSize();
+		capture.Params.HZBSizeScale.X = (float)actualSize.w / (float)hzb.GetSize();
+		capture.Params.HZBSizeScale.Y = (float)actualSize.h / (float)hzb.GetSize();
+	}
+
+	// instance groups laid out as UpdateGPUBuffers of the GPU driven renderer: leaf clusters of up to 16 instances,
+	// instance ranges local to the group, ID ranges aligned per group and shared by the primitives of the group
+	void BuildScene(InstanceCullingCapture& capture, uint32 seed, uint32 numGroups) {
+		uint32 numInstanceIDs = 0;
+		for(uint32 group = 0; group < numGroups; ++group) {
+			const uint32 clusterOffset = capture.ClusterAABBs.Size();
+			const uint32 instanceOffset = capture.InstanceAABBs.Size();
+			const uint32 primitiveStart = capture.IndirectCmds.Size();
+			const uint32 primitiveCount = 1 + Random(seed, 3);
+			for(uint32 i = 0; i < primitiveCount; ++i) {
+				capture.IndirectCmds.PushBack({ 36 * (i + 1), 0, 0, 0, 0 });
+			}
+			const uint32 numClusters = 8 + Random(seed, 64);
+			uint32 numInstances = 0;
+			for(uint32 c = 0; c < numClusters; ++c) {
+				// clusters are spread around the camera, small ones are often inside the frustum as a whole
+				const Math::FVector3 center{ RandomFloat(seed, -150.0f, 150.0f), RandomFloat(seed, -20.0f, 20.0f), RandomFloat(seed, -50.0f, 180.0f) };
+				const float radius = RandomFloat(seed, 0.5f, 12.0f);
+				const uint32 clusterSize = 1 + Random(seed, NUM_INSTANCE_PER_CLUSTER);
+				Math::FVector3 clusterMin{ FLT_MAX, FLT_MAX, FLT_MAX };
+				Math::FVector3 clusterMax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+				for(uint32 i = 0; i < clusterSize; ++i) {
+					const Math::FVector3 position = center + Math::FVector3{ RandomFloat(seed, -radius, radius), RandomFloat(seed, -radius, radius), RandomFloat(seed, -radius, radius) };
+					const float size = RandomFloat(seed, 0.1f, 1.0f);
+					const Math::FVector3 min = position - Math::FVector3{ size, size, size };
+					const Math::FVector3 max = position + Math::FVector3{ size, size, size };
+					capture.InstanceAABBs.PushBack({ { min.X, min.Y, min.Z, 1.0f }, { max.X, max.Y, max.Z, 1.0f } });
+					clusterMin = { std::min(clusterMin.X, min.X), std::min(clusterMin.Y, min.Y), std::min(clusterMin.Z, min.Z) };
+					clusterMax = { std::max(clusterMax.X, max.X), std::max(clusterMax.Y, max.Y), std::max(clusterMax.Z, max.Z) };
+				}
+				capture.ClusterAABBs.PushBack({ { clusterMin.X, clusterMin.Y, clusterMin.Z, (float)numInstances }, { clusterMax.X, clusterMax.Y, clusterMax.Z, (float)(numInstances + clusterSize) } });
+				numInstances += clusterSize;
+				capture.Clusters.PushBack({ clusterOffset + c, instanceOffset, numInstanceIDs, primitiveStart, primitiveCount });
+			}
+			numInstanceIDs += (numInstances + SRV_ALIGNMENT - 1) / SRV_ALIGNMENT * SRV_ALIGNMENT;
+		}
+		capture.NumInstanceIDs = numInstanceIDs;
+		capture.Params.NumClusters = capture.Clusters.Size();
+	}
+
+	// random scenes and views, with and without the occlusion test
+	void TestRandomScenes() {
+		uint32 seed = 99;
+		uint32 numFrustumVisibleTotal = 0, numVisibleTotal = 0;
+		for(uint32 scene = 0; scene < 10; ++scene) {
+			InstanceCullingCapture capture;
+			BuildScene(capture, Random(seed, 100000), 1 + Random(seed, 6));
+			for(uint32 view = 0; view < 8; ++view) {
+				SetupView(capture, RandomFloat(seed, -Math::PI, Math::PI));
+				capture.Depth.Reset();
+				const uint32 numFrustumVisible = CullAndCompare(capture, Random(seed, 100000));
+				SetupDepth(capture, 256, 128, RandomFloat(seed, 5.0f, 80.0f));
+				const uint32 numVisible = CullAndCompare(capture, Random(seed, 100000));
+				TEST_CHECK(numVisible <= numFrustumVisible);
+				numFrustumVisibleTotal += numFrustumVisible;
+				numVisibleTotal += numVisible;
+			}
+		}
+		// the views see instances and the occluders hide some of them
+		TEST_CHECK(numVisibleTotal > 0 && numVisibleTotal < numFrustumVisibleTotal);
+	}
+
+	// an occluder in the left half hides the instances behind it, an occluder behind them hides none
+	void TestOcclusion() {
+		InstanceCullingCapture capture;
+		// one cluster per instance, on a row from the left to the right of the screen at depth 30
+		capture.IndirectCmds.PushBack({ 36, 0, 0, 0, 0 });
+		constexpr uint32 NUM_INSTANCES = 16;
+		for(uint32 i = 0; i < NUM_INSTANCES; ++i) {
+			const float x = -40.0f + 80.0f * ((float)i + 0.5f) / (float)NUM_INSTANCES;
+			const Math::FVector4 min{ x - 0.5f, -0.5f, 29.5f, (float)i };
+			const Math::FVector4 max{ x + 0.5f, 0.5f, 30.5f, (float)(i + 1) };
+			capture.InstanceAABBs.PushBack({ { min.X, min.Y, min.Z, 1.0f }, { max.X, max.Y, max.Z, 1.0f } });
+			capture.ClusterAABBs.PushBack({ min, max });
+			capture.Clusters.PushBack({ i, 0, 0, 0, 1 });
+		}
+		capture.NumInstanceIDs = NUM_INSTANCES;
+		capture.Params.NumClusters = NUM_INSTANCES;
+		SetupView(capture, 0.0f);
+		TEST_CHECK(CullAndCompare(capture, 1) == NUM_INSTANCES);
+		SetupDepth(capture, 256, 128, 60.0f);
+		TEST_CHECK(CullAndCompare(capture, 2) == NUM_INSTANCES);
+		SetupDepth(capture, 256, 128, 10.0f);
+		TEST_CHECK(CullAndCompare(capture, 3) == NUM_INSTANCES / 2);
+	}
+
+	// a capture saved and loaded back culls the same
+	void TestCaptureFile() {
+		InstanceCullingCapture capture;
+		BuildScene(capture, 5, 3);
+		SetupView(capture, 0.3f);
+		SetupDepth(capture, 128, 64, 20.0f);
+		const char* filePath = "InstanceCullingTest.iccap";
+		TEST_CHECK(capture.Save(filePath));
+		InstanceCullingCapture loaded;
+		TEST_CHECK(loaded.Load(filePath));
+		File::RemoveFile(filePath);
+		TEST_CHECK(0 == memcmp(&loaded.Params, &capture.Params, sizeof(Render::InstanceCullingParams)));
+		TEST_CHECK(loaded.InstanceAABBs.Size() == capture.InstanceAABBs.Size() && loaded.ClusterAABBs.Size() == capture.ClusterAABBs.Size());
+		TEST_CHECK(loaded.Clusters.Size() == capture.Clusters.Size() && loaded.IndirectCmds.Size() == capture.IndirectCmds.Size());
+		TEST_CHECK(loaded.NumInstanceIDs == capture.NumInstanceIDs);
+		TEST_CHECK(loaded.Depth.Size() == capture.Depth.Size() && std::equal(loaded.Depth.begin(), loaded.Depth.end(), capture.Depth.begin()) && loaded.DepthWidth == capture.DepthWidth && loaded.DepthHeight == capture.DepthHeight);
+		TEST_CHECK(CullAndCompare(loaded, 4) == CullAndCompare(capture, 4));
+	}
+
+	uint32 CompareCaptures(const File::FPath& captureDir) {
+		uint32 numCaptures = 0;
+		for(const File::DirEntry& entry: File::DirIterator(captureDir)) {
+			if(entry.path().extension() != ".iccap") {
+				continue;
+			}
+			InstanceCullingCapture capture;
+			const bool loaded = capture.Load(entry.path().string().c_str());
+			TEST_CHECK(loaded);
+			if(loaded) {
+				CullAndCompare(capture, numCaptures);
+				++numCaptures;
+			}
+		}
+		printf("%u scenes compared in %s\n", numCaptures, captureDir.string().c_str());
+		return numCaptures;
+	}
+
+	// Captures committed in Test/Data, and the ones recorded with Rendering.InstanceCullingCaptureFrame in the working directory if any.
+	void TestRecordedScenes() {
+		const File::FPath fixtureDir = File::FPath{ TEST_DATA_DIR } / "InstanceCullingCaptures";
+		TEST_CHECK(File::IsFolder(fixtureDir));
+		if(File::IsFolder(fixtureDir)) {
+			TEST_CHECK(CompareCaptures(fixtureDir) > 0);
+		}
+		const File::FPath recordedDir{ "InstanceCullingCaptures" };
+		if(File::IsFolder(recordedDir)) {
+			CompareCaptures(recordedDir);
+		}
+	}
+}
+
+int main() {
+	// InstanceCullingCPU culls on the workers
+	Engine::XXThreadPool::Initialize();
+	TEST_RUN(TestRandomScenes);
+	TEST_RUN(TestOcclusion);
+	TEST_RUN(TestCaptureFile);
+	TEST_RUN(TestRecordedScenes);
+	Engine::XXThreadPool::Release();
+	return Test::Result();
+}
@@ -0,0 +1,227 @@
+#include "TestCommon.h"
+#include "Objects/Public/InstanceDataMgr.h"
+#include "Math/Public/Math.h"
+#include "System/Public/ThreadPool.h"
+#include <chrono>
+#include <cmath>
+
+namespace {
+	constexpr float LEVEL_SIZE = 4000.0f;
+	constexpr uint32 NUM_GROUPS = 200;
+
+	uint32 Random(uint32& seed, uint32 range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	float RandomFloat(uint32& seed, float min, float max) {
+		return min + (max - min) * (float)Random(seed, 65536) / 65535.0f;
+	}
+
+	const char* GetBuildName(Engine::EClusterTreeBuild buildMethod) {
+		return Engine::EClusterTreeBuild::MedianSplit == buildMethod ? "median" : "SAH";
+	}
+
+	// foliage like instances, 3/4 of them in dense groups and the others scattered over the level
+	TArray<Math::FTransform> MakeInstances(uint32 seed, uint32 num) {
+		const float halfLevel = LEVEL_SIZE * 0.5f;
+		TArray<Math::FVector3> groupCenters;
+		for(uint32 i = 0; i < NUM_GROUPS; ++i) {
+			groupCenters.PushBack(Math::FVector3{ RandomFloat(seed, -halfLevel, halfLevel), 0.0f, RandomFloat(seed, -halfLevel, halfLevel) });
+		}
+		TArray<Math::FTransform> transforms(num);
+		for(Math::FTransform& transform: transforms) {
+			if(Random(seed, 4)) {
+				const Math::FVector3& center = groupCenters[Random(seed, NUM_GROUPS)];
+				// sum of uniforms as a rough gaussian
+				const float x = RandomFloat(seed, -20.0f, 20.0f) + RandomFloat(seed, -20.0f, 20.0f) + RandomFloat(seed, -20.0f, 20.0f);
+				const float z = RandomFloat(seed, -20.0f, 20.0f) + RandomFloat(seed, -20.0f, 20.0f) + RandomFloat(seed, -20.0f, 20.0f);
+				transform.Position = center + Math::FVector3{ x, 0.0f, z };
+			}
+			else {
+				transform.Position = { RandomFloat(seed, -halfLevel, halfLevel), 0.0f, RandomFloat(seed, -halfLevel, halfLevel) };
+			}
+			const float scale = RandomFloat(seed, 0.5f, 3.0f);
+			transform.Scale = { scale, scale, scale };
+		}
+		return transforms;
+	}
+
+	Math::Frustum MakeViewFrustum(uint32& seed) {
+		const float halfLevel = LEVEL_SIZE * 0.5f;
+		const Math::FVector3 eye{ RandomFloat(seed, -halfLevel, halfLevel), 10.0f, RandomFloat(seed, -halfLevel, halfLevel) };
+		const float yaw = RandomFloat(seed, 0.0f, 2.0f * Math::PI);
+		const float farDistance = 600.0f;
+		const Math::FVector3 front{ std::sin(yaw), 0.0f, std::cos(yaw) };
+		const Math::FVector3 up{ 0.0f, 1.0f, 0.0f };
+		const Math::FVector3 right = up.Cross(front).Normalize();
+		const float halfHeight = farDistance * std::tan(Math::PI * 0.2f);
+		const Math::FVector3 frontVec = front * farDistance;
+		const Math::FVector3 rightVec = right * halfHeight * 1.8f;
+		const Math::FVector3 upVec = up * halfHeight;
+		Math::Frustum frustum;
+		frustum.Near = { eye + front * 0.5f, front };
+		frustum.Far = { eye + frontVec, -front };
+		frustum.Left = { eye, up.Cross((frontVec - rightVec).Normalize()) };
+		frustum.Right = { eye, (frontVec + rightVec).Normalize().Cross(up) };
+		frustum.Bottom = { eye, (frontVec - upVec).Normalize().Cross(right) };
+		frustum.Top = { eye, right.Cross((frontVec + upVec).Normalize()) };
+		return frustum;
+	}
+
+	// Compare GenerateInstanceID with testing the instance of every slot in the leaves, returns the number of mismatches.
+	// Draw ranges must cover all visible slots, outNumDrawn is the number of slots in the ranges.
+	uint32 CompareBruteForce(Object::InstanceDataMgr& mgr, const Math::Frustum& frustum, uint32& outNumVisible, uint32& outNumDrawn) {
+		const TConstArrayView<Object::InstanceDataMgr::ClusterNode> clusters = mgr.GetClusters();
+		const TConstArrayView<Math::AABB3> aabbs = mgr.GetInstanceAABBs();
+		// 0 for hidden, 1 for visible, 2 for visible and output
+		TArray<uint8> states(aabbs.Size());
+		for(uint8& state: states) {
+			state = 0;
+		}
+		uint32 numVisible = 0;
+		for(const Object::InstanceDataMgr::ClusterNode& cluster: clusters) {
+			if(!cluster.HasChild()) {
+				for(uint32 slot = cluster.InstanceStart; slot < cluster.InstanceEnd; ++slot) {
+					if(frustum.TestAABBSimple(aabbs[slot])) {
+						states[slot] = 1;
+						++numVisible;
+					}
+				}
+			}
+		}
+		uint32 numMismatches = 0;
+		TFrameArray<uint32> instanceIDs;
+		mgr.GenerateInstanceID(frustum, instanceIDs);
+		for(uint32 slot: instanceIDs) {
+			// hidden, freed or output twice
+			if(slot >= states.Size() || 1 != states[slot]) {
+				++numMismatches;
+				continue;
+			}
+			states[slot] = 2;
+		}
+		numMismatches += instanceIDs.Size() != numVisible;
+
+		TArray<Object::InstanceDrawRange> ranges;
+		mgr.GenerateDrawRanges(frustum, ranges);
+		uint32 numDrawn = 0;
+		for(const Object::InstanceDrawRange& range: ranges) {
+			numDrawn += range.InstanceEnd - range.InstanceStart;
+			for(uint32 slot = range.InstanceStart; slot < range.InstanceEnd && slot < states.Size(); ++slot) {
+				states[slot] = states[slot] ? 3 : 0;
+			}
+		}
+		for(uint8 state: states) {
+			numMismatches += 1 == state || 2 == state; // visible but not in the ranges
+		}
+		outNumVisible = numVisible;
+		outNumDrawn = numDrawn;
+		return numMismatches;
+	}
+
+	// Instances culled by the tree of either builder are the ones a linear scan finds, after building and after edits.
+	void TestGenerateInstanceID() {
+		const Math::AABB3 resAABB = Math::AABB3::MinMax({ -1.0f, 0.0f, -1.0f }, { 1.0f, 4.0f, 1.0f });
+		for(Engine::EClusterTreeBuild buildMethod: { Engine::EClusterTreeBuild::MedianSplit, Engine::EClusterTreeBuild::BinnedSAH }) {
+			uint32 seed = 17;
+			TArray<Math::FTransform> transforms = MakeInstances(seed, 30000);
+			Object::InstanceDataMgr mgr;
+			mgr.SetClusterTreeBuild(buildMethod);
+			mgr.Build(resAABB, transforms);
+			TEST_CHECK(mgr.GetNumInstances() == transforms.Size());
+			uint32 numMismatches = 0, numVisibleTotal = 0, numVisible, numDrawn;
+			for(uint32 view = 0; view < 16; ++view) {
+				FrameAllocator::BeginFrame();
+				numMismatches += CompareBruteForce(mgr, MakeViewFrustum(seed), numVisible, numDrawn);
+				numVisibleTotal += numVisible;
+			}
+
+			// move, add and remove instances, then let FlushUpdates decide whether to rebuild
+			TArray<uint32> handles;
+			for(uint32 i = 0; i < transforms.Size(); ++i) {
+				handles.PushBack(i);
+			}
+			const TArray<Math::FTransform> newTransforms = MakeInstances(seed + 1, 6000);
+			for(uint32 i = 0; i < 2000; ++i) {
+				mgr.UpdateInstance(handles[Random(seed, handles.Size())], newTransforms[i]);
+			}
+			for(uint32 i = 0; i < 2000; ++i) {
+				const uint32 idx = Random(seed, handles.Size());
+				mgr.RemoveInstance(handles[idx]);
+				handles.SwapRemoveAt(idx);
+			}
+			for(uint32 i = 2000; i < 6000; ++i) {
+				handles.PushBack(mgr.AddInstance(newTransforms[i]));
+			}
+			mgr.FlushUpdates();
+			TEST_CHECK(mgr.GetNumInstances() == handles.Size());
+			for(uint32 view = 0; view < 16; ++view) {
+				FrameAllocator::BeginFrame();
+				numMismatches += CompareBruteForce(mgr, MakeViewFrustum(seed), numVisible, numDrawn);
+				numVisibleTotal += numVisible;
+			}
+			if(numMismatches) {
+				printf("%s: %u mismatches\n", GetBuildName(buildMethod), numMismatches);
+			}
+			TEST_CHECK(0 == numMismatches);
+			TEST_CHECK(numVisibleTotal > 0);
+		}
+	}
+
+	// Build time and cull efficiency of the median split and the binned SAH builders on the same instances.
+	// Leaf area is the sum of leaf surface areas, drawn/visible is the ratio of instances in the draw ranges to the visible ones.
+	void BenchmarkBuilders() {
+		constexpr uint32 NUM_INSTANCES = 200000;
+		constexpr uint32 NUM_VIEWS = 64;
+		const Math::AABB3 resAABB = Math::AABB3::MinMax({ -1.0f, 0.0f, -1.0f }, { 1.0f, 4.0f, 1.0f });
+		const TArray<Math::FTransform> transforms = MakeInstances(29, NUM_INSTANCES);
+		uint32 numVisibleOfBuilds[2] = { 0, 0 };
+		uint32 buildIndex = 0;
+		for(Engine::EClusterTreeBuild buildMethod: { Engine::EClusterTreeBuild::MedianSplit, Engine::EClusterTreeBuild::BinnedSAH }) {
+			Object::InstanceDataMgr mgr;
+			mgr.SetClusterTreeBuild(buildMethod);
+			const auto buildStart = std::chrono::steady_clock::now();
+			mgr.Build(resAABB, transforms);
+			const double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+			uint32 numLeaves = 0;
+			double leafArea = 0.0;
+			for(const Object::InstanceDataMgr::ClusterNode& cluster: mgr.GetClusters()) {
+				if(!cluster.HasChild() && !cluster.IsEmpty()) {
+					const Math::FVector3 size = cluster.AABB.Max - cluster.AABB.Min;
+					leafArea += 2.0 * (size.X * size.Y + size.Y * size.Z + size.Z * size.X);
+					++numLeaves;
+				}
+			}
+			uint32 seed = 31;
+			uint32 numVisible = 0, numDrawn = 0, numMismatches = 0;
+			double cullMs = 0.0;
+			for(uint32 view = 0; view < NUM_VIEWS; ++view) {
+				FrameAllocator::BeginFrame();
+				const Math::Frustum frustum = MakeViewFrustum(seed);
+				const auto cullStart = std::chrono::steady_clock::now();
+				TFrameArray<uint32> instanceIDs;
+				mgr.GenerateInstanceID(frustum, instanceIDs);
+				cullMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cullStart).count();
+				uint32 viewVisible, viewDrawn;
+				numMismatches += CompareBruteForce(mgr, frustum, viewVisible, viewDrawn);
+				numVisible += viewVisible;
+				numDrawn += viewDrawn;
+			}
+			printf("%s: build %.1f ms, %u leaves, leaf area %.3g, IDs %.3f ms per view, drawn/visible %.3f\n",
+				GetBuildName(buildMethod), buildMs, numLeaves, leafArea, cullMs / NUM_VIEWS, numVisible ? (double)numDrawn / numVisible : 0.0);
+			TEST_CHECK(0 == numMismatches);
+			numVisibleOfBuilds[buildIndex++] = numVisible;
+		}
+		TEST_CHECK(numVisibleOfBuilds[0] == numVisibleOfBuilds[1]);
+	}
+}
+
+int main() {
+	// builds run on workers
+	Engine::XXThreadPool::Initialize();
+	TEST_RUN(TestGenerateInstanceID);
+	TEST_RUN(BenchmarkBuilders);
+	Engine::XXThreadPool::Release();
+	return Test::Result();
+}
@@ -0,0 +1,148 @@
+#include "TestCommon.h"
+#include "Render/Public/RenderGraphResourcePool.h"
+#include "Math/Public/Math.h"
+
+namespace {
+	bool IsOverlapped(const Render::RGTransientResource& a, const Render::RGTransientResource& b) {
+		return a.FirstUse <= b.LastUse && b.FirstUse <= a.LastUse;
+	}
+
+	// resources sharing a slot have the same key and never overlap
+	void CheckSlotsDisjoint(const Render::RGTransientPlacement& placement, const TArray<Render::RGTransientResource>& resources) {
+		for(uint32 i = 0; i < resources.Size(); ++i) {
+			const uint32 slot = placement.GetResourceSlot(i);
+			TEST_CHECK(slot < placement.GetSlots().Size());
+			TEST_CHECK(placement.GetSlots()[slot].Key == resources[i].Key);
+			TEST_CHECK(placement.GetSlots()[slot].Size >= resources[i].Size);
+			for(uint32 j = i + 1; j < resources.Size(); ++j) {
+				if(placement.GetResourceSlot(j) == slot) {
+					TEST_CHECK(!IsOverlapped(resources[i], resources[j]));
+				}
+			}
+		}
+	}
+
+	void TestEmpty() {
+		Render::RGTransientPlacement placement;
+		placement.Place({});
+		TEST_CHECK(placement.GetSlots().IsEmpty());
+		TEST_CHECK(placement.GetNaiveSize() == 0);
+		TEST_CHECK(placement.GetAllocatedSize() == 0);
+		TEST_CHECK(placement.GetPeakSize() == 0);
+	}
+
+	// a resource last used in the step another is first used cannot share its slot
+	void TestChain() {
+		const TArray<Render::RGTransientResource> resources = {
+			{ 0, 100, 0, 1 },
+			{ 0, 100, 1, 2 },
+			{ 0, 100, 2, 3 },
+			{ 0, 100, 3, 4 },
+		};
+		Render::RGTransientPlacement placement;
+		placement.Place(resources);
+		CheckSlotsDisjoint(placement, resources);
+		TEST_CHECK(placement.GetSlots().Size() == 2);
+		TEST_CHECK(placement.GetResourceSlot(0) == placement.GetResourceSlot(2));
+		TEST_CHECK(placement.GetResourceSlot(1) == placement.GetResourceSlot(3));
+		TEST_CHECK(placement.GetNaiveSize() == 400);
+		TEST_CHECK(placement.GetAllocatedSize() == 200);
+		TEST_CHECK(placement.GetPeakSize() == 200);
+	}
+
+	// resources of different keys never share a slot, a shared slot grows to its largest resource
+	void TestKeysAndSizes() {
+		const TArray<Render::RGTransientResource> resources = {
+			{ 0, 100, 0, 0 },
+			{ 1, 400, 1, 1 },
+			{ 0, 300, 2, 2 },
+			{ 1, 200, 3, 3 },
+		};
+		Render::RGTransientPlacement placement;
+		placement.Place(resources);
+		CheckSlotsDisjoint(placement, resources);
+		TEST_CHECK(placement.GetSlots().Size() == 2);
+		TEST_CHECK(placement.GetResourceSlot(0) == placement.GetResourceSlot(2));
+		TEST_CHECK(placement.GetResourceSlot(1) == placement.GetResourceSlot(3));
+		TEST_CHECK(placement.GetSlots()[placement.GetResourceSlot(0)].Size == 300);
+		TEST_CHECK(placement.GetSlots()[placement.GetResourceSlot(1)].Size == 400);
+		TEST_CHECK(placement.GetNaiveSize() == 1000);
+		TEST_CHECK(placement.GetAllocatedSize() == 700);
+		TEST_CHECK(placement.GetPeakSize() == 400);
+	}
+
+	// the slots of a key equal the max number of its resources alive in one step
+	void TestMaxOverlap() {
+		TArray<Render::RGTransientResource> resources;
+		uint32 seed = 12345;
+		auto random = [&seed](uint32 range) {
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) % range;
+		};
+		constexpr uint32 NUM_STEPS = 64;
+		for(uint32 i = 0; i < 200; ++i) {
+			const uint32 firstUse = random(NUM_STEPS);
+			const uint32 lastUse = Math::Min(NUM_STEPS - 1, firstUse + random(8));
+			resources.PushBack({ random(3), 64 + random(4) * 64, firstUse, lastUse });
+		}
+		Render::RGTransientPlacement placement;
+		placement.Place(resources);
+		CheckSlotsDisjoint(placement, resources);
+
+		uint64 peakSize = 0;
+		for(uint32 key = 0; key < 3; ++key) {
+			uint32 maxOverlap = 0;
+			for(uint32 step = 0; step < NUM_STEPS; ++step) {
+				uint32 overlap = 0;
+				for(const Render::RGTransientResource& resource: resources) {
+					overlap += resource.Key == key && resource.FirstUse <= step && step <= resource.LastUse;
+				}
+				maxOverlap = Math::Max(maxOverlap, overlap);
+			}
+			uint32 numSlots = 0;
+			for(const auto& slot: placement.GetSlots()) {
+				numSlots += slot.Key == key;
+			}
+			TEST_CHECK(numSlots == maxOverlap);
+		}
+		for(uint32 step = 0; step < NUM_STEPS; ++step) {
+			uint64 liveSize = 0;
+			for(const Render::RGTransientResource& resource: resources) {
+				liveSize += (resource.FirstUse <= step && step <= resource.LastUse) ? resource.Size : 0;
+			}
+			peakSize = Math::Max(peakSize, liveSize);
+		}
+		TEST_CHECK(placement.GetPeakSize() == peakSize);
+		TEST_CHECK(placement.GetPeakSize() <= placement.GetAllocatedSize());
+		TEST_CHECK(placement.GetAllocatedSize() <= placement.GetNaiveSize());
+	}
+
+	// the pool key compares every field of the description
+	void TestSameDesc() {
+		RHITextureDesc desc = RHITextureDesc::Texture2D();
+		desc.Flags = ETextureFlags::ColorTarget | ETextureFlags::SRV;
+		desc.Format = ERHIFormat::R8G8B8A8_UNORM;
+		desc.Width = 256;
+		desc.Height = 128;
+		TEST_CHECK(Render::RGTransientTexturePool::IsSameDesc(desc, desc));
+		RHITextureDesc other = desc;
+		other.Format = ERHIFormat::R16G16B16A16_SFLOAT;
+		TEST_CHECK(!Render::RGTransientTexturePool::IsSameDesc(desc, other));
+		other = desc;
+		other.Flags = ETextureFlags::ColorTarget;
+		TEST_CHECK(!Render::RGTransientTexturePool::IsSameDesc(desc, other));
+		other = desc;
+		other.Height = 256;
+		TEST_CHECK(!Render::RGTransientTexturePool::IsSameDesc(desc, other));
+		TEST_CHECK(Render::RGTransientTexturePool::GetTextureByteSize(desc) == 256 * 128 * 4);
+	}
+}
+
+int main() {
+	TEST_RUN(TestEmpty);
+	TEST_RUN(TestChain);
+	TEST_RUN(TestKeysAndSizes);
+	TEST_RUN(TestMaxOverlap);
+	TEST_RUN(TestSameDesc);
+	return Test::Result();
+}
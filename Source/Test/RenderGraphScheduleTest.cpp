@@ -0,0 +1,189 @@
+#include "TestCommon.h"
+#include "Render/Public/RenderGraphSchedule.h"
+#include "Math/Public/Math.h"
+
+namespace {
+	using Render::RGSchedulePass;
+	using Render::RGQueueSchedule;
+
+	struct ScheduleInput {
+		TArray<RGSchedulePass> Passes;
+		TArray<uint32> Deps;
+		uint32 AddPass(EQueueType queue, uint32 cost, std::initializer_list<uint32> deps) {
+			RGSchedulePass& pass = Passes.EmplaceBack();
+			pass.Queue = queue;
+			pass.Cost = cost;
+			pass.DepOffset = Deps.Size();
+			pass.DepCount = (uint32)deps.size();
+			for(uint32 dep: deps) {
+				Deps.PushBack(dep);
+			}
+			return Passes.Size() - 1;
+		}
+		TConstArrayView<uint32> GetDeps(uint32 pass) const {
+			return { Deps.Data() + Passes[pass].DepOffset, Passes[pass].DepCount };
+		}
+	};
+
+	// every pass is in one batch of its queue, every dependency is synchronized and respected by the simulated timeline
+	void CheckSchedule(const RGQueueSchedule& schedule, const ScheduleInput& input) {
+		const uint32 numPasses = input.Passes.Size();
+		const auto order = schedule.GetOrder();
+		const auto& batches = schedule.GetBatches();
+		TEST_CHECK(order.Size() == numPasses);
+		TArray<uint32> counts(numPasses, 0);
+		for(uint32 pass: order) {
+			TEST_CHECK(pass < numPasses);
+			if(pass < numPasses) {
+				++counts[pass];
+			}
+		}
+		for(uint32 count: counts) {
+			TEST_CHECK(count == 1);
+		}
+
+		// batches each batch runs after, by its queue order and its waits
+		TArray<TArray<bool>> afterBatches(batches.Size());
+		TStaticArray<uint32, RGQueueSchedule::NUM_QUEUES> lastBatches(INVALID_INDEX);
+		for(uint32 b = 0; b < batches.Size(); ++b) {
+			const RGQueueSchedule::Batch& batch = batches[b];
+			afterBatches[b].Resize(batches.Size(), false);
+			auto addAfter = [&afterBatches, b](uint32 prev) {
+				afterBatches[b][prev] = true;
+				for(uint32 i = 0; i < prev; ++i) {
+					afterBatches[b][i] = afterBatches[b][i] || afterBatches[prev][i];
+				}
+			};
+			const uint32 queue = EnumCast(batch.Queue);
+			if(INVALID_INDEX != lastBatches[queue]) {
+				TEST_CHECK(batches[lastBatches[queue]].End <= batch.Start);
+				addAfter(lastBatches[queue]);
+			}
+			lastBatches[queue] = b;
+			for(uint32 q = 0; q < RGQueueSchedule::NUM_QUEUES; ++q) {
+				const uint32 wait = batch.Waits[q];
+				if(INVALID_INDEX != wait) {
+					TEST_CHECK(wait < b && EnumCast(batches[wait].Queue) == q && q != queue);
+					addAfter(wait);
+				}
+			}
+			for(uint32 i = batch.PassOffset; i < batch.PassOffset + batch.PassCount; ++i) {
+				const uint32 pass = order[i];
+				TEST_CHECK(input.Passes[pass].Queue == batch.Queue);
+				TEST_CHECK(schedule.GetPassBatch(pass) == b);
+			}
+		}
+		for(uint32 pass = 0; pass < numPasses; ++pass) {
+			const uint32 batch = schedule.GetPassBatch(pass);
+			TEST_CHECK(schedule.GetPassEnd(pass) == schedule.GetPassStart(pass) + input.Passes[pass].Cost);
+			for(uint32 dep: input.GetDeps(pass)) {
+				const uint32 depBatch = schedule.GetPassBatch(dep);
+				TEST_CHECK(depBatch == batch || afterBatches[batch][depBatch]);
+				TEST_CHECK(schedule.GetPassEnd(dep) <= schedule.GetPassStart(pass));
+			}
+		}
+		TEST_CHECK(schedule.GetScheduledTime() <= schedule.GetSerialTime());
+	}
+
+	uint64 GetCriticalPath(const ScheduleInput& input) {
+		TArray<uint64> ends(input.Passes.Size(), 0);
+		uint64 criticalPath = 0;
+		for(uint32 pass = 0; pass < input.Passes.Size(); ++pass) {
+			for(uint32 dep: input.GetDeps(pass)) {
+				ends[pass] = Math::Max(ends[pass], ends[dep]);
+			}
+			ends[pass] += input.Passes[pass].Cost;
+			criticalPath = Math::Max(criticalPath, ends[pass]);
+		}
+		return criticalPath;
+	}
+
+	void TestGraphicsOnly() {
+		ScheduleInput input;
+		const uint32 a = input.AddPass(EQueueType::Graphics, 3, {});
+		const uint32 b = input.AddPass(EQueueType::Graphics, 4, { a });
+		input.AddPass(EQueueType::Graphics, 5, { b });
+		RGQueueSchedule schedule;
+		schedule.Build(input.Passes, input.Deps);
+		CheckSchedule(schedule, input);
+		TEST_CHECK(schedule.GetBatches().Size() == 1);
+		TEST_CHECK(schedule.GetNumSyncPoints() == 0);
+		TEST_CHECK(schedule.GetSerialTime() == 12);
+		TEST_CHECK(schedule.GetScheduledTime() == 12);
+	}
+
+	// culling, the hzb build and the ao on the compute queue run beside the shadow cascades
+	void TestComputeOverlapsShadow() {
+		ScheduleInput input;
+		const uint32 basePassCulling = input.AddPass(EQueueType::Compute, 2, {});
+		const uint32 basePass = input.AddPass(EQueueType::Graphics, 10, { basePassCulling });
+		const uint32 copyDepth = input.AddPass(EQueueType::Graphics, 1, { basePass });
+		const uint32 hzb = input.AddPass(EQueueType::Compute, 6, { copyDepth });
+		const uint32 csmCulling = input.AddPass(EQueueType::Compute, 2, {});
+		const uint32 csm0 = input.AddPass(EQueueType::Graphics, 4, { csmCulling });
+		const uint32 csm1 = input.AddPass(EQueueType::Graphics, 4, { csmCulling });
+		const uint32 ao = input.AddPass(EQueueType::Compute, 6, { hzb });
+		const uint32 lighting = input.AddPass(EQueueType::Graphics, 5, { ao, csm0, csm1 });
+		RGQueueSchedule schedule;
+		schedule.Build(input.Passes, input.Deps);
+		CheckSchedule(schedule, input);
+		// the hzb overlaps the cascades instead of delaying the lighting
+		TEST_CHECK(schedule.GetPassStart(hzb) < schedule.GetPassEnd(csm1));
+		TEST_CHECK(schedule.GetPassStart(csm0) < schedule.GetPassEnd(hzb));
+		TEST_CHECK(schedule.GetPassEnd(ao) <= schedule.GetPassStart(lighting));
+		TEST_CHECK(schedule.GetSerialTime() == 40);
+		TEST_CHECK(schedule.GetScheduledTime() < schedule.GetSerialTime());
+		TEST_CHECK(schedule.GetScheduledTime() >= GetCriticalPath(input));
+	}
+
+	// graphics -> compute -> graphics needs a wait each way, a second consumer of the same batch needs no more
+	void TestSyncPoints() {
+		ScheduleInput input;
+		const uint32 a = input.AddPass(EQueueType::Graphics, 2, {});
+		const uint32 b = input.AddPass(EQueueType::Compute, 2, { a });
+		const uint32 c = input.AddPass(EQueueType::Graphics, 2, { b });
+		input.AddPass(EQueueType::Graphics, 2, { b, c });
+		RGQueueSchedule schedule;
+		schedule.Build(input.Passes, input.Deps);
+		CheckSchedule(schedule, input);
+		TEST_CHECK(schedule.GetNumSyncPoints() == 2);
+		TEST_CHECK(schedule.GetScheduledTime() == 8);
+	}
+
+	// seeded random dags on all queues
+	void TestRandomGraphs() {
+		uint32 seed = 7;
+		auto random = [&seed](uint32 range) {
+			seed = seed * 1664525u + 1013904223u;
+			return (seed >> 8) % range;
+		};
+		for(uint32 graph = 0; graph < 50; ++graph) {
+			ScheduleInput input;
+			const uint32 numPasses = 1 + random(40);
+			for(uint32 pass = 0; pass < numPasses; ++pass) {
+				RGSchedulePass& schedulePass = input.Passes.EmplaceBack();
+				schedulePass.Queue = (EQueueType)random(RGQueueSchedule::NUM_QUEUES);
+				schedulePass.Cost = 1 + random(10);
+				schedulePass.DepOffset = input.Deps.Size();
+				for(uint32 dep = 0; dep < pass; ++dep) {
+					if(0 == random(6)) {
+						input.Deps.PushBack(dep);
+					}
+				}
+				schedulePass.DepCount = input.Deps.Size() - schedulePass.DepOffset;
+			}
+			RGQueueSchedule schedule;
+			schedule.Build(input.Passes, input.Deps);
+			CheckSchedule(schedule, input);
+			TEST_CHECK(schedule.GetScheduledTime() >= GetCriticalPath(input));
+		}
+	}
+}
+
+int main() {
+	TEST_RUN(TestGraphicsOnly);
+	TEST_RUN(TestComputeOverlapsShadow);
+	TEST_RUN(TestSyncPoints);
+	TEST_RUN(TestRandomGraphs);
+	return Test::Result();
+}
@@ -0,0 +1,394 @@
+#include "TestCommon.h"
+#include "Render/Public/RenderGraph.h"
+#include "RHI/Public/RHI.h"
+
+namespace {
+	// resources only referenced by nodes, compiling needs no RHI
+	class MockTexture: public RHITexture {
+	public:
+		explicit MockTexture(const RHITextureDesc& desc): RHITexture(desc) {}
+		void UpdateData(const void* data, uint32 byteSize, RHITextureSubRes subRes, IOffset3D offset) override {}
+	};
+
+	class MockBuffer: public RHIBuffer {
+	public:
+		MockBuffer(): RHIBuffer(RHIBufferDesc{ EBufferFlags::UAV | EBufferFlags::SRV, 256 }) {}
+		void UpdateData(const void* data, uint32 byteSize, uint32 offset) override {}
+	};
+
+	class MockFence: public RHIFence {
+	public:
+		void Wait() override {}
+		void Reset() override {}
+	};
+
+	// records the transitions and the debug labels of the passes
+	class MockCmd: public RHICommandBuffer {
+	public:
+		struct Barrier {
+			TArray<RHITextureTransition> Textures;
+			TArray<RHIBufferTransition> Buffers;
+		};
+		TArray<Barrier> Barriers;
+		TArray<XString> Labels;
+		void Reset() override { Barriers.Reset(); Labels.Reset(); }
+		void Close() override {}
+		void BeginRendering(const RHIRenderPassInfo& info) override {}
+		void EndRendering() override {}
+		void BindGraphicsPipeline(RHIGraphicsPipelineState* pipeline) override {}
+		void BindComputePipeline(RHIComputePipelineState* pipeline) override {}
+		void SetShaderParam(uint32 setIndex, uint32 bindIndex, const RHIShaderParam& parameter) override {}
+		void SetShaderParam(RHIShaderBinding binding, const RHIShaderParam& param) override {}
+		void BindVertexBuffer(RHIBuffer* buffer, uint32 slot, uint64 offset) override {}
+		void BindVertexBuffer(const RHIDynamicBuffer& buffer, uint32 slot, uint32 offset) override {}
+		void BindIndexBuffer(RHIBuffer* buffer, uint64 offset) override {}
+		void SetViewport(FRect rect, float minDepth, float maxDepth) override {}
+		void SetScissor(Rect rect) override {}
+		void Draw(uint32 vertexCount, uint32 instanceCount, uint32 firstIndex, uint32 firstInstance) override {}
+		void DrawIndexed(uint32 indexCount, uint32 instanceCount, uint32 firstIndex, uint32 vertexOffset, uint32 firstInstance) override {}
+		void Dispatch(uint32 groupCountX, uint32 groupCountY, uint32 groupCountZ) override {}
+		void DrawIndirect(const RHIDynamicBuffer& buffer, uint32 drawCount) override {}
+		void DrawIndexedIndirect(const RHIDynamicBuffer& buffer, uint32 drawCount) override {}
+		void DrawIndirect(RHIBuffer* buffer, uint32 bufferOffset, uint32 drawCount) override {}
+		void DrawIndexedIndirect(RHIBuffer* buffer, uint32 bufferOffset, uint32 drawCount) override {}
+		void ClearColorTarget(uint32 targetIndex, const float* color, const IRect& rect) override {}
+		void CopyBufferToTexture(RHIBuffer* buffer, RHITexture* texture, RHITextureSubRes dstSubRes, IOffset3D dstOffset) override {}
+		void CopyTextureToTexture(RHITexture* srcTex, RHITexture* dstTex, const RHITextureCopyRegion& region) override {}
+		void CopyBufferToBuffer(RHIBuffer* srcBuffer, RHIBuffer* dstBuffer, uint32 srcOffset, uint32 dstOffset, uint32 byteSize) override {}
+		void TransitionTextureState(RHITexture* texture, EResourceState stateBefore, EResourceState stateAfter, RHITextureSubRes subDesc) override {}
+		void TransitionBufferState(RHIBuffer* buffer, EResourceState stateBefore, EResourceState stateAfter) override {}
+		void TransitionResourceStates(TConstArrayView<RHITextureTransition> textures, TConstArrayView<RHIBufferTransition> buffers) override {
+			Barrier& barrier = Barriers.EmplaceBack();
+			barrier.Textures.Resize(textures.Size());
+			for(uint32 i = 0; i < textures.Size(); ++i) {
+				barrier.Textures[i] = textures[i];
+			}
+			barrier.Buffers.Resize(buffers.Size());
+			for(uint32 i = 0; i < buffers.Size(); ++i) {
+				barrier.Buffers[i] = buffers[i];
+			}
+		}
+		void GenerateMipmap(RHITexture* texture, uint8 mipSize, uint16 arrayIndex, uint16 arraySize, ETextureViewFlags viewFlags) override {}
+		void BeginDebugLabel(const char* msg, const float* color) override { Labels.PushBack(msg); }
+		void EndDebugLabel() override {}
+	};
+
+	class MockCmdAllocator: public Render::ICmdAllocator {
+	public:
+		TArray<TUniquePtr<MockCmd>> Cmds;
+		RHICommandBuffer* GetCmd(EQueueType queue) override { return Cmds.EmplaceBack(new MockCmd).Get(); }
+		void Reserve(EQueueType queue, uint32 size) override {}
+	};
+
+	class MockViewport: public RHIViewport {
+	public:
+		uint32 NumPresents{ 0 };
+		void SetSize(USize2D size) override {}
+		USize2D GetSize() override { return { 64, 64 }; }
+		bool PrepareBackBuffer() override { return true; }
+		RHITexture* GetBackBuffer() override { return nullptr; }
+		ERHIFormat GetBackBufferFormat() override { return ERHIFormat::R8G8B8A8_UNORM; }
+		void Present() override { ++NumPresents; }
+	};
+
+	// an RHI creating nothing, records the submissions of the graph
+	class NullRHI: public RHI {
+	public:
+		struct Submission {
+			TArray<RHICommandBuffer*> Cmds;
+			RHIFence* Fence;
+			bool Present;
+		};
+		TArray<Submission> Submissions;
+		MockViewport Viewport;
+		static NullRHI* Install() {
+			s_Instance.Reset(new NullRHI);
+			return (NullRHI*)s_Instance.Get();
+		}
+		uint32 GetBufferAlignment(EBufferFlags bufferFlags) override { return 1; }
+		RHIViewport* GetViewport() override { return &Viewport; }
+		void BeginFrame() override {}
+		void BeginRendering() override {}
+		RHIBufferPtr CreateBuffer(const RHIBufferDesc& desc) override { return nullptr; }
+		RHITexturePtr CreateTexture(const RHITextureDesc& desc) override { return nullptr; }
+		RHISamplerPtr CreateSampler(const RHISamplerDesc& desc) override { return nullptr; }
+		RHIFencePtr CreateFence(bool isSignaled) override { return nullptr; }
+		RHIShaderPtr CreateShader(EShaderStageFlags type, XStringView code, XStringView entryFunc, RHIShaderBindingInterface* bindingInterface) override { return nullptr; }
+		RHIGraphicsPipelineStatePtr CreateGraphicsPipelineState(const RHIGraphicsPipelineStateDesc& desc) override { return nullptr; }
+		RHIComputePipelineStatePtr CreateComputePipelineState(RHIShader* Shader) override { return nullptr; }
+		RHICommandBufferPtr CreateCommandBuffer(EQueueType queue) override { return nullptr; }
+		void SubmitCommandBuffers(TArrayView<RHICommandBuffer*> cmds, EQueueType queue, RHIFence* fence, bool bPresent) override {
+			Submission& submission = Submissions.EmplaceBack();
+			for(RHICommandBuffer* cmd: cmds) {
+				submission.Cmds.PushBack(cmd);
+			}
+			submission.Fence = fence;
+			submission.Present = bPresent;
+		}
+		RHIDynamicBuffer AllocateDynamicBuffer(EBufferFlags bufferFlags, uint32 bufferSize, const void* bufferData, uint32 stride) override { return {}; }
+	};
+
+	RHITextureDesc GetTargetDesc() {
+		RHITextureDesc desc = RHITextureDesc::Texture2D();
+		desc.Flags = ETextureFlags::ColorTarget | ETextureFlags::SRV;
+		desc.Format = ERHIFormat::R8G8B8A8_UNORM;
+		desc.Width = 64;
+		desc.Height = 64;
+		return desc;
+	}
+
+	uint32 FindStep(const Render::RenderGraph& rg, Render::RGNodeID nodeID) {
+		const auto order = rg.GetExecuteOrder();
+		for(uint32 i = 0; i < order.Size(); ++i) {
+			if(order[i] == nodeID) {
+				return i;
+			}
+		}
+		return INVALID_INDEX;
+	}
+
+	// culling -> base pass -> lighting -> present, a pass writing a texture no one reads is culled with the texture
+	void TestCullingAndOrder() {
+		const RHITextureDesc desc = GetTargetDesc();
+		MockTexture backBuffer(desc);
+		MockBuffer cullResult;
+		Render::RGTransientTexturePool pool;
+		Render::RenderGraph rg(nullptr, &pool);
+		Render::RGTextureNode* backBufferNode = rg.CreateTextureNode(&backBuffer, "BackBuffer");
+		Render::RGBufferNode* cullResultNode = rg.CreateBufferNode(&cullResult, "CullResult");
+		Render::RGTextureNode* gBufferNode = rg.CreateTransientTextureNode(desc, "GBuffer");
+		Render::RGTextureNode* unusedNode = rg.CreateTransientTextureNode(desc, "Unused");
+
+		Render::RGComputeNode* unusedPass = rg.CreateComputeNode("Unused");
+		unusedPass->ReadSRV(gBufferNode);
+		unusedPass->WriteUAV(unusedNode);
+		Render::RGComputeNode* cullingPass = rg.CreateComputeNode("Culling");
+		cullingPass->WriteUAV(cullResultNode);
+		Render::RGRenderNode* basePass = rg.CreateRenderNode("BasePass");
+		basePass->ReadSRV(cullResultNode);
+		basePass->WriteColorTarget(gBufferNode, 0);
+		Render::RGRenderNode* lightingPass = rg.CreateRenderNode("Lighting");
+		lightingPass->ReadSRV(gBufferNode);
+		lightingPass->WriteColorTarget(backBufferNode, 0);
+		Render::RGPresentNode* presentNode = rg.CreatePresentNode(backBufferNode, "Present");
+
+		TEST_CHECK(!rg.IsCompiled());
+		rg.Compile();
+		TEST_CHECK(rg.IsCompiled());
+
+		const auto order = rg.GetExecuteOrder();
+		TEST_CHECK(order.Size() == 4);
+		TEST_CHECK(FindStep(rg, cullingPass->GetNodeID()) == 0);
+		TEST_CHECK(FindStep(rg, basePass->GetNodeID()) == 1);
+		TEST_CHECK(FindStep(rg, lightingPass->GetNodeID()) == 2);
+		TEST_CHECK(FindStep(rg, presentNode->GetNodeID()) == 3);
+
+		TEST_CHECK(rg.IsNodeCulled(unusedPass->GetNodeID()));
+		TEST_CHECK(rg.IsNodeCulled(unusedNode->GetNodeID()));
+		TEST_CHECK(!rg.IsNodeCulled(gBufferNode->GetNodeID()));
+		TEST_CHECK(!rg.IsNodeCulled(cullResultNode->GetNodeID()));
+		TEST_CHECK(FindStep(rg, unusedPass->GetNodeID()) == INVALID_INDEX);
+
+		// the culled reader is not a use of the gBuffer
+		const Render::RGResourceLifetime& gBufferLifetime = rg.GetResourceLifetime(gBufferNode->GetNodeID());
+		TEST_CHECK(gBufferLifetime.FirstUse == 1 && gBufferLifetime.LastUse == 2);
+		const Render::RGResourceLifetime& cullResultLifetime = rg.GetResourceLifetime(cullResultNode->GetNodeID());
+		TEST_CHECK(cullResultLifetime.FirstUse == 0 && cullResultLifetime.LastUse == 1);
+		const Render::RGResourceLifetime& backBufferLifetime = rg.GetResourceLifetime(backBufferNode->GetNodeID());
+		TEST_CHECK(backBufferLifetime.FirstUse == 2 && backBufferLifetime.LastUse == 3);
+		TEST_CHECK(INVALID_INDEX == rg.GetResourceLifetime(unusedNode->GetNodeID()).FirstUse);
+
+		const auto prevPasses = rg.GetPrevPassNodes(lightingPass->GetNodeID());
+		TEST_CHECK(prevPasses.Size() == 1 && prevPasses[0] == basePass->GetNodeID());
+	}
+
+	// outputs run in the order of creation, a pass required by both outputs runs once before the first
+	void TestOutputsOrder() {
+		const RHITextureDesc desc = GetTargetDesc();
+		MockTexture backBuffer(desc);
+		MockTexture history(desc);
+		Render::RGTransientTexturePool pool;
+		Render::RenderGraph rg(nullptr, &pool);
+		Render::RGTextureNode* backBufferNode = rg.CreateTextureNode(&backBuffer, "BackBuffer");
+		Render::RGTextureNode* historyNode = rg.CreateTextureNode(&history, "History");
+		Render::RGTextureNode* sceneNode = rg.CreateTransientTextureNode(desc, "Scene");
+
+		Render::RGRenderNode* scenePass = rg.CreateRenderNode("Scene");
+		scenePass->WriteColorTarget(sceneNode, 0);
+		Render::RGTransferNode* copyHistory = rg.CreateTransferNode("CopyHistory");
+		copyHistory->CopyTexture(sceneNode, historyNode);
+		Render::RGRenderNode* compositePass = rg.CreateRenderNode("Composite");
+		compositePass->ReadSRV(sceneNode);
+		compositePass->WriteColorTarget(backBufferNode, 0);
+		Render::RGOutputNode* historyOutput = rg.CreateOutputNode(historyNode, "HistoryOutput");
+		Render::RGPresentNode* presentNode = rg.CreatePresentNode(backBufferNode, "Present");
+
+		rg.Compile();
+		const auto order = rg.GetExecuteOrder();
+		TEST_CHECK(order.Size() == 5);
+		TEST_CHECK(FindStep(rg, scenePass->GetNodeID()) == 0);
+		TEST_CHECK(FindStep(rg, copyHistory->GetNodeID()) == 1);
+		TEST_CHECK(FindStep(rg, historyOutput->GetNodeID()) == 2);
+		TEST_CHECK(FindStep(rg, compositePass->GetNodeID()) == 3);
+		TEST_CHECK(FindStep(rg, presentNode->GetNodeID()) == 4);
+
+		const Render::RGResourceLifetime& sceneLifetime = rg.GetResourceLifetime(sceneNode->GetNodeID());
+		TEST_CHECK(sceneLifetime.FirstUse == 0 && sceneLifetime.LastUse == 3);
+		const Render::RGResourceLifetime& historyLifetime = rg.GetResourceLifetime(historyNode->GetNodeID());
+		TEST_CHECK(historyLifetime.FirstUse == 1 && historyLifetime.LastUse == 2);
+	}
+
+	bool HasTransition(const Render::RenderGraph& rg, uint32 step, Render::RGNodeID nodeID, EResourceState stateBefore, EResourceState stateAfter, EBarrierSplit split) {
+		for(const Render::RGTransition& transition: rg.GetStepBarriers(step)) {
+			if(transition.Resource == nodeID && transition.StateBefore == stateBefore && transition.StateAfter == stateAfter && transition.Split == split) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// compute A writes a buffer, render B writes a texture, render C reads both and writes the back buffer
+	struct BarrierGraph {
+		MockTexture BackBuffer{ GetTargetDesc() };
+		MockTexture Target{ GetTargetDesc() };
+		MockBuffer Buffer;
+		MockFence Fence;
+		Render::RGTransientTexturePool Pool;
+		Render::RenderGraph Graph{ nullptr, &Pool };
+		Render::RGTextureNode* BackBufferNode;
+		Render::RGTextureNode* TargetNode;
+		Render::RGBufferNode* BufferNode;
+		Render::RGComputeNode* PassA;
+		Render::RGRenderNode* PassB;
+		Render::RGRenderNode* PassC;
+		Render::RGPresentNode* PresentNode;
+		BarrierGraph() {
+			BackBufferNode = Graph.CreateTextureNode(&BackBuffer, "BackBuffer");
+			TargetNode = Graph.CreateTextureNode(&Target, "Target");
+			BufferNode = Graph.CreateBufferNode(&Buffer, "Buffer");
+			PassA = Graph.CreateComputeNode("A");
+			PassA->WriteUAV(BufferNode);
+			PassB = Graph.CreateRenderNode("B");
+			PassB->WriteColorTarget(TargetNode, 0);
+			PassC = Graph.CreateRenderNode("C");
+			PassC->ReadSRV(BufferNode);
+			PassC->ReadSRV(TargetNode);
+			PassC->WriteColorTarget(BackBufferNode, 0);
+			PresentNode = Graph.CreatePresentNode(BackBufferNode, "Present");
+			PresentNode->InsertFenceBefore(&Fence);
+		}
+	};
+
+	// the buffer transition to the read of C begins after A and ends before C, the back buffer is transitioned to present once
+	void TestBarriers() {
+		BarrierGraph g;
+		g.Graph.Compile();
+		Render::RenderGraph& rg = g.Graph;
+		TEST_CHECK(FindStep(rg, g.PassA->GetNodeID()) == 0);
+		TEST_CHECK(FindStep(rg, g.PassB->GetNodeID()) == 1);
+		TEST_CHECK(FindStep(rg, g.PassC->GetNodeID()) == 2);
+		TEST_CHECK(FindStep(rg, g.PresentNode->GetNodeID()) == 3);
+		const Render::RGNodeID buffer = g.BufferNode->GetNodeID();
+		const Render::RGNodeID target = g.TargetNode->GetNodeID();
+		const Render::RGNodeID backBuffer = g.BackBufferNode->GetNodeID();
+		TEST_CHECK(rg.GetStepBarriers(0).Size() == 1);
+		TEST_CHECK(HasTransition(rg, 0, buffer, EResourceState::Unknown, EResourceState::UnorderedAccessView, EBarrierSplit::None));
+		TEST_CHECK(rg.GetStepBarriers(1).Size() == 2);
+		TEST_CHECK(HasTransition(rg, 1, buffer, EResourceState::UnorderedAccessView, EResourceState::ShaderResourceView, EBarrierSplit::Begin));
+		TEST_CHECK(HasTransition(rg, 1, target, EResourceState::Unknown, EResourceState::ColorTarget, EBarrierSplit::None));
+		TEST_CHECK(rg.GetStepBarriers(2).Size() == 3);
+		TEST_CHECK(HasTransition(rg, 2, buffer, EResourceState::UnorderedAccessView, EResourceState::ShaderResourceView, EBarrierSplit::End));
+		TEST_CHECK(HasTransition(rg, 2, target, EResourceState::ColorTarget, EResourceState::ShaderResourceView, EBarrierSplit::None));
+		TEST_CHECK(HasTransition(rg, 2, backBuffer, EResourceState::Unknown, EResourceState::ColorTarget, EBarrierSplit::None));
+		TEST_CHECK(rg.GetStepBarriers(3).Size() == 1);
+		TEST_CHECK(HasTransition(rg, 3, backBuffer, EResourceState::ColorTarget, EResourceState::Present, EBarrierSplit::None));
+
+		// all steps are recorded in one command buffer, one barrier before each step
+		NullRHI* rhi = NullRHI::Install();
+		MockCmdAllocator cmdAlloc;
+		rg.Run(&cmdAlloc);
+		TEST_CHECK(rhi->Submissions.Size() == 1);
+		TEST_CHECK(rhi->Viewport.NumPresents == 1);
+		if(rhi->Submissions.Size() == 1) {
+			const NullRHI::Submission& submission = rhi->Submissions[0];
+			TEST_CHECK(submission.Present && submission.Fence == &g.Fence);
+			TEST_CHECK(submission.Cmds.Size() == 1);
+			const MockCmd* cmd = (MockCmd*)submission.Cmds[0];
+			TEST_CHECK(cmd->Barriers.Size() == 4);
+			TEST_CHECK(cmd->Labels.Size() == 3);
+			if(cmd->Barriers.Size() == 4) {
+				TEST_CHECK(cmd->Barriers[1].Buffers.Size() == 1 && cmd->Barriers[1].Buffers[0].Split == EBarrierSplit::Begin);
+				TEST_CHECK(cmd->Barriers[2].Buffers.Size() == 1 && cmd->Barriers[2].Buffers[0].Split == EBarrierSplit::End);
+				TEST_CHECK(cmd->Barriers[2].Textures.Size() == 2);
+				TEST_CHECK(cmd->Barriers[3].Textures.Size() == 1 && cmd->Barriers[3].Textures[0].StateAfter == EResourceState::Present);
+			}
+		}
+		RHI::Release();
+	}
+
+	// a submit before C separates the command buffers, the buffer transition is not split across them
+	void TestBarriersAcrossSubmits() {
+		BarrierGraph g;
+		MockFence fence;
+		g.PassC->InsertFenceBefore(&fence);
+		g.Graph.Compile();
+		Render::RenderGraph& rg = g.Graph;
+		const Render::RGNodeID buffer = g.BufferNode->GetNodeID();
+		TEST_CHECK(rg.GetStepBarriers(1).Size() == 1);
+		TEST_CHECK(HasTransition(rg, 2, buffer, EResourceState::UnorderedAccessView, EResourceState::ShaderResourceView, EBarrierSplit::None));
+
+		NullRHI* rhi = NullRHI::Install();
+		MockCmdAllocator cmdAlloc;
+		rg.Run(&cmdAlloc);
+		TEST_CHECK(rhi->Submissions.Size() == 2);
+		if(rhi->Submissions.Size() == 2) {
+			TEST_CHECK(rhi->Submissions[0].Fence == &fence && !rhi->Submissions[0].Present);
+			TEST_CHECK(rhi->Submissions[1].Fence == &g.Fence && rhi->Submissions[1].Present);
+			TEST_CHECK(((MockCmd*)rhi->Submissions[0].Cmds[0])->Barriers.Size() == 2);
+			TEST_CHECK(((MockCmd*)rhi->Submissions[1].Cmds[0])->Barriers.Size() == 2);
+		}
+		RHI::Release();
+	}
+
+	// passes recorded in their own command buffers issue the split transitions whole before the using pass
+	void TestParallelBarriers() {
+		BarrierGraph g;
+		g.Graph.Compile();
+		NullRHI* rhi = NullRHI::Install();
+		MockCmdAllocator cmdAlloc;
+		Render::RenderGraph::ParrallelNodes = true;
+		g.Graph.Run(&cmdAlloc);
+		Render::RenderGraph::ParrallelNodes = false;
+		TEST_CHECK(rhi->Viewport.NumPresents == 1);
+		TEST_CHECK(cmdAlloc.Cmds.Size() == 4);
+		uint32 numSubmittedCmds = 0;
+		for(const NullRHI::Submission& submission: rhi->Submissions) {
+			numSubmittedCmds += submission.Cmds.Size();
+		}
+		TEST_CHECK(numSubmittedCmds == 4);
+		for(const auto& cmd: cmdAlloc.Cmds) {
+			for(const MockCmd::Barrier& barrier: cmd->Barriers) {
+				for(const RHIBufferTransition& transition: barrier.Buffers) {
+					TEST_CHECK(EBarrierSplit::None == transition.Split);
+				}
+				for(const RHITextureTransition& transition: barrier.Textures) {
+					TEST_CHECK(EBarrierSplit::None == transition.Split);
+				}
+			}
+		}
+		if(cmdAlloc.Cmds.Size() == 4) {
+			const MockCmd* cmdC = cmdAlloc.Cmds[2].Get();
+			TEST_CHECK(cmdC->Barriers.Size() == 1 && cmdC->Barriers[0].Buffers.Size() == 1 && cmdC->Barriers[0].Textures.Size() == 2);
+		}
+		RHI::Release();
+	}
+}
+
+int main() {
+	TEST_RUN(TestCullingAndOrder);
+	TEST_RUN(TestOutputsOrder);
+	TEST_RUN(TestBarriers);
+	TEST_RUN(TestBarriersAcrossSubmits);
+	TEST_RUN(TestParallelBarriers);
+	return Test::Result();
+}
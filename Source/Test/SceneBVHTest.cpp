@@ -0,0 +1,291 @@
+#include "TestCommon.h"
+#include "Objects/Public/SceneBVH.h"
+#include "Math/Public/Math.h"
+#include "System/Public/ThreadPool.h"
+#include <chrono>
+#include <cmath>
+
+namespace {
+	constexpr float LEVEL_SIZE = 2000.0f;
+
+	uint32 Random(uint32& seed, uint32 range) {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	float RandomFloat(uint32& seed, float min, float max) {
+		return min + (max - min) * (float)Random(seed, 65536) / 65535.0f;
+	}
+
+	// an actor of the synthetic level, mostly small props and some large buildings
+	Math::AABB3 RandomActor(uint32& seed) {
+		const float halfLevel = LEVEL_SIZE * 0.5f;
+		const Math::FVector3 center{ RandomFloat(seed, -halfLevel, halfLevel), RandomFloat(seed, 0.0f, 20.0f), RandomFloat(seed, -halfLevel, halfLevel) };
+		const float size = Random(seed, 20) ? RandomFloat(seed, 0.2f, 3.0f) : RandomFloat(seed, 5.0f, 40.0f);
+		return Math::AABB3::CenterExtent(center, { size, size, size });
+	}
+
+	// camera at eye looking along yaw, frustum as Object::Camera builds it
+	Math::Frustum MakeViewFrustum(const Math::FVector3& eye, float yaw, float farDistance) {
+		const float nearDistance = 0.5f;
+		const Math::FVector3 front{ std::sin(yaw), 0.0f, std::cos(yaw) };
+		const Math::FVector3 up{ 0.0f, 1.0f, 0.0f };
+		const Math::FVector3 right = up.Cross(front).Normalize();
+		const float halfHeight = farDistance * std::tan(Math::PI * 0.2f);
+		const Math::FVector3 frontVec = front * farDistance;
+		const Math::FVector3 rightVec = right * halfHeight * 1.8f;
+		const Math::FVector3 upVec = up * halfHeight;
+		Math::Frustum frustum;
+		frustum.Near = { eye + front * nearDistance, front };
+		frustum.Far = { eye + frontVec, -front };
+		frustum.Left = { eye, up.Cross((frontVec - rightVec).Normalize()) };
+		frustum.Right = { eye, (frontVec + rightVec).Normalize().Cross(up) };
+		frustum.Bottom = { eye, (frontVec - upVec).Normalize().Cross(right) };
+		frustum.Top = { eye, right.Cross((frontVec + upVec).Normalize()) };
+		return frustum;
+	}
+
+	// Proxies kept by the test to check the tree against, indexed by proxy id.
+	struct ProxyModel {
+		TArray<Math::AABB3> AABBs;
+		TArray<bool> Alive;
+		TArray<uint32> AliveProxies;
+
+		void Insert(uint32 proxy, const Math::AABB3& aabb) {
+			if(proxy >= AABBs.Size()) {
+				AABBs.Resize(proxy + 1);
+				Alive.Resize(proxy + 1, false);
+			}
+			AABBs[proxy] = aabb;
+			Alive[proxy] = true;
+			AliveProxies.PushBack(proxy);
+		}
+		// remove the idx-th alive proxy
+		uint32 Remove(uint32 idx) {
+			const uint32 proxy = AliveProxies[idx];
+			Alive[proxy] = false;
+			AliveProxies.SwapRemoveAt(idx);
+			return proxy;
+		}
+	};
+
+	// Compare CullViews with testing every alive proxy against every view, returns the number of mismatches.
+	uint32 CompareBruteForce(const Object::SceneBVH& bvh, const ProxyModel& model, const Math::Frustum* frustums, uint32 numFrustums, uint32* outNumVisible = nullptr) {
+		TFrameArray<uint32> proxies, viewMasks;
+		bvh.CullViews(frustums, numFrustums, proxies, viewMasks);
+		TArray<uint32> masks(model.AABBs.Size());
+		for(uint32& mask: masks) {
+			mask = UINT32_MAX; // not output
+		}
+		uint32 numMismatches = 0;
+		for(uint32 i = 0; i < proxies.Size(); ++i) {
+			const uint32 proxy = proxies[i];
+			if(proxy >= masks.Size() || !model.Alive[proxy] || UINT32_MAX != masks[proxy]) {
+				++numMismatches; // removed or output twice
+				continue;
+			}
+			masks[proxy] = viewMasks[i];
+		}
+		uint32 numVisible = 0;
+		for(uint32 proxy: model.AliveProxies) {
+			uint32 expected = 0;
+			for(uint32 v = 0; v < numFrustums; ++v) {
+				expected |= (frustums[v].TestAABBSimple(model.AABBs[proxy]) ? 1u : 0u) << v;
+			}
+			numVisible += expected ? 1 : 0;
+			const uint32 actual = UINT32_MAX == masks[proxy] ? 0 : masks[proxy];
+			numMismatches += expected != actual;
+			numMismatches += !(bvh.GetAABB(proxy).Min == model.AABBs[proxy].Min && bvh.GetAABB(proxy).Max == model.AABBs[proxy].Max);
+		}
+		numMismatches += bvh.GetNumProxies() != model.AliveProxies.Size();
+		if(outNumVisible) {
+			*outNumVisible = numVisible;
+		}
+		return numMismatches;
+	}
+
+	void MakeViews(uint32& seed, Math::Frustum* frustums, uint32 numFrustums) {
+		for(uint32 v = 0; v < numFrustums; ++v) {
+			const Math::FVector3 eye{ RandomFloat(seed, -800.0f, 800.0f), 10.0f, RandomFloat(seed, -800.0f, 800.0f) };
+			frustums[v] = MakeViewFrustum(eye, RandomFloat(seed, 0.0f, 2.0f * Math::PI), RandomFloat(seed, 100.0f, 600.0f));
+		}
+	}
+
+	// Changes made while a rebuild is in flight are replayed on the rebuilt tree, including removing a proxy and
+	// inserting again with the same id, and inserting a proxy the snapshot doesn't have and removing it.
+	void TestRebuildReplay() {
+		uint32 seed = 5;
+		Object::SceneBVH bvh;
+		ProxyModel model;
+		for(uint32 i = 0; i < 500; ++i) {
+			const Math::AABB3 aabb = RandomActor(seed);
+			model.Insert(bvh.Insert(aabb), aabb);
+		}
+		// the first tick with enough proxies launches the first build
+		bvh.Tick();
+
+		// remove then reinsert, the free list gives the removed id back
+		const uint32 reused = model.Remove(7);
+		const Math::AABB3 reusedAABB = Math::AABB3::CenterExtent({ 900.0f, 5.0f, 900.0f }, { 2.0f, 2.0f, 2.0f });
+		bvh.Remove(reused);
+		const uint32 reinserted = bvh.Insert(reusedAABB);
+		TEST_CHECK(reinserted == reused);
+		model.Insert(reinserted, reusedAABB);
+
+		// removed and reinserted twice, then moved
+		const uint32 twice = model.Remove(20);
+		bvh.Remove(twice);
+		TEST_CHECK(twice == bvh.Insert(RandomActor(seed)));
+		bvh.Remove(twice);
+		Math::AABB3 twiceAABB = RandomActor(seed);
+		TEST_CHECK(twice == bvh.Insert(twiceAABB));
+		twiceAABB = Math::AABB3::CenterExtent({ -900.0f, 5.0f, -900.0f }, { 1.0f, 1.0f, 1.0f });
+		bvh.Update(twice, twiceAABB);
+		model.Insert(twice, twiceAABB);
+
+		// inserted after the snapshot and removed again, its id is reused by the next insert
+		const uint32 transient = bvh.Insert(RandomActor(seed));
+		bvh.Remove(transient);
+		const Math::AABB3 newAABB = RandomActor(seed);
+		const uint32 newProxy = bvh.Insert(newAABB);
+		TEST_CHECK(newProxy == transient);
+		model.Insert(newProxy, newAABB);
+
+		// moved then removed
+		const uint32 movedProxy = model.AliveProxies[30];
+		bvh.Update(movedProxy, RandomActor(seed));
+		bvh.Remove(model.Remove(30));
+
+		// plain moves and removes
+		for(uint32 i = 0; i < 50; ++i) {
+			const uint32 proxy = model.AliveProxies[Random(seed, model.AliveProxies.Size())];
+			const Math::AABB3 aabb = RandomActor(seed);
+			bvh.Update(proxy, aabb);
+			model.AABBs[proxy] = aabb;
+		}
+		for(uint32 i = 0; i < 50; ++i) {
+			bvh.Remove(model.Remove(Random(seed, model.AliveProxies.Size())));
+		}
+
+		bvh.FlushRebuild();
+		Math::Frustum frustums[4];
+		MakeViews(seed, frustums, 4);
+		TEST_CHECK(0 == CompareBruteForce(bvh, model, frustums, 4));
+		// the reinserted proxies are found where they are now
+		const Math::Frustum corner = MakeViewFrustum({ 850.0f, 5.0f, 850.0f }, Math::PI * 0.25f, 200.0f);
+		TFrameArray<uint32> proxies, viewMasks;
+		bvh.CullViews(&corner, 1, proxies, viewMasks);
+		bool bFound = false;
+		for(uint32 proxy: proxies) {
+			bFound |= proxy == reused;
+		}
+		TEST_CHECK(bFound);
+		TEST_CHECK(0 == CompareBruteForce(bvh, model, &corner, 1));
+	}
+
+	// Actors move, spawn and despawn every frame while Tick launches and applies rebuilds,
+	// culling of each frame is checked against testing every actor.
+	void TestBruteForceWithRebuilds() {
+		uint32 seed = 11;
+		Object::SceneBVH bvh;
+		ProxyModel model;
+		for(uint32 i = 0; i < 3000; ++i) {
+			const Math::AABB3 aabb = RandomActor(seed);
+			model.Insert(bvh.Insert(aabb), aabb);
+		}
+		uint32 numMismatches = 0, numCostDrops = 0, numVisible = 0;
+		float lastCost = bvh.GetCost();
+		for(uint32 frame = 0; frame < 200; ++frame) {
+			FrameAllocator::BeginFrame();
+			// teleport some actors far away, refitting then degrades the tree
+			for(uint32 i = 0; i < 40; ++i) {
+				const uint32 proxy = model.AliveProxies[Random(seed, model.AliveProxies.Size())];
+				const Math::AABB3 aabb = RandomActor(seed);
+				bvh.Update(proxy, aabb);
+				model.AABBs[proxy] = aabb;
+			}
+			for(uint32 i = 0; i < 5; ++i) {
+				bvh.Remove(model.Remove(Random(seed, model.AliveProxies.Size())));
+			}
+			for(uint32 i = 0; i < 5; ++i) {
+				const Math::AABB3 aabb = RandomActor(seed);
+				model.Insert(bvh.Insert(aabb), aabb);
+			}
+			bvh.Tick();
+			const float cost = bvh.GetCost();
+			numCostDrops += cost < lastCost ? 1 : 0;
+			lastCost = cost;
+			Math::Frustum frustums[3];
+			MakeViews(seed, frustums, 3);
+			uint32 frameVisible = 0;
+			numMismatches += CompareBruteForce(bvh, model, frustums, 3, &frameVisible);
+			numVisible += frameVisible;
+		}
+		bvh.FlushRebuild();
+		TEST_CHECK(0 == numMismatches);
+		TEST_CHECK(numCostDrops > 0); // rebuilds were applied
+		TEST_CHECK(numVisible > 0);
+	}
+
+	// 100k static actors: culling by the tree against testing every actor, as the renderer did before the tree
+	void BenchmarkLevel() {
+		constexpr uint32 NUM_ACTORS = 100000;
+		constexpr uint32 NUM_ROUNDS = 20;
+		uint32 seed = 3;
+		TArray<Math::AABB3> actors;
+		actors.Reserve(NUM_ACTORS);
+		for(uint32 i = 0; i < NUM_ACTORS; ++i) {
+			actors.PushBack(RandomActor(seed));
+		}
+		Object::SceneBVH bvh;
+		auto start = std::chrono::steady_clock::now();
+		for(const Math::AABB3& aabb: actors) {
+			bvh.Insert(aabb);
+		}
+		const double insertMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		const float insertedCost = bvh.GetCost();
+		start = std::chrono::steady_clock::now();
+		bvh.Tick();
+		bvh.FlushRebuild();
+		const double rebuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printf("%u actors: insert %.2f ms, cost %.1f, rebuild %.2f ms, cost %.1f\n", NUM_ACTORS, insertMs, insertedCost, rebuildMs, bvh.GetCost());
+
+		for(uint32 numViews: { 1u, 4u }) {
+			Math::Frustum frustums[4];
+			double bvhMs = 0.0, linearMs = 0.0;
+			uint32 numBVHVisible = 0, numLinearVisible = 0;
+			for(uint32 round = 0; round < NUM_ROUNDS; ++round) {
+				FrameAllocator::BeginFrame();
+				MakeViews(seed, frustums, numViews);
+				start = std::chrono::steady_clock::now();
+				{
+					TFrameArray<uint32> proxies, viewMasks;
+					bvh.CullViews(frustums, numViews, proxies, viewMasks);
+					numBVHVisible += proxies.Size();
+				}
+				bvhMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				start = std::chrono::steady_clock::now();
+				for(const Math::AABB3& aabb: actors) {
+					uint32 mask = 0;
+					for(uint32 v = 0; v < numViews; ++v) {
+						mask |= (frustums[v].TestAABBSimple(aabb) ? 1u : 0u) << v;
+					}
+					numLinearVisible += mask ? 1 : 0;
+				}
+				linearMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			}
+			printf("  %u view(s): tree %.3f ms, linear scan %.3f ms per frame, %u visible\n", numViews, bvhMs / NUM_ROUNDS, linearMs / NUM_ROUNDS, numBVHVisible / NUM_ROUNDS);
+			TEST_CHECK(numBVHVisible == numLinearVisible);
+		}
+	}
+}
+
+int main() {
+	// rebuilds and culling run on workers
+	Engine::XXThreadPool::Initialize();
+	TEST_RUN(TestRebuildReplay);
+	TEST_RUN(TestBruteForceWithRebuilds);
+	TEST_RUN(BenchmarkLevel);
+	Engine::XXThreadPool::Release();
+	return Test::Result();
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdio>
+
+// Checks of the test executables, a failed check is printed and the test goes on, main returns the result.
+namespace Test {
+	inline int& FailedChecks() {
+		static int count = 0;
+		return count;
+	}
+
+	inline int Result() {
+		if(FailedChecks()) {
+			printf("%d check(s) failed\n", FailedChecks());
+			return 1;
+		}
+		printf("all checks passed\n");
+		return 0;
+	}
+}
+
+#define TEST_CHECK(x)\
+	do{ if(!(x)) { printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #x); ++Test::FailedChecks(); } }while(0)
+
+#define TEST_RUN(func)\
+	do{ printf("[run] %s\n", #func); func(); }while(0)